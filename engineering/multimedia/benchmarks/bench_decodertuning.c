@@ -0,0 +1,264 @@
+/* Playback next to background decoding, with and without decoder tuning.
+ *
+ * Plays a clip in real time while other pipelines decode it as fast as they can in a
+ * loop, like the Gtk+3 player does while it makes the timeline thumbnails. It runs once
+ * with the decoders at their defaults and once with the decoder tuning of the player,
+ * playback bound to the playback CPUs and the other pipelines to the background ones,
+ * and reports how late the frames of the playback pipeline reach the sink and how many
+ * were dropped. The CPUs allowed for the threads of the process are sampled midway, to
+ * check which threads got pinned.
+ */
+#include <string.h>
+
+#include <gst/gst.h>
+
+#include "decodertuning.h"
+
+#define DEFAULT_SECONDS     10
+#define DEFAULT_BACKGROUND  2
+#define MAX_BACKGROUND      16
+#define BUS_POLL            (100 * GST_MSECOND)
+
+static gint seconds_option = DEFAULT_SECONDS;
+static gint background_option = DEFAULT_BACKGROUND;
+
+static GOptionEntry option_entries[] = {
+  { "seconds", 's', 0, G_OPTION_ARG_INT, &seconds_option, "Seconds of playback of each run (default: 10)", "N" },
+  { "background", 'b', 0, G_OPTION_ARG_INT, &background_option,
+    "Pipelines decoding in the background (default: 2)", "N" },
+  { NULL }
+};
+
+/* Background pipeline, looping on its own thread until stopped */
+typedef struct _Background
+{
+  GstElement *pipeline;
+  GThread *thread;
+  gint running;
+  guint loops;
+} Background;
+
+/* This function creates a playbin with fakesinks, bound to the given role if tuned */
+static GstElement *make_playbin(const gchar *uri, gboolean sync, gboolean tuned, DecoderRole role)
+{
+  GstElement *playbin = gst_element_factory_make("playbin", NULL);
+  GstElement *video_sink = gst_element_factory_make("fakesink", "videosink");
+  GstElement *audio_sink = gst_element_factory_make("fakesink", NULL);
+
+  g_object_set(video_sink, "sync", sync, "qos", TRUE, NULL);
+  g_object_set(audio_sink, "sync", sync, NULL);
+  g_object_set(playbin, "uri", uri, "video-sink", video_sink, "audio-sink", audio_sink, NULL);
+  if (tuned)
+    decoder_tuning_install(playbin, role);
+
+  return playbin;
+}
+
+static gpointer background_thread_func(Background *background)
+{
+  GstBus *bus = gst_element_get_bus(background->pipeline);
+
+  gst_element_set_state(background->pipeline, GST_STATE_PLAYING);
+  while (g_atomic_int_get(&background->running)) {
+    GstMessage *msg = gst_bus_timed_pop_filtered(bus, BUS_POLL, GST_MESSAGE_EOS | GST_MESSAGE_ERROR);
+
+    if (msg == NULL)
+      continue;
+    if (GST_MESSAGE_TYPE(msg) == GST_MESSAGE_ERROR) {
+      g_printerr("Background pipeline failed\n");
+      gst_message_unref(msg);
+      break;
+    }
+    gst_message_unref(msg);
+
+    background->loops++;
+    gst_element_seek_simple(background->pipeline, GST_FORMAT_TIME, GST_SEEK_FLAG_FLUSH, 0);
+  }
+  gst_element_set_state(background->pipeline, GST_STATE_NULL);
+  gst_object_unref(bus);
+
+  return NULL;
+}
+
+/* This function is called by the video sink of the playback pipeline for each frame it renders,
+ * once its clock time is reached */
+static void handoff_cb(GstElement *sink, GstBuffer *buffer, GstPad *pad, GArray *lateness)
+{
+  GstEvent *event = gst_pad_get_sticky_event(pad, GST_EVENT_SEGMENT, 0);
+  GstClock *clock = gst_element_get_clock(sink);
+
+  if (event != NULL && clock != NULL && GST_BUFFER_PTS_IS_VALID(buffer)) {
+    const GstSegment *segment;
+
+    gst_event_parse_segment(event, &segment);
+    GstClockTime running_time = gst_segment_to_running_time(segment, GST_FORMAT_TIME, GST_BUFFER_PTS(buffer));
+    if (GST_CLOCK_TIME_IS_VALID(running_time)) {
+      GstClockTimeDiff late = GST_CLOCK_DIFF(gst_element_get_base_time(sink) + running_time,
+          gst_clock_get_time(clock));
+      gdouble ms = MAX(late, 0) / (gdouble) GST_MSECOND;
+      g_array_append_val(lateness, ms);
+    }
+  }
+
+  if (clock != NULL)
+    gst_object_unref(clock);
+  if (event != NULL)
+    gst_event_unref(event);
+}
+
+/* This function prints how many threads of the process may run on each CPU list */
+static void print_thread_affinity(void)
+{
+  GDir *dir = g_dir_open("/proc/self/task", 0, NULL);
+  GHashTable *counts = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+  const gchar *tid;
+
+  if (dir == NULL)
+    return;
+
+  while ((tid = g_dir_read_name(dir)) != NULL) {
+    gchar *path = g_strdup_printf("/proc/self/task/%s/status", tid);
+    gchar *contents = NULL;
+
+    if (g_file_get_contents(path, &contents, NULL, NULL)) {
+      const gchar *line = strstr(contents, "\nCpus_allowed_list:");
+      if (line != NULL) {
+        gchar *list = g_strstrip(g_strndup(line + strlen("\nCpus_allowed_list:"),
+            strcspn(line + strlen("\nCpus_allowed_list:"), "\n")));
+        guint count = GPOINTER_TO_UINT(g_hash_table_lookup(counts, list));
+        g_hash_table_replace(counts, list, GUINT_TO_POINTER(count + 1));
+      }
+    }
+    g_free(contents);
+    g_free(path);
+  }
+  g_dir_close(dir);
+
+  GHashTableIter iter;
+  gpointer list, count;
+  g_hash_table_iter_init(&iter, counts);
+  while (g_hash_table_iter_next(&iter, &list, &count))
+    g_print("  threads on CPUs %s: %u\n", (const gchar *) list, GPOINTER_TO_UINT(count));
+  g_hash_table_destroy(counts);
+}
+
+static gint compare_double(gconstpointer a, gconstpointer b)
+{
+  gdouble x = *(const gdouble *) a, y = *(const gdouble *) b;
+
+  return x < y ? -1 : x > y;
+}
+
+static gdouble percentile(GArray *values, guint percent)
+{
+  if (values->len == 0)
+    return 0;
+  return g_array_index(values, gdouble, MIN(values->len * percent / 100, values->len - 1));
+}
+
+/* This function plays the clip for seconds_option seconds next to the background pipelines */
+static gboolean run(const gchar *uri, gboolean tuned)
+{
+  Background backgrounds[MAX_BACKGROUND];
+  GArray *lateness = g_array_new(FALSE, FALSE, sizeof(gdouble));
+  GstElement *playbin = make_playbin(uri, TRUE, tuned, DECODER_ROLE_PLAYBACK);
+  GstElement *video_sink = NULL;
+  gboolean res = TRUE;
+  guint loops = 0;
+
+  g_object_get(playbin, "video-sink", &video_sink, NULL);
+  g_object_set(video_sink, "signal-handoffs", TRUE, NULL);
+  g_signal_connect(video_sink, "handoff", G_CALLBACK(handoff_cb), lateness);
+
+  for (gint i = 0; i < background_option; i++) {
+    backgrounds[i].pipeline = make_playbin(uri, FALSE, tuned, DECODER_ROLE_BACKGROUND);
+    backgrounds[i].running = TRUE;
+    backgrounds[i].loops = 0;
+    backgrounds[i].thread = g_thread_new("bench-background", (GThreadFunc) background_thread_func, &backgrounds[i]);
+  }
+
+  g_print("%s:\n", tuned ? "tuned" : "default");
+
+  GstBus *bus = gst_element_get_bus(playbin);
+  gst_element_set_state(playbin, GST_STATE_PLAYING);
+  gint64 end = g_get_monotonic_time() + seconds_option * G_TIME_SPAN_SECOND;
+  gboolean sampled = FALSE;
+
+  while (g_get_monotonic_time() < end) {
+    GstMessage *msg = gst_bus_timed_pop_filtered(bus, BUS_POLL, GST_MESSAGE_EOS | GST_MESSAGE_ERROR);
+
+    if (!sampled && g_get_monotonic_time() > end - seconds_option * G_TIME_SPAN_SECOND / 2) {
+      print_thread_affinity();
+      sampled = TRUE;
+    }
+    if (msg == NULL)
+      continue;
+
+    gboolean failed = GST_MESSAGE_TYPE(msg) == GST_MESSAGE_ERROR;
+    gst_message_unref(msg);
+    if (failed) {
+      g_printerr("Could not play %s\n", uri);
+      res = FALSE;
+    }
+    break;
+  }
+
+  GstStructure *stats = NULL;
+  guint64 rendered = 0, dropped = 0;
+  g_object_get(video_sink, "stats", &stats, NULL);
+  gst_structure_get_uint64(stats, "rendered", &rendered);
+  gst_structure_get_uint64(stats, "dropped", &dropped);
+  gst_structure_free(stats);
+
+  gst_element_set_state(playbin, GST_STATE_NULL);
+  gst_object_unref(bus);
+
+  for (gint i = 0; i < background_option; i++) {
+    g_atomic_int_set(&backgrounds[i].running, FALSE);
+    g_thread_join(backgrounds[i].thread);
+    loops += backgrounds[i].loops;
+    gst_object_unref(backgrounds[i].pipeline);
+  }
+
+  g_array_sort(lateness, compare_double);
+  g_print("  frames rendered %" G_GUINT64_FORMAT ", dropped %" G_GUINT64_FORMAT
+      ", late p50 %.2f ms, p99 %.2f ms, max %.2f ms, background loops %u\n",
+      rendered, dropped, percentile(lateness, 50), percentile(lateness, 99), percentile(lateness, 100), loops);
+
+  g_signal_handlers_disconnect_by_func(video_sink, handoff_cb, lateness);
+  gst_object_unref(video_sink);
+  gst_object_unref(playbin);
+  g_array_free(lateness, TRUE);
+  return res;
+}
+
+int main(int argc, char *argv[])
+{
+  GOptionContext *context = g_option_context_new("CLIP - playback next to background decoding benchmark");
+  GError *error = NULL;
+
+  g_option_context_add_main_entries(context, option_entries, NULL);
+  g_option_context_add_group(context, gst_init_get_option_group());
+  if (!g_option_context_parse(context, &argc, &argv, &error)) {
+    g_printerr("Could not parse options: %s\n", error->message);
+    g_clear_error(&error);
+    return -1;
+  }
+  g_option_context_free(context);
+
+  if (argc < 2 || seconds_option <= 0 || background_option < 0 || background_option > MAX_BACKGROUND) {
+    g_printerr("Usage: %s [--seconds=N] [--background=N] CLIP\n", argv[0]);
+    return -1;
+  }
+
+  decoder_tuning_probe_topology();
+  gchar *description = decoder_tuning_describe();
+  g_print("%s\n", description);
+  g_free(description);
+
+  gchar *uri = gst_uri_is_valid(argv[1]) ? g_strdup(argv[1]) : gst_filename_to_uri(argv[1], NULL);
+  gboolean res = run(uri, FALSE) && run(uri, TRUE);
+
+  g_free(uri);
+  return res ? 0 : -1;
+}
@@ -0,0 +1,93 @@
+/* Export of a range of a clip.
+ *
+ * Times the stream copy export of the range, then its re-encode with 1, 2, 4... chunks up
+ * to the number of CPUs, and reports the speedup of each over the single chunk.
+ */
+#include <gst/gst.h>
+#include <glib/gstdio.h>
+
+#include "clipexport.h"
+
+#define DEFAULT_START_S     0
+#define DEFAULT_DURATION_S  600
+
+static gint start_option = DEFAULT_START_S;
+static gint duration_option = DEFAULT_DURATION_S;
+
+static GOptionEntry option_entries[] = {
+  { "start", 's', 0, G_OPTION_ARG_INT, &start_option, "Start of the range in seconds (default: 0)", "SECONDS" },
+  { "duration", 'd', 0, G_OPTION_ARG_INT, &duration_option, "Duration of the range in seconds (default: 600)", "SECONDS" },
+  { NULL }
+};
+
+/* This function exports the range once and gives the time it took in seconds, -1 on error */
+static gdouble measure(const gchar *uri, const gchar *path, ClipExportMode mode, guint n_chunks)
+{
+  GstClockTime start = start_option * GST_SECOND;
+  GstClockTime stop = start + duration_option * GST_SECOND;
+  GError *error = NULL;
+
+  gint64 begin = g_get_monotonic_time();
+  gboolean res = clip_export(uri, start, stop, path, mode, n_chunks, &error);
+  gint64 end = g_get_monotonic_time();
+
+  g_unlink(path);
+  if (!res) {
+    g_printerr("Could not export: %s\n", error->message);
+    g_clear_error(&error);
+    return -1;
+  }
+
+  return (end - begin) / 1e6;
+}
+
+int main(int argc, char *argv[])
+{
+  GOptionContext *context = g_option_context_new("CLIP - range export benchmark");
+  GError *error = NULL;
+
+  g_option_context_add_main_entries(context, option_entries, NULL);
+  g_option_context_add_group(context, gst_init_get_option_group());
+  if (!g_option_context_parse(context, &argc, &argv, &error)) {
+    g_printerr("Could not parse options: %s\n", error->message);
+    g_clear_error(&error);
+    return -1;
+  }
+  g_option_context_free(context);
+
+  if (argc < 2 || start_option < 0 || duration_option <= 0) {
+    g_printerr("Usage: %s [--start=SECONDS] [--duration=SECONDS] CLIP\n", argv[0]);
+    return -1;
+  }
+
+  gchar *uri = gst_uri_is_valid(argv[1]) ? g_strdup(argv[1]) : gst_filename_to_uri(argv[1], NULL);
+  gchar *path = g_build_filename(g_get_tmp_dir(), "bench_export.mkv", NULL);
+  gint res = 0;
+
+  g_print("mode        chunks     time-s    speedup\n");
+
+  gdouble copy = measure(uri, path, CLIP_EXPORT_COPY, 0);
+  if (copy < 0) {
+    res = -1;
+    goto out;
+  }
+  g_print("%-10s %7s %10.2f %10s\n", "copy", "-", copy, "-");
+
+  gdouble single = -1;
+  for (guint n = 1; n <= g_get_num_processors(); n *= 2) {
+    gdouble seconds = measure(uri, path, CLIP_EXPORT_REENCODE, n);
+
+    if (seconds < 0) {
+      res = -1;
+      goto out;
+    }
+    if (single < 0)
+      single = seconds;
+    g_print("%-10s %7u %10.2f %10.2f\n", "reencode", n, seconds, single / seconds);
+  }
+
+out:
+  g_free(path);
+  g_free(uri);
+  return res;
+}
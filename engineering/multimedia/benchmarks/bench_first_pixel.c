@@ -0,0 +1,171 @@
+/* Time to first visible pixel of a clip.
+ *
+ * Runs, like the player on a poster cache miss, a single-frame poster decode next
+ * to a prerolling playbin, and reports the time each takes to produce its first frame.
+ * The player shows whichever comes first, which is the time to first pixel.
+ */
+#include <gst/gst.h>
+
+#include "posterframe.h"
+
+#define DEFAULT_RUNS    10
+#define POSTER_WIDTH    640
+#define POSTER_TIMEOUT  (10 * GST_SECOND)
+
+static gint runs_option = DEFAULT_RUNS;
+
+static GOptionEntry option_entries[] = {
+  { "runs", 'n', 0, G_OPTION_ARG_INT, &runs_option, "Number of runs (default: 10)", "N" },
+  { NULL }
+};
+
+/* Arrival of the first buffer, written from the streaming thread and read from the main thread */
+typedef struct _FirstBuffer
+{
+  GMutex lock;
+  gint64 time;
+} FirstBuffer;
+
+static GstPadProbeReturn first_buffer_probe_cb(GstPad *pad, GstPadProbeInfo *info, FirstBuffer *first_buffer)
+{
+  g_mutex_lock(&first_buffer->lock);
+  if (first_buffer->time == 0)
+    first_buffer->time = g_get_monotonic_time();
+  g_mutex_unlock(&first_buffer->lock);
+
+  return GST_PAD_PROBE_REMOVE;
+}
+
+/* This function measures the time playbin takes to get its first frame to the sink, in milliseconds */
+static gdouble measure_playbin(const gchar *uri)
+{
+  GstElement *playbin = gst_element_factory_make("playbin", NULL);
+  GstElement *video_sink = gst_element_factory_make("fakesink", NULL);
+  GstElement *audio_sink = gst_element_factory_make("fakesink", NULL);
+  FirstBuffer first_buffer = { 0 };
+  gdouble ms = -1;
+
+  g_mutex_init(&first_buffer.lock);
+
+  g_object_set(playbin, "uri", uri, "video-sink", video_sink, "audio-sink", audio_sink, NULL);
+
+  GstPad *pad = gst_element_get_static_pad(video_sink, "sink");
+  gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_BUFFER, (GstPadProbeCallback) first_buffer_probe_cb,
+      &first_buffer, NULL);
+  gst_object_unref(pad);
+
+  gint64 start = g_get_monotonic_time();
+  gst_element_set_state(playbin, GST_STATE_PAUSED);
+
+  GstBus *bus = gst_element_get_bus(playbin);
+  GstMessage *msg = gst_bus_timed_pop_filtered(bus, POSTER_TIMEOUT, GST_MESSAGE_ASYNC_DONE | GST_MESSAGE_ERROR);
+  g_mutex_lock(&first_buffer.lock);
+  gint64 first_buffer_time = first_buffer.time;
+  g_mutex_unlock(&first_buffer.lock);
+  if (msg != NULL && GST_MESSAGE_TYPE(msg) == GST_MESSAGE_ASYNC_DONE && first_buffer_time != 0)
+    ms = (first_buffer_time - start) / 1000.0;
+  if (msg != NULL)
+    gst_message_unref(msg);
+  gst_object_unref(bus);
+
+  gst_element_set_state(playbin, GST_STATE_NULL);
+  gst_object_unref(playbin);
+  g_mutex_clear(&first_buffer.lock);
+  return ms;
+}
+
+/* This function measures the time the poster decode takes, in milliseconds */
+static gdouble measure_poster(const gchar *uri)
+{
+  GError *error = NULL;
+  gint64 start = g_get_monotonic_time();
+  GstSample *sample = poster_frame_grab(uri, POSTER_WIDTH, POSTER_TIMEOUT, &error);
+  gint64 end = g_get_monotonic_time();
+
+  if (sample == NULL) {
+    g_printerr("No poster frame: %s\n", error->message);
+    g_clear_error(&error);
+    return -1;
+  }
+
+  gst_sample_unref(sample);
+  return (end - start) / 1000.0;
+}
+
+static gpointer poster_thread_func(gpointer uri)
+{
+  gdouble *ms = g_new(gdouble, 1);
+
+  *ms = measure_poster(uri);
+  return ms;
+}
+
+static gint compare_double(gconstpointer a, gconstpointer b)
+{
+  gdouble x = *(const gdouble *) a, y = *(const gdouble *) b;
+
+  return x < y ? -1 : x > y;
+}
+
+static void print_result(const gchar *name, GArray *values)
+{
+  g_array_sort(values, compare_double);
+  g_print("%-8s %10.1f %10.1f %10.1f\n", name,
+      g_array_index(values, gdouble, 0),
+      g_array_index(values, gdouble, values->len / 2),
+      g_array_index(values, gdouble, values->len - 1));
+}
+
+int main(int argc, char *argv[])
+{
+  GOptionContext *context = g_option_context_new("CLIP - time to first pixel benchmark");
+  GError *error = NULL;
+
+  g_option_context_add_main_entries(context, option_entries, NULL);
+  g_option_context_add_group(context, gst_init_get_option_group());
+  if (!g_option_context_parse(context, &argc, &argv, &error)) {
+    g_printerr("Could not parse options: %s\n", error->message);
+    g_clear_error(&error);
+    return -1;
+  }
+  g_option_context_free(context);
+
+  if (argc < 2 || runs_option <= 0) {
+    g_printerr("Usage: %s [--runs=N] CLIP\n", argv[0]);
+    return -1;
+  }
+
+  gchar *uri = gst_uri_is_valid(argv[1]) ? g_strdup(argv[1]) : gst_filename_to_uri(argv[1], NULL);
+  GArray *poster = g_array_new(FALSE, FALSE, sizeof(gdouble));
+  GArray *playbin = g_array_new(FALSE, FALSE, sizeof(gdouble));
+  GArray *first_pixel = g_array_new(FALSE, FALSE, sizeof(gdouble));
+
+  for (gint i = 0; i < runs_option; i++) {
+    GThread *thread = g_thread_new("poster", poster_thread_func, uri);
+    gdouble playbin_ms = measure_playbin(uri);
+    gdouble *result = g_thread_join(thread);
+    gdouble poster_ms = *result;
+    g_free(result);
+
+    if (poster_ms < 0 || playbin_ms < 0) {
+      g_printerr("Could not measure %s\n", uri);
+      return -1;
+    }
+
+    gdouble first_pixel_ms = MIN(poster_ms, playbin_ms);
+    g_array_append_val(poster, poster_ms);
+    g_array_append_val(playbin, playbin_ms);
+    g_array_append_val(first_pixel, first_pixel_ms);
+  }
+
+  g_print("path         min-ms     p50-ms     max-ms\n");
+  print_result("poster", poster);
+  print_result("playbin", playbin);
+  print_result("first", first_pixel);
+
+  g_array_free(first_pixel, TRUE);
+  g_array_free(playbin, TRUE);
+  g_array_free(poster, TRUE);
+  g_free(uri);
+  return 0;
+}
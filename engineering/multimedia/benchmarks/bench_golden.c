@@ -0,0 +1,417 @@
+/* Golden frames of the snapshot and thumbnail paths.
+ *
+ * Encodes a few deterministic clips from videotestsrc, takes their poster frame and
+ * their timeline thumbnails the way the players do, and compares a 64-bit hash of
+ * each frame to the golden hashes of a previous run. With --update, the hashes and the
+ * frames themselves are stored as the new golden set. A frame whose hash changed still
+ * passes if no byte differs from the stored one by more than --tolerance. The time
+ * taken to extract each frame is reported next to its hash.
+ */
+#include <gst/gst.h>
+#include <glib/gstdio.h>
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "posterframe.h"
+
+#define DEFAULT_GOLDEN_DIR  "golden"
+#define THUMB_WIDTH         160
+#define THUMBNAILS_NUMBER   9
+#define CLIP_BUFFERS        250  /* 10 seconds at 25 fps */
+#define PREROLL_TIMEOUT     (10 * GST_SECOND)
+#define HASHES_FILE         "hashes.txt"
+
+#define PRIME64_1 G_GUINT64_CONSTANT(0x9E3779B185EBCA87)
+#define PRIME64_2 G_GUINT64_CONSTANT(0xC2B2AE3D27D4EB4F)
+#define PRIME64_3 G_GUINT64_CONSTANT(0x165667B19E3779F9)
+
+/* Clips made for the run. The encoders are single threaded, so the same build gives
+ * the same bytes */
+typedef struct _GoldenClip
+{
+  const gchar *name;
+  const gchar *pattern;
+  const gchar *encoder;
+  const gchar *muxer;
+} GoldenClip;
+
+static const GoldenClip golden_clips[] = {
+  { "smpte-h264", "smpte", "x264enc threads=1 bframes=0 key-int-max=25", "mp4mux" },
+  { "ball-h264", "ball", "x264enc threads=1 bframes=0 key-int-max=25", "mp4mux" },
+  { "ball-mjpeg", "ball", "jpegenc", "matroskamux" },
+};
+
+static gchar *golden_dir_option = NULL;
+static gboolean update_option = FALSE;
+static gint tolerance_option = 0;
+
+static GOptionEntry option_entries[] = {
+  { "golden-dir", 'g', 0, G_OPTION_ARG_FILENAME, &golden_dir_option, "Directory of the golden set (default: golden)", "DIR" },
+  { "update", 'u', 0, G_OPTION_ARG_NONE, &update_option, "Store the frames of this run as the golden set", NULL },
+  { "tolerance", 't', 0, G_OPTION_ARG_INT, &tolerance_option, "Largest difference of a byte still accepted (default: 0)", "N" },
+  { NULL }
+};
+
+#define STRIPE_LANES  8    /* 64-bit lanes of a 64 bytes stripe */
+#define BLOCK_STRIPES 16   /* Stripes accumulated between two scrambles */
+
+static inline guint64 rotl64(guint64 x, guint r)
+{
+  return (x << r) | (x >> (64 - r));
+}
+
+/* This function adds stripes of 64 bytes to the accumulators, the accumulate step of
+ * XXH3. Each 64-bit lane is mixed with its key and its two 32-bit halves are multiplied
+ * into a 64-bit product, which SSE2 has for vectors (pmuludq), unlike the 64-bit
+ * multiply of XXH64 that x86-64 only vectorizes with AVX-512. gcc -O3 turns each stripe
+ * into SSE2 code, but only out of line and with restrict accumulators. -O2 and
+ * unoptimized builds keep it scalar */
+static G_GNUC_NO_INLINE void accumulate(guint64 *restrict acc, const guint64 *restrict key,
+    const guint8 *data, gsize stripes)
+{
+  for (gsize stripe = 0; stripe < stripes; stripe++, data += STRIPE_LANES * 8) {
+    guint64 value[STRIPE_LANES];
+
+    memcpy(value, data, sizeof(value));
+    for (guint lane = 0; lane < STRIPE_LANES; lane++) {
+      guint64 mixed = value[lane] ^ key[lane];
+
+      /* Each accumulator also takes the data of its neighbour lane */
+      acc[lane] += value[lane ^ 1] + (mixed & 0xFFFFFFFF) * (mixed >> 32);
+    }
+  }
+}
+
+/* This function hashes size bytes on top of seed, in stripes of 64 bytes like XXH3 */
+static guint64 hash_bytes(const guint8 *data, gsize size, guint64 seed)
+{
+  guint64 acc[STRIPE_LANES], key[STRIPE_LANES];
+  gsize stripes = size / (STRIPE_LANES * 8);
+  gsize i = stripes * STRIPE_LANES * 8;
+
+  for (guint lane = 0; lane < STRIPE_LANES; lane++) {
+    acc[lane] = rotl64(PRIME64_1, lane * 8) ^ PRIME64_3;
+    key[lane] = rotl64(PRIME64_2, lane * 8) + seed;
+  }
+
+  for (gsize stripe = 0; stripe < stripes; stripe += BLOCK_STRIPES) {
+    gsize block = MIN(BLOCK_STRIPES, stripes - stripe);
+
+    accumulate(acc, key, data + stripe * STRIPE_LANES * 8, block);
+
+    /* The high bits of the accumulators are folded back in after each block, like XXH3 */
+    if (block == BLOCK_STRIPES) {
+      for (guint lane = 0; lane < STRIPE_LANES; lane++)
+        acc[lane] = (acc[lane] ^ (acc[lane] >> 47) ^ key[lane]) * (guint32) PRIME64_1;
+    }
+  }
+
+  guint64 h = size * PRIME64_1;
+  for (guint lane = 0; lane < STRIPE_LANES; lane += 2)
+    h += (acc[lane] ^ key[lane]) * ((acc[lane + 1] ^ key[lane + 1]) | 1);
+
+  for (; i + 8 <= size; i += 8) {
+    guint64 value;
+
+    memcpy(&value, data + i, 8);
+    h = rotl64(h ^ (value * PRIME64_2), 27) * PRIME64_1;
+  }
+  for (; i < size; i++)
+    h = rotl64(h ^ (data[i] * PRIME64_3), 11) * PRIME64_1;
+
+  h ^= h >> 33;
+  h *= PRIME64_2;
+  h ^= h >> 29;
+  h *= PRIME64_3;
+  h ^= h >> 32;
+  return h;
+}
+
+/* This function hashes the visible pixels of an RGB sample, the row padding is left out */
+static gboolean hash_sample(GstSample *sample, guint64 *hash, GBytes **pixels)
+{
+  GstStructure *s = gst_caps_get_structure(gst_sample_get_caps(sample), 0);
+  GstBuffer *buffer = gst_sample_get_buffer(sample);
+  gint width, height;
+  GstMapInfo map;
+
+  if (!gst_structure_get_int(s, "width", &width) || !gst_structure_get_int(s, "height", &height) ||
+      !gst_buffer_map(buffer, &map, GST_MAP_READ))
+    return FALSE;
+
+  gsize row = width * 3;
+  guint8 *packed = g_malloc(row * height);
+  guint64 h = (guint64) width << 32 | height;
+
+  /* Rows are padded to 4 bytes, only the pixels are hashed, in one go */
+  for (gint y = 0; y < height; y++)
+    memcpy(packed + y * row, map.data + y * GST_ROUND_UP_4(row), row);
+  gst_buffer_unmap(buffer, &map);
+  h = hash_bytes(packed, row * height, h);
+
+  *hash = h;
+  *pixels = g_bytes_new_take(packed, row * height);
+  return TRUE;
+}
+
+/* This function encodes a clip to path */
+static gboolean make_clip(const GoldenClip *clip, const gchar *path)
+{
+  GError *error = NULL;
+  gchar *description = g_strdup_printf("videotestsrc pattern=%s num-buffers=%d ! "
+      "video/x-raw,format=I420,width=320,height=240,framerate=25/1 ! %s ! %s ! filesink location=\"%s\"",
+      clip->pattern, CLIP_BUFFERS, clip->encoder, clip->muxer, path);
+  GstElement *pipeline = gst_parse_launch(description, &error);
+  gboolean res = FALSE;
+
+  g_free(description);
+  if (pipeline == NULL) {
+    g_printerr("Could not make %s: %s\n", clip->name, error->message);
+    g_clear_error(&error);
+    return FALSE;
+  }
+
+  gst_element_set_state(pipeline, GST_STATE_PLAYING);
+  GstBus *bus = gst_element_get_bus(pipeline);
+  GstMessage *msg = gst_bus_timed_pop_filtered(bus, GST_CLOCK_TIME_NONE, GST_MESSAGE_EOS | GST_MESSAGE_ERROR);
+  if (GST_MESSAGE_TYPE(msg) == GST_MESSAGE_ERROR) {
+    gst_message_parse_error(msg, &error, NULL);
+    g_printerr("Could not make %s: %s\n", clip->name, error->message);
+    g_clear_error(&error);
+  } else {
+    res = TRUE;
+  }
+  gst_message_unref(msg);
+  gst_object_unref(bus);
+
+  gst_element_set_state(pipeline, GST_STATE_NULL);
+  gst_object_unref(pipeline);
+  return res;
+}
+
+/* This function stores, or checks against the golden set, one frame. Returns whether it passes */
+static gboolean check_frame(GHashTable *golden, GString *hashes, const gchar *name, GstSample *sample,
+    gdouble ms)
+{
+  gchar *frame_path = g_strdup_printf("%s/%s.rgb", golden_dir_option, name);
+  GBytes *pixels = NULL;
+  guint64 hash;
+  const gchar *status;
+  gboolean res = TRUE;
+
+  if (sample == NULL || !hash_sample(sample, &hash, &pixels)) {
+    g_print("%-28s %16s %10.2f  failed\n", name, "-", ms);
+    g_free(frame_path);
+    return FALSE;
+  }
+
+  if (update_option) {
+    g_string_append_printf(hashes, "%s %016" G_GINT64_MODIFIER "x\n", name, hash);
+    g_file_set_contents(frame_path, g_bytes_get_data(pixels, NULL), g_bytes_get_size(pixels), NULL);
+    status = "stored";
+  } else {
+    const gchar *expected = g_hash_table_lookup(golden, name);
+
+    if (expected == NULL) {
+      status = "new";
+      res = FALSE;
+    } else if (g_ascii_strtoull(expected, NULL, 16) == hash) {
+      status = "ok";
+    } else {
+      gchar *stored = NULL;
+      gsize size = 0;
+      gsize n = 0;
+      const guint8 *data = g_bytes_get_data(pixels, &n);
+      gint diff = G_MAXINT;
+
+      /* Only the largest difference matters, a changed kernel may round differently */
+      if (g_file_get_contents(frame_path, &stored, &size, NULL) && size == n) {
+        diff = 0;
+        for (gsize i = 0; i < n; i++)
+          diff = MAX(diff, ABS((gint) data[i] - (gint) (guint8) stored[i]));
+      }
+      g_free(stored);
+
+      res = diff <= tolerance_option;
+      status = res ? "within tolerance" : "changed";
+    }
+  }
+
+  g_print("%-28s %016" G_GINT64_MODIFIER "x %10.2f  %s\n", name, hash, ms, status);
+  g_bytes_unref(pixels);
+  g_free(frame_path);
+  return res;
+}
+
+/* This function takes the poster frame of the clip, as both players do on open */
+static gboolean check_poster(GHashTable *golden, GString *hashes, const gchar *clip, const gchar *uri)
+{
+  GError *error = NULL;
+  gchar *name = g_strdup_printf("%s/poster", clip);
+
+  gint64 begin = g_get_monotonic_time();
+  GstSample *sample = poster_frame_grab(uri, THUMB_WIDTH, PREROLL_TIMEOUT, &error);
+  gint64 end = g_get_monotonic_time();
+
+  if (sample == NULL) {
+    g_printerr("Could not grab the poster of %s: %s\n", clip, error->message);
+    g_clear_error(&error);
+  }
+
+  gboolean res = check_frame(golden, hashes, name, sample, (end - begin) / 1000.0);
+  if (sample != NULL)
+    gst_sample_unref(sample);
+  g_free(name);
+  return res;
+}
+
+/* This function takes the thumbnails of the clip like the timeline of the Gtk+3 player
+ * and the snapshot example: keyframe seeks at 10%, 20%... of one paused pipeline */
+static gboolean check_thumbnails(GHashTable *golden, GString *hashes, const gchar *clip, const gchar *uri)
+{
+  GError *error = NULL;
+  gchar *description = g_strdup_printf("uridecodebin uri=\"%s\" ! videoconvert ! videoscale ! "
+      "appsink name=sink sync=false caps=\"video/x-raw,format=RGB,width=%d,pixel-aspect-ratio=1/1\"",
+      uri, THUMB_WIDTH);
+  GstElement *pipeline = gst_parse_launch(description, &error);
+  gint64 duration;
+  gboolean res = TRUE;
+
+  g_free(description);
+  if (pipeline == NULL) {
+    g_printerr("Could not make the thumbnail pipeline: %s\n", error->message);
+    g_clear_error(&error);
+    return FALSE;
+  }
+
+  GstElement *sink = gst_bin_get_by_name(GST_BIN(pipeline), "sink");
+  gst_element_set_state(pipeline, GST_STATE_PAUSED);
+  if (gst_element_get_state(pipeline, NULL, NULL, PREROLL_TIMEOUT) != GST_STATE_CHANGE_SUCCESS ||
+      !gst_element_query_duration(pipeline, GST_FORMAT_TIME, &duration)) {
+    g_printerr("Could not preroll %s\n", clip);
+    res = FALSE;
+    goto out;
+  }
+
+  for (gint step = 0; step < THUMBNAILS_NUMBER; step++) {
+    gchar *name = g_strdup_printf("%s/thumbnail-%d", clip, step);
+    GstSample *sample = NULL;
+
+    gint64 begin = g_get_monotonic_time();
+    gst_element_seek_simple(pipeline, GST_FORMAT_TIME, GST_SEEK_FLAG_KEY_UNIT | GST_SEEK_FLAG_FLUSH,
+        (step + 1) * duration / 10);
+    g_signal_emit_by_name(sink, "pull-preroll", &sample, NULL);
+    gint64 end = g_get_monotonic_time();
+
+    res &= check_frame(golden, hashes, name, sample, (end - begin) / 1000.0);
+    if (sample != NULL)
+      gst_sample_unref(sample);
+    g_free(name);
+  }
+
+out:
+  gst_object_unref(sink);
+  gst_element_set_state(pipeline, GST_STATE_NULL);
+  gst_object_unref(pipeline);
+  return res;
+}
+
+/* This function reads the golden hashes, name to hexadecimal hash */
+static GHashTable *load_golden(void)
+{
+  GHashTable *golden = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+  gchar *path = g_build_filename(golden_dir_option, HASHES_FILE, NULL);
+  gchar *contents = NULL;
+
+  if (g_file_get_contents(path, &contents, NULL, NULL)) {
+    gchar **lines = g_strsplit(contents, "\n", -1);
+
+    for (gchar **line = lines; *line != NULL; line++) {
+      gchar **fields = g_strsplit(*line, " ", 2);
+
+      if (fields[0] != NULL && fields[1] != NULL)
+        g_hash_table_insert(golden, g_strdup(fields[0]), g_strdup(fields[1]));
+      g_strfreev(fields);
+    }
+    g_strfreev(lines);
+    g_free(contents);
+  }
+
+  g_free(path);
+  return golden;
+}
+
+int main(int argc, char *argv[])
+{
+  GOptionContext *context = g_option_context_new("- golden frames of the snapshot and thumbnail paths");
+  GError *error = NULL;
+
+  g_option_context_add_main_entries(context, option_entries, NULL);
+  g_option_context_add_group(context, gst_init_get_option_group());
+  if (!g_option_context_parse(context, &argc, &argv, &error)) {
+    g_printerr("Could not parse options: %s\n", error->message);
+    g_clear_error(&error);
+    return -1;
+  }
+  g_option_context_free(context);
+
+  if (tolerance_option < 0) {
+    g_printerr("Invalid tolerance %d\n", tolerance_option);
+    return -1;
+  }
+  if (golden_dir_option == NULL)
+    golden_dir_option = g_strdup(DEFAULT_GOLDEN_DIR);
+
+  gchar *work_dir = g_dir_make_tmp("bench_golden-XXXXXX", &error);
+  if (work_dir == NULL) {
+    g_printerr("Could not make the clips directory: %s\n", error->message);
+    g_clear_error(&error);
+    return -1;
+  }
+
+  GHashTable *golden = load_golden();
+  GString *hashes = g_string_new(NULL);
+  gboolean res = TRUE;
+
+  g_print("%-28s %16s %10s  %s\n", "frame", "hash", "time-ms", "status");
+  for (gsize i = 0; i < G_N_ELEMENTS(golden_clips); i++) {
+    gchar *file = g_strconcat(golden_clips[i].name, ".clip", NULL);
+    gchar *path = g_build_filename(work_dir, file, NULL);
+    gchar *frames_dir = g_build_filename(golden_dir_option, golden_clips[i].name, NULL);
+
+    g_mkdir_with_parents(frames_dir, 0755);
+    if (make_clip(&golden_clips[i], path)) {
+      gchar *uri = gst_filename_to_uri(path, NULL);
+
+      res &= check_poster(golden, hashes, golden_clips[i].name, uri);
+      res &= check_thumbnails(golden, hashes, golden_clips[i].name, uri);
+      g_free(uri);
+    } else {
+      res = FALSE;
+    }
+
+    g_unlink(path);
+    g_free(frames_dir);
+    g_free(path);
+    g_free(file);
+  }
+  g_rmdir(work_dir);
+
+  if (update_option) {
+    gchar *path = g_build_filename(golden_dir_option, HASHES_FILE, NULL);
+
+    if (!g_file_set_contents(path, hashes->str, hashes->len, &error)) {
+      g_printerr("Could not write %s: %s\n", path, error->message);
+      g_clear_error(&error);
+      res = FALSE;
+    }
+    g_free(path);
+  }
+
+  g_string_free(hashes, TRUE);
+  g_hash_table_unref(golden);
+  g_free(work_dir);
+  g_free(golden_dir_option);
+  return res ? 0 : 1;
+}
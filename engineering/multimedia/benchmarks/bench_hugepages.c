@@ -0,0 +1,132 @@
+/* Conversion throughput with and without the huge page allocator.
+ *
+ * Runs videotestsrc ! videoconvert ! fakesink on large I420 frames converted to BGRx, once
+ * with the buffers of both links from the system allocator and once from the huge page
+ * allocator, installed through the ALLOCATION queries as the Gtk+3 player does. Each mode
+ * runs several times, alternating, and the best run of each is kept.
+ */
+#include <gst/gst.h>
+
+#include "hugepagealloc.h"
+
+#define DEFAULT_FRAMES  300
+#define DEFAULT_RUNS    3
+#define DEFAULT_WIDTH   3840
+#define DEFAULT_HEIGHT  2160
+
+static gint frames_option = DEFAULT_FRAMES;
+static gint runs_option = DEFAULT_RUNS;
+static gint width_option = DEFAULT_WIDTH;
+static gint height_option = DEFAULT_HEIGHT;
+
+static GOptionEntry option_entries[] = {
+  { "frames", 'n', 0, G_OPTION_ARG_INT, &frames_option, "Frames converted per run (default: 300)", "N" },
+  { "runs", 'r', 0, G_OPTION_ARG_INT, &runs_option, "Runs of each mode (default: 3)", "N" },
+  { "width", 0, 0, G_OPTION_ARG_INT, &width_option, "Width of the frames (default: 3840)", "PIXELS" },
+  { "height", 0, 0, G_OPTION_ARG_INT, &height_option, "Height of the frames (default: 2160)", "PIXELS" },
+  { NULL }
+};
+
+/* This function converts the frames once, and gives the time taken in seconds, or a negative
+ * value on error */
+static gdouble run(gboolean huge_pages)
+{
+  GError *error = NULL;
+  gchar *description = g_strdup_printf("videotestsrc name=src pattern=solid-color num-buffers=%d ! "
+      "video/x-raw,format=I420,width=%d,height=%d,framerate=0/1 ! videoconvert name=convert ! "
+      "video/x-raw,format=BGRx ! fakesink sync=false", frames_option, width_option, height_option);
+  GstElement *pipeline = gst_parse_launch(description, &error);
+  gdouble seconds = -1;
+
+  g_free(description);
+  if (pipeline == NULL) {
+    g_printerr("Could not make the pipeline: %s\n", error->message);
+    g_clear_error(&error);
+    return -1;
+  }
+
+  /* The pipeline is already built, so the elements are attached directly */
+  if (huge_pages) {
+    GstElement *src = gst_bin_get_by_name(GST_BIN(pipeline), "src");
+    GstElement *convert = gst_bin_get_by_name(GST_BIN(pipeline), "convert");
+
+    huge_page_allocator_attach(src);
+    huge_page_allocator_attach(convert);
+    gst_object_unref(convert);
+    gst_object_unref(src);
+  }
+
+  gint64 begin = g_get_monotonic_time();
+  gst_element_set_state(pipeline, GST_STATE_PLAYING);
+  GstBus *bus = gst_element_get_bus(pipeline);
+  GstMessage *msg = gst_bus_timed_pop_filtered(bus, GST_CLOCK_TIME_NONE, GST_MESSAGE_EOS | GST_MESSAGE_ERROR);
+  if (GST_MESSAGE_TYPE(msg) == GST_MESSAGE_ERROR) {
+    gst_message_parse_error(msg, &error, NULL);
+    g_printerr("Could not convert: %s\n", error->message);
+    g_clear_error(&error);
+  } else {
+    seconds = (g_get_monotonic_time() - begin) / (gdouble) G_USEC_PER_SEC;
+  }
+  gst_message_unref(msg);
+  gst_object_unref(bus);
+
+  gst_element_set_state(pipeline, GST_STATE_NULL);
+  gst_object_unref(pipeline);
+  return seconds;
+}
+
+static void print_result(const gchar *name, gdouble seconds)
+{
+  /* Bytes read from I420 and written to BGRx by the conversion */
+  gdouble bytes = (gdouble) frames_option * width_option * height_option * (1.5 + 4);
+
+  g_print("%-12s %8.3f s %8.1f fps %8.1f MB/s\n", name, seconds, frames_option / seconds,
+      bytes / seconds / (1024 * 1024));
+}
+
+int main(int argc, char *argv[])
+{
+  GOptionContext *context = g_option_context_new("- conversion throughput with huge page frame buffers");
+  GError *error = NULL;
+
+  g_option_context_add_main_entries(context, option_entries, NULL);
+  g_option_context_add_group(context, gst_init_get_option_group());
+  if (!g_option_context_parse(context, &argc, &argv, &error)) {
+    g_printerr("Could not parse options: %s\n", error->message);
+    g_clear_error(&error);
+    return -1;
+  }
+  g_option_context_free(context);
+
+  if (frames_option <= 0 || runs_option <= 0 || width_option <= 0 || height_option <= 0) {
+    g_printerr("Usage: %s [--frames=N] [--runs=N] [--width=PIXELS] [--height=PIXELS]\n", argv[0]);
+    return -1;
+  }
+
+  gdouble best[2] = { G_MAXDOUBLE, G_MAXDOUBLE };
+  for (gint i = 0; i < runs_option; i++) {
+    for (gint huge_pages = 0; huge_pages < 2; huge_pages++) {
+      gdouble seconds = run(huge_pages);
+
+      if (seconds < 0)
+        return 1;
+      best[huge_pages] = MIN(best[huge_pages], seconds);
+    }
+  }
+
+  g_print("%d frames of %dx%d, I420 to BGRx, best of %d runs\n", frames_option, width_option, height_option,
+      runs_option);
+  print_result("system", best[FALSE]);
+  print_result("huge pages", best[TRUE]);
+  g_print("speedup      %8.2fx\n", best[FALSE] / best[TRUE]);
+
+  HugePageStats stats;
+  huge_page_allocator_get_stats(&stats);
+  g_print("buffers: %" G_GUINT64_FORMAT " from hugetlbfs, %" G_GUINT64_FORMAT " transparent huge pages, %"
+      G_GUINT64_FORMAT " small pages\n", stats.hugetlb, stats.thp, stats.small);
+  if (stats.hugetlb == 0 && stats.thp == 0)
+    g_print("Huge pages are not available: reserve some in /proc/sys/vm/nr_hugepages, or set "
+        "/sys/kernel/mm/transparent_hugepage/enabled to madvise\n");
+
+  return 0;
+}
@@ -0,0 +1,356 @@
+/* Memory governor under an artificial cgroup limit.
+ *
+ * Two synthetic caches, standing for the frame grabber and the pre-seeker of the Gtk+3 player,
+ * grow by touched chunks until each reaches a budget of twice the limit, so together they would
+ * get the process OOM-killed. The governor is registered as in the player and has to keep them
+ * under the limit for the whole run. The limit is applied either by running the benchmark in a
+ * scope, for example:
+ *   systemd-run --user --scope -p MemoryHigh=256M -p MemoryMax=320M ./bench_memory
+ * or, with the rights to create a cgroup, with --cgroup and --limit, which move the process into
+ * that cgroup first. It exits with 1 if the cgroup hit its OOM killer or was never under pressure.
+ *
+ * With --page-cache=FILE, the caches stay at a quarter of the limit each, and FILE, larger than
+ * the limit, is read in a loop, like a player streaming a long clip. The page cache fills the
+ * cgroup up to its limit, but the kernel reclaims it on its own: the governor must not shrink
+ * the caches for it, and the run exits with 1 if it does.
+ */
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "memgovernor.h"
+
+#define DEFAULT_DURATION  30
+#define DEFAULT_RATE      64      /* MB per second each cache grows by */
+#define DEFAULT_INTERVAL  250
+#define CHUNK_BYTES       (4 << 20)
+#define GROW_INTERVAL_MS  100
+#define READ_BYTES        (1 << 20)
+
+static gint duration_option = DEFAULT_DURATION;
+static gint rate_option = DEFAULT_RATE;
+static gint interval_option = DEFAULT_INTERVAL;
+static gchar *cgroup_option = NULL;
+static gint limit_option = 0;
+static gboolean no_governor_option = FALSE;
+static gchar *page_cache_option = NULL;
+
+static GOptionEntry option_entries[] = {
+  { "duration", 'd', 0, G_OPTION_ARG_INT, &duration_option, "Seconds the caches grow for (default: 30)", "SECONDS" },
+  { "rate", 'r', 0, G_OPTION_ARG_INT, &rate_option, "MB per second each cache grows by (default: 64)", "MB" },
+  { "interval", 'i', 0, G_OPTION_ARG_INT, &interval_option, "Milliseconds between two updates of the governor "
+    "(default: 250)", "MS" },
+  { "cgroup", 0, 0, G_OPTION_ARG_FILENAME, &cgroup_option, "Run in the cgroup v2 DIR, created if needed", "DIR" },
+  { "limit", 0, 0, G_OPTION_ARG_INT, &limit_option, "Set memory.high of the cgroup given with --cgroup to MB, "
+    "and memory.max to 1.25 times that", "MB" },
+  { "no-governor", 0, 0, G_OPTION_ARG_NONE, &no_governor_option, "Let the caches grow to their budget, "
+    "to check the limit does kill the process without the governor", NULL },
+  { "page-cache", 0, 0, G_OPTION_ARG_FILENAME, &page_cache_option, "Keep the caches under the limit and read "
+    "FILE in a loop instead, the caches must not be shrunk for its page cache", "FILE" },
+  { NULL }
+};
+
+/* A cache of chunks of touched memory, which grows up to the bytes it is allowed */
+typedef struct _Cache
+{
+  const gchar *name;
+  GQueue chunks;
+  guint64 allowed;
+  guint64 peak;
+} Cache;
+
+static guint64 cache_size(Cache *cache)
+{
+  return (guint64) g_queue_get_length(&cache->chunks) * CHUNK_BYTES;
+}
+
+static void cache_set_budget(guint64 budget, Cache *cache)
+{
+  cache->allowed = budget;
+  while (cache_size(cache) > budget)
+    munmap(g_queue_pop_head(&cache->chunks), CHUNK_BYTES);
+}
+
+static void cache_grow(Cache *cache, guint64 bytes)
+{
+  for (guint64 grown = 0; grown < bytes && cache_size(cache) + CHUNK_BYTES <= cache->allowed; grown += CHUNK_BYTES) {
+    /* Mapped rather than allocated, so freeing gives the memory back whatever the malloc thresholds */
+    gpointer chunk = mmap(NULL, CHUNK_BYTES, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+    if (chunk == MAP_FAILED)
+      break;
+
+    /* Only touched pages are charged to the cgroup */
+    memset(chunk, 0x5a, CHUNK_BYTES);
+    g_queue_push_tail(&cache->chunks, chunk);
+  }
+  cache->peak = MAX(cache->peak, cache_size(cache));
+}
+
+typedef struct _Bench
+{
+  GMainLoop *loop;
+  Cache caches[2];
+  MemoryGovernor *governor;
+  MemoryLevel worst_level;
+  guint64 peak;                /* Highest usage of the cgroup seen, without its clean page cache */
+  guint64 peak_page_cache;     /* Highest clean page cache of the cgroup seen */
+  guint64 limit;
+  gint reading;                /* Whether the reader thread goes on, with --page-cache */
+  guint64 read_bytes;
+} Bench;
+
+static gboolean grow_cb(Bench *bench)
+{
+  guint64 bytes = (guint64) rate_option * (1 << 20) * GROW_INTERVAL_MS / 1000;
+
+  for (guint i = 0; i < G_N_ELEMENTS(bench->caches); i++)
+    cache_grow(&bench->caches[i], bytes);
+
+  MemoryGovernorStats stats;
+  memory_governor_get_stats(bench->governor, &stats);
+  bench->peak = MAX(bench->peak, stats.current);
+  bench->peak_page_cache = MAX(bench->peak_page_cache, stats.page_cache);
+  bench->limit = stats.limit;
+  bench->worst_level = MAX(bench->worst_level, stats.level);
+  return G_SOURCE_CONTINUE;
+}
+
+static gboolean stop_cb(Bench *bench)
+{
+  g_main_loop_quit(bench->loop);
+  return G_SOURCE_REMOVE;
+}
+
+/* This function reads the file given with --page-cache from start to end, again and again, which
+ * only fills the page cache of the cgroup */
+static gpointer reader_thread_func(Bench *bench)
+{
+  gchar *buffer = g_malloc(READ_BYTES);
+  int fd = open(page_cache_option, O_RDONLY);
+
+  if (fd < 0) {
+    g_printerr("Could not open %s: %s\n", page_cache_option, g_strerror(errno));
+    g_free(buffer);
+    return NULL;
+  }
+
+  while (g_atomic_int_get(&bench->reading)) {
+    gssize n = read(fd, buffer, READ_BYTES);
+
+    if (n > 0)
+      bench->read_bytes += n;
+    else if (n == 0)
+      lseek(fd, 0, SEEK_SET);
+    else if (errno != EINTR)
+      break;
+  }
+
+  close(fd);
+  g_free(buffer);
+  return NULL;
+}
+
+/* This function writes a cgroup file in place, they cannot be replaced as g_file_set_contents() does */
+static gboolean write_file(const gchar *dir, const gchar *name, const gchar *contents)
+{
+  gchar *path = g_build_filename(dir, name, NULL);
+  FILE *file = fopen(path, "w");
+  gboolean res = file != NULL && fputs(contents, file) >= 0;
+
+  /* The kernel checks the value when the file is flushed */
+  if (file != NULL)
+    res = fclose(file) == 0 && res;
+  if (!res)
+    g_printerr("Could not write %s: %s\n", path, g_strerror(errno));
+  g_free(path);
+  return res;
+}
+
+/* This function moves the process into the cgroup given with --cgroup, with the limit given with --limit */
+static gboolean enter_cgroup(void)
+{
+  if (g_mkdir_with_parents(cgroup_option, 0755) != 0) {
+    g_printerr("Could not create %s\n", cgroup_option);
+    return FALSE;
+  }
+
+  if (limit_option > 0) {
+    gchar *high = g_strdup_printf("%" G_GUINT64_FORMAT, (guint64) limit_option << 20);
+    gchar *max = g_strdup_printf("%" G_GUINT64_FORMAT, ((guint64) limit_option << 20) * 5 / 4);
+    gboolean res = write_file(cgroup_option, "memory.high", high) && write_file(cgroup_option, "memory.max", max);
+
+    g_free(high);
+    g_free(max);
+    if (!res)
+      return FALSE;
+  }
+
+  /* Writing 0 moves the writer */
+  return write_file(cgroup_option, "cgroup.procs", "0");
+}
+
+/* This function tells whether memory.high or memory.max is set on cgroup itself */
+static gboolean has_limit(const gchar *cgroup)
+{
+  const gchar *names[] = { "memory.high", "memory.max" };
+  gboolean res = FALSE;
+
+  for (guint i = 0; i < G_N_ELEMENTS(names) && !res; i++) {
+    gchar *path = g_build_filename(cgroup, names[i], NULL);
+    gchar *contents = NULL;
+
+    if (g_file_get_contents(path, &contents, NULL, NULL))
+      res = !g_str_has_prefix(contents, "max");
+    g_free(contents);
+    g_free(path);
+  }
+  return res;
+}
+
+/* This function gives a counter of the memory.events file of cgroup, 0 if there is none */
+static guint64 read_event(const gchar *cgroup, const gchar *name)
+{
+  gchar *path = g_build_filename(cgroup, "memory.events", NULL);
+  gchar *contents = NULL;
+  guint64 value = 0;
+
+  if (g_file_get_contents(path, &contents, NULL, NULL)) {
+    gchar **lines = g_strsplit(contents, "\n", -1);
+
+    for (gchar **line = lines; *line != NULL; line++) {
+      if (g_str_has_prefix(*line, name) && (*line)[strlen(name)] == ' ')
+        value = g_ascii_strtoull(*line + strlen(name) + 1, NULL, 10);
+    }
+    g_strfreev(lines);
+    g_free(contents);
+  }
+  g_free(path);
+  return value;
+}
+
+int main(int argc, char *argv[])
+{
+  GOptionContext *context = g_option_context_new("- cache shrinking under an artificial cgroup limit");
+  GError *error = NULL;
+
+  g_option_context_add_main_entries(context, option_entries, NULL);
+  if (!g_option_context_parse(context, &argc, &argv, &error)) {
+    g_printerr("Could not parse options: %s\n", error->message);
+    g_clear_error(&error);
+    return -1;
+  }
+  g_option_context_free(context);
+
+  if (duration_option <= 0 || rate_option <= 0 || interval_option <= 0 || limit_option < 0 ||
+      (limit_option > 0 && cgroup_option == NULL)) {
+    g_printerr("Usage: %s [--duration=SECONDS] [--rate=MB] [--interval=MS] [--cgroup=DIR [--limit=MB]] "
+        "[--no-governor] [--page-cache=FILE]\n", argv[0]);
+    return -1;
+  }
+
+  if (cgroup_option != NULL && !enter_cgroup())
+    return -1;
+
+  Bench bench = { 0 };
+  bench.loop = g_main_loop_new(NULL, FALSE);
+  bench.caches[0].name = "frame-grab";
+  bench.caches[1].name = "pre-seek";
+
+  /* With --no-governor, no cache is registered and the governor only follows the cgroup */
+  bench.governor = memory_governor_new(cgroup_option, interval_option);
+  const gchar *cgroup = memory_governor_get_cgroup(bench.governor);
+  MemoryGovernorStats stats;
+  memory_governor_get_stats(bench.governor, &stats);
+  if (cgroup == NULL || !has_limit(cgroup)) {
+    g_printerr("No cgroup v2 memory limit: run in a scope with MemoryHigh and MemoryMax, or use --cgroup and "
+        "--limit\n");
+    return -1;
+  }
+
+  /* Together, the caches would hold four times the limit, or half of it while reading a file */
+  guint64 budget = page_cache_option != NULL ? stats.limit / 4 : stats.limit * 2;
+  if (no_governor_option) {
+    for (guint i = 0; i < G_N_ELEMENTS(bench.caches); i++)
+      cache_set_budget(budget, &bench.caches[i]);
+  } else {
+    for (guint i = 0; i < G_N_ELEMENTS(bench.caches); i++)
+      memory_governor_add_cache(bench.governor, bench.caches[i].name, i, budget,
+          (MemoryCacheSizeFunc) cache_size, (MemoryCacheBudgetFunc) cache_set_budget, &bench.caches[i]);
+  }
+
+  guint64 oom_kills = read_event(cgroup, "oom_kill");
+  guint64 high_events = read_event(cgroup, "high");
+  g_print("%s: limit %" G_GUINT64_FORMAT " MB, caches of up to %" G_GUINT64_FORMAT " MB each growing by %d MB/s for "
+      "%d s\n", cgroup, stats.limit >> 20, budget >> 20, rate_option, duration_option);
+
+  GThread *reader = NULL;
+  if (page_cache_option != NULL) {
+    GStatBuf file_stat;
+
+    if (g_stat(page_cache_option, &file_stat) != 0) {
+      g_printerr("Could not read %s\n", page_cache_option);
+      return -1;
+    }
+    if ((guint64) file_stat.st_size <= stats.limit)
+      g_printerr("%s is not larger than the limit, its page cache may not reach it\n", page_cache_option);
+
+    bench.reading = TRUE;
+    reader = g_thread_new("bench-reader", (GThreadFunc) reader_thread_func, &bench);
+  }
+
+  g_timeout_add(GROW_INTERVAL_MS, (GSourceFunc) grow_cb, &bench);
+  g_timeout_add_seconds(duration_option, (GSourceFunc) stop_cb, &bench);
+  g_main_loop_run(bench.loop);
+
+  if (reader != NULL) {
+    g_atomic_int_set(&bench.reading, FALSE);
+    g_thread_join(reader);
+  }
+
+  memory_governor_get_stats(bench.governor, &stats);
+  oom_kills = read_event(cgroup, "oom_kill") - oom_kills;
+  high_events = read_event(cgroup, "high") - high_events;
+
+  for (guint i = 0; i < G_N_ELEMENTS(bench.caches); i++)
+    g_print("%-12s peak %6" G_GUINT64_FORMAT " MB, now %6" G_GUINT64_FORMAT " MB\n", bench.caches[i].name,
+        bench.caches[i].peak >> 20, cache_size(&bench.caches[i]) >> 20);
+  g_print("cgroup       peak %6" G_GUINT64_FORMAT " MB of %" G_GUINT64_FORMAT " MB, worst level %s\n",
+      bench.peak >> 20, bench.limit >> 20,
+      bench.worst_level == MEMORY_LEVEL_CRITICAL ? "critical" :
+      bench.worst_level == MEMORY_LEVEL_MODERATE ? "moderate" : "normal");
+  g_print("governor     %" G_GUINT64_FORMAT " shrinks, %" G_GUINT64_FORMAT " MB freed\n", stats.shrinks,
+      stats.shrunk_bytes >> 20);
+  g_print("cgroup       %" G_GUINT64_FORMAT " throttling events, %" G_GUINT64_FORMAT " OOM kills\n", high_events,
+      oom_kills);
+  if (page_cache_option != NULL)
+    g_print("page cache   peak %6" G_GUINT64_FORMAT " MB, %" G_GUINT64_FORMAT " MB read\n",
+        bench.peak_page_cache >> 20, bench.read_bytes >> 20);
+
+  for (guint i = 0; i < G_N_ELEMENTS(bench.caches); i++)
+    cache_set_budget(0, &bench.caches[i]);
+  memory_governor_free(bench.governor);
+  g_main_loop_unref(bench.loop);
+
+  if (oom_kills > 0) {
+    g_print("FAIL: the OOM killer ran in the cgroup\n");
+    return 1;
+  }
+  if (page_cache_option != NULL) {
+    if (stats.shrinks > 0) {
+      g_print("FAIL: the caches were shrunk for page cache the kernel could reclaim\n");
+      return 1;
+    }
+    return 0;
+  }
+  if (stats.shrinks == 0 && !no_governor_option) {
+    g_print("FAIL: the caches were never shrunk, the limit is too high for the duration and rate\n");
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,236 @@
+/* Hot helpers of the Gtk+3 player.
+ *
+ * Times the helpers run on every position tick and on every timeline thumbnail, and
+ * counts the allocations they make, so a change to one of them can be checked. The
+ * player is built into the benchmark, its static helpers are called directly, and
+ * the widgets are those of its UI, which is never shown.
+ */
+#include <gtk/gtk.h>
+#include <gst/gst.h>
+#include <gst/video/videooverlay.h>
+
+#include <malloc.h>
+
+/* Everything but main() of the player */
+#define main videoplayer_main
+#include "videoplayer.c"
+#undef main
+
+#define DEFAULT_MIN_TIME_MS 200
+#define SAMPLE_WIDTH        160
+#define SAMPLE_HEIGHT       90
+
+static gint min_time_option = DEFAULT_MIN_TIME_MS;
+static gchar *filter_option = NULL;
+
+static GOptionEntry bench_entries[] = {
+  { "min-time", 't', 0, G_OPTION_ARG_INT, &min_time_option, "Minimum time of a measure in ms (default: 200)", "MS" },
+  { "filter", 'f', 0, G_OPTION_ARG_STRING, &filter_option, "Only run the benchmarks whose name contains TEXT", "TEXT" },
+  { NULL }
+};
+
+/* Allocations made by the thread while counting. malloc() and friends are wrapped below,
+ * g_malloc() and g_slice (with G_SLICE=always-malloc) end up there */
+static __thread gboolean counting;
+static __thread guint64 allocations;
+
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t n, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+extern void *__libc_memalign(size_t alignment, size_t size);
+
+void *malloc(size_t size)
+{
+  if (counting)
+    allocations++;
+  return __libc_malloc(size);
+}
+
+void *calloc(size_t n, size_t size)
+{
+  if (counting)
+    allocations++;
+  return __libc_calloc(n, size);
+}
+
+void *realloc(void *ptr, size_t size)
+{
+  if (counting)
+    allocations++;
+  return __libc_realloc(ptr, size);
+}
+
+void *memalign(size_t alignment, size_t size)
+{
+  if (counting)
+    allocations++;
+  return __libc_memalign(alignment, size);
+}
+
+typedef void (*BenchFunc)(CustomData *data);
+
+static void run_loop(BenchFunc func, CustomData *data, guint64 iterations)
+{
+  for (guint64 i = 0; i < iterations; i++)
+    func(data);
+}
+
+/* This function runs func until a loop lasts the minimum time, then measures that loop */
+static void run(const gchar *name, BenchFunc func, CustomData *data)
+{
+  gint64 min_time = min_time_option * G_GINT64_CONSTANT(1000);
+  guint64 iterations = 1;
+
+  if (filter_option != NULL && strstr(name, filter_option) == NULL)
+    return;
+
+  /* This also warms the caches up */
+  for (;;) {
+    gint64 begin = g_get_monotonic_time();
+    run_loop(func, data, iterations);
+    if (g_get_monotonic_time() - begin >= min_time / 4)
+      break;
+    iterations *= 2;
+  }
+  iterations *= 4;
+
+  allocations = 0;
+  counting = TRUE;
+  gint64 begin = g_get_monotonic_time();
+  run_loop(func, data, iterations);
+  gint64 end = g_get_monotonic_time();
+  counting = FALSE;
+
+  g_print("%-24s %12" G_GUINT64_FORMAT " %12.1f %12.2f\n", name, iterations,
+      (end - begin) * 1000.0 / iterations, (gdouble) allocations / iterations);
+}
+
+/* The position moves on every tick, as when playing, so no text is set twice */
+static void tick(CustomData *data)
+{
+  data->position = (data->position + 500 * GST_MSECOND) % data->duration;
+}
+
+static void bench_time_to_string(CustomData *data)
+{
+  tick(data);
+  g_free(time_to_string(data->position));
+}
+
+static void bench_make_label_txt(CustomData *data)
+{
+  g_free(make_label_txt(WIDGET_TYPE_POSITION, "01:02:03.004"));
+}
+
+static GtkWidget *label;
+
+static void bench_set_label_txt(CustomData *data)
+{
+  tick(data);
+  set_label_txt(label, WIDGET_TYPE_POSITION, data);
+}
+
+static void bench_update_position(CustomData *data)
+{
+  tick(data);
+  update_widget(data, WIDGET_TYPE_POSITION);
+}
+
+static void bench_update_scale(CustomData *data)
+{
+  tick(data);
+  update_widget(data, WIDGET_TYPE_SCALE);
+}
+
+static void bench_update_tick(CustomData *data)
+{
+  tick(data);
+  update_widget(data, WIDGET_TYPE_POSITION);
+  update_widget(data, WIDGET_TYPE_SCALE);
+}
+
+static GstSample *sample;
+
+static void bench_sample_size(CustomData *data)
+{
+  gint width, height;
+
+  get_sample_size(sample, &width, &height);
+}
+
+static void bench_wrap_sample(CustomData *data)
+{
+  GstMapInfo map;
+  GdkPixbuf *pixbuf = wrap_sample(sample, &map);
+
+  g_object_unref(pixbuf);
+  gst_buffer_unmap(gst_sample_get_buffer(sample), &map);
+}
+
+/* This function makes a sample like those of the timeline sink */
+static GstSample *make_sample(void)
+{
+  GstCaps *caps = gst_caps_new_simple("video/x-raw", "format", G_TYPE_STRING, "RGB",
+      "width", G_TYPE_INT, SAMPLE_WIDTH, "height", G_TYPE_INT, SAMPLE_HEIGHT,
+      "pixel-aspect-ratio", GST_TYPE_FRACTION, 1, 1, NULL);
+  GstBuffer *buffer = gst_buffer_new_allocate(NULL, GST_ROUND_UP_4(SAMPLE_WIDTH * 3) * SAMPLE_HEIGHT, NULL);
+  GstSample *res = gst_sample_new(buffer, caps, NULL, NULL);
+
+  gst_buffer_unref(buffer);
+  gst_caps_unref(caps);
+  return res;
+}
+
+int main(int argc, char *argv[])
+{
+  GOptionContext *context;
+  GError *error = NULL;
+  CustomData data;
+
+  /* Slices are counted as the allocations they are in recent GLib */
+  g_setenv("G_SLICE", "always-malloc", TRUE);
+
+  context = g_option_context_new("- micro-benchmarks of the player helpers");
+  g_option_context_add_main_entries(context, bench_entries, NULL);
+  g_option_context_add_group(context, gst_init_get_option_group());
+  if (!g_option_context_parse(context, &argc, &argv, &error)) {
+    g_printerr("Could not parse options: %s\n", error->message);
+    g_clear_error(&error);
+    return -1;
+  }
+  g_option_context_free(context);
+
+  if (min_time_option <= 0) {
+    g_printerr("Invalid minimum time %d\n", min_time_option);
+    return -1;
+  }
+
+  memset(&data, 0, sizeof(data));
+  data.duration = 2 * 3600 * GST_SECOND;
+  sample = make_sample();
+
+  g_print("benchmark                  iterations        ns/op    allocs/op\n");
+  run("time_to_string", bench_time_to_string, &data);
+  run("make_label_txt", bench_make_label_txt, &data);
+  run("get_sample_size", bench_sample_size, &data);
+  run("wrap_sample", bench_wrap_sample, &data);
+
+  /* The widgets need a display, the UI is created but never shown */
+  if (!gtk_init_check(&argc, &argv)) {
+    g_printerr("No display, the widget benchmarks are skipped\n");
+  } else {
+    label = g_object_ref_sink(gtk_label_new(NULL));
+    create_ui(&data);
+
+    run("set_label_txt", bench_set_label_txt, &data);
+    run("update_widget/position", bench_update_position, &data);
+    run("update_widget/scale", bench_update_scale, &data);
+    run("update_widget/tick", bench_update_tick, &data);
+
+    gtk_widget_destroy(data.main_window);
+    g_object_unref(label);
+  }
+
+  gst_sample_unref(sample);
+  return 0;
+}
@@ -0,0 +1,149 @@
+/* CPU per tile of the mosaic mode as the grid grows.
+ *
+ * Plays the same clip in every tile of a 1x1 to 4x4 mosaic of the Gtk+3 player, in real time
+ * into a fakesink, once with the decoders at full resolution and once with the libav decoders
+ * downscaling to the tile, and reports the CPU time of the process per second of playback,
+ * in total and per tile, and the frames rendered per second. libavcodec only decodes some
+ * codecs at a lower resolution, MPEG-2, MPEG-4 part 2 and MJPEG: with an H.264 clip both
+ * runs are expected to cost the same.
+ */
+#include <sys/resource.h>
+
+#include <gst/gst.h>
+
+#include "mosaic.h"
+
+#define DEFAULT_SECONDS  10
+#define MAX_GRID         4
+#define PREROLL_TIMEOUT  (10 * GST_SECOND)
+
+static gint seconds_option = DEFAULT_SECONDS;
+
+static GOptionEntry option_entries[] = {
+  { "seconds", 's', 0, G_OPTION_ARG_INT, &seconds_option, "Seconds of playback of each run (default: 10)", "N" },
+  { NULL }
+};
+
+/* Tiles being replaced by mosaic_set_uris() */
+typedef struct _SetUris
+{
+  GMainLoop *loop;
+  gboolean ready;
+} SetUris;
+
+static void ready_cb(Mosaic *mosaic, gboolean ready, SetUris *set_uris)
+{
+  set_uris->ready = ready;
+  g_main_loop_quit(set_uris->loop);
+}
+
+static void handoff_cb(GstElement *sink, GstBuffer *buffer, GstPad *pad, gint *frames)
+{
+  g_atomic_int_inc(frames);
+}
+
+static gdouble cpu_seconds(const struct rusage *usage)
+{
+  return usage->ru_utime.tv_sec + usage->ru_utime.tv_usec / (gdouble) G_USEC_PER_SEC +
+      usage->ru_stime.tv_sec + usage->ru_stime.tv_usec / (gdouble) G_USEC_PER_SEC;
+}
+
+/* This function plays the clip in every tile of a grid x grid mosaic for seconds_option seconds */
+static gboolean run(const gchar *uri, guint grid, gboolean downscale)
+{
+  GstElement *sink = gst_element_factory_make("fakesink", NULL);
+  gint frames = 0;
+  SetUris set_uris = { NULL, FALSE };
+  gboolean res = TRUE;
+
+  g_object_set(sink, "sync", TRUE, "signal-handoffs", TRUE, NULL);
+  g_signal_connect(sink, "handoff", G_CALLBACK(handoff_cb), &frames);
+
+  Mosaic *mosaic = mosaic_new(grid, grid, sink);
+  if (mosaic == NULL)
+    return FALSE;
+  mosaic_set_decoder_downscale(mosaic, downscale);
+
+  gchar **uris = g_new0(gchar *, grid * grid + 1);
+  for (guint i = 0; i < grid * grid; i++)
+    uris[i] = g_strdup(uri);
+
+  set_uris.loop = g_main_loop_new(NULL, FALSE);
+  mosaic_set_uris(mosaic, uris, (MosaicReadyFunc) ready_cb, &set_uris);
+  g_strfreev(uris);
+  g_main_loop_run(set_uris.loop);
+  g_main_loop_unref(set_uris.loop);
+
+  GstElement *pipeline = mosaic_get_pipeline(mosaic);
+  GstBus *bus = gst_element_get_bus(pipeline);
+  GstMessage *msg = NULL;
+
+  if (set_uris.ready) {
+    gst_element_set_state(pipeline, GST_STATE_PLAYING);
+    msg = gst_bus_timed_pop_filtered(bus, PREROLL_TIMEOUT, GST_MESSAGE_ASYNC_DONE | GST_MESSAGE_ERROR);
+  }
+  if (msg == NULL || GST_MESSAGE_TYPE(msg) == GST_MESSAGE_ERROR) {
+    g_printerr("Could not play %s in a %ux%u mosaic\n", uri, grid, grid);
+    res = FALSE;
+  } else {
+    struct rusage before, after;
+
+    gst_message_unref(msg);
+    getrusage(RUSAGE_SELF, &before);
+    gint first_frame = g_atomic_int_get(&frames);
+    gint64 start = g_get_monotonic_time();
+
+    /* A clip shorter than the run ends it early */
+    msg = gst_bus_timed_pop_filtered(bus, seconds_option * GST_SECOND, GST_MESSAGE_EOS | GST_MESSAGE_ERROR);
+    if (msg != NULL && GST_MESSAGE_TYPE(msg) == GST_MESSAGE_ERROR) {
+      g_printerr("Playback failed in a %ux%u mosaic\n", grid, grid);
+      res = FALSE;
+    }
+
+    gdouble seconds = (g_get_monotonic_time() - start) / (gdouble) G_USEC_PER_SEC;
+    getrusage(RUSAGE_SELF, &after);
+    gdouble cpu = (cpu_seconds(&after) - cpu_seconds(&before)) / seconds * 100;
+
+    g_print("%2ux%-2u %-10s %8.1f %11.1f %8.1f\n", grid, grid, downscale ? "downscale" : "full",
+        cpu, cpu / (grid * grid), (g_atomic_int_get(&frames) - first_frame) / seconds);
+  }
+
+  if (msg != NULL)
+    gst_message_unref(msg);
+  gst_object_unref(bus);
+
+  /* The next run starts from an idle process */
+  gst_element_set_state(pipeline, GST_STATE_NULL);
+  mosaic_free(mosaic);
+  return res;
+}
+
+int main(int argc, char *argv[])
+{
+  GOptionContext *context = g_option_context_new("CLIP - mosaic CPU per tile benchmark");
+  GError *error = NULL;
+
+  g_option_context_add_main_entries(context, option_entries, NULL);
+  g_option_context_add_group(context, gst_init_get_option_group());
+  if (!g_option_context_parse(context, &argc, &argv, &error)) {
+    g_printerr("Could not parse options: %s\n", error->message);
+    g_clear_error(&error);
+    return -1;
+  }
+  g_option_context_free(context);
+
+  if (argc < 2 || seconds_option <= 0) {
+    g_printerr("Usage: %s [--seconds=N] CLIP\n", argv[0]);
+    return -1;
+  }
+
+  gchar *uri = gst_uri_is_valid(argv[1]) ? g_strdup(argv[1]) : gst_filename_to_uri(argv[1], NULL);
+  gboolean res = TRUE;
+
+  g_print("grid  decoders     cpu-%%  cpu-%%/tile  frames/s\n");
+  for (guint grid = 1; grid <= MAX_GRID && res; grid++)
+    res = run(uri, grid, FALSE) && run(uri, grid, TRUE);
+
+  g_free(uri);
+  return res ? 0 : -1;
+}
@@ -0,0 +1,291 @@
+/* Inter-process presentation skew of the network clock sync mode.
+ *
+ * Runs one master and several slave processes on localhost, each playing the same
+ * test pattern to a synchronised fakesink, and joins the frame logs of all the
+ * processes on the running time. All processes read the same CLOCK_MONOTONIC, so
+ * the spread of the render times of a frame is the true skew between them.
+ */
+#include <string.h>
+#include <sys/wait.h>
+
+#include <glib/gstdio.h>
+#include <gst/gst.h>
+
+#include "netsync.h"
+
+#define DEFAULT_PROCESSES  4
+#define DEFAULT_FRAMES     300
+#define DEFAULT_ADDRESS    "127.0.0.1:5637"
+
+#define PIPELINE_DESCRIPTION \
+  "videotestsrc num-buffers=%d ! video/x-raw,width=320,height=240,framerate=30/1 ! " \
+  "fakesink name=sink sync=true qos=true"
+
+static gchar *slave_option = NULL;
+static gchar *log_option = NULL;
+static gint processes_option = DEFAULT_PROCESSES;
+static gint frames_option = DEFAULT_FRAMES;
+
+static GOptionEntry option_entries[] = {
+  { "processes", 'p', 0, G_OPTION_ARG_INT, &processes_option,
+    "Number of slave processes (default: 4)", "N" },
+  { "frames", 'f', 0, G_OPTION_ARG_INT, &frames_option,
+    "Frames played by every process (default: 300)", "N" },
+  { "slave", 0, G_OPTION_FLAG_HIDDEN, G_OPTION_ARG_STRING, &slave_option,
+    "Run as a slave of ADDRESS:PORT", "ADDRESS:PORT" },
+  { "log", 0, G_OPTION_FLAG_HIDDEN, G_OPTION_ARG_FILENAME, &log_option,
+    "Frame log of the slave", "FILE" },
+  { NULL }
+};
+
+/* One process of the benchmark */
+typedef struct _Player
+{
+  GstElement *pipeline;
+  NetSync *sync;
+} Player;
+
+static void player_clear(Player *player)
+{
+  if (player->sync != NULL)
+    net_sync_free(player->sync);
+  if (player->pipeline != NULL)
+    gst_object_unref(player->pipeline);
+  memset(player, 0, sizeof(*player));
+}
+
+/* This function builds the test pattern pipeline and shares its clock, as the master or a slave */
+static gboolean player_setup(Player *player, gboolean master, const gchar *address, guint16 port,
+    const gchar *log_path)
+{
+  gchar *description = g_strdup_printf(PIPELINE_DESCRIPTION, frames_option);
+  GError *error = NULL;
+
+  memset(player, 0, sizeof(*player));
+  player->pipeline = gst_parse_launch(description, &error);
+  g_free(description);
+  if (player->pipeline == NULL) {
+    g_printerr("Could not construct pipeline: %s\n", error->message);
+    g_clear_error(&error);
+    return FALSE;
+  }
+
+  if (master)
+    player->sync = net_sync_new_master(player->pipeline, address, port, &error);
+  else
+    player->sync = net_sync_new_slave(player->pipeline, address, port, &error);
+
+  if (player->sync == NULL || !net_sync_set_log(player->sync, log_path, &error)) {
+    g_printerr("%s\n", error->message);
+    g_clear_error(&error);
+    player_clear(player);
+    return FALSE;
+  }
+
+  GstElement *sink = gst_bin_get_by_name(GST_BIN(player->pipeline), "sink");
+  net_sync_watch_sink(player->sync, sink);
+  gst_object_unref(sink);
+  return TRUE;
+}
+
+/* This function plays the test pattern until EOS in lockstep with the other processes */
+static gboolean player_run(Player *player)
+{
+  gboolean res = TRUE;
+
+  gst_element_set_state(player->pipeline, GST_STATE_PLAYING);
+
+  GstBus *bus = gst_element_get_bus(player->pipeline);
+  GstMessage *msg = gst_bus_timed_pop_filtered(bus, GST_CLOCK_TIME_NONE, GST_MESSAGE_EOS | GST_MESSAGE_ERROR);
+  if (GST_MESSAGE_TYPE(msg) == GST_MESSAGE_ERROR) {
+    g_printerr("Pipeline failed\n");
+    res = FALSE;
+  }
+  gst_message_unref(msg);
+  gst_object_unref(bus);
+
+  gst_element_set_state(player->pipeline, GST_STATE_NULL);
+  return res;
+}
+
+/* This function reads a frame log into a table from running time to render time */
+static GHashTable *read_log(const gchar *path)
+{
+  GHashTable *frames = g_hash_table_new_full(g_int64_hash, g_int64_equal, g_free, g_free);
+  gchar *contents = NULL;
+
+  if (!g_file_get_contents(path, &contents, NULL, NULL))
+    return frames;
+
+  gchar **lines = g_strsplit(contents, "\n", -1);
+  for (gint i = 0; lines[i] != NULL; i++) {
+    gchar *end = NULL;
+    gint64 running_time = g_ascii_strtoll(lines[i], &end, 10);
+
+    if (end == lines[i])
+      continue;
+
+    gint64 *key = g_new(gint64, 1);
+    gint64 *render_time = g_new(gint64, 1);
+    *key = running_time;
+    *render_time = g_ascii_strtoll(end, NULL, 10);
+    g_hash_table_replace(frames, key, render_time);
+  }
+
+  g_strfreev(lines);
+  g_free(contents);
+  return frames;
+}
+
+static gint compare_int64(gconstpointer a, gconstpointer b)
+{
+  gint64 x = *(const gint64 *) a, y = *(const gint64 *) b;
+
+  return x < y ? -1 : x > y;
+}
+
+/* This function prints the skew of every frame rendered by all the processes */
+static void report(gchar **log_paths, guint n_logs)
+{
+  GHashTable **logs = g_new(GHashTable *, n_logs);
+  GArray *skews = g_array_new(FALSE, FALSE, sizeof(gint64));
+  GHashTableIter iter;
+  gpointer key, value;
+
+  for (guint i = 0; i < n_logs; i++)
+    logs[i] = read_log(log_paths[i]);
+
+  /* The first log is the master's */
+  g_hash_table_iter_init(&iter, logs[0]);
+  while (g_hash_table_iter_next(&iter, &key, &value)) {
+    gint64 earliest = *(gint64 *) value, latest = earliest;
+    gboolean everywhere = TRUE;
+
+    for (guint i = 1; i < n_logs && everywhere; i++) {
+      gint64 *render_time = g_hash_table_lookup(logs[i], key);
+
+      everywhere = render_time != NULL;
+      if (everywhere) {
+        earliest = MIN(earliest, *render_time);
+        latest = MAX(latest, *render_time);
+      }
+    }
+
+    if (everywhere) {
+      gint64 skew = latest - earliest;
+      g_array_append_val(skews, skew);
+    }
+  }
+
+  if (skews->len == 0) {
+    g_print("No frame was rendered by every process\n");
+  } else {
+    g_array_sort(skews, compare_int64);
+    g_print("processes  frames   p50-skew-ms  p99-skew-ms  max-skew-ms\n");
+    g_print("%9u  %6u  %12.3f %12.3f %12.3f\n", n_logs, skews->len,
+        g_array_index(skews, gint64, skews->len / 2) / (gdouble) GST_MSECOND,
+        g_array_index(skews, gint64, skews->len * 99 / 100) / (gdouble) GST_MSECOND,
+        g_array_index(skews, gint64, skews->len - 1) / (gdouble) GST_MSECOND);
+  }
+
+  for (guint i = 0; i < n_logs; i++)
+    g_hash_table_destroy(logs[i]);
+  g_free(logs);
+  g_array_free(skews, TRUE);
+}
+
+int main(int argc, char *argv[])
+{
+  GOptionContext *context = g_option_context_new("- network clock sync skew benchmark");
+  GError *error = NULL;
+  gchar *address = NULL;
+  guint16 port;
+
+  g_option_context_add_main_entries(context, option_entries, NULL);
+  g_option_context_add_group(context, gst_init_get_option_group());
+  if (!g_option_context_parse(context, &argc, &argv, &error)) {
+    g_printerr("Could not parse options: %s\n", error->message);
+    g_clear_error(&error);
+    return -1;
+  }
+  g_option_context_free(context);
+
+  if (processes_option <= 0 || frames_option <= 0) {
+    g_printerr("The number of processes and frames must be positive\n");
+    return -1;
+  }
+
+  if (slave_option != NULL) {
+    Player player;
+
+    if (!net_sync_parse_address(slave_option, &address, &port) || log_option == NULL)
+      return -1;
+    gboolean res = player_setup(&player, FALSE, address, port, log_option) && player_run(&player);
+    player_clear(&player);
+    g_free(address);
+    return res ? 0 : -1;
+  }
+
+  net_sync_parse_address(DEFAULT_ADDRESS, &address, &port);
+  gchar *dir = g_dir_make_tmp("bench-netsync-XXXXXX", &error);
+  if (dir == NULL) {
+    g_printerr("Could not create the log directory: %s\n", error->message);
+    g_clear_error(&error);
+    return -1;
+  }
+
+  guint n_logs = processes_option + 1;
+  gchar **log_paths = g_new0(gchar *, n_logs + 1);
+  GPid *pids = g_new0(GPid, processes_option);
+  for (guint i = 0; i < n_logs; i++)
+    log_paths[i] = g_strdup_printf("%s/process-%u.log", dir, i);
+
+  /* The master publishes its clock first, and plays a few seconds later, once the slaves joined */
+  Player master;
+  gboolean res = player_setup(&master, TRUE, address, port, log_paths[0]);
+  gchar *frames = g_strdup_printf("--frames=%d", frames_option);
+
+  for (gint i = 0; i < processes_option && res; i++) {
+    gchar *slave = g_strdup_printf("--slave=%s", DEFAULT_ADDRESS);
+    gchar *log = g_strdup_printf("--log=%s", log_paths[i + 1]);
+    gchar *child_argv[] = { argv[0], slave, log, frames, NULL };
+
+    res = g_spawn_async(NULL, child_argv, NULL, G_SPAWN_DO_NOT_REAP_CHILD | G_SPAWN_SEARCH_PATH,
+        NULL, NULL, &pids[i], &error);
+    if (!res) {
+      g_printerr("Could not start a slave: %s\n", error->message);
+      g_clear_error(&error);
+    }
+    g_free(log);
+    g_free(slave);
+  }
+
+  if (res)
+    res = player_run(&master);
+  player_clear(&master);
+
+  for (gint i = 0; i < processes_option; i++) {
+    gint status;
+
+    if (pids[i] <= 0)
+      continue;
+    waitpid(pids[i], &status, 0);
+    g_spawn_close_pid(pids[i]);
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+      res = FALSE;
+  }
+
+  if (res)
+    report(log_paths, n_logs);
+
+  for (guint i = 0; i < n_logs; i++)
+    g_remove(log_paths[i]);
+  g_rmdir(dir);
+
+  g_strfreev(log_paths);
+  g_free(pids);
+  g_free(frames);
+  g_free(dir);
+  g_free(address);
+  return res ? 0 : -1;
+}
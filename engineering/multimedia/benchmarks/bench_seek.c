@@ -0,0 +1,288 @@
+/* Seek latency across containers and GOP lengths.
+ *
+ * Encodes the same content in MP4, MOV, Matroska, WebM and MPEG-TS with a keyframe
+ * every 1, 12, 60 and 250 frames. For each clip it times flushing KEY_UNIT seeks, as the
+ * slider of the players does, flushing ACCURATE seeks, and thumbnail extraction as the
+ * timeline does, at the same positions, and prints the p50/p95/p99 of each as a matrix.
+ */
+#include <gst/gst.h>
+#include <glib/gstdio.h>
+
+#include <stdlib.h>
+
+#define DEFAULT_SEEKS       50
+#define DEFAULT_DURATION_S  60
+#define FRAMERATE           25
+#define THUMB_WIDTH         160
+#define SEEK_TIMEOUT        (10 * GST_SECOND)
+#define POSITIONS_SEED      1234
+
+static gint seeks_option = DEFAULT_SEEKS;
+static gint duration_option = DEFAULT_DURATION_S;
+static gchar *clips_dir_option = NULL;
+
+static GOptionEntry option_entries[] = {
+  { "seeks", 'n', 0, G_OPTION_ARG_INT, &seeks_option, "Seeks per clip and kind (default: 50)", "N" },
+  { "duration", 'd', 0, G_OPTION_ARG_INT, &duration_option, "Duration of the clips in seconds (default: 60)", "SECONDS" },
+  { "clips-dir", 'c', 0, G_OPTION_ARG_FILENAME, &clips_dir_option,
+    "Keep the clips in DIR and reuse those already there (default: a temporary directory)", "DIR" },
+  { NULL }
+};
+
+/* Containers of the matrix. WebM only holds VP8/VP9, the others get H.264 */
+typedef struct _Container
+{
+  const gchar *name;
+  const gchar *extension;
+  const gchar *muxer;
+  gboolean vp8;
+} Container;
+
+static const Container containers[] = {
+  { "mp4", "mp4", "mp4mux", FALSE },
+  { "mov", "mov", "qtmux", FALSE },
+  { "mkv", "mkv", "matroskamux", FALSE },
+  { "webm", "webm", "webmmux", TRUE },
+  { "ts", "ts", "mpegtsmux", FALSE },
+};
+
+static const gint gop_lengths[] = { 1, 12, 60, 250 };
+
+/* Percentiles of one kind of seek on one clip, in milliseconds */
+typedef struct _Latency
+{
+  gdouble p50;
+  gdouble p95;
+  gdouble p99;
+} Latency;
+
+/* This function encodes the content with a keyframe every gop frames */
+static gboolean make_clip(const Container *container, gint gop, const gchar *path)
+{
+  GError *error = NULL;
+  gchar *encoder = container->vp8 ?
+      g_strdup_printf("vp8enc deadline=1 keyframe-max-dist=%d", gop) :
+      g_strdup_printf("x264enc speed-preset=veryfast bframes=0 key-int-max=%d ! h264parse", gop);
+  gchar *description = g_strdup_printf("videotestsrc pattern=ball num-buffers=%d ! "
+      "video/x-raw,format=I420,width=640,height=360,framerate=%d/1 ! %s ! %s ! filesink location=\"%s\"",
+      duration_option * FRAMERATE, FRAMERATE, encoder, container->muxer, path);
+  GstElement *pipeline = gst_parse_launch(description, &error);
+  gboolean res = FALSE;
+
+  g_free(description);
+  g_free(encoder);
+  if (pipeline == NULL) {
+    g_printerr("Could not encode %s: %s\n", path, error->message);
+    g_clear_error(&error);
+    return FALSE;
+  }
+
+  gst_element_set_state(pipeline, GST_STATE_PLAYING);
+  GstBus *bus = gst_element_get_bus(pipeline);
+  GstMessage *msg = gst_bus_timed_pop_filtered(bus, GST_CLOCK_TIME_NONE, GST_MESSAGE_EOS | GST_MESSAGE_ERROR);
+  if (GST_MESSAGE_TYPE(msg) == GST_MESSAGE_ERROR) {
+    gst_message_parse_error(msg, &error, NULL);
+    g_printerr("Could not encode %s: %s\n", path, error->message);
+    g_clear_error(&error);
+  } else {
+    res = TRUE;
+  }
+  gst_message_unref(msg);
+  gst_object_unref(bus);
+
+  gst_element_set_state(pipeline, GST_STATE_NULL);
+  gst_object_unref(pipeline);
+  return res;
+}
+
+static gint compare_doubles(gconstpointer a, gconstpointer b)
+{
+  gdouble x = *(const gdouble *) a, y = *(const gdouble *) b;
+
+  return x < y ? -1 : x > y;
+}
+
+/* This function sorts the latencies and gives their percentiles, by nearest rank */
+static void get_latency(gdouble *ms, gint n, Latency *latency)
+{
+  qsort(ms, n, sizeof(gdouble), compare_doubles);
+  latency->p50 = ms[(n - 1) * 50 / 100];
+  latency->p95 = ms[(n - 1) * 95 / 100];
+  latency->p99 = ms[(n - 1) * 99 / 100];
+}
+
+/* This function waits for the pipeline to preroll after a flushing seek, or the
+ * initial state change. Returns FALSE on error or timeout */
+static gboolean wait_preroll(GstElement *pipeline)
+{
+  GstBus *bus = gst_element_get_bus(pipeline);
+  GstMessage *msg = gst_bus_timed_pop_filtered(bus, SEEK_TIMEOUT, GST_MESSAGE_ASYNC_DONE | GST_MESSAGE_ERROR);
+  gboolean res = msg != NULL && GST_MESSAGE_TYPE(msg) == GST_MESSAGE_ASYNC_DONE;
+
+  if (msg != NULL)
+    gst_message_unref(msg);
+  gst_object_unref(bus);
+  return res;
+}
+
+/* This function times seeks of playbin, paused, to positions: the time until the new
+ * frame is prerolled in the sink */
+static gboolean measure_seeks(const gchar *uri, GstSeekFlags flags, const GstClockTime *positions,
+    Latency *latency)
+{
+  GstElement *playbin = gst_element_factory_make("playbin", NULL);
+  GstElement *sink = gst_element_factory_make("fakesink", NULL);
+  gdouble *ms = g_new(gdouble, seeks_option);
+  gboolean res = TRUE;
+
+  g_object_set(playbin, "uri", uri, "video-sink", sink, NULL);
+  gst_element_set_state(playbin, GST_STATE_PAUSED);
+  res = wait_preroll(playbin);
+
+  for (gint i = 0; i < seeks_option && res; i++) {
+    gint64 begin = g_get_monotonic_time();
+
+    res = gst_element_seek_simple(playbin, GST_FORMAT_TIME, GST_SEEK_FLAG_FLUSH | flags, positions[i]) &&
+        wait_preroll(playbin);
+    ms[i] = (g_get_monotonic_time() - begin) / 1000.0;
+  }
+
+  if (res)
+    get_latency(ms, seeks_option, latency);
+
+  g_free(ms);
+  gst_element_set_state(playbin, GST_STATE_NULL);
+  gst_object_unref(playbin);
+  return res;
+}
+
+/* This function times thumbnails taken like the timeline of the Gtk+3 player: a keyframe
+ * seek of a paused pipeline, and the pull of the scaled RGB frame */
+static gboolean measure_thumbnails(const gchar *uri, const GstClockTime *positions, Latency *latency)
+{
+  GError *error = NULL;
+  gchar *description = g_strdup_printf("uridecodebin uri=\"%s\" ! videoconvert ! videoscale ! "
+      "appsink name=sink sync=false caps=\"video/x-raw,format=RGB,width=%d,pixel-aspect-ratio=1/1\"",
+      uri, THUMB_WIDTH);
+  GstElement *pipeline = gst_parse_launch(description, &error);
+  gdouble *ms = g_new(gdouble, seeks_option);
+  gboolean res = TRUE;
+
+  g_free(description);
+  if (pipeline == NULL) {
+    g_printerr("Could not make the thumbnail pipeline: %s\n", error->message);
+    g_clear_error(&error);
+    g_free(ms);
+    return FALSE;
+  }
+
+  GstElement *sink = gst_bin_get_by_name(GST_BIN(pipeline), "sink");
+  gst_element_set_state(pipeline, GST_STATE_PAUSED);
+  res = gst_element_get_state(pipeline, NULL, NULL, SEEK_TIMEOUT) == GST_STATE_CHANGE_SUCCESS;
+
+  for (gint i = 0; i < seeks_option && res; i++) {
+    GstSample *sample = NULL;
+    gint64 begin = g_get_monotonic_time();
+
+    gst_element_seek_simple(pipeline, GST_FORMAT_TIME, GST_SEEK_FLAG_KEY_UNIT | GST_SEEK_FLAG_FLUSH, positions[i]);
+    g_signal_emit_by_name(sink, "pull-preroll", &sample, NULL);
+    ms[i] = (g_get_monotonic_time() - begin) / 1000.0;
+
+    res = sample != NULL;
+    if (sample != NULL)
+      gst_sample_unref(sample);
+  }
+
+  if (res)
+    get_latency(ms, seeks_option, latency);
+
+  g_free(ms);
+  gst_object_unref(sink);
+  gst_element_set_state(pipeline, GST_STATE_NULL);
+  gst_object_unref(pipeline);
+  return res;
+}
+
+static void print_latency(const Latency *latency, gboolean ok)
+{
+  if (ok)
+    g_print(" %7.1f %7.1f %7.1f", latency->p50, latency->p95, latency->p99);
+  else
+    g_print(" %7s %7s %7s", "-", "-", "-");
+}
+
+int main(int argc, char *argv[])
+{
+  GOptionContext *context = g_option_context_new("- seek latency across containers and GOP lengths");
+  GError *error = NULL;
+
+  g_option_context_add_main_entries(context, option_entries, NULL);
+  g_option_context_add_group(context, gst_init_get_option_group());
+  if (!g_option_context_parse(context, &argc, &argv, &error)) {
+    g_printerr("Could not parse options: %s\n", error->message);
+    g_clear_error(&error);
+    return -1;
+  }
+  g_option_context_free(context);
+
+  if (seeks_option <= 0 || duration_option <= 0) {
+    g_printerr("Usage: %s [--seeks=N] [--duration=SECONDS] [--clips-dir=DIR]\n", argv[0]);
+    return -1;
+  }
+
+  gboolean keep_clips = clips_dir_option != NULL;
+  gchar *clips_dir = keep_clips ? g_strdup(clips_dir_option) : g_dir_make_tmp("bench_seek-XXXXXX", &error);
+  if (clips_dir == NULL) {
+    g_printerr("Could not make the clips directory: %s\n", error->message);
+    g_clear_error(&error);
+    return -1;
+  }
+  g_mkdir_with_parents(clips_dir, 0755);
+
+  /* The same positions for every clip and kind of seek, spread over the whole clip */
+  GstClockTime *positions = g_new(GstClockTime, seeks_option);
+  GRand *rand = g_rand_new_with_seed(POSITIONS_SEED);
+  for (gint i = 0; i < seeks_option; i++)
+    positions[i] = g_rand_double(rand) * (duration_option - 1) * GST_SECOND;
+  g_rand_free(rand);
+
+  g_print("%-10s %5s | %-23s | %-23s | %-23s\n", "", "", "key-unit seek (ms)", "accurate seek (ms)",
+      "thumbnail (ms)");
+  g_print("%-10s %5s |     p50     p95     p99 |     p50     p95     p99 |     p50     p95     p99\n",
+      "container", "gop");
+
+  for (gsize c = 0; c < G_N_ELEMENTS(containers); c++) {
+    for (gsize g = 0; g < G_N_ELEMENTS(gop_lengths); g++) {
+      gchar *file = g_strdup_printf("gop%d-%ds.%s", gop_lengths[g], duration_option, containers[c].extension);
+      gchar *path = g_build_filename(clips_dir, file, NULL);
+      Latency key_unit, accurate, thumbnail;
+
+      g_print("%-10s %5d |", containers[c].name, gop_lengths[g]);
+      if ((g_file_test(path, G_FILE_TEST_IS_REGULAR) && keep_clips) ||
+          make_clip(&containers[c], gop_lengths[g], path)) {
+        gchar *uri = gst_filename_to_uri(path, NULL);
+
+        print_latency(&key_unit, measure_seeks(uri, GST_SEEK_FLAG_KEY_UNIT, positions, &key_unit));
+        g_print(" |");
+        print_latency(&accurate, measure_seeks(uri, GST_SEEK_FLAG_ACCURATE, positions, &accurate));
+        g_print(" |");
+        print_latency(&thumbnail, measure_thumbnails(uri, positions, &thumbnail));
+        g_print("\n");
+        g_free(uri);
+      } else {
+        g_print(" could not encode\n");
+      }
+
+      if (!keep_clips)
+        g_unlink(path);
+      g_free(path);
+      g_free(file);
+    }
+  }
+
+  if (!keep_clips)
+    g_rmdir(clips_dir);
+  g_free(clips_dir);
+  g_free(positions);
+  return 0;
+}
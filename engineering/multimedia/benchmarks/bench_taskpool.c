@@ -0,0 +1,249 @@
+/* Scaling benchmark of the shared task pool.
+ *
+ * Runs 1 to 32 concurrent pipelines, each with three streaming threads, once on the
+ * default GStreamer task pool and once on the shared task pool of the players, sized like
+ * theirs, and reports throughput, context switches and the peak number of threads of the
+ * process. With many pipelines the streaming threads go past the thread limit of the pool,
+ * which they must, every pipeline has to reach EOS. Then pushes more long jobs than a small
+ * pool has threads, and checks they all run within the limit while a dedicated job, like a
+ * stall recovery, still starts at once.
+ */
+#include <string.h>
+#include <sys/resource.h>
+
+#include <gst/gst.h>
+
+#include "sharedtaskpool.h"
+#include "workpool.h"
+
+#define FRAMES_PER_PIPELINE  300
+#define MAX_PIPELINES        32
+#define THREAD_SAMPLE_US     (2 * G_TIME_SPAN_MILLISECOND)
+#define LIMIT_THREADS        4    /* Thread limit of the pool of the limit run, one worker included */
+#define LIMIT_JOBS           32   /* Long jobs pushed at once on it */
+#define LIMIT_JOB_US         (20 * G_TIME_SPAN_MILLISECOND)
+#define DEDICATED_START_US   (LIMIT_JOB_US / 2) /* A dedicated job starting later waited for a long job */
+
+#define PIPELINE_DESCRIPTION \
+  "videotestsrc num-buffers=%d ! video/x-raw,width=320,height=240 ! queue ! " \
+  "videoconvert ! video/x-raw,format=I420 ! queue ! fakesink sync=false"
+
+static const guint pipeline_counts[] = { 1, 2, 4, 8, 16, 32 };
+
+/* Measurements of one run */
+typedef struct _BenchResult
+{
+  gdouble seconds;       /* Wall time until every pipeline reached EOS */
+  gdouble frames_per_s;  /* Frames processed by all the pipelines per second */
+  glong voluntary;       /* Voluntary context switches of the process */
+  glong involuntary;     /* Involuntary context switches of the process */
+  guint peak_threads;    /* Highest thread count of the process */
+} BenchResult;
+
+/* Thread count sampler, running while the pipelines play */
+static struct
+{
+  gint running;
+  gint peak;
+} sampler;
+
+/* This function reads the thread count of the process from /proc/self/status */
+static guint read_thread_count(void)
+{
+  gchar *contents = NULL;
+  guint threads = 0;
+
+  if (!g_file_get_contents("/proc/self/status", &contents, NULL, NULL))
+    return 0;
+
+  const gchar *line = strstr(contents, "\nThreads:");
+  if (line != NULL)
+    threads = (guint) g_ascii_strtoull(line + strlen("\nThreads:"), NULL, 10);
+
+  g_free(contents);
+  return threads;
+}
+
+static gpointer sampler_thread_func(gpointer user_data)
+{
+  while (g_atomic_int_get(&sampler.running)) {
+    gint threads = (gint) read_thread_count();
+    if (threads > g_atomic_int_get(&sampler.peak))
+      g_atomic_int_set(&sampler.peak, threads);
+    g_usleep(THREAD_SAMPLE_US);
+  }
+
+  return NULL;
+}
+
+/* This function plays n_pipelines pipelines at once until EOS, on the given task pool or the default one */
+static gboolean run(guint n_pipelines, GstTaskPool *pool, BenchResult *result)
+{
+  GstElement *pipelines[MAX_PIPELINES];
+  gchar *description = g_strdup_printf(PIPELINE_DESCRIPTION, FRAMES_PER_PIPELINE);
+  struct rusage before, after;
+  gboolean res = TRUE;
+
+  for (guint i = 0; i < n_pipelines; i++) {
+    GError *error = NULL;
+
+    pipelines[i] = gst_parse_launch(description, &error);
+    if (pipelines[i] == NULL) {
+      g_printerr("Could not construct pipeline: %s\n", error->message);
+      g_clear_error(&error);
+      g_free(description);
+      return FALSE;
+    }
+    if (pool != NULL)
+      shared_task_pool_install(pipelines[i], pool);
+  }
+  g_free(description);
+
+  sampler.running = TRUE;
+  sampler.peak = 0;
+  GThread *sampler_thread = g_thread_new("bench-sampler", sampler_thread_func, NULL);
+
+  getrusage(RUSAGE_SELF, &before);
+  gint64 start = g_get_monotonic_time();
+
+  for (guint i = 0; i < n_pipelines; i++)
+    gst_element_set_state(pipelines[i], GST_STATE_PLAYING);
+
+  for (guint i = 0; i < n_pipelines; i++) {
+    GstBus *bus = gst_element_get_bus(pipelines[i]);
+    GstMessage *msg = gst_bus_timed_pop_filtered(bus, GST_CLOCK_TIME_NONE,
+        GST_MESSAGE_EOS | GST_MESSAGE_ERROR);
+
+    if (GST_MESSAGE_TYPE(msg) == GST_MESSAGE_ERROR) {
+      g_printerr("Pipeline %u failed\n", i);
+      res = FALSE;
+    }
+    gst_message_unref(msg);
+    gst_object_unref(bus);
+  }
+
+  gint64 end = g_get_monotonic_time();
+  getrusage(RUSAGE_SELF, &after);
+
+  g_atomic_int_set(&sampler.running, FALSE);
+  g_thread_join(sampler_thread);
+
+  for (guint i = 0; i < n_pipelines; i++) {
+    gst_element_set_state(pipelines[i], GST_STATE_NULL);
+    gst_object_unref(pipelines[i]);
+  }
+
+  result->seconds = (end - start) / (gdouble) G_USEC_PER_SEC;
+  result->frames_per_s = n_pipelines * FRAMES_PER_PIPELINE / result->seconds;
+  result->voluntary = after.ru_nvcsw - before.ru_nvcsw;
+  result->involuntary = after.ru_nivcsw - before.ru_nivcsw;
+  result->peak_threads = g_atomic_int_get(&sampler.peak);
+
+  return res;
+}
+
+static void limit_job_func(gint *completed)
+{
+  g_usleep(LIMIT_JOB_US);
+  g_atomic_int_inc(completed);
+}
+
+static void dedicated_job_func(gint64 *start_time)
+{
+  *start_time = g_get_monotonic_time();
+}
+
+/* This function pushes LIMIT_JOBS long jobs at once on a pool of LIMIT_THREADS threads, like a
+ * burst of exports, and checks they all run within the limit. A dedicated job pushed behind them
+ * gets a thread of its own */
+static gboolean run_limit(void)
+{
+  WorkPool *work_pool = work_pool_new(1, LIMIT_THREADS);
+  WorkJob *handles[LIMIT_JOBS];
+  WorkPoolStats stats;
+  gint completed = 0;
+  gint64 dedicated_start = 0;
+  gboolean res = TRUE;
+  GError *error = NULL;
+
+  gint64 start = g_get_monotonic_time();
+  for (guint i = 0; i < LIMIT_JOBS; i++) {
+    handles[i] = work_pool_push(work_pool, (WorkFunc) limit_job_func, &completed, WORK_JOB_LONG, &error);
+    if (handles[i] == NULL) {
+      g_printerr("Could not push job %u: %s\n", i, error->message);
+      g_clear_error(&error);
+      res = FALSE;
+    }
+  }
+
+  gint64 dedicated_push = g_get_monotonic_time();
+  WorkJob *dedicated = work_pool_push(work_pool, (WorkFunc) dedicated_job_func, &dedicated_start,
+      WORK_JOB_DEDICATED, &error);
+  if (dedicated == NULL) {
+    g_printerr("Could not push the dedicated job: %s\n", error->message);
+    g_clear_error(&error);
+    res = FALSE;
+  } else {
+    work_job_join(dedicated);
+  }
+
+  for (guint i = 0; i < LIMIT_JOBS; i++)
+    if (handles[i] != NULL)
+      work_job_join(handles[i]);
+  gint64 end = g_get_monotonic_time();
+  work_pool_get_stats(work_pool, &stats);
+
+  g_print("limit: %d of %d long jobs done in %.3f s on %u threads at most, %u waited at peak, "
+      "dedicated job started after %.3f ms\n",
+      g_atomic_int_get(&completed), LIMIT_JOBS, (end - start) / (gdouble) G_USEC_PER_SEC,
+      stats.peak_threads, stats.peak_waiting, (dedicated_start - dedicated_push) / 1000.0);
+
+  /* The dedicated job is the only one allowed past the limit */
+  if (g_atomic_int_get(&completed) != LIMIT_JOBS || stats.peak_threads > LIMIT_THREADS + 1) {
+    g_printerr("The pool went past its limit or lost jobs\n");
+    res = FALSE;
+  }
+  if (dedicated_start == 0 || dedicated_start - dedicated_push > DEDICATED_START_US) {
+    g_printerr("The dedicated job waited for the long jobs\n");
+    res = FALSE;
+  }
+
+  work_pool_free(work_pool);
+  return res;
+}
+
+static void print_result(guint n_pipelines, const gchar *pool_name, const BenchResult *result)
+{
+  g_print("%9u  %-7s %9.3f %11.0f %14ld %16ld %13u\n", n_pipelines, pool_name,
+      result->seconds, result->frames_per_s, result->voluntary, result->involuntary,
+      result->peak_threads);
+}
+
+int main(int argc, char *argv[])
+{
+  gst_init(&argc, &argv);
+
+  /* The pools of the players, so 32 pipelines take their streaming threads past its limit */
+  WorkPool *work_pool = work_pool_get_default();
+  GstTaskPool *shared_pool = shared_task_pool_get_default();
+
+  g_print("pipelines  pool      seconds    frames/s  ctx-voluntary  ctx-involuntary  peak-threads\n");
+  for (guint i = 0; i < G_N_ELEMENTS(pipeline_counts); i++) {
+    BenchResult result;
+
+    if (!run(pipeline_counts[i], NULL, &result))
+      return -1;
+    print_result(pipeline_counts[i], "default", &result);
+
+    if (!run(pipeline_counts[i], shared_pool, &result))
+      return -1;
+    print_result(pipeline_counts[i], "shared", &result);
+  }
+
+  WorkPoolStats stats;
+  work_pool_get_stats(work_pool, &stats);
+  g_print("shared pool: %u threads alive, %u at peak, %u streaming threads at peak\n",
+      stats.threads, stats.peak_threads, stats.peak_dedicated);
+
+  return run_limit() ? 0 : -1;
+}
@@ -0,0 +1,361 @@
+#include "clipexport.h"
+#include "workpool.h"
+
+#include <glib/gstdio.h>
+
+#define READY_MESSAGE "clip-export-ready"
+#define MIN_CHUNK     (2 * GST_SECOND)  /* Shorter chunks spend more time decoding up to their start than encoding */
+/* The chunks are joined without decoding them, so their streams must have the same codec_data:
+ * every encoder gets the same explicit profile and settings */
+#define CHUNK_CAPS    "video/x-h264,profile=high,stream-format=avc,alignment=au"
+#define CHUNK_PRESET  "medium"
+#define CHUNK_KEY_INT 250
+#define CHUNK_BFRAMES 0
+
+/* One chunk of a parallel export, encoded by its own pipeline */
+typedef struct _ChunkJob
+{
+  const gchar *uri;
+  GstClockTime start;
+  GstClockTime stop;
+  gchar *path;
+  GstCaps *caps;        /* Caps of the encoded stream */
+  gboolean ok;
+  GError *error;
+} ChunkJob;
+
+/* This function drops the buffers going out of a demuxer or decoder until the seek to the
+ * range flushes it, so nothing before the range reaches the muxer */
+static GstPadProbeReturn gate_probe_cb(GstPad *pad, GstPadProbeInfo *info, gpointer user_data)
+{
+  if (info->type & GST_PAD_PROBE_TYPE_EVENT_FLUSH)
+    return GST_EVENT_TYPE(GST_PAD_PROBE_INFO_EVENT(info)) == GST_EVENT_FLUSH_STOP ? GST_PAD_PROBE_REMOVE : GST_PAD_PROBE_OK;
+
+  return GST_PAD_PROBE_DROP;
+}
+
+static void gate_pad(GstPad *pad)
+{
+  gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_BUFFER | GST_PAD_PROBE_TYPE_BUFFER_LIST | GST_PAD_PROBE_TYPE_EVENT_FLUSH,
+      gate_probe_cb, NULL, NULL);
+}
+
+/* This function tells run_range() that all the streams are linked and gated, so it can seek.
+ * It is called from a streaming thread, which cannot do a flushing seek itself */
+static void no_more_pads_cb(GstElement *element, gpointer user_data)
+{
+  gst_element_post_message(element,
+      gst_message_new_application(GST_OBJECT(element), gst_structure_new_empty(READY_MESSAGE)));
+}
+
+/* This function runs the pipeline over [start, stop) of the clip until EOS. With start
+ * GST_CLOCK_TIME_NONE, the pipeline is run from the beginning without seeking */
+static gboolean run_range(GstElement *pipeline, GstClockTime start, GstClockTime stop, GstSeekFlags flags, GError **error)
+{
+  GstBus *bus = gst_element_get_bus(pipeline);
+  gboolean res = FALSE, done = FALSE;
+
+  if (gst_element_set_state(pipeline, start == GST_CLOCK_TIME_NONE ? GST_STATE_PLAYING : GST_STATE_PAUSED) ==
+      GST_STATE_CHANGE_FAILURE) {
+    g_set_error(error, GST_CORE_ERROR, GST_CORE_ERROR_STATE_CHANGE, "Could not start the export pipeline");
+    done = TRUE;
+  }
+
+  while (!done) {
+    GstMessage *msg = gst_bus_timed_pop_filtered(bus, GST_CLOCK_TIME_NONE,
+        GST_MESSAGE_APPLICATION | GST_MESSAGE_EOS | GST_MESSAGE_ERROR);
+
+    switch (GST_MESSAGE_TYPE(msg)) {
+    case GST_MESSAGE_APPLICATION:
+      if (!gst_message_has_name(msg, READY_MESSAGE))
+        break;
+      if (!gst_element_seek(pipeline, 1.0, GST_FORMAT_TIME, GST_SEEK_FLAG_FLUSH | flags,
+          GST_SEEK_TYPE_SET, start, GST_SEEK_TYPE_SET, stop)) {
+        g_set_error(error, GST_CORE_ERROR, GST_CORE_ERROR_SEEK, "Could not seek to the export range");
+        done = TRUE;
+        break;
+      }
+      /* The file sink does not sync, so this runs as fast as the pipeline can go */
+      gst_element_set_state(pipeline, GST_STATE_PLAYING);
+      break;
+    case GST_MESSAGE_EOS:
+      res = done = TRUE;
+      break;
+    case GST_MESSAGE_ERROR:
+      gst_message_parse_error(msg, error, NULL);
+      done = TRUE;
+      break;
+    default:
+      break;
+    }
+    gst_message_unref(msg);
+  }
+
+  gst_element_set_state(pipeline, GST_STATE_NULL);
+  gst_object_unref(bus);
+  return res;
+}
+
+/* This function links a stream of the clip to the muxer, streams it cannot take are left out */
+static void copy_pad_added_cb(GstElement *parser, GstPad *pad, GstElement *muxer)
+{
+  GstPad *sink = gst_element_get_compatible_pad(muxer, pad, NULL);
+
+  if (sink == NULL)
+    return;
+
+  gate_pad(pad);
+  gst_pad_link(pad, sink);
+  gst_object_unref(sink);
+}
+
+static void source_pad_added_cb(GstElement *source, GstPad *pad, GstElement *next)
+{
+  GstPad *sink = gst_element_get_static_pad(next, "sink");
+
+  if (!gst_pad_is_linked(sink))
+    gst_pad_link(pad, sink);
+  gst_object_unref(sink);
+}
+
+/* This function copies the compressed streams of the range to path. Nothing is decoded, so
+ * this is bound by I/O. The copy has to start on a keyframe, so a range starting between
+ * two keyframes gets the frames from the previous one */
+static gboolean export_copy(const gchar *uri, GstClockTime start, GstClockTime stop, const gchar *path, GError **error)
+{
+  GstElement *pipeline = gst_pipeline_new("export-copy");
+  GstElement *source = gst_element_factory_make("urisourcebin", NULL);
+  GstElement *parser = gst_element_factory_make("parsebin", NULL);
+  GstElement *muxer = gst_element_factory_make("matroskamux", NULL);
+  GstElement *sink = gst_element_factory_make("filesink", NULL);
+
+  if (source == NULL || parser == NULL || muxer == NULL || sink == NULL) {
+    g_set_error(error, GST_CORE_ERROR, GST_CORE_ERROR_MISSING_PLUGIN, "Not all export elements could be created");
+    gst_object_unref(pipeline);
+    return FALSE;
+  }
+
+  g_object_set(source, "uri", uri, NULL);
+  g_object_set(sink, "location", path, "sync", FALSE, NULL);
+  gst_bin_add_many(GST_BIN(pipeline), source, parser, muxer, sink, NULL);
+  gst_element_link(muxer, sink);
+  g_signal_connect(source, "pad-added", G_CALLBACK(source_pad_added_cb), parser);
+  g_signal_connect(parser, "pad-added", G_CALLBACK(copy_pad_added_cb), muxer);
+  g_signal_connect(parser, "no-more-pads", G_CALLBACK(no_more_pads_cb), NULL);
+
+  gboolean res = run_range(pipeline, start, stop, GST_SEEK_FLAG_KEY_UNIT | GST_SEEK_FLAG_SNAP_BEFORE, error);
+  gst_object_unref(pipeline);
+  return res;
+}
+
+static void decode_pad_added_cb(GstElement *decoder, GstPad *pad, GstElement *convert)
+{
+  GstPad *sink = gst_element_get_static_pad(convert, "sink");
+
+  if (!gst_pad_is_linked(sink)) {
+    gate_pad(pad);
+    gst_pad_link(pad, sink);
+  }
+  gst_object_unref(sink);
+}
+
+/* This function keeps the decoders of a chunk to one thread, like its encoder */
+static void decoder_added_cb(GstBin *bin, GstBin *sub_bin, GstElement *element, gpointer user_data)
+{
+  if (g_object_class_find_property(G_OBJECT_GET_CLASS(element), "max-threads") != NULL)
+    g_object_set(element, "max-threads", 1, NULL);
+}
+
+/* This function records the caps of the encoded stream, which carry its codec_data */
+static GstPadProbeReturn encoded_caps_probe_cb(GstPad *pad, GstPadProbeInfo *info, GstCaps **caps)
+{
+  GstEvent *event = GST_PAD_PROBE_INFO_EVENT(info);
+
+  if (GST_EVENT_TYPE(event) == GST_EVENT_CAPS) {
+    GstCaps *event_caps;
+
+    gst_event_parse_caps(event, &event_caps);
+    gst_caps_replace(caps, event_caps);
+  }
+  return GST_PAD_PROBE_OK;
+}
+
+/* This function encodes the video of [start, stop) to H.264 in path. The seek is accurate, the
+ * decoder starts from the keyframe before start but only frames of the range are encoded, so
+ * chunks next to each other neither overlap nor leave a gap. caps, if not NULL, is set to the
+ * caps of the encoded stream */
+static gboolean encode_chunk(const gchar *uri, GstClockTime start, GstClockTime stop, const gchar *path,
+    GstCaps **caps, GError **error)
+{
+  GstElement *pipeline = gst_pipeline_new("export-chunk");
+  GstElement *decoder = gst_element_factory_make("uridecodebin", NULL);
+  GstElement *convert = gst_element_factory_make("videoconvert", NULL);
+  GstElement *encoder = gst_element_factory_make("x264enc", NULL);
+  GstElement *filter = gst_element_factory_make("capsfilter", NULL);
+  GstElement *muxer = gst_element_factory_make("matroskamux", NULL);
+  GstElement *sink = gst_element_factory_make("filesink", NULL);
+
+  if (decoder == NULL || convert == NULL || encoder == NULL || filter == NULL || muxer == NULL || sink == NULL) {
+    g_set_error(error, GST_CORE_ERROR, GST_CORE_ERROR_MISSING_PLUGIN, "Not all export elements could be created");
+    gst_object_unref(pipeline);
+    return FALSE;
+  }
+
+  GstCaps *raw_caps = gst_caps_from_string("video/x-raw");
+  g_object_set(decoder, "uri", uri, "caps", raw_caps, "expose-all-streams", FALSE, NULL);
+  gst_caps_unref(raw_caps);
+
+  /* The chunks are what runs in parallel, each decoder and encoder keeps to one core */
+  g_signal_connect(pipeline, "deep-element-added", G_CALLBACK(decoder_added_cb), NULL);
+  g_object_set(encoder, "threads", 1, "key-int-max", CHUNK_KEY_INT, "bframes", CHUNK_BFRAMES, NULL);
+  gst_util_set_object_arg(G_OBJECT(encoder), "speed-preset", CHUNK_PRESET);
+  GstCaps *encoded_caps = gst_caps_from_string(CHUNK_CAPS);
+  g_object_set(filter, "caps", encoded_caps, NULL);
+  gst_caps_unref(encoded_caps);
+  g_object_set(sink, "location", path, "sync", FALSE, NULL);
+
+  if (caps != NULL) {
+    GstPad *pad = gst_element_get_static_pad(filter, "src");
+    gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM, (GstPadProbeCallback) encoded_caps_probe_cb,
+        caps, NULL);
+    gst_object_unref(pad);
+  }
+
+  gst_bin_add_many(GST_BIN(pipeline), decoder, convert, encoder, filter, muxer, sink, NULL);
+  gst_element_link_many(convert, encoder, filter, muxer, sink, NULL);
+  g_signal_connect(decoder, "pad-added", G_CALLBACK(decode_pad_added_cb), convert);
+  g_signal_connect(decoder, "no-more-pads", G_CALLBACK(no_more_pads_cb), NULL);
+
+  gboolean res = run_range(pipeline, start, stop, GST_SEEK_FLAG_ACCURATE, error);
+  gst_object_unref(pipeline);
+  return res;
+}
+
+static void chunk_job_func(ChunkJob *job)
+{
+  job->ok = encode_chunk(job->uri, job->start, job->stop, job->path, &job->caps, &job->error);
+}
+
+static void concat_pad_added_cb(GstElement *demuxer, GstPad *pad, GstPad *concat_pad)
+{
+  if (!gst_pad_is_linked(concat_pad))
+    gst_pad_link(pad, concat_pad);
+}
+
+/* This function joins the encoded chunks into path, in order, without decoding them */
+static gboolean concat_chunks(ChunkJob *jobs, guint n_jobs, const gchar *path, GError **error)
+{
+  GstElement *pipeline = gst_pipeline_new("export-concat");
+  GstElement *concat = gst_element_factory_make("concat", NULL);
+  GstElement *muxer = gst_element_factory_make("matroskamux", NULL);
+  GstElement *sink = gst_element_factory_make("filesink", NULL);
+
+  if (concat == NULL || muxer == NULL || sink == NULL) {
+    g_set_error(error, GST_CORE_ERROR, GST_CORE_ERROR_MISSING_PLUGIN, "Not all export elements could be created");
+    gst_object_unref(pipeline);
+    return FALSE;
+  }
+
+  g_object_set(sink, "location", path, "sync", FALSE, NULL);
+  gst_bin_add_many(GST_BIN(pipeline), concat, muxer, sink, NULL);
+  gst_element_link_many(concat, muxer, sink, NULL);
+
+  /* concat plays its sink pads in the order they were requested */
+  for (guint i = 0; i < n_jobs; i++) {
+    GstElement *source = gst_element_factory_make("filesrc", NULL);
+    GstElement *demuxer = gst_element_factory_make("matroskademux", NULL);
+#if GST_CHECK_VERSION(1, 20, 0)
+    GstPad *concat_pad = gst_element_request_pad_simple(concat, "sink_%u");
+#else
+    GstPad *concat_pad = gst_element_get_request_pad(concat, "sink_%u");
+#endif
+
+    g_object_set(source, "location", jobs[i].path, NULL);
+    gst_bin_add_many(GST_BIN(pipeline), source, demuxer, NULL);
+    gst_element_link(source, demuxer);
+    g_signal_connect_data(demuxer, "pad-added", G_CALLBACK(concat_pad_added_cb), concat_pad,
+        (GClosureNotify) gst_object_unref, 0);
+  }
+
+  gboolean res = run_range(pipeline, GST_CLOCK_TIME_NONE, GST_CLOCK_TIME_NONE, GST_SEEK_FLAG_NONE, error);
+  gst_object_unref(pipeline);
+  return res;
+}
+
+/* This function encodes the range in n_chunks chunks on workers of the shared pool, and joins them */
+static gboolean export_reencode(const gchar *uri, GstClockTime start, GstClockTime stop, const gchar *path,
+    guint n_chunks, GError **error)
+{
+  if (n_chunks == 0)
+    n_chunks = g_get_num_processors();
+  n_chunks = CLAMP((stop - start) / MIN_CHUNK, 1, n_chunks);
+
+  if (n_chunks == 1)
+    return encode_chunk(uri, start, stop, path, NULL, error);
+
+  ChunkJob *jobs = g_new0(ChunkJob, n_chunks);
+  WorkJob **handles = g_new0(WorkJob *, n_chunks);
+  gboolean res = TRUE;
+
+  for (guint i = 0; i < n_chunks; i++) {
+    jobs[i].uri = uri;
+    jobs[i].start = start + gst_util_uint64_scale(stop - start, i, n_chunks);
+    jobs[i].stop = start + gst_util_uint64_scale(stop - start, i + 1, n_chunks);
+    jobs[i].path = g_strdup_printf("%s.chunk%u.mkv", path, i);
+    handles[i] = work_pool_push(work_pool_get_default(), (WorkFunc) chunk_job_func, &jobs[i], WORK_JOB_LONG,
+        &jobs[i].error);
+  }
+
+  for (guint i = 0; i < n_chunks; i++) {
+    if (handles[i] != NULL)
+      work_job_join(handles[i]);
+    if (res && !jobs[i].ok) {
+      g_propagate_error(error, jobs[i].error);
+      jobs[i].error = NULL;
+      res = FALSE;
+    }
+  }
+
+  /* A decoder of the joined stream only gets the codec_data of the first chunk */
+  for (guint i = 1; res && i < n_chunks; i++) {
+    if (jobs[0].caps == NULL || jobs[i].caps == NULL || !gst_caps_is_equal(jobs[i].caps, jobs[0].caps)) {
+      g_set_error(error, GST_STREAM_ERROR, GST_STREAM_ERROR_ENCODE,
+          "Chunk %u was encoded with other H.264 parameters than the first one, export it in a single chunk", i);
+      res = FALSE;
+    }
+  }
+
+  if (res)
+    res = concat_chunks(jobs, n_chunks, path, error);
+
+  for (guint i = 0; i < n_chunks; i++) {
+    g_unlink(jobs[i].path);
+    g_free(jobs[i].path);
+    if (jobs[i].caps != NULL)
+      gst_caps_unref(jobs[i].caps);
+    g_clear_error(&jobs[i].error);
+  }
+  g_free(handles);
+  g_free(jobs);
+  return res;
+}
+
+/* This function exports [start, stop) of the clip at uri to path, as Matroska. It blocks until
+ * the export is over, so it should be called from a worker. With CLIP_EXPORT_REENCODE only the
+ * video is exported, in n_chunks chunks encoded in parallel, one per CPU if n_chunks is 0 */
+gboolean clip_export(const gchar *uri, GstClockTime start, GstClockTime stop, const gchar *path,
+    ClipExportMode mode, guint n_chunks, GError **error)
+{
+  g_return_val_if_fail(uri != NULL && path != NULL, FALSE);
+  g_return_val_if_fail(GST_CLOCK_TIME_IS_VALID(start) && GST_CLOCK_TIME_IS_VALID(stop), FALSE);
+
+  if (stop <= start) {
+    g_set_error(error, GST_CORE_ERROR, GST_CORE_ERROR_FAILED, "The export range is empty");
+    return FALSE;
+  }
+
+  if (mode == CLIP_EXPORT_COPY)
+    return export_copy(uri, start, stop, path, error);
+
+  return export_reencode(uri, start, stop, path, n_chunks, error);
+}
@@ -0,0 +1,20 @@
+#ifndef CLIP_EXPORT_H
+#define CLIP_EXPORT_H
+
+#include <gst/gst.h>
+
+G_BEGIN_DECLS
+
+/* How a range of a clip is exported */
+typedef enum
+{
+  CLIP_EXPORT_COPY,     /* Compressed streams copied as they are, the start snaps back to a keyframe */
+  CLIP_EXPORT_REENCODE  /* Video decoded and encoded again to H.264, in chunks encoded in parallel */
+} ClipExportMode;
+
+gboolean clip_export(const gchar *uri, GstClockTime start, GstClockTime stop, const gchar *path,
+    ClipExportMode mode, guint n_chunks, GError **error);
+
+G_END_DECLS
+
+#endif /* CLIP_EXPORT_H */
@@ -0,0 +1,216 @@
+#define _GNU_SOURCE
+#include "decodertuning.h"
+
+#include <sched.h>
+#include <string.h>
+#include <pthread.h>
+
+#define SYSFS_CPU_DIR "/sys/devices/system/cpu"
+
+/* CPU sets computed once at startup by decoder_tuning_probe_topology() */
+static struct
+{
+  gboolean probed;
+  cpu_set_t sets[2];  /* Indexed by DecoderRole */
+  gint counts[2];     /* Number of CPUs of each set */
+} topology;
+
+/* This function reads a small integer from sysfs, -1 if it is not available */
+static gint read_sysfs_int(guint cpu, const gchar *name)
+{
+  gchar *path = g_strdup_printf(SYSFS_CPU_DIR "/cpu%u/topology/%s", cpu, name);
+  gchar *contents = NULL;
+  gint value = -1;
+
+  if (g_file_get_contents(path, &contents, NULL, NULL))
+    value = (gint) g_ascii_strtoll(contents, NULL, 10);
+
+  g_free(contents);
+  g_free(path);
+  return value;
+}
+
+/* This function splits the CPUs we may run on into a playback and a background set.
+ * SMT siblings are kept in the same set, and the background set gets a quarter of the
+ * physical cores. With a single core both sets are the same. */
+void decoder_tuning_probe_topology(void)
+{
+  cpu_set_t allowed;
+  GArray *cores = g_array_new(FALSE, FALSE, sizeof(gint)); /* Core key of each allowed CPU, in CPU order */
+  GArray *cpus = g_array_new(FALSE, FALSE, sizeof(guint));
+  GHashTable *distinct = g_hash_table_new(g_direct_hash, g_direct_equal);
+
+  CPU_ZERO(&allowed);
+  if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0) {
+    for (guint cpu = 0; cpu < g_get_num_processors() && cpu < CPU_SETSIZE; cpu++)
+      CPU_SET(cpu, &allowed);
+  }
+
+  for (guint cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+    if (!CPU_ISSET(cpu, &allowed))
+      continue;
+
+    gint package = MAX(read_sysfs_int(cpu, "physical_package_id"), 0);
+    gint core = read_sysfs_int(cpu, "core_id");
+    gint key = core < 0 ? (gint) cpu : package * 4096 + core;
+
+    g_array_append_val(cpus, cpu);
+    g_array_append_val(cores, key);
+    g_hash_table_add(distinct, GINT_TO_POINTER(key + 1));
+  }
+
+  guint n_cores = g_hash_table_size(distinct);
+  guint n_background = n_cores > 1 ? MAX(1, n_cores / 4) : 0;
+  GHashTable *background = g_hash_table_new(g_direct_hash, g_direct_equal);
+
+  /* Background work takes the highest numbered cores */
+  for (gint i = cpus->len - 1; i >= 0 && g_hash_table_size(background) < n_background; i--)
+    g_hash_table_add(background, GINT_TO_POINTER(g_array_index(cores, gint, i) + 1));
+
+  for (guint role = 0; role < G_N_ELEMENTS(topology.sets); role++) {
+    CPU_ZERO(&topology.sets[role]);
+    topology.counts[role] = 0;
+  }
+
+  for (guint i = 0; i < cpus->len; i++) {
+    gboolean is_background = g_hash_table_contains(background,
+        GINT_TO_POINTER(g_array_index(cores, gint, i) + 1));
+    guint cpu = g_array_index(cpus, guint, i);
+
+    if (n_background == 0 || !is_background) {
+      CPU_SET(cpu, &topology.sets[DECODER_ROLE_PLAYBACK]);
+      topology.counts[DECODER_ROLE_PLAYBACK]++;
+    }
+    if (n_background == 0 || is_background) {
+      CPU_SET(cpu, &topology.sets[DECODER_ROLE_BACKGROUND]);
+      topology.counts[DECODER_ROLE_BACKGROUND]++;
+    }
+  }
+  topology.probed = TRUE;
+
+  g_hash_table_destroy(background);
+  g_hash_table_destroy(distinct);
+  g_array_unref(cpus);
+  g_array_unref(cores);
+}
+
+static void append_cpu_set(GString *str, const cpu_set_t *set)
+{
+  gboolean first = TRUE;
+
+  for (guint cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+    if (!CPU_ISSET(cpu, set))
+      continue;
+    g_string_append_printf(str, first ? "%u" : ",%u", cpu);
+    first = FALSE;
+  }
+}
+
+/* This function describes the CPU sets, for logging
+ * The returned string should be freed with g_free() when no longer needed.
+*/
+gchar *decoder_tuning_describe(void)
+{
+  g_return_val_if_fail(topology.probed, NULL);
+
+  GString *str = g_string_new("playback CPUs ");
+  append_cpu_set(str, &topology.sets[DECODER_ROLE_PLAYBACK]);
+  g_string_append(str, ", background CPUs ");
+  append_cpu_set(str, &topology.sets[DECODER_ROLE_BACKGROUND]);
+
+  return g_string_free(str, FALSE);
+}
+
+/* Pinning state of the sink pad of a decoder */
+typedef struct _DecoderPin
+{
+  DecoderRole role;
+  GThread *thread;    /* Thread pinned on CAPS, NULL once restored */
+  cpu_set_t saved;    /* Its affinity before */
+  gboolean buffered;  /* The first buffer after CAPS went through */
+} DecoderPin;
+
+/* This function is called for everything going into a decoder, in the upstream streaming thread:
+ * the multiqueue task of decodebin, or the source or demuxer thread without one. That thread is
+ * not the decoder's, so it is only pinned from CAPS until the first buffer after it went through,
+ * which is when libav opens the codec and creates its worker threads. These threads are the
+ * decoder's own, they inherit the affinity of their creator and keep it, the streaming thread gets
+ * its own back */
+static GstPadProbeReturn decoder_probe_cb(GstPad *pad, GstPadProbeInfo *info, DecoderPin *pin)
+{
+  gboolean is_caps = (info->type & GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM)
+      && GST_EVENT_TYPE(GST_PAD_PROBE_INFO_EVENT(info)) == GST_EVENT_CAPS;
+
+  if (pin->thread != NULL && (pin->buffered || is_caps)) {
+    if (pin->thread == g_thread_self())
+      pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &pin->saved);
+    pin->thread = NULL;
+  }
+
+  if (is_caps) {
+    pthread_getaffinity_np(pthread_self(), sizeof(cpu_set_t), &pin->saved);
+    pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &topology.sets[pin->role]);
+    pin->thread = g_thread_self();
+    pin->buffered = FALSE;
+  } else if (pin->thread != NULL && (info->type & (GST_PAD_PROBE_TYPE_BUFFER | GST_PAD_PROBE_TYPE_BUFFER_LIST))) {
+    pin->buffered = TRUE;
+  }
+
+  return GST_PAD_PROBE_OK;
+}
+
+static gboolean has_property(GstElement *element, const gchar *name)
+{
+  return g_object_class_find_property(G_OBJECT_GET_CLASS(element), name) != NULL;
+}
+
+/* This function is called by playbin for each element it creates, before it is used */
+static void element_setup_cb(GstElement *playbin, GstElement *element, gpointer user_data)
+{
+  DecoderRole role = GPOINTER_TO_INT(user_data);
+  GstElementFactory *factory = gst_element_get_factory(element);
+  const gchar *klass;
+
+  if (factory == NULL)
+    return;
+
+  klass = gst_element_factory_get_metadata(factory, GST_ELEMENT_METADATA_KLASS);
+  if (klass == NULL || strstr(klass, "Decoder") == NULL || strstr(klass, "Video") == NULL)
+    return;
+
+  /* Bound the threads to the CPU set, so both pipelines together do not oversubscribe */
+  if (has_property(element, "max-threads"))
+    g_object_set(element, "max-threads", topology.counts[role], NULL);
+
+  /* Frame threading delays output by one frame per thread, which thumbnails wait for */
+  if (role == DECODER_ROLE_BACKGROUND && has_property(element, "thread-type"))
+    gst_util_set_object_arg(G_OBJECT(element), "thread-type", "slice");
+
+  GstPad *pad = gst_element_get_static_pad(element, "sink");
+  if (pad != NULL) {
+    DecoderPin *pin = g_new0(DecoderPin, 1);
+
+    pin->role = role;
+    gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM | GST_PAD_PROBE_TYPE_BUFFER
+        | GST_PAD_PROBE_TYPE_BUFFER_LIST, (GstPadProbeCallback) decoder_probe_cb, pin, g_free);
+    gst_object_unref(pad);
+  }
+}
+
+/* This function is the fallback of element_setup_cb() for pipelines other than playbin */
+static void deep_element_added_cb(GstBin *bin, GstBin *sub_bin, GstElement *element, gpointer user_data)
+{
+  element_setup_cb(GST_ELEMENT(bin), element, user_data);
+}
+
+/* This function configures the threads of every decoder the pipeline creates for the given role */
+void decoder_tuning_install(GstElement *playbin, DecoderRole role)
+{
+  g_return_if_fail(GST_IS_ELEMENT(playbin));
+  g_return_if_fail(topology.probed);
+
+  if (g_signal_lookup("element-setup", G_OBJECT_TYPE(playbin)) != 0)
+    g_signal_connect(playbin, "element-setup", G_CALLBACK(element_setup_cb), GINT_TO_POINTER(role));
+  else
+    g_signal_connect(playbin, "deep-element-added", G_CALLBACK(deep_element_added_cb), GINT_TO_POINTER(role));
+}
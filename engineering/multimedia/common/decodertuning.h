@@ -0,0 +1,21 @@
+#ifndef DECODER_TUNING_H
+#define DECODER_TUNING_H
+
+#include <gst/gst.h>
+
+G_BEGIN_DECLS
+
+/* What a pipeline decodes for, which decides the CPU set of its decoders */
+typedef enum
+{
+  DECODER_ROLE_PLAYBACK,   /* Main playback, latency sensitive */
+  DECODER_ROLE_BACKGROUND  /* Thumbnails and other background work */
+} DecoderRole;
+
+void decoder_tuning_probe_topology(void);
+gchar *decoder_tuning_describe(void);
+void decoder_tuning_install(GstElement *playbin, DecoderRole role);
+
+G_END_DECLS
+
+#endif /* DECODER_TUNING_H */
@@ -0,0 +1,327 @@
+#include "framegrab.h"
+#include "workpool.h"
+
+#include <gst/video/video.h>
+#include <gst/video/gstvideopool.h>
+
+#define ENCODER_DESCRIPTION "appsrc name=src format=time ! videoconvert ! pngenc snapshot=false ! appsink name=sink sync=false"
+#define ENCODE_TIMEOUT      (10 * GST_SECOND)
+
+struct _FrameGrabber
+{
+  GMutex lock;           /* Guards pending, budget and pool_bytes */
+  GCond idle;            /* Signalled when pending drops to 0 */
+  guint pending;         /* Jobs pushed and not done yet */
+  guint64 budget;        /* Bytes the pool may keep from one frame to the next */
+  guint64 pool_bytes;    /* Bytes of the pool buffer, 0 without a pool */
+
+  GMutex encode_lock;    /* Held by the job using the members below, frames are saved one at a time */
+  GstElement *encoder;   /* Kept from one frame to the next, NULL until the first frame or after an error */
+  GstElement *src;
+  GstElement *sink;
+  GstBufferPool *pool;   /* System memory buffers the frames are copied to */
+  GstVideoInfo pool_info;
+};
+
+/* One frame to save */
+typedef struct _SaveJob
+{
+  FrameGrabber *grabber;
+  GstSample *sample;
+  gchar *path;
+  FrameGrabDoneFunc done;
+  gpointer user_data;
+} SaveJob;
+
+FrameGrabber *frame_grabber_new(void)
+{
+  FrameGrabber *grabber = g_new0(FrameGrabber, 1);
+
+  g_mutex_init(&grabber->lock);
+  g_cond_init(&grabber->idle);
+  g_mutex_init(&grabber->encode_lock);
+  grabber->budget = G_MAXUINT64;
+  return grabber;
+}
+
+static void release_encoder(FrameGrabber *grabber)
+{
+  if (grabber->encoder == NULL)
+    return;
+
+  gst_element_set_state(grabber->encoder, GST_STATE_NULL);
+  gst_object_unref(grabber->src);
+  gst_object_unref(grabber->sink);
+  gst_object_unref(grabber->encoder);
+  grabber->encoder = grabber->src = grabber->sink = NULL;
+}
+
+static void release_pool(FrameGrabber *grabber)
+{
+  if (grabber->pool == NULL)
+    return;
+
+  gst_buffer_pool_set_active(grabber->pool, FALSE);
+  gst_object_unref(grabber->pool);
+  grabber->pool = NULL;
+
+  g_mutex_lock(&grabber->lock);
+  grabber->pool_bytes = 0;
+  g_mutex_unlock(&grabber->lock);
+}
+
+/* This function waits for the frames being saved before freeing the grabber */
+void frame_grabber_free(FrameGrabber *grabber)
+{
+  g_return_if_fail(grabber != NULL);
+
+  g_mutex_lock(&grabber->lock);
+  while (grabber->pending > 0)
+    g_cond_wait(&grabber->idle, &grabber->lock);
+  g_mutex_unlock(&grabber->lock);
+
+  release_encoder(grabber);
+  release_pool(grabber);
+  g_mutex_clear(&grabber->encode_lock);
+  g_cond_clear(&grabber->idle);
+  g_mutex_clear(&grabber->lock);
+  g_free(grabber);
+}
+
+/* This function gives the frame shown by a playbin ("sample") or a video sink ("last-sample"),
+ * NULL if none was shown yet. It only takes a reference, the frame is not copied
+ * The returned sample should be freed with gst_sample_unref() when no longer needed.
+*/
+GstSample *frame_grab_get_last_sample(GstElement *element)
+{
+  g_return_val_if_fail(GST_IS_ELEMENT(element), NULL);
+
+  GObjectClass *klass = G_OBJECT_GET_CLASS(element);
+  GstSample *sample = NULL;
+
+  if (g_object_class_find_property(klass, "sample") != NULL)
+    g_object_get(element, "sample", &sample, NULL);
+  else if (g_object_class_find_property(klass, "last-sample") != NULL)
+    g_object_get(element, "last-sample", &sample, NULL);
+
+  return sample;
+}
+
+/* This function copies the frame of sample to a buffer of the pool, so the video sink gets its
+ * own buffer back before the slow part, the conversion and encoding, starts */
+static GstSample *copy_sample(FrameGrabber *grabber, GstSample *sample, GError **error)
+{
+  GstCaps *caps = gst_sample_get_caps(sample);
+  GstBuffer *buffer = NULL;
+  GstVideoInfo info;
+  GstVideoFrame in_frame, out_frame;
+
+  if (caps == NULL || !gst_video_info_from_caps(&info, caps)) {
+    g_set_error(error, GST_STREAM_ERROR, GST_STREAM_ERROR_FORMAT, "The frame is not raw video");
+    return NULL;
+  }
+
+  /* The pool is only made again when the format or size of the video changes */
+  if (grabber->pool == NULL || !gst_video_info_is_equal(&info, &grabber->pool_info)) {
+    release_pool(grabber);
+    grabber->pool = gst_video_buffer_pool_new();
+    GstStructure *config = gst_buffer_pool_get_config(grabber->pool);
+    gst_buffer_pool_config_set_params(config, caps, info.size, 1, 0);
+    if (!gst_buffer_pool_set_config(grabber->pool, config) || !gst_buffer_pool_set_active(grabber->pool, TRUE)) {
+      g_set_error(error, GST_RESOURCE_ERROR, GST_RESOURCE_ERROR_NO_SPACE_LEFT, "Could not allocate the frame buffers");
+      release_pool(grabber);
+      return NULL;
+    }
+    grabber->pool_info = info;
+
+    g_mutex_lock(&grabber->lock);
+    grabber->pool_bytes = info.size;
+    g_mutex_unlock(&grabber->lock);
+  }
+
+  if (gst_buffer_pool_acquire_buffer(grabber->pool, &buffer, NULL) != GST_FLOW_OK) {
+    g_set_error(error, GST_RESOURCE_ERROR, GST_RESOURCE_ERROR_NO_SPACE_LEFT, "No frame buffer available");
+    return NULL;
+  }
+
+  if (!gst_video_frame_map(&in_frame, &info, gst_sample_get_buffer(sample), GST_MAP_READ)) {
+    g_set_error(error, GST_RESOURCE_ERROR, GST_RESOURCE_ERROR_READ, "Could not read the frame");
+    gst_buffer_unref(buffer);
+    return NULL;
+  }
+  if (!gst_video_frame_map(&out_frame, &info, buffer, GST_MAP_WRITE)) {
+    g_set_error(error, GST_RESOURCE_ERROR, GST_RESOURCE_ERROR_WRITE, "Could not write the frame copy");
+    gst_video_frame_unmap(&in_frame);
+    gst_buffer_unref(buffer);
+    return NULL;
+  }
+  gst_video_frame_copy(&out_frame, &in_frame);
+  gst_video_frame_unmap(&out_frame);
+  gst_video_frame_unmap(&in_frame);
+
+  GstSample *copy = gst_sample_new(buffer, caps, NULL, NULL);
+  gst_buffer_unref(buffer);
+  return copy;
+}
+
+/* This function gives the error posted by the encoder, or a timeout error */
+static void get_encoder_error(FrameGrabber *grabber, GError **error)
+{
+  GstBus *bus = gst_element_get_bus(grabber->encoder);
+  GstMessage *msg = gst_bus_pop_filtered(bus, GST_MESSAGE_ERROR);
+
+  if (msg != NULL) {
+    gst_message_parse_error(msg, error, NULL);
+    gst_message_unref(msg);
+  } else {
+    g_set_error(error, GST_CORE_ERROR, GST_CORE_ERROR_FAILED, "Timed out encoding the frame");
+  }
+  gst_object_unref(bus);
+}
+
+/* This function converts and encodes the frame to PNG, and writes it to path. The encoder
+ * pipeline is kept between frames, so its converter reuses its buffers too */
+static gboolean encode_sample(FrameGrabber *grabber, GstSample *sample, const gchar *path, GError **error)
+{
+  GstFlowReturn ret;
+  GstSample *encoded = NULL;
+
+  if (grabber->encoder == NULL) {
+    grabber->encoder = gst_parse_launch(ENCODER_DESCRIPTION, error);
+    if (grabber->encoder == NULL)
+      return FALSE;
+    grabber->src = gst_bin_get_by_name(GST_BIN(grabber->encoder), "src");
+    grabber->sink = gst_bin_get_by_name(GST_BIN(grabber->encoder), "sink");
+    gst_element_set_state(grabber->encoder, GST_STATE_PLAYING);
+  }
+
+  /* appsrc takes the caps of the sample, the converter follows when they change */
+  g_signal_emit_by_name(grabber->src, "push-sample", sample, &ret);
+  if (ret == GST_FLOW_OK)
+    g_signal_emit_by_name(grabber->sink, "try-pull-sample", ENCODE_TIMEOUT, &encoded);
+
+  if (encoded == NULL) {
+    get_encoder_error(grabber, error);
+    release_encoder(grabber);
+    return FALSE;
+  }
+
+  GstMapInfo map;
+  GstBuffer *buffer = gst_sample_get_buffer(encoded);
+  gboolean res = FALSE;
+
+  if (gst_buffer_map(buffer, &map, GST_MAP_READ)) {
+    res = g_file_set_contents(path, (const gchar *) map.data, map.size, error);
+    gst_buffer_unmap(buffer, &map);
+  } else {
+    g_set_error(error, GST_RESOURCE_ERROR, GST_RESOURCE_ERROR_READ, "Could not read the encoded frame");
+  }
+  gst_sample_unref(encoded);
+  return res;
+}
+
+static void save_job_func(SaveJob *job)
+{
+  FrameGrabber *grabber = job->grabber;
+  GError *error = NULL;
+
+  g_mutex_lock(&grabber->encode_lock);
+  GstSample *copy = copy_sample(grabber, job->sample, &error);
+  gst_sample_unref(job->sample);
+  job->sample = NULL;
+  if (copy != NULL) {
+    encode_sample(grabber, copy, job->path, &error);
+    gst_sample_unref(copy);
+  }
+
+  /* Over budget, the buffer and the encoder are made again for the next frame */
+  g_mutex_lock(&grabber->lock);
+  gboolean over_budget = grabber->pool_bytes > grabber->budget;
+  g_mutex_unlock(&grabber->lock);
+  if (over_budget) {
+    release_pool(grabber);
+    release_encoder(grabber);
+  }
+  g_mutex_unlock(&grabber->encode_lock);
+
+  if (job->done != NULL)
+    job->done(job->path, error, job->user_data);
+  g_clear_error(&error);
+  g_free(job->path);
+  g_free(job);
+
+  g_mutex_lock(&grabber->lock);
+  if (--grabber->pending == 0)
+    g_cond_broadcast(&grabber->idle);
+  g_mutex_unlock(&grabber->lock);
+}
+
+/* This function gives the bytes kept by the grabber between two frames */
+guint64 frame_grabber_get_memory(FrameGrabber *grabber)
+{
+  g_return_val_if_fail(grabber != NULL, 0);
+
+  g_mutex_lock(&grabber->lock);
+  guint64 bytes = grabber->pool_bytes;
+  g_mutex_unlock(&grabber->lock);
+
+  return bytes;
+}
+
+/* This function bounds the bytes kept between two frames. Over budget, the buffer and the
+ * encoder are released now if no frame is being saved, or else once it is */
+void frame_grabber_set_budget(FrameGrabber *grabber, guint64 budget)
+{
+  g_return_if_fail(grabber != NULL);
+
+  g_mutex_lock(&grabber->lock);
+  grabber->budget = budget;
+  gboolean over_budget = grabber->pool_bytes > budget;
+  g_mutex_unlock(&grabber->lock);
+
+  if (over_budget && g_mutex_trylock(&grabber->encode_lock)) {
+    release_pool(grabber);
+    release_encoder(grabber);
+    g_mutex_unlock(&grabber->encode_lock);
+  }
+}
+
+/* This function saves the frame of sample to path as PNG, at its full resolution. The caller
+ * only takes a reference to the sample, copying, converting and encoding happen on a worker
+ * of the shared pool, so playback goes on meanwhile. done is called from that worker */
+gboolean frame_grabber_save(FrameGrabber *grabber, GstSample *sample, const gchar *path,
+    FrameGrabDoneFunc done, gpointer user_data, GError **error)
+{
+  g_return_val_if_fail(grabber != NULL, FALSE);
+  g_return_val_if_fail(GST_IS_SAMPLE(sample), FALSE);
+  g_return_val_if_fail(path != NULL, FALSE);
+
+  SaveJob *job = g_new0(SaveJob, 1);
+  job->grabber = grabber;
+  job->sample = gst_sample_ref(sample);
+  job->path = g_strdup(path);
+  job->done = done;
+  job->user_data = user_data;
+
+  g_mutex_lock(&grabber->lock);
+  grabber->pending++;
+  g_mutex_unlock(&grabber->lock);
+
+  /* Converting and encoding only use the CPU and never wait on a pipeline, so the job goes to the
+   * workers rather than taking a spare thread */
+  WorkJob *handle = work_pool_push(work_pool_get_default(), (WorkFunc) save_job_func, job, WORK_JOB_SHORT, error);
+  if (handle == NULL) {
+    gst_sample_unref(job->sample);
+    g_free(job->path);
+    g_free(job);
+
+    g_mutex_lock(&grabber->lock);
+    if (--grabber->pending == 0)
+      g_cond_broadcast(&grabber->idle);
+    g_mutex_unlock(&grabber->lock);
+    return FALSE;
+  }
+
+  work_job_detach(handle);
+  return TRUE;
+}
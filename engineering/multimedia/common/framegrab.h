@@ -0,0 +1,26 @@
+#ifndef FRAME_GRAB_H
+#define FRAME_GRAB_H
+
+#include <gst/gst.h>
+
+G_BEGIN_DECLS
+
+/* Called from a worker thread once a frame is saved, error is NULL on success */
+typedef void (*FrameGrabDoneFunc)(const gchar *path, const GError *error, gpointer user_data);
+
+/* Saves the frames shown by a player as PNG, off the UI and streaming threads */
+typedef struct _FrameGrabber FrameGrabber;
+
+FrameGrabber *frame_grabber_new(void);
+void frame_grabber_free(FrameGrabber *grabber);
+
+GstSample *frame_grab_get_last_sample(GstElement *element);
+gboolean frame_grabber_save(FrameGrabber *grabber, GstSample *sample, const gchar *path,
+    FrameGrabDoneFunc done, gpointer user_data, GError **error);
+
+guint64 frame_grabber_get_memory(FrameGrabber *grabber);
+void frame_grabber_set_budget(FrameGrabber *grabber, guint64 budget);
+
+G_END_DECLS
+
+#endif /* FRAME_GRAB_H */
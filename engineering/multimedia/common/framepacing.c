@@ -0,0 +1,118 @@
+#include "framepacing.h"
+
+#include <math.h>
+#include <stdlib.h>
+
+#define WINDOW_SIZE     256
+#define MAX_INTERVAL_US G_USEC_PER_SEC
+
+/* The statistics cover the last WINDOW_SIZE intervals. Intervals longer than a second are a
+ * pause or an idle window rather than a late frame, they are left out. */
+struct _FramePacing
+{
+  GMutex lock;                        /* Protects the fields below */
+  guint64 frames;
+  gint64 last_frame;                  /* Monotonic time of the last frame, 0 if none */
+  gint64 intervals[WINDOW_SIZE];      /* Ring of the last intervals, in microseconds */
+  guint head;                         /* Index the next interval is written to */
+  guint count;
+};
+
+FramePacing *frame_pacing_new(void)
+{
+  FramePacing *pacing = g_new0(FramePacing, 1);
+
+  g_mutex_init(&pacing->lock);
+  return pacing;
+}
+
+void frame_pacing_free(FramePacing *pacing)
+{
+  g_return_if_fail(pacing != NULL);
+
+  g_mutex_clear(&pacing->lock);
+  g_free(pacing);
+}
+
+/* This function records that a frame was presented now. It is called from the thread
+ * drawing the frames, which may not be the UI thread */
+void frame_pacing_frame(FramePacing *pacing)
+{
+  gint64 now = g_get_monotonic_time();
+
+  g_return_if_fail(pacing != NULL);
+
+  g_mutex_lock(&pacing->lock);
+  if (pacing->last_frame != 0 && now - pacing->last_frame <= MAX_INTERVAL_US) {
+    pacing->intervals[pacing->head] = now - pacing->last_frame;
+    pacing->head = (pacing->head + 1) % WINDOW_SIZE;
+    pacing->count = MIN(pacing->count + 1, WINDOW_SIZE);
+  }
+  pacing->last_frame = now;
+  pacing->frames++;
+  g_mutex_unlock(&pacing->lock);
+}
+
+static gint compare_intervals(gconstpointer a, gconstpointer b)
+{
+  gint64 x = *(const gint64 *) a, y = *(const gint64 *) b;
+
+  return x < y ? -1 : x > y;
+}
+
+void frame_pacing_get_stats(FramePacing *pacing, FramePacingStats *stats)
+{
+  gint64 sorted[WINDOW_SIZE];
+  guint n;
+
+  g_return_if_fail(pacing != NULL && stats != NULL);
+
+  g_mutex_lock(&pacing->lock);
+  n = pacing->count;
+  for (guint i = 0; i < n; i++)
+    sorted[i] = pacing->intervals[i];
+  stats->frames = pacing->frames;
+  g_mutex_unlock(&pacing->lock);
+
+  stats->intervals = n;
+  stats->mean_ms = stats->stddev_ms = stats->p95_ms = stats->p99_ms = stats->max_ms = 0;
+  stats->late = 0;
+  if (n == 0)
+    return;
+
+  qsort(sorted, n, sizeof(gint64), compare_intervals);
+
+  gdouble sum = 0, sum_squares = 0;
+  for (guint i = 0; i < n; i++) {
+    sum += sorted[i];
+    sum_squares += (gdouble) sorted[i] * sorted[i];
+  }
+
+  gdouble mean = sum / n;
+  gint64 median = sorted[(n - 1) / 2];
+  for (guint i = 0; i < n; i++) {
+    if (sorted[i] * 2 > median * 3)
+      stats->late++;
+  }
+
+  stats->mean_ms = mean / 1000.0;
+  stats->stddev_ms = sqrt(MAX(0.0, sum_squares / n - mean * mean)) / 1000.0;
+  stats->p95_ms = sorted[(n - 1) * 95 / 100] / 1000.0;
+  stats->p99_ms = sorted[(n - 1) * 99 / 100] / 1000.0;
+  stats->max_ms = sorted[n - 1] / 1000.0;
+}
+
+/* This function formats the statistics for the HUD or a report
+ * The returned string should be freed with g_free() when no longer needed.
+*/
+gchar *frame_pacing_stats_to_string(const FramePacingStats *stats)
+{
+  g_return_val_if_fail(stats != NULL, NULL);
+
+  return g_strdup_printf("Presented: %" G_GUINT64_FORMAT " frames\n"
+                         "Interval: %.2f ms, stddev %.2f ms\n"
+                         "Interval p95/p99/max: %.1f/%.1f/%.1f ms\n"
+                         "Late: %u of %u",
+                         stats->frames, stats->mean_ms, stats->stddev_ms, stats->p95_ms, stats->p99_ms,
+                         stats->max_ms, stats->late, stats->intervals);
+}
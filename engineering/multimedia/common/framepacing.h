@@ -0,0 +1,34 @@
+#ifndef FRAME_PACING_H
+#define FRAME_PACING_H
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/* Intervals between the frames presented on screen, filled by frame_pacing_get_stats() */
+typedef struct _FramePacingStats
+{
+  guint64 frames;          /* Frames presented since frame_pacing_new() */
+  guint intervals;         /* Intervals in the window the values below are computed on */
+  gdouble mean_ms;         /* Mean interval between two frames */
+  gdouble stddev_ms;       /* Standard deviation of the intervals */
+  gdouble p95_ms;
+  gdouble p99_ms;
+  gdouble max_ms;
+  guint late;              /* Intervals longer than 1.5 times the median, a missed refresh */
+} FramePacingStats;
+
+/* Thread safe collector of the presentation times of a video output */
+typedef struct _FramePacing FramePacing;
+
+FramePacing *frame_pacing_new(void);
+void frame_pacing_free(FramePacing *pacing);
+
+void frame_pacing_frame(FramePacing *pacing);
+
+void frame_pacing_get_stats(FramePacing *pacing, FramePacingStats *stats);
+gchar *frame_pacing_stats_to_string(const FramePacingStats *stats);
+
+G_END_DECLS
+
+#endif /* FRAME_PACING_H */
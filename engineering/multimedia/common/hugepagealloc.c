@@ -0,0 +1,274 @@
+#define _GNU_SOURCE
+#include "hugepagealloc.h"
+
+#include <string.h>
+#include <sys/mman.h>
+
+#define HUGE_PAGE_SIZE (2 * 1024 * 1024)
+
+/* Decoded 4K frames are 12 MB or more, so walking one in 4 KB pages costs thousands of TLB
+ * entries per pass of videoconvert or the sink. Buffers of at least one huge page are mapped
+ * from the hugetlbfs pool when the administrator reserved one, or else from anonymous memory
+ * advised for transparent huge pages. Smaller buffers, where rounding up to 2 MB would waste
+ * more than it saves, come from the system allocator. */
+
+/* Memory of a single mapping, shared by the sub-memories made by huge_page_mem_share() */
+typedef struct _HugePageMemory
+{
+  GstMemory mem;
+
+  gpointer data;    /* Start of the mapping */
+  gsize mapped;     /* Length of the mapping, 0 for a sub-memory */
+} HugePageMemory;
+
+struct _HugePageAllocator
+{
+  GstAllocator parent;
+};
+
+G_DEFINE_TYPE(HugePageAllocator, huge_page_allocator, GST_TYPE_ALLOCATOR)
+
+static struct
+{
+  gint hugetlb;
+  gint thp;
+  gint small;
+} counters;
+
+/* This function maps length bytes, a multiple of HUGE_PAGE_SIZE, aligned on a huge page */
+static gpointer map_huge_pages(gsize length)
+{
+  gpointer data = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+  if (data != MAP_FAILED) {
+    g_atomic_int_inc(&counters.hugetlb);
+    return data;
+  }
+
+  /* khugepaged and the fault handler only use huge pages for aligned ranges, so map
+   * one more and trim both ends */
+  guint8 *base = mmap(NULL, length + HUGE_PAGE_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (base == MAP_FAILED)
+    return NULL;
+
+  guint8 *aligned = (guint8 *) (((guintptr) base + HUGE_PAGE_SIZE - 1) & ~((guintptr) HUGE_PAGE_SIZE - 1));
+  if (aligned > base)
+    munmap(base, aligned - base);
+  munmap(aligned + length, base + HUGE_PAGE_SIZE - aligned);
+
+  /* Fails when THP is disabled, the memory is still good with small pages */
+  if (madvise(aligned, length, MADV_HUGEPAGE) == 0)
+    g_atomic_int_inc(&counters.thp);
+  else
+    g_atomic_int_inc(&counters.small);
+
+  return aligned;
+}
+
+static GstMemory *huge_page_alloc(GstAllocator *allocator, gsize size, GstAllocationParams *params)
+{
+  gsize maxsize = params->prefix + size + params->padding;
+
+  if (maxsize < HUGE_PAGE_SIZE) {
+    g_atomic_int_inc(&counters.small);
+    return gst_allocator_alloc(NULL, size, params);
+  }
+
+  /* A huge page is aligned far beyond anything params->align asks for */
+  gsize mapped = (maxsize + HUGE_PAGE_SIZE - 1) & ~((gsize) HUGE_PAGE_SIZE - 1);
+  gpointer data = map_huge_pages(mapped);
+  if (data == NULL) {
+    g_atomic_int_inc(&counters.small);
+    return gst_allocator_alloc(NULL, size, params);
+  }
+
+  /* Anonymous mappings are zero filled, which covers GST_MEMORY_FLAG_ZERO_PREFIXED and ZERO_PADDED */
+  HugePageMemory *mem = g_new(HugePageMemory, 1);
+  gst_memory_init(GST_MEMORY_CAST(mem), params->flags, allocator, NULL, maxsize, params->align,
+      params->prefix, size);
+  mem->data = data;
+  mem->mapped = mapped;
+
+  return GST_MEMORY_CAST(mem);
+}
+
+static void huge_page_free(GstAllocator *allocator, GstMemory *memory)
+{
+  HugePageMemory *mem = (HugePageMemory *) memory;
+
+  if (mem->mapped != 0)
+    munmap(mem->data, mem->mapped);
+  g_free(mem);
+}
+
+static gpointer huge_page_mem_map(GstMemory *memory, gsize maxsize, GstMapFlags flags)
+{
+  return ((HugePageMemory *) memory)->data;
+}
+
+static void huge_page_mem_unmap(GstMemory *memory)
+{
+}
+
+static GstMemory *huge_page_mem_share(GstMemory *memory, gssize offset, gssize size)
+{
+  HugePageMemory *mem = (HugePageMemory *) memory;
+  GstMemory *parent = memory->parent != NULL ? memory->parent : memory;
+
+  if (size == -1)
+    size = memory->size - offset;
+
+  HugePageMemory *sub = g_new(HugePageMemory, 1);
+  gst_memory_init(GST_MEMORY_CAST(sub), GST_MINI_OBJECT_FLAGS(parent) | GST_MINI_OBJECT_FLAG_LOCK_READONLY,
+      memory->allocator, parent, memory->maxsize, memory->align, memory->offset + offset, size);
+  sub->data = mem->data;
+  sub->mapped = 0;
+
+  return GST_MEMORY_CAST(sub);
+}
+
+static void huge_page_allocator_class_init(HugePageAllocatorClass *klass)
+{
+  GstAllocatorClass *allocator_class = GST_ALLOCATOR_CLASS(klass);
+
+  allocator_class->alloc = huge_page_alloc;
+  allocator_class->free = huge_page_free;
+}
+
+static void huge_page_allocator_init(HugePageAllocator *self)
+{
+  GstAllocator *allocator = GST_ALLOCATOR(self);
+
+  allocator->mem_type = HUGE_PAGE_MEMORY_TYPE;
+  allocator->mem_map = huge_page_mem_map;
+  allocator->mem_unmap = huge_page_mem_unmap;
+  allocator->mem_share = huge_page_mem_share;
+}
+
+static gpointer create_default_allocator(gpointer user_data)
+{
+  return g_object_new(HUGE_TYPE_PAGE_ALLOCATOR, NULL);
+}
+
+/* This function returns the allocator shared by every pipeline, it is never freed */
+GstAllocator *huge_page_allocator_get_default(void)
+{
+  static GOnce once = G_ONCE_INIT;
+
+  g_once(&once, create_default_allocator, NULL);
+  return once.retval;
+}
+
+/* This function gives how many allocations were served each way, since the start of the process */
+void huge_page_allocator_get_stats(HugePageStats *stats)
+{
+  g_return_if_fail(stats != NULL);
+
+  stats->hugetlb = (guint) g_atomic_int_get(&counters.hugetlb);
+  stats->thp = (guint) g_atomic_int_get(&counters.thp);
+  stats->small = (guint) g_atomic_int_get(&counters.small);
+}
+
+/* This function tells whether downstream asks for memory of its own: a GL texture, a DMABuf, or
+ * the pool of a sink drawing from its buffers directly */
+static gboolean has_special_memory(GstQuery *query)
+{
+  for (guint i = 0; i < gst_query_get_n_allocation_params(query); i++) {
+    GstAllocator *allocator = NULL;
+    gboolean special;
+
+    gst_query_parse_nth_allocation_param(query, i, &allocator, NULL);
+    special = allocator != NULL && g_strcmp0(allocator->mem_type, GST_ALLOCATOR_SYSMEM) != 0;
+    if (allocator != NULL)
+      gst_object_unref(allocator);
+    if (special)
+      return TRUE;
+  }
+
+  for (guint i = 0; i < gst_query_get_n_allocation_pools(query); i++) {
+    GstBufferPool *pool = NULL;
+    const gchar *type;
+    gboolean special;
+
+    gst_query_parse_nth_allocation_pool(query, i, &pool, NULL, NULL, NULL);
+    if (pool == NULL)
+      continue;
+    /* Generic pools, such as the one proposed by videoconvert, use the allocator of the query */
+    type = G_OBJECT_TYPE_NAME(pool);
+    special = strcmp(type, "GstBufferPool") != 0 && strcmp(type, "GstVideoBufferPool") != 0;
+    gst_object_unref(pool);
+    if (special)
+      return TRUE;
+  }
+
+  return FALSE;
+}
+
+/* This function is called once downstream answered an ALLOCATION query of the element, before the
+ * element decides how to allocate from the answer */
+static GstPadProbeReturn allocation_query_probe_cb(GstPad *pad, GstPadProbeInfo *info, gpointer user_data)
+{
+  GstQuery *query = GST_PAD_PROBE_INFO_QUERY(info);
+  GstAllocationParams params;
+
+  if (GST_QUERY_TYPE(query) != GST_QUERY_ALLOCATION || has_special_memory(query))
+    return GST_PAD_PROBE_OK;
+
+  if (gst_query_get_n_allocation_params(query) > 0) {
+    gst_query_parse_nth_allocation_param(query, 0, NULL, &params);
+    gst_query_set_nth_allocation_param(query, 0, huge_page_allocator_get_default(), &params);
+  } else {
+    gst_allocation_params_init(&params);
+    gst_query_add_allocation_param(query, huge_page_allocator_get_default(), &params);
+  }
+
+  return GST_PAD_PROBE_OK;
+}
+
+/* This function makes element allocate its output from the huge page allocator, unless
+ * downstream asks for memory of its own */
+void huge_page_allocator_attach(GstElement *element)
+{
+  g_return_if_fail(GST_IS_ELEMENT(element));
+
+  GstPad *pad = gst_element_get_static_pad(element, "src");
+  if (pad == NULL)
+    return;
+
+  gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_QUERY_DOWNSTREAM | GST_PAD_PROBE_TYPE_PULL,
+      allocation_query_probe_cb, NULL, NULL);
+  gst_object_unref(pad);
+}
+
+/* This function is called by playbin for each element it creates, before it is used */
+static void element_setup_cb(GstElement *pipeline, GstElement *element, gpointer user_data)
+{
+  GstElementFactory *factory = gst_element_get_factory(element);
+  const gchar *klass;
+
+  if (factory == NULL)
+    return;
+
+  /* Decoders make the frames, converters and scalers copy them once more */
+  klass = gst_element_factory_get_metadata(factory, GST_ELEMENT_METADATA_KLASS);
+  if (klass != NULL && strstr(klass, "Video") != NULL &&
+      (strstr(klass, "Decoder") != NULL || strstr(klass, "Converter") != NULL))
+    huge_page_allocator_attach(element);
+}
+
+/* This function is the fallback of element_setup_cb() for pipelines other than playbin */
+static void deep_element_added_cb(GstBin *bin, GstBin *sub_bin, GstElement *element, gpointer user_data)
+{
+  element_setup_cb(GST_ELEMENT(bin), element, user_data);
+}
+
+/* This function attaches the huge page allocator to every video decoder and converter the
+ * pipeline creates */
+void huge_page_allocator_install(GstElement *pipeline)
+{
+  g_return_if_fail(GST_IS_ELEMENT(pipeline));
+
+  if (g_signal_lookup("element-setup", G_OBJECT_TYPE(pipeline)) != 0)
+    g_signal_connect(pipeline, "element-setup", G_CALLBACK(element_setup_cb), NULL);
+  else
+    g_signal_connect(pipeline, "deep-element-added", G_CALLBACK(deep_element_added_cb), NULL);
+}
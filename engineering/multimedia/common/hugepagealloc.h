@@ -0,0 +1,29 @@
+#ifndef HUGE_PAGE_ALLOC_H
+#define HUGE_PAGE_ALLOC_H
+
+#include <gst/gst.h>
+
+G_BEGIN_DECLS
+
+#define HUGE_PAGE_MEMORY_TYPE "HugePageMemory"
+
+/* How the allocations were served, filled by huge_page_allocator_get_stats() */
+typedef struct _HugePageStats
+{
+  guint64 hugetlb;     /* From the reserved pool of hugetlbfs */
+  guint64 thp;         /* Anonymous memory advised for transparent huge pages */
+  guint64 small;       /* Huge pages are not available, or the buffer is too small for one */
+} HugePageStats;
+
+#define HUGE_TYPE_PAGE_ALLOCATOR (huge_page_allocator_get_type())
+G_DECLARE_FINAL_TYPE(HugePageAllocator, huge_page_allocator, HUGE, PAGE_ALLOCATOR, GstAllocator)
+
+GstAllocator *huge_page_allocator_get_default(void);
+void huge_page_allocator_get_stats(HugePageStats *stats);
+
+void huge_page_allocator_attach(GstElement *element);
+void huge_page_allocator_install(GstElement *pipeline);
+
+G_END_DECLS
+
+#endif /* HUGE_PAGE_ALLOC_H */
@@ -0,0 +1,479 @@
+#include "memgovernor.h"
+
+#include <glib-unix.h>
+#include <glib/gstdio.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+
+#define CGROUP_ROOT        "/sys/fs/cgroup"
+#define MODERATE_USAGE     0.80   /* Share of the limit used */
+#define CRITICAL_USAGE     0.90
+#define TARGET_USAGE       0.70   /* Share of the limit the caches are shrunk back to */
+#define MODERATE_PRESSURE  5.0    /* some avg10, in percent */
+#define CRITICAL_PRESSURE  5.0    /* full avg10, in percent */
+#define RELAX_UPDATES      10     /* Updates at the normal level before the caches get their budgets back */
+#define PSI_TRIGGER        "some 100000 1000000" /* 100 ms of stall within 1 s wakes the governor up at once */
+
+static const gchar *level_names[] = {
+  [MEMORY_LEVEL_NORMAL]   = "normal",
+  [MEMORY_LEVEL_MODERATE] = "moderate",
+  [MEMORY_LEVEL_CRITICAL] = "critical"
+};
+
+/* A cache registered with memory_governor_add_cache() */
+typedef struct _MemoryCache
+{
+  guint id;
+  gchar *name;
+  gint priority;           /* Caches of lower priority are shrunk first */
+  guint64 budget;          /* Bytes the cache may hold without pressure */
+  guint64 allowed;         /* Bytes it may hold now, lowered under pressure */
+  MemoryCacheSizeFunc size;
+  MemoryCacheBudgetFunc set_budget;
+  gpointer user_data;
+} MemoryCache;
+
+/* The caches are only touched from the main loop: the timer, the PSI trigger and the calls of
+ * the application all run there. Only the statistics are read from other threads. */
+struct _MemoryGovernor
+{
+  gchar *cgroup;           /* Directory of the cgroup of the process, NULL without cgroup v2 */
+  GList *caches;           /* Sorted by priority, lowest first */
+  guint next_id;
+  guint timer_id;
+  gint trigger_fd;         /* PSI trigger, -1 if the kernel or the permissions do not allow one */
+  guint trigger_id;
+  guint relax_count;       /* Updates at the normal level since the last shrink */
+
+  GMutex lock;             /* Protects stats */
+  MemoryGovernorStats stats;
+};
+
+/* This function reads a file holding a number of bytes or "max", given as G_MAXUINT64 */
+static gboolean read_bytes(const gchar *dir, const gchar *name, guint64 *value)
+{
+  gchar *path = g_build_filename(dir, name, NULL);
+  gchar *contents = NULL;
+  gboolean res = g_file_get_contents(path, &contents, NULL, NULL);
+
+  g_free(path);
+  if (!res)
+    return FALSE;
+
+  g_strstrip(contents);
+  *value = g_strcmp0(contents, "max") == 0 ? G_MAXUINT64 : g_ascii_strtoull(contents, NULL, 10);
+  g_free(contents);
+  return TRUE;
+}
+
+/* This function reads the page cache of a cgroup the kernel can drop without writing anything back:
+ * the file pages of memory.stat, but tmpfs pages and the dirty ones or under writeback */
+static guint64 read_clean_page_cache(const gchar *dir)
+{
+  gchar *path = g_build_filename(dir, "memory.stat", NULL);
+  gchar *contents = NULL;
+  guint64 file = 0, shmem = 0, dirty = 0, writeback = 0;
+
+  if (g_file_get_contents(path, &contents, NULL, NULL)) {
+    gchar **lines = g_strsplit(contents, "\n", -1);
+
+    for (gchar **line = lines; *line != NULL; line++) {
+      if (g_str_has_prefix(*line, "file "))
+        file = g_ascii_strtoull(*line + strlen("file "), NULL, 10);
+      else if (g_str_has_prefix(*line, "shmem "))
+        shmem = g_ascii_strtoull(*line + strlen("shmem "), NULL, 10);
+      else if (g_str_has_prefix(*line, "file_dirty "))
+        dirty = g_ascii_strtoull(*line + strlen("file_dirty "), NULL, 10);
+      else if (g_str_has_prefix(*line, "file_writeback "))
+        writeback = g_ascii_strtoull(*line + strlen("file_writeback "), NULL, 10);
+    }
+    g_strfreev(lines);
+  }
+  g_free(contents);
+  g_free(path);
+
+  return file > shmem + dirty + writeback ? file - shmem - dirty - writeback : 0;
+}
+
+/* This function reads the avg10 of the "some" and "full" lines of a PSI file */
+static void read_pressure(const gchar *path, gdouble *some, gdouble *full)
+{
+  gchar *contents = NULL;
+
+  *some = *full = 0;
+  if (!g_file_get_contents(path, &contents, NULL, NULL))
+    return;
+
+  gchar **lines = g_strsplit(contents, "\n", -1);
+  for (gchar **line = lines; *line != NULL; line++) {
+    const gchar *avg10 = strstr(*line, "avg10=");
+
+    if (avg10 == NULL)
+      continue;
+    if (g_str_has_prefix(*line, "some "))
+      *some = g_ascii_strtod(avg10 + strlen("avg10="), NULL);
+    else if (g_str_has_prefix(*line, "full "))
+      *full = g_ascii_strtod(avg10 + strlen("avg10="), NULL);
+  }
+  g_strfreev(lines);
+  g_free(contents);
+}
+
+/* This function reads the RAM of the host and what is not available of it, without cgroup v2 */
+static void read_host_usage(MemoryGovernorStats *stats)
+{
+  guint64 total = 0, available = 0;
+  gchar *contents = NULL;
+
+  if (!g_file_get_contents("/proc/meminfo", &contents, NULL, NULL))
+    return;
+
+  gchar **lines = g_strsplit(contents, "\n", -1);
+  for (gchar **line = lines; *line != NULL; line++) {
+    if (g_str_has_prefix(*line, "MemTotal:"))
+      total = g_ascii_strtoull(*line + strlen("MemTotal:"), NULL, 10) * 1024;
+    else if (g_str_has_prefix(*line, "MemAvailable:"))
+      available = g_ascii_strtoull(*line + strlen("MemAvailable:"), NULL, 10) * 1024;
+  }
+  g_strfreev(lines);
+  g_free(contents);
+
+  stats->limit = total;
+  stats->current = total > available ? total - available : 0;
+}
+
+/* This function reads the usage and limit of the cgroup of the process. A limit may be set on
+ * any ancestor, a systemd slice for example, so the one closest to its limit is reported.
+ * memory.current includes the page cache, which a player streaming large files keeps close to
+ * memory.high on its own: the clean part of it is left out, the kernel reclaims it before the
+ * caches of the player are of any help. Real reclaim trouble shows in the PSI pressure */
+static void read_usage(MemoryGovernor *governor, MemoryGovernorStats *stats)
+{
+  gdouble worst = -1;
+
+  if (governor->cgroup == NULL) {
+    read_host_usage(stats);
+    read_pressure("/proc/pressure/memory", &stats->some_avg10, &stats->full_avg10);
+    return;
+  }
+
+  gchar *dir = g_strdup(governor->cgroup);
+  do {
+    guint64 current, high = G_MAXUINT64, max = G_MAXUINT64;
+
+    if (read_bytes(dir, "memory.current", &current)) {
+      guint64 page_cache = MIN(read_clean_page_cache(dir), current);
+
+      read_bytes(dir, "memory.high", &high);
+      read_bytes(dir, "memory.max", &max);
+      current -= page_cache;
+
+      guint64 limit = MIN(high, max);
+      if (worst < 0) {
+        stats->current = current;
+        stats->page_cache = page_cache;
+        worst = 0;
+      }
+      if (limit != G_MAXUINT64 && limit > 0 && (gdouble) current / limit > worst) {
+        worst = (gdouble) current / limit;
+        stats->current = current;
+        stats->page_cache = page_cache;
+        stats->limit = limit;
+      }
+    }
+
+    gchar *parent = g_path_get_dirname(dir);
+    g_free(dir);
+    dir = parent;
+  } while (g_str_has_prefix(dir, CGROUP_ROOT "/"));
+  g_free(dir);
+
+  /* Without a limit up to the root, the RAM of the host is the limit */
+  if (stats->limit == 0) {
+    MemoryGovernorStats host = { 0 };
+
+    read_host_usage(&host);
+    stats->limit = host.limit;
+  }
+
+  gchar *pressure = g_build_filename(governor->cgroup, "memory.pressure", NULL);
+  read_pressure(pressure, &stats->some_avg10, &stats->full_avg10);
+  g_free(pressure);
+}
+
+/* This function gives the cgroup v2 directory of the process, NULL if it has no memory controller */
+static gchar *find_cgroup(void)
+{
+  gchar *contents = NULL;
+  gchar *dir = NULL;
+
+  if (!g_file_get_contents("/proc/self/cgroup", &contents, NULL, NULL))
+    return NULL;
+
+  gchar **lines = g_strsplit(contents, "\n", -1);
+  for (gchar **line = lines; *line != NULL && dir == NULL; line++) {
+    if (!g_str_has_prefix(*line, "0::"))
+      continue;
+
+    dir = g_build_filename(CGROUP_ROOT, *line + strlen("0::"), NULL);
+    gchar *current = g_build_filename(dir, "memory.current", NULL);
+    if (!g_file_test(current, G_FILE_TEST_EXISTS))
+      g_clear_pointer(&dir, g_free);
+    g_free(current);
+  }
+  g_strfreev(lines);
+  g_free(contents);
+
+  return dir;
+}
+
+static MemoryLevel get_level(const MemoryGovernorStats *stats)
+{
+  gdouble usage = stats->limit > 0 ? (gdouble) stats->current / stats->limit : 0;
+
+  if (usage >= CRITICAL_USAGE || stats->full_avg10 >= CRITICAL_PRESSURE)
+    return MEMORY_LEVEL_CRITICAL;
+  if (usage >= MODERATE_USAGE || stats->some_avg10 >= MODERATE_PRESSURE)
+    return MEMORY_LEVEL_MODERATE;
+  return MEMORY_LEVEL_NORMAL;
+}
+
+/* This function lowers the budgets of the caches, lowest priority first, until need bytes are
+ * given back. It returns the bytes the caches were asked to free */
+static guint64 shrink_caches(MemoryGovernor *governor, guint64 need)
+{
+  guint64 shrunk = 0;
+
+  for (GList *l = governor->caches; l != NULL && need > 0; l = l->next) {
+    MemoryCache *cache = l->data;
+    guint64 size = cache->size(cache->user_data);
+
+    if (size == 0)
+      continue;
+
+    guint64 freed = MIN(size, need);
+    cache->allowed = MIN(cache->allowed, size - freed);
+    cache->set_budget(cache->allowed, cache->user_data);
+    need -= freed;
+    shrunk += freed;
+  }
+
+  return shrunk;
+}
+
+static void relax_caches(MemoryGovernor *governor)
+{
+  for (GList *l = governor->caches; l != NULL; l = l->next) {
+    MemoryCache *cache = l->data;
+
+    if (cache->allowed < cache->budget) {
+      cache->allowed = cache->budget;
+      cache->set_budget(cache->allowed, cache->user_data);
+    }
+  }
+}
+
+/* This function reads the memory state, and shrinks the caches if it is not normal. It is called
+ * periodically and on PSI events, and may be called by the application before a large allocation */
+void memory_governor_update(MemoryGovernor *governor)
+{
+  MemoryGovernorStats stats = { 0 };
+  guint64 need = 0;
+
+  g_return_if_fail(governor != NULL);
+
+  read_usage(governor, &stats);
+  for (GList *l = governor->caches; l != NULL; l = l->next) {
+    MemoryCache *cache = l->data;
+
+    stats.cache_bytes += cache->size(cache->user_data);
+  }
+  stats.level = get_level(&stats);
+
+  /* Usage goes back to the target, and stalls free a share of the caches even far from the limit */
+  if (stats.level != MEMORY_LEVEL_NORMAL) {
+    guint64 target = (guint64) (stats.limit * TARGET_USAGE);
+
+    if (stats.limit > 0 && stats.current > target)
+      need = stats.current - target;
+    if (stats.some_avg10 >= MODERATE_PRESSURE)
+      need = MAX(need, stats.cache_bytes / 4);
+    if (stats.level == MEMORY_LEVEL_CRITICAL)
+      need = MAX(need, stats.cache_bytes / 2);
+  }
+
+  guint64 shrunk = 0;
+  if (need > 0) {
+    shrunk = shrink_caches(governor, need);
+    governor->relax_count = 0;
+  } else if (stats.level == MEMORY_LEVEL_NORMAL && ++governor->relax_count == RELAX_UPDATES) {
+    relax_caches(governor);
+  }
+
+  g_mutex_lock(&governor->lock);
+  stats.shrinks = governor->stats.shrinks + (shrunk > 0);
+  stats.shrunk_bytes = governor->stats.shrunk_bytes + shrunk;
+  if (shrunk > 0 && stats.level != governor->stats.level)
+    g_printerr("Memory %s: %" G_GUINT64_FORMAT " of %" G_GUINT64_FORMAT " MB used, %.1f%% stalled, "
+        "%" G_GUINT64_FORMAT " MB of caches freed\n", level_names[stats.level], stats.current >> 20,
+        stats.limit >> 20, stats.some_avg10, shrunk >> 20);
+  governor->stats = stats;
+  g_mutex_unlock(&governor->lock);
+}
+
+static gboolean timer_cb(MemoryGovernor *governor)
+{
+  memory_governor_update(governor);
+  return G_SOURCE_CONTINUE;
+}
+
+static gboolean trigger_cb(gint fd, GIOCondition condition, MemoryGovernor *governor)
+{
+  /* The cgroup was removed, the timer goes on with the host */
+  if (condition & (G_IO_ERR | G_IO_HUP)) {
+    governor->trigger_id = 0;
+    return G_SOURCE_REMOVE;
+  }
+
+  memory_governor_update(governor);
+  return G_SOURCE_CONTINUE;
+}
+
+/* This function asks the kernel to wake the governor up when memory stalls, so it does not wait
+ * for its next update. Unprivileged triggers need a window of 2 s on older kernels, then the
+ * timer alone is used */
+static void install_trigger(MemoryGovernor *governor)
+{
+  gchar *path = governor->cgroup != NULL ? g_build_filename(governor->cgroup, "memory.pressure", NULL) :
+      g_strdup("/proc/pressure/memory");
+
+  governor->trigger_fd = g_open(path, O_RDWR | O_NONBLOCK | O_CLOEXEC, 0);
+  g_free(path);
+  if (governor->trigger_fd < 0)
+    return;
+
+  if (write(governor->trigger_fd, PSI_TRIGGER, strlen(PSI_TRIGGER) + 1) < 0) {
+    close(governor->trigger_fd);
+    governor->trigger_fd = -1;
+    return;
+  }
+
+  governor->trigger_id = g_unix_fd_add(governor->trigger_fd, G_IO_PRI | G_IO_ERR | G_IO_HUP,
+      (GUnixFDSourceFunc) trigger_cb, governor);
+}
+
+/* This function starts following the cgroup in cgroup_dir, or the cgroup of the process if NULL,
+ * every interval_ms from the main loop. Without cgroup v2, the memory of the host is followed */
+MemoryGovernor *memory_governor_new(const gchar *cgroup_dir, guint interval_ms)
+{
+  g_return_val_if_fail(interval_ms > 0, NULL);
+
+  MemoryGovernor *governor = g_new0(MemoryGovernor, 1);
+  governor->cgroup = cgroup_dir != NULL ? g_strdup(cgroup_dir) : find_cgroup();
+  governor->next_id = 1;
+  governor->trigger_fd = -1;
+  g_mutex_init(&governor->lock);
+
+  install_trigger(governor);
+  governor->timer_id = g_timeout_add(interval_ms, (GSourceFunc) timer_cb, governor);
+  memory_governor_update(governor);
+
+  return governor;
+}
+
+static void memory_cache_free(MemoryCache *cache)
+{
+  g_free(cache->name);
+  g_free(cache);
+}
+
+void memory_governor_free(MemoryGovernor *governor)
+{
+  g_return_if_fail(governor != NULL);
+
+  g_source_remove(governor->timer_id);
+  if (governor->trigger_id != 0)
+    g_source_remove(governor->trigger_id);
+  if (governor->trigger_fd >= 0)
+    close(governor->trigger_fd);
+  g_list_free_full(governor->caches, (GDestroyNotify) memory_cache_free);
+  g_free(governor->cgroup);
+  g_mutex_clear(&governor->lock);
+  g_free(governor);
+}
+
+static gint compare_priorities(const MemoryCache *a, const MemoryCache *b)
+{
+  return a->priority < b->priority ? -1 : a->priority > b->priority;
+}
+
+/* This function registers a cache that may hold up to budget bytes. Under pressure, caches of
+ * lower priority are shrunk first. It returns an ID for memory_governor_remove_cache() */
+guint memory_governor_add_cache(MemoryGovernor *governor, const gchar *name, gint priority, guint64 budget,
+    MemoryCacheSizeFunc size, MemoryCacheBudgetFunc set_budget, gpointer user_data)
+{
+  g_return_val_if_fail(governor != NULL && name != NULL, 0);
+  g_return_val_if_fail(size != NULL && set_budget != NULL, 0);
+
+  MemoryCache *cache = g_new0(MemoryCache, 1);
+  cache->id = governor->next_id++;
+  cache->name = g_strdup(name);
+  cache->priority = priority;
+  cache->budget = cache->allowed = budget;
+  cache->size = size;
+  cache->set_budget = set_budget;
+  cache->user_data = user_data;
+  governor->caches = g_list_insert_sorted(governor->caches, cache, (GCompareFunc) compare_priorities);
+
+  set_budget(budget, user_data);
+  return cache->id;
+}
+
+void memory_governor_remove_cache(MemoryGovernor *governor, guint id)
+{
+  g_return_if_fail(governor != NULL);
+
+  for (GList *l = governor->caches; l != NULL; l = l->next) {
+    MemoryCache *cache = l->data;
+
+    if (cache->id == id) {
+      governor->caches = g_list_delete_link(governor->caches, l);
+      memory_cache_free(cache);
+      return;
+    }
+  }
+}
+
+/* This function gives the cgroup directory followed, NULL if the memory of the host is */
+const gchar *memory_governor_get_cgroup(MemoryGovernor *governor)
+{
+  g_return_val_if_fail(governor != NULL, NULL);
+
+  return governor->cgroup;
+}
+
+void memory_governor_get_stats(MemoryGovernor *governor, MemoryGovernorStats *stats)
+{
+  g_return_if_fail(governor != NULL && stats != NULL);
+
+  g_mutex_lock(&governor->lock);
+  *stats = governor->stats;
+  g_mutex_unlock(&governor->lock);
+}
+
+/* This function formats the memory state for the HUD or a report
+ * The returned string should be freed with g_free() when no longer needed.
+*/
+gchar *memory_governor_stats_to_string(const MemoryGovernorStats *stats)
+{
+  g_return_val_if_fail(stats != NULL, NULL);
+
+  return g_strdup_printf("Memory: %" G_GUINT64_FORMAT "/%" G_GUINT64_FORMAT " MB, %s, page cache %" G_GUINT64_FORMAT
+                         " MB\n"
+                         "Memory stall: %.1f%% some, %.1f%% full\n"
+                         "Caches: %.1f MB, %" G_GUINT64_FORMAT " shrinks",
+                         stats->current >> 20, stats->limit >> 20, level_names[stats->level], stats->page_cache >> 20,
+                         stats->some_avg10, stats->full_avg10, stats->cache_bytes / (1024.0 * 1024.0),
+                         stats->shrinks);
+}
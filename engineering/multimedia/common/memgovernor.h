@@ -0,0 +1,56 @@
+#ifndef MEMORY_GOVERNOR_H
+#define MEMORY_GOVERNOR_H
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/* How close the process is to running out of memory */
+typedef enum
+{
+  MEMORY_LEVEL_NORMAL,
+  MEMORY_LEVEL_MODERATE,   /* Caches are shrunk, lowest priority first, until usage is back to the target */
+  MEMORY_LEVEL_CRITICAL    /* Same, freeing at least half of what the caches hold */
+} MemoryLevel;
+
+/* Memory state of the cgroup of the process, filled by memory_governor_get_stats() */
+typedef struct _MemoryGovernorStats
+{
+  guint64 current;         /* Memory charged to the cgroup but its clean page cache, or used on the host
+                            * without cgroup v2 */
+  guint64 page_cache;      /* Clean page cache charged to the cgroup, which the kernel reclaims on its own */
+  guint64 limit;           /* memory.high, else memory.max, else the RAM of the host, 0 if unknown */
+  gdouble some_avg10;      /* Share of the last 10 s some task stalled on memory, in percent */
+  gdouble full_avg10;      /* Share of the last 10 s all tasks stalled on memory, in percent */
+  MemoryLevel level;
+  guint64 cache_bytes;     /* Bytes held by the registered caches */
+  guint64 shrinks;         /* Times the budgets of the caches were lowered */
+  guint64 shrunk_bytes;    /* Bytes the caches were asked to give back */
+} MemoryGovernorStats;
+
+/* Gives the bytes held by a cache, it may run on any thread */
+typedef guint64 (*MemoryCacheSizeFunc)(gpointer user_data);
+/* Sets the bytes a cache may hold. The cache frees what is above at once, and keeps under it
+ * until the next call. It is called from the main context the governor was created on */
+typedef void (*MemoryCacheBudgetFunc)(guint64 budget, gpointer user_data);
+
+/* Follows the memory usage and pressure of the cgroup of the process, and shrinks the registered
+ * caches when they rise */
+typedef struct _MemoryGovernor MemoryGovernor;
+
+MemoryGovernor *memory_governor_new(const gchar *cgroup_dir, guint interval_ms);
+void memory_governor_free(MemoryGovernor *governor);
+
+guint memory_governor_add_cache(MemoryGovernor *governor, const gchar *name, gint priority, guint64 budget,
+    MemoryCacheSizeFunc size, MemoryCacheBudgetFunc set_budget, gpointer user_data);
+void memory_governor_remove_cache(MemoryGovernor *governor, guint id);
+
+void memory_governor_update(MemoryGovernor *governor);
+
+const gchar *memory_governor_get_cgroup(MemoryGovernor *governor);
+void memory_governor_get_stats(MemoryGovernor *governor, MemoryGovernorStats *stats);
+gchar *memory_governor_stats_to_string(const MemoryGovernorStats *stats);
+
+G_END_DECLS
+
+#endif /* MEMORY_GOVERNOR_H */
@@ -0,0 +1,354 @@
+#include "metrics.h"
+
+#include <string.h>
+#include <stdatomic.h>
+#include <gio/gio.h>
+
+typedef enum
+{
+  METRIC_TYPE_COUNTER,
+  METRIC_TYPE_GAUGE,
+  METRIC_TYPE_HISTOGRAM
+} MetricType;
+
+static const gchar *metric_type_strings[] = {
+    [METRIC_TYPE_COUNTER]   = "counter",
+    [METRIC_TYPE_GAUGE]     = "gauge",
+    [METRIC_TYPE_HISTOGRAM] = "histogram"
+  };
+
+struct _Metric
+{
+  MetricType type;
+  gchar *name;
+  gchar *help;
+  _Atomic guint64 value;    /* Counter value, or gauge value as the bits of a gdouble */
+  gdouble *bounds;          /* Upper bounds of the histogram buckets */
+  guint n_bounds;
+  _Atomic guint64 *buckets; /* Observations per bucket, the last one is +Inf */
+  _Atomic guint64 count;    /* Number of observations */
+  _Atomic guint64 sum;      /* Sum of the observations as the bits of a gdouble */
+};
+
+typedef struct _MetricsCollector
+{
+  MetricsCollectFunc func;
+  gpointer user_data;
+} MetricsCollector;
+
+/* Registration and export take the lock, updates never do */
+static struct
+{
+  GMutex lock;
+  GPtrArray *metrics;
+  GArray *collectors;
+  GThread *writer;          /* Periodic textfile writer */
+  GCond writer_cond;
+  gboolean writer_running;
+  gchar *textfile_path;
+  guint interval_seconds;
+  GSocketService *service;  /* Local HTTP endpoint */
+} metrics;
+
+static guint64 double_to_bits(gdouble value)
+{
+  guint64 bits;
+
+  memcpy(&bits, &value, sizeof(bits));
+  return bits;
+}
+
+static gdouble bits_to_double(guint64 bits)
+{
+  gdouble value;
+
+  memcpy(&value, &bits, sizeof(value));
+  return value;
+}
+
+static void ensure_registry_locked(void)
+{
+  if (metrics.metrics != NULL)
+    return;
+
+  metrics.metrics = g_ptr_array_new();
+  metrics.collectors = g_array_new(FALSE, FALSE, sizeof(MetricsCollector));
+}
+
+static Metric *metric_register(MetricType type, const gchar *name, const gchar *help)
+{
+  Metric *metric = g_new0(Metric, 1);
+
+  metric->type = type;
+  metric->name = g_strdup(name);
+  metric->help = g_strdup(help);
+
+  g_mutex_lock(&metrics.lock);
+  ensure_registry_locked();
+  g_ptr_array_add(metrics.metrics, metric);
+  g_mutex_unlock(&metrics.lock);
+
+  return metric;
+}
+
+Metric *metrics_counter_new(const gchar *name, const gchar *help)
+{
+  return metric_register(METRIC_TYPE_COUNTER, name, help);
+}
+
+Metric *metrics_gauge_new(const gchar *name, const gchar *help)
+{
+  return metric_register(METRIC_TYPE_GAUGE, name, help);
+}
+
+/* Bounds must be sorted in increasing order, the +Inf bucket is implicit */
+Metric *metrics_histogram_new(const gchar *name, const gchar *help, const gdouble *bounds, guint n_bounds)
+{
+  Metric *metric = metric_register(METRIC_TYPE_HISTOGRAM, name, help);
+
+  metric->bounds = g_new(gdouble, n_bounds);
+  memcpy(metric->bounds, bounds, n_bounds * sizeof(gdouble));
+  metric->n_bounds = n_bounds;
+  metric->buckets = g_new0(_Atomic guint64, n_bounds + 1);
+
+  return metric;
+}
+
+void metric_inc(Metric *metric)
+{
+  metric_add(metric, 1);
+}
+
+void metric_add(Metric *metric, guint64 value)
+{
+  g_return_if_fail(metric != NULL && metric->type == METRIC_TYPE_COUNTER);
+
+  atomic_fetch_add_explicit(&metric->value, value, memory_order_relaxed);
+}
+
+/* Gauges can be set to any value. Counters can only be set by a collector
+ * mirroring a monotonic value maintained elsewhere */
+void metric_set(Metric *metric, gdouble value)
+{
+  g_return_if_fail(metric != NULL && metric->type != METRIC_TYPE_HISTOGRAM);
+
+  if (metric->type == METRIC_TYPE_COUNTER)
+    atomic_store_explicit(&metric->value, (guint64) value, memory_order_relaxed);
+  else
+    atomic_store_explicit(&metric->value, double_to_bits(value), memory_order_relaxed);
+}
+
+void metric_observe(Metric *metric, gdouble value)
+{
+  guint bucket = 0;
+
+  g_return_if_fail(metric != NULL && metric->type == METRIC_TYPE_HISTOGRAM);
+
+  while (bucket < metric->n_bounds && value > metric->bounds[bucket])
+    bucket++;
+
+  atomic_fetch_add_explicit(&metric->buckets[bucket], 1, memory_order_relaxed);
+  atomic_fetch_add_explicit(&metric->count, 1, memory_order_relaxed);
+
+  guint64 old_bits = atomic_load_explicit(&metric->sum, memory_order_relaxed);
+  while (!atomic_compare_exchange_weak_explicit(&metric->sum, &old_bits,
+      double_to_bits(bits_to_double(old_bits) + value), memory_order_relaxed, memory_order_relaxed))
+    ;
+}
+
+void metrics_add_collector(MetricsCollectFunc func, gpointer user_data)
+{
+  MetricsCollector collector = { func, user_data };
+
+  g_return_if_fail(func != NULL);
+
+  g_mutex_lock(&metrics.lock);
+  ensure_registry_locked();
+  g_array_append_val(metrics.collectors, collector);
+  g_mutex_unlock(&metrics.lock);
+}
+
+static void append_double(GString *out, gdouble value)
+{
+  gchar buffer[G_ASCII_DTOSTR_BUF_SIZE];
+
+  g_string_append(out, g_ascii_dtostr(buffer, sizeof(buffer), value));
+}
+
+static void render_metric(GString *out, Metric *metric)
+{
+  g_string_append_printf(out, "# HELP %s %s\n# TYPE %s %s\n",
+      metric->name, metric->help, metric->name, metric_type_strings[metric->type]);
+
+  switch (metric->type) {
+    case METRIC_TYPE_COUNTER:
+      g_string_append_printf(out, "%s %" G_GUINT64_FORMAT "\n", metric->name,
+          atomic_load_explicit(&metric->value, memory_order_relaxed));
+      break;
+
+    case METRIC_TYPE_GAUGE:
+      g_string_append_printf(out, "%s ", metric->name);
+      append_double(out, bits_to_double(atomic_load_explicit(&metric->value, memory_order_relaxed)));
+      g_string_append_c(out, '\n');
+      break;
+
+    case METRIC_TYPE_HISTOGRAM: {
+      guint64 cumulative = 0;
+
+      for (guint i = 0; i <= metric->n_bounds; i++) {
+        cumulative += atomic_load_explicit(&metric->buckets[i], memory_order_relaxed);
+        g_string_append_printf(out, "%s_bucket{le=\"", metric->name);
+        if (i < metric->n_bounds)
+          append_double(out, metric->bounds[i]);
+        else
+          g_string_append(out, "+Inf");
+        g_string_append_printf(out, "\"} %" G_GUINT64_FORMAT "\n", cumulative);
+      }
+
+      g_string_append_printf(out, "%s_sum ", metric->name);
+      append_double(out, bits_to_double(atomic_load_explicit(&metric->sum, memory_order_relaxed)));
+      /* Observations racing with the export are counted in the buckets but not yet in count */
+      g_string_append_printf(out, "\n%s_count %" G_GUINT64_FORMAT "\n", metric->name,
+          MAX(cumulative, atomic_load_explicit(&metric->count, memory_order_relaxed)));
+      break;
+    }
+  }
+}
+
+/* This function renders all the registered metrics in the Prometheus text format
+ * The returned string should be freed with g_free() when no longer needed.
+*/
+gchar *metrics_render(void)
+{
+  GString *out = g_string_new(NULL);
+
+  g_mutex_lock(&metrics.lock);
+  if (metrics.metrics != NULL) {
+    for (guint i = 0; i < metrics.collectors->len; i++) {
+      MetricsCollector *collector = &g_array_index(metrics.collectors, MetricsCollector, i);
+      collector->func(collector->user_data);
+    }
+    for (guint i = 0; i < metrics.metrics->len; i++)
+      render_metric(out, g_ptr_array_index(metrics.metrics, i));
+  }
+  g_mutex_unlock(&metrics.lock);
+
+  return g_string_free(out, FALSE);
+}
+
+/* This function writes the metrics for the node_exporter textfile collector.
+ * g_file_set_contents() writes a temporary file and renames it, so readers never see a partial file */
+gboolean metrics_write_textfile(const gchar *path, GError **error)
+{
+  gchar *contents = metrics_render();
+  gboolean res = g_file_set_contents(path, contents, -1, error);
+
+  g_free(contents);
+  return res;
+}
+
+static gpointer writer_thread_func(gpointer user_data)
+{
+  GError *error = NULL;
+
+  g_mutex_lock(&metrics.lock);
+  while (metrics.writer_running) {
+    gint64 deadline = g_get_monotonic_time() + metrics.interval_seconds * G_TIME_SPAN_SECOND;
+    while (metrics.writer_running && g_cond_wait_until(&metrics.writer_cond, &metrics.lock, deadline))
+      ;
+
+    /* Write one last time on shutdown too */
+    g_mutex_unlock(&metrics.lock);
+    if (!metrics_write_textfile(metrics.textfile_path, &error)) {
+      g_printerr("Could not write metrics: %s\n", error->message);
+      g_clear_error(&error);
+    }
+    g_mutex_lock(&metrics.lock);
+  }
+  g_mutex_unlock(&metrics.lock);
+
+  return NULL;
+}
+
+/* This function starts a thread writing the metrics to path every interval_seconds */
+void metrics_start_textfile_writer(const gchar *path, guint interval_seconds)
+{
+  g_return_if_fail(path != NULL);
+  g_return_if_fail(interval_seconds > 0);
+  g_return_if_fail(metrics.writer == NULL);
+
+  metrics.textfile_path = g_strdup(path);
+  metrics.interval_seconds = interval_seconds;
+  metrics.writer_running = TRUE;
+  metrics.writer = g_thread_new("metrics-writer", writer_thread_func, NULL);
+}
+
+/* This function answers any request on the metrics port with the current metrics, it runs in the service thread pool */
+static gboolean metrics_run_cb(GThreadedSocketService *service, GSocketConnection *connection,
+    GObject *source_object, gpointer user_data)
+{
+  GInputStream *input = g_io_stream_get_input_stream(G_IO_STREAM(connection));
+  GOutputStream *output = g_io_stream_get_output_stream(G_IO_STREAM(connection));
+  gchar request[1024];
+
+  /* The request itself does not matter, there is a single resource */
+  g_input_stream_read(input, request, sizeof(request), NULL, NULL);
+
+  gchar *body = metrics_render();
+  gchar *response = g_strdup_printf("HTTP/1.0 200 OK\r\n"
+                                    "Content-Type: text/plain; version=0.0.4\r\n"
+                                    "Content-Length: %" G_GSIZE_FORMAT "\r\n"
+                                    "\r\n%s", strlen(body), body);
+  g_output_stream_write_all(output, response, strlen(response), NULL, NULL, NULL);
+
+  g_free(response);
+  g_free(body);
+  return TRUE;
+}
+
+/* This function serves the metrics over HTTP on the loopback interface */
+gboolean metrics_serve(guint16 port, GError **error)
+{
+  g_return_val_if_fail(metrics.service == NULL, FALSE);
+
+  GSocketService *service = g_threaded_socket_service_new(1);
+  GInetAddress *loopback = g_inet_address_new_loopback(G_SOCKET_FAMILY_IPV4);
+  GSocketAddress *address = g_inet_socket_address_new(loopback, port);
+  gboolean res = g_socket_listener_add_address(G_SOCKET_LISTENER(service), address,
+      G_SOCKET_TYPE_STREAM, G_SOCKET_PROTOCOL_TCP, NULL, NULL, error);
+
+  g_object_unref(address);
+  g_object_unref(loopback);
+
+  if (!res) {
+    g_object_unref(service);
+    return FALSE;
+  }
+
+  g_signal_connect(service, "run", G_CALLBACK(metrics_run_cb), NULL);
+  g_socket_service_start(service);
+  metrics.service = service;
+
+  return TRUE;
+}
+
+/* This function stops the writer, after a final write, and the HTTP endpoint */
+void metrics_shutdown(void)
+{
+  if (metrics.writer != NULL) {
+    g_mutex_lock(&metrics.lock);
+    metrics.writer_running = FALSE;
+    g_cond_signal(&metrics.writer_cond);
+    g_mutex_unlock(&metrics.lock);
+
+    g_thread_join(metrics.writer);
+    metrics.writer = NULL;
+    g_clear_pointer(&metrics.textfile_path, g_free);
+  }
+
+  if (metrics.service != NULL) {
+    g_socket_service_stop(metrics.service);
+    g_socket_listener_close(G_SOCKET_LISTENER(metrics.service));
+    g_clear_object(&metrics.service);
+  }
+}
@@ -0,0 +1,35 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/* A counter, gauge or histogram exported in the Prometheus text format */
+typedef struct _Metric Metric;
+
+/* Called before every export to refresh metrics mirrored from other sources,
+ * it may run on any thread */
+typedef void (*MetricsCollectFunc)(gpointer user_data);
+
+Metric *metrics_counter_new(const gchar *name, const gchar *help);
+Metric *metrics_gauge_new(const gchar *name, const gchar *help);
+Metric *metrics_histogram_new(const gchar *name, const gchar *help, const gdouble *bounds, guint n_bounds);
+
+/* Hot path operations, lock-free */
+void metric_inc(Metric *metric);
+void metric_add(Metric *metric, guint64 value);
+void metric_set(Metric *metric, gdouble value);
+void metric_observe(Metric *metric, gdouble value);
+
+void metrics_add_collector(MetricsCollectFunc func, gpointer user_data);
+gchar *metrics_render(void);
+
+gboolean metrics_write_textfile(const gchar *path, GError **error);
+void metrics_start_textfile_writer(const gchar *path, guint interval_seconds);
+gboolean metrics_serve(guint16 port, GError **error);
+void metrics_shutdown(void);
+
+G_END_DECLS
+
+#endif /* METRICS_H */
@@ -0,0 +1,392 @@
+#include "netsync.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include <gio/gio.h>
+#include <gst/net/net.h>
+
+#define NET_SYNC_START_DELAY  (3 * GST_SECOND)   /* Time the other processes have to join before the first frame */
+#define NET_SYNC_LATENCY      (500 * GST_MSECOND) /* Same pipeline latency everywhere, whatever the local sinks ask for */
+#define NET_SYNC_JOIN_DELAY   (1 * GST_SECOND)   /* Time a late pipeline has to seek and preroll before it joins the schedule */
+#define NET_SYNC_TIMEOUT_S    5
+#define NET_SYNC_STATS_NAME   "gst-netclock-statistics"
+
+struct _NetSync
+{
+  gboolean master;
+  GstElement *pipeline;
+  GstClock *clock;                 /* System clock on the master, network client clock on the slaves */
+  GstClockTime base_time;          /* Base time shared by all the processes */
+  GstNetTimeProvider *provider;    /* Publishes the clock over UDP, master only */
+  GSocketService *service;         /* Hands the base time out over TCP, master only */
+
+  GMutex lock;                     /* Protects the fields below, written from the streaming and bus threads */
+  FILE *log;                       /* Per frame presentation log, NULL if none */
+  GstClockTime join_position;      /* Stream time the pipeline joined the schedule at, 0 if on time */
+  gboolean synchronised;
+  GstClockTimeDiff clock_offset;
+  GstClockTime rtt;
+  gdouble error_sum;               /* Sum of the lateness of the measured frames, in nanoseconds */
+  GstClockTimeDiff error_max;
+  guint64 frames;
+};
+
+/* This function gives the process-wide monotonic time in nanoseconds. It is the clock
+ * GstSystemClock uses, so on one host these values compare across processes */
+static gint64 monotonic_ns(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (gint64) ts.tv_sec * GST_SECOND + ts.tv_nsec;
+}
+
+/* This function splits ADDRESS:PORT, the address is freed by the caller with g_free() */
+gboolean net_sync_parse_address(const gchar *str, gchar **address, guint16 *port)
+{
+  g_return_val_if_fail(str != NULL, FALSE);
+
+  const gchar *colon = strrchr(str, ':');
+  gchar *end = NULL;
+
+  if (colon == NULL || colon == str)
+    return FALSE;
+
+  guint64 parsed_port = g_ascii_strtoull(colon + 1, &end, 10);
+  if (end == colon + 1 || *end != '\0' || parsed_port == 0 || parsed_port > G_MAXUINT16)
+    return FALSE;
+
+  *address = g_strndup(str, colon - str);
+  *port = parsed_port;
+  return TRUE;
+}
+
+/* This function makes the pipeline run on the shared clock and base time, instead of
+ * picking its own when it goes to PLAYING */
+static void net_sync_apply(NetSync *sync)
+{
+  gst_pipeline_use_clock(GST_PIPELINE(sync->pipeline), sync->clock);
+  gst_element_set_start_time(sync->pipeline, GST_CLOCK_TIME_NONE);
+  gst_element_set_base_time(sync->pipeline, sync->base_time);
+  gst_pipeline_set_latency(GST_PIPELINE(sync->pipeline), NET_SYNC_LATENCY);
+}
+
+static NetSync *net_sync_new(GstElement *pipeline, gboolean master)
+{
+  NetSync *sync = g_new0(NetSync, 1);
+
+  sync->master = master;
+  sync->pipeline = gst_object_ref(pipeline);
+  g_mutex_init(&sync->lock);
+  return sync;
+}
+
+/* This function answers every connection on the base time port with the base time, it runs in the service thread pool */
+static gboolean base_time_run_cb(GThreadedSocketService *service, GSocketConnection *connection,
+    GObject *source_object, NetSync *sync)
+{
+  GOutputStream *output = g_io_stream_get_output_stream(G_IO_STREAM(connection));
+  gchar *line = g_strdup_printf("%" G_GUINT64_FORMAT "\n", sync->base_time);
+
+  g_output_stream_write_all(output, line, strlen(line), NULL, NULL, NULL);
+  g_free(line);
+  return TRUE;
+}
+
+/* This function publishes the pipeline clock on address:port, UDP for the clock and TCP for
+ * the base time. The first frame is shown NET_SYNC_START_DELAY after this call, so the slaves
+ * should be started before */
+NetSync *net_sync_new_master(GstElement *pipeline, const gchar *address, guint16 port, GError **error)
+{
+  g_return_val_if_fail(GST_IS_PIPELINE(pipeline), NULL);
+  g_return_val_if_fail(address != NULL, NULL);
+
+  NetSync *sync = net_sync_new(pipeline, TRUE);
+  sync->clock = gst_system_clock_obtain();
+  sync->synchronised = TRUE;
+
+  sync->provider = gst_net_time_provider_new(sync->clock, address, port);
+  if (sync->provider == NULL) {
+    g_set_error(error, G_IO_ERROR, G_IO_ERROR_FAILED, "Could not publish the clock on %s:%u", address, port);
+    net_sync_free(sync);
+    return NULL;
+  }
+
+  GSocketAddress *socket_address = g_inet_socket_address_new_from_string(address, port);
+  if (socket_address == NULL) {
+    g_set_error(error, G_IO_ERROR, G_IO_ERROR_INVALID_ARGUMENT, "Invalid address %s", address);
+    net_sync_free(sync);
+    return NULL;
+  }
+
+  sync->service = g_threaded_socket_service_new(1);
+  gboolean res = g_socket_listener_add_address(G_SOCKET_LISTENER(sync->service), socket_address,
+      G_SOCKET_TYPE_STREAM, G_SOCKET_PROTOCOL_TCP, NULL, NULL, error);
+  g_object_unref(socket_address);
+  if (!res) {
+    net_sync_free(sync);
+    return NULL;
+  }
+
+  sync->base_time = gst_clock_get_time(sync->clock) + NET_SYNC_START_DELAY;
+  g_signal_connect(sync->service, "run", G_CALLBACK(base_time_run_cb), sync);
+  g_socket_service_start(sync->service);
+
+  net_sync_apply(sync);
+  return sync;
+}
+
+/* This function asks the master for the base time */
+static gboolean fetch_base_time(const gchar *address, guint16 port, GstClockTime *base_time, GError **error)
+{
+  GSocketClient *client = g_socket_client_new();
+  gboolean res = FALSE;
+
+  g_socket_client_set_timeout(client, NET_SYNC_TIMEOUT_S);
+  GSocketConnection *connection = g_socket_client_connect_to_host(client, address, port, NULL, error);
+  if (connection != NULL) {
+    GDataInputStream *input = g_data_input_stream_new(g_io_stream_get_input_stream(G_IO_STREAM(connection)));
+    gchar *line = g_data_input_stream_read_line(input, NULL, NULL, error);
+    gchar *end = NULL;
+
+    if (line != NULL) {
+      *base_time = g_ascii_strtoull(line, &end, 10);
+      res = end != line && *end == '\0';
+      if (!res)
+        g_set_error(error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA, "Invalid base time '%s'", line);
+    }
+
+    g_free(line);
+    g_object_unref(input);
+    g_object_unref(connection);
+  }
+
+  g_object_unref(client);
+  return res;
+}
+
+/* This function slaves the pipeline to the clock published by a master on address:port.
+ * It blocks until the client clock is synchronised, at most NET_SYNC_TIMEOUT_S seconds */
+NetSync *net_sync_new_slave(GstElement *pipeline, const gchar *address, guint16 port, GError **error)
+{
+  g_return_val_if_fail(GST_IS_PIPELINE(pipeline), NULL);
+  g_return_val_if_fail(address != NULL, NULL);
+
+  NetSync *sync = net_sync_new(pipeline, FALSE);
+
+  if (!fetch_base_time(address, port, &sync->base_time, error)) {
+    net_sync_free(sync);
+    return NULL;
+  }
+
+  /* Statistics of the clock are posted on the bus of the pipeline, see net_sync_handle_message() */
+  GstBus *bus = gst_element_get_bus(pipeline);
+  sync->clock = gst_net_client_clock_new("netclock", address, port, 0);
+  g_object_set(sync->clock, "bus", bus, NULL);
+  gst_object_unref(bus);
+
+  if (!gst_clock_wait_for_sync(sync->clock, NET_SYNC_TIMEOUT_S * GST_SECOND)) {
+    g_set_error(error, G_IO_ERROR, G_IO_ERROR_TIMED_OUT, "Could not synchronise with the clock of %s:%u",
+        address, port);
+    net_sync_free(sync);
+    return NULL;
+  }
+  sync->synchronised = TRUE;
+
+  net_sync_apply(sync);
+  return sync;
+}
+
+void net_sync_free(NetSync *sync)
+{
+  g_return_if_fail(sync != NULL);
+
+  if (sync->service != NULL) {
+    g_socket_service_stop(sync->service);
+    g_socket_listener_close(G_SOCKET_LISTENER(sync->service));
+    g_object_unref(sync->service);
+  }
+  if (sync->provider != NULL)
+    gst_object_unref(sync->provider);
+  if (sync->clock != NULL)
+    gst_object_unref(sync->clock);
+  if (sync->log != NULL)
+    fclose(sync->log);
+
+  gst_object_unref(sync->pipeline);
+  g_mutex_clear(&sync->lock);
+  g_free(sync);
+}
+
+GstClockTime net_sync_get_base_time(NetSync *sync)
+{
+  g_return_val_if_fail(sync != NULL, GST_CLOCK_TIME_NONE);
+
+  return sync->base_time;
+}
+
+/* This function lets a pipeline that starts after the first frame of the schedule, a slave started
+ * late or a player restarted after an error, show the frame the others show. It seeks to the
+ * position the schedule will be at NET_SYNC_JOIN_DELAY from now and moves the base time of the
+ * pipeline by as much, instead of decoding from the start and dropping every late frame until it
+ * catches up. It must be called once the pipeline has left READY, it does nothing on time */
+void net_sync_join(NetSync *sync)
+{
+  g_return_if_fail(sync != NULL);
+
+  GstClockTime join_time = gst_clock_get_time(sync->clock) + NET_SYNC_JOIN_DELAY;
+  GstClockTime position = join_time > sync->base_time ? join_time - sync->base_time : 0;
+
+  /* The base time goes first, the pipeline hands it out again when the seek has prerolled */
+  gst_element_set_base_time(sync->pipeline, sync->base_time + position);
+  if (position > 0 && !gst_element_seek_simple(sync->pipeline, GST_FORMAT_TIME,
+        GST_SEEK_FLAG_FLUSH | GST_SEEK_FLAG_ACCURATE, position)) {
+    g_printerr("Could not seek to %" GST_TIME_FORMAT " to join the schedule\n", GST_TIME_ARGS(position));
+    gst_element_set_base_time(sync->pipeline, sync->base_time);
+    position = 0;
+  }
+
+  g_mutex_lock(&sync->lock);
+  sync->join_position = position;
+  g_mutex_unlock(&sync->lock);
+}
+
+/* This function logs every measured frame to path, one line per frame with its running time,
+ * the monotonic time it was rendered at and its lateness, all in nanoseconds. The running time is the
+ * one of the schedule, so it stays comparable after net_sync_join() moved the pipeline. Logs of processes
+ * on the same host can be joined on the running time to get the inter-process skew */
+gboolean net_sync_set_log(NetSync *sync, const gchar *path, GError **error)
+{
+  g_return_val_if_fail(sync != NULL, FALSE);
+  g_return_val_if_fail(path != NULL, FALSE);
+
+  FILE *log = fopen(path, "w");
+  if (log == NULL) {
+    g_set_error(error, G_FILE_ERROR, G_FILE_ERROR_FAILED, "Could not open %s for writing", path);
+    return FALSE;
+  }
+
+  g_mutex_lock(&sync->lock);
+  if (sync->log != NULL)
+    fclose(sync->log);
+  sync->log = log;
+  g_mutex_unlock(&sync->lock);
+
+  return TRUE;
+}
+
+/* This function is called for every upstream event of the sink. Sinks send a QoS event
+ * after each rendered frame, with its lateness against base time + running time + latency,
+ * which is the schedule all the processes share */
+static GstPadProbeReturn sink_qos_probe_cb(GstPad *pad, GstPadProbeInfo *info, NetSync *sync)
+{
+  GstEvent *event = GST_PAD_PROBE_INFO_EVENT(info);
+  GstQOSType type;
+  gdouble proportion;
+  GstClockTimeDiff diff;
+  GstClockTime timestamp;
+
+  if (GST_EVENT_TYPE(event) != GST_EVENT_QOS)
+    return GST_PAD_PROBE_OK;
+
+  gst_event_parse_qos(event, &type, &proportion, &diff, &timestamp);
+  if (type == GST_QOS_TYPE_THROTTLE)
+    return GST_PAD_PROBE_OK;
+
+  gint64 now = monotonic_ns();
+
+  g_mutex_lock(&sync->lock);
+  sync->frames++;
+  sync->error_sum += diff;
+  if (ABS(diff) > ABS(sync->error_max))
+    sync->error_max = diff;
+  if (sync->log != NULL)
+    fprintf(sync->log, "%" G_GUINT64_FORMAT " %" G_GINT64_FORMAT " %" G_GINT64_FORMAT "\n",
+        timestamp + sync->join_position, now, diff);
+  g_mutex_unlock(&sync->lock);
+
+  return GST_PAD_PROBE_OK;
+}
+
+/* This function measures the presentation error of the frames rendered by sink, which must have QoS enabled */
+void net_sync_watch_sink(NetSync *sync, GstElement *sink)
+{
+  g_return_if_fail(sync != NULL);
+  g_return_if_fail(GST_IS_ELEMENT(sink));
+
+  GstPad *pad = gst_element_get_static_pad(sink, "sink");
+  g_return_if_fail(pad != NULL);
+
+  gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_EVENT_UPSTREAM,
+      (GstPadProbeCallback) sink_qos_probe_cb, sync, NULL);
+  gst_object_unref(pad);
+}
+
+/* This function picks up the statistics the client clock posts on the bus.
+ * It returns TRUE if the message was one of them */
+gboolean net_sync_handle_message(NetSync *sync, GstMessage *msg)
+{
+  g_return_val_if_fail(sync != NULL, FALSE);
+
+  if (GST_MESSAGE_TYPE(msg) != GST_MESSAGE_ELEMENT || !gst_message_has_name(msg, NET_SYNC_STATS_NAME))
+    return FALSE;
+
+  const GstStructure *structure = gst_message_get_structure(msg);
+  gboolean synchronised = FALSE;
+  GstClockTime rtt = GST_CLOCK_TIME_NONE;
+  GstClockTimeDiff offset = 0;
+
+  gst_structure_get_boolean(structure, "synchronised", &synchronised);
+  gst_structure_get_clock_time(structure, "rtt-average", &rtt);
+  gst_structure_get(structure, "local-clock-offset", G_TYPE_INT64, &offset, NULL);
+
+  g_mutex_lock(&sync->lock);
+  sync->synchronised = synchronised;
+  sync->rtt = rtt;
+  sync->clock_offset = offset;
+  g_mutex_unlock(&sync->lock);
+
+  return TRUE;
+}
+
+void net_sync_get_stats(NetSync *sync, NetSyncStats *stats)
+{
+  g_return_if_fail(sync != NULL);
+  g_return_if_fail(stats != NULL);
+
+  g_mutex_lock(&sync->lock);
+  stats->master = sync->master;
+  stats->synchronised = sync->synchronised;
+  stats->clock_offset_ms = sync->clock_offset / (gdouble) GST_MSECOND;
+  stats->rtt_ms = GST_CLOCK_TIME_IS_VALID(sync->rtt) ? sync->rtt / (gdouble) GST_MSECOND : 0;
+  stats->presentation_error_ms = sync->frames > 0 ? sync->error_sum / sync->frames / GST_MSECOND : 0;
+  stats->presentation_error_max_ms = sync->error_max / (gdouble) GST_MSECOND;
+  stats->frames = sync->frames;
+  g_mutex_unlock(&sync->lock);
+}
+
+/* This function formats the synchronisation state, one value per line
+ * The returned string should be freed with g_free() when no longer needed.
+*/
+gchar *net_sync_stats_to_string(const NetSyncStats *stats)
+{
+  g_return_val_if_fail(stats != NULL, NULL);
+
+  GString *str = g_string_new(NULL);
+
+  if (stats->master)
+    g_string_append(str, "Sync: master\n");
+  else
+    g_string_append_printf(str, "Sync: slave, %s\n"
+                                "Clock offset: %.3f ms\n"
+                                "Clock RTT: %.3f ms\n",
+        stats->synchronised ? "locked" : "unlocked", stats->clock_offset_ms, stats->rtt_ms);
+
+  g_string_append_printf(str, "Presentation error: %.3f ms\n"
+                              "Worst presentation error: %.3f ms",
+      stats->presentation_error_ms, stats->presentation_error_max_ms);
+
+  return g_string_free(str, FALSE);
+}
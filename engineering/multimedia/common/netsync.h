@@ -0,0 +1,40 @@
+#ifndef NET_SYNC_H
+#define NET_SYNC_H
+
+#include <gst/gst.h>
+
+G_BEGIN_DECLS
+
+/* Clock synchronisation state, filled by net_sync_get_stats() */
+typedef struct _NetSyncStats
+{
+  gboolean master;               /* Whether this process publishes the clock */
+  gboolean synchronised;         /* Whether the client clock is locked to the master, always TRUE on the master */
+  gdouble clock_offset_ms;       /* Last offset applied to the client clock, in milliseconds */
+  gdouble rtt_ms;                /* Average round trip to the clock provider, in milliseconds */
+  gdouble presentation_error_ms; /* Average lateness of the rendered frames against the shared schedule */
+  gdouble presentation_error_max_ms; /* Largest lateness seen, in absolute value */
+  guint64 frames;                /* Frames measured */
+} NetSyncStats;
+
+/* Shared clock and base time of a pipeline playing in lockstep with other processes */
+typedef struct _NetSync NetSync;
+
+gboolean net_sync_parse_address(const gchar *str, gchar **address, guint16 *port);
+
+NetSync *net_sync_new_master(GstElement *pipeline, const gchar *address, guint16 port, GError **error);
+NetSync *net_sync_new_slave(GstElement *pipeline, const gchar *address, guint16 port, GError **error);
+void net_sync_free(NetSync *sync);
+
+GstClockTime net_sync_get_base_time(NetSync *sync);
+void net_sync_join(NetSync *sync);
+gboolean net_sync_set_log(NetSync *sync, const gchar *path, GError **error);
+void net_sync_watch_sink(NetSync *sync, GstElement *sink);
+gboolean net_sync_handle_message(NetSync *sync, GstMessage *msg);
+
+void net_sync_get_stats(NetSync *sync, NetSyncStats *stats);
+gchar *net_sync_stats_to_string(const NetSyncStats *stats);
+
+G_END_DECLS
+
+#endif /* NET_SYNC_H */
@@ -0,0 +1,450 @@
+#include "playerstats.h"
+
+#include <string.h>
+#include <unistd.h>
+
+#define SAMPLE_INTERVAL_US  (500 * G_TIME_SPAN_MILLISECOND)
+#define DECODE_RING_SIZE    64
+
+/* Frames in flight inside one decoder, used to measure decode time per frame */
+typedef struct _DecoderProbe
+{
+  PlayerStats *stats;
+  GMutex lock;
+  gint64 entries[DECODE_RING_SIZE]; /* Monotonic time at which each pending frame entered the decoder */
+  guint head;                       /* Index of the oldest pending frame */
+  guint count;                      /* Number of pending frames */
+} DecoderProbe;
+
+struct _PlayerStats
+{
+  GstElement *pipeline;        /* Pipeline we are attached to, not owned */
+
+  /* Updated lock-free from the streaming threads */
+  gint frames_rendered;        /* Frames that reached the video sink */
+  gint decode_us;              /* Moving average of the decode time per frame */
+  gint jitter_us;              /* Moving average of the absolute QoS jitter */
+  gint thumbnail_queue;        /* Thumbnails waiting to be generated */
+
+  /* Only touched from the thread dispatching bus messages */
+  GHashTable *qos_dropped;     /* Last QoS dropped count per element */
+  gint frames_dropped;         /* Sum of frames dropped by all elements */
+  gint64 seek_start;           /* Monotonic time of the pending seek, 0 if none */
+
+  GMutex lock;                 /* Protects the fields below */
+  GCond cond;
+  GThread *sampler;            /* Low frequency thread sampling rates and memory */
+  gboolean running;
+  GPtrArray *queues;           /* Queue elements of the pipeline, owned */
+  gint64 last_sample_time;
+  gint last_rendered;
+  gint last_dropped;
+  PlayerStatsSnapshot current; /* Values computed by the last sample */
+};
+
+/* This function reads the resident set size of the process from /proc/self/statm */
+static guint64 read_rss_bytes(void)
+{
+  gchar *contents = NULL;
+  guint64 resident = 0;
+
+  if (!g_file_get_contents("/proc/self/statm", &contents, NULL, NULL))
+    return 0;
+
+  gchar **fields = g_strsplit(contents, " ", 3);
+  if (fields[0] != NULL && fields[1] != NULL)
+    resident = g_ascii_strtoull(fields[1], NULL, 10) * sysconf(_SC_PAGESIZE);
+
+  g_strfreev(fields);
+  g_free(contents);
+  return resident;
+}
+
+/* This function reads an integer property, if the object has it, as a guint64 */
+static guint64 get_level_property(gpointer object, const gchar *name)
+{
+  GParamSpec *pspec = g_object_class_find_property(G_OBJECT_GET_CLASS(object), name);
+  GValue value = G_VALUE_INIT;
+  GValue converted = G_VALUE_INIT;
+  guint64 res = 0;
+
+  if (pspec == NULL)
+    return 0;
+
+  g_value_init(&value, pspec->value_type);
+  g_object_get_property(G_OBJECT(object), name, &value);
+  g_value_init(&converted, G_TYPE_UINT64);
+  if (g_value_transform(&value, &converted))
+    res = g_value_get_uint64(&converted);
+  g_value_unset(&converted);
+  g_value_unset(&value);
+
+  return res;
+}
+
+/* This function returns how full a queue, queue2 or multiqueue is, in percent */
+static gint queue_fill_percent(GstElement *queue)
+{
+  guint64 max_time = get_level_property(queue, "max-size-time");
+  guint64 max_bytes = get_level_property(queue, "max-size-bytes");
+  guint64 level_time = 0, level_bytes = 0;
+
+  if (g_strcmp0(G_OBJECT_TYPE_NAME(queue), "GstMultiQueue") == 0) {
+    /* multiqueue only exposes levels on its pads, take the fullest one */
+    GstIterator *it = gst_element_iterate_sink_pads(queue);
+    GValue item = G_VALUE_INIT;
+
+    while (gst_iterator_next(it, &item) == GST_ITERATOR_OK) {
+      GstPad *pad = g_value_get_object(&item);
+      level_time = MAX(level_time, get_level_property(pad, "current-level-time"));
+      level_bytes = MAX(level_bytes, get_level_property(pad, "current-level-bytes"));
+      g_value_reset(&item);
+    }
+    g_value_unset(&item);
+    gst_iterator_free(it);
+  } else {
+    level_time = get_level_property(queue, "current-level-time");
+    level_bytes = get_level_property(queue, "current-level-bytes");
+  }
+
+  if (max_time > 0)
+    return (gint) MIN(100, level_time * 100 / max_time);
+  if (max_bytes > 0)
+    return (gint) MIN(100, level_bytes * 100 / max_bytes);
+  return 0;
+}
+
+/* This function computes the rates and levels exposed in the snapshot */
+static void sample(PlayerStats *stats)
+{
+  gint64 now = g_get_monotonic_time();
+  gint rendered = g_atomic_int_get(&stats->frames_rendered);
+  gint dropped = g_atomic_int_get(&stats->frames_dropped);
+  GPtrArray *queues;
+  gint queue_percent = 0;
+
+  g_mutex_lock(&stats->lock);
+  queues = g_ptr_array_new_with_free_func(gst_object_unref);
+  for (guint i = 0; i < stats->queues->len; i++)
+    g_ptr_array_add(queues, gst_object_ref(g_ptr_array_index(stats->queues, i)));
+  g_mutex_unlock(&stats->lock);
+
+  /* Query the queues without holding our lock, they take their own */
+  for (guint i = 0; i < queues->len; i++)
+    queue_percent = MAX(queue_percent, queue_fill_percent(g_ptr_array_index(queues, i)));
+  g_ptr_array_unref(queues);
+
+  guint64 rss = read_rss_bytes();
+
+  g_mutex_lock(&stats->lock);
+  gdouble elapsed = (gdouble)(now - stats->last_sample_time) / G_USEC_PER_SEC;
+  if (elapsed > 0) {
+    stats->current.rendered_fps = (rendered - stats->last_rendered) / elapsed;
+    stats->current.dropped_fps = (dropped - stats->last_dropped) / elapsed;
+  }
+  stats->current.queue_percent = queue_percent;
+  stats->current.rss_bytes = rss;
+  stats->last_sample_time = now;
+  stats->last_rendered = rendered;
+  stats->last_dropped = dropped;
+  g_mutex_unlock(&stats->lock);
+}
+
+static gpointer sampler_thread_func(gpointer user_data)
+{
+  PlayerStats *stats = user_data;
+  gint64 next_sample = g_get_monotonic_time() + SAMPLE_INTERVAL_US;
+
+  g_mutex_lock(&stats->lock);
+  while (stats->running) {
+    if (g_cond_wait_until(&stats->cond, &stats->lock, next_sample))
+      continue;
+
+    g_mutex_unlock(&stats->lock);
+    sample(stats);
+    next_sample = g_get_monotonic_time() + SAMPLE_INTERVAL_US;
+    g_mutex_lock(&stats->lock);
+  }
+  g_mutex_unlock(&stats->lock);
+
+  return NULL;
+}
+
+PlayerStats *player_stats_new(void)
+{
+  PlayerStats *stats = g_new0(PlayerStats, 1);
+
+  stats->qos_dropped = g_hash_table_new(g_direct_hash, g_direct_equal);
+  stats->queues = g_ptr_array_new_with_free_func(gst_object_unref);
+  stats->current.seek_latency_ms = -1;
+  stats->last_sample_time = g_get_monotonic_time();
+  g_mutex_init(&stats->lock);
+  g_cond_init(&stats->cond);
+
+  stats->running = TRUE;
+  stats->sampler = g_thread_new("player-stats", sampler_thread_func, stats);
+
+  return stats;
+}
+
+/* The pipeline must have been disposed before the statistics, since its pad probes point here */
+void player_stats_free(PlayerStats *stats)
+{
+  g_return_if_fail(stats != NULL);
+
+  g_mutex_lock(&stats->lock);
+  stats->running = FALSE;
+  g_cond_signal(&stats->cond);
+  g_mutex_unlock(&stats->lock);
+  g_thread_join(stats->sampler);
+
+  g_hash_table_destroy(stats->qos_dropped);
+  g_ptr_array_unref(stats->queues);
+  g_mutex_clear(&stats->lock);
+  g_cond_clear(&stats->cond);
+  g_free(stats);
+}
+
+static void decoder_probe_free(gpointer user_data)
+{
+  DecoderProbe *probe = user_data;
+
+  g_mutex_clear(&probe->lock);
+  g_free(probe);
+}
+
+/* This function is called when a buffer enters a decoder */
+static GstPadProbeReturn decoder_sink_probe_cb(GstPad *pad, GstPadProbeInfo *info, gpointer user_data)
+{
+  DecoderProbe *probe = user_data;
+
+  g_mutex_lock(&probe->lock);
+  if (GST_PAD_PROBE_INFO_TYPE(info) & GST_PAD_PROBE_TYPE_EVENT_FLUSH) {
+    /* Frames inside the decoder are discarded on flush */
+    if (GST_EVENT_TYPE(GST_PAD_PROBE_INFO_EVENT(info)) == GST_EVENT_FLUSH_STOP)
+      probe->count = 0;
+  } else {
+    if (probe->count == DECODE_RING_SIZE) {
+      /* The decoder swallowed frames without output, forget the oldest one */
+      probe->head = (probe->head + 1) % DECODE_RING_SIZE;
+      probe->count--;
+    }
+    probe->entries[(probe->head + probe->count) % DECODE_RING_SIZE] = g_get_monotonic_time();
+    probe->count++;
+  }
+  g_mutex_unlock(&probe->lock);
+
+  return GST_PAD_PROBE_OK;
+}
+
+/* This function is called when a decoded frame leaves a decoder */
+static GstPadProbeReturn decoder_src_probe_cb(GstPad *pad, GstPadProbeInfo *info, gpointer user_data)
+{
+  DecoderProbe *probe = user_data;
+  gint64 entry = 0;
+
+  g_mutex_lock(&probe->lock);
+  if (probe->count > 0) {
+    entry = probe->entries[probe->head];
+    probe->head = (probe->head + 1) % DECODE_RING_SIZE;
+    probe->count--;
+  }
+  g_mutex_unlock(&probe->lock);
+
+  if (entry > 0) {
+    gint elapsed = (gint)(g_get_monotonic_time() - entry);
+    gint average = g_atomic_int_get(&probe->stats->decode_us);
+    g_atomic_int_set(&probe->stats->decode_us, average > 0 ? (average * 7 + elapsed) / 8 : elapsed);
+  }
+
+  return GST_PAD_PROBE_OK;
+}
+
+/* This function is called when a buffer reaches the video sink */
+static GstPadProbeReturn sink_probe_cb(GstPad *pad, GstPadProbeInfo *info, gpointer user_data)
+{
+  PlayerStats *stats = user_data;
+
+  g_atomic_int_inc(&stats->frames_rendered);
+  return GST_PAD_PROBE_OK;
+}
+
+static void attach_decoder(PlayerStats *stats, GstElement *element)
+{
+  DecoderProbe *probe = g_new0(DecoderProbe, 1);
+  GstPad *pad;
+
+  probe->stats = stats;
+  g_mutex_init(&probe->lock);
+  /* The probe lives as long as the decoder and its pads */
+  g_object_set_data_full(G_OBJECT(element), "player-stats-decoder", probe, decoder_probe_free);
+
+  pad = gst_element_get_static_pad(element, "sink");
+  if (pad != NULL) {
+    gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_BUFFER | GST_PAD_PROBE_TYPE_EVENT_FLUSH,
+        decoder_sink_probe_cb, probe, NULL);
+    gst_object_unref(pad);
+  }
+
+  pad = gst_element_get_static_pad(element, "src");
+  if (pad != NULL) {
+    gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_BUFFER, decoder_src_probe_cb, probe, NULL);
+    gst_object_unref(pad);
+  }
+}
+
+static void attach_video_sink(PlayerStats *stats, GstElement *element)
+{
+  GstPad *pad = gst_element_get_static_pad(element, "sink");
+
+  if (pad != NULL) {
+    gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_BUFFER, sink_probe_cb, stats, NULL);
+    gst_object_unref(pad);
+  }
+}
+
+/* This function is called when an element is added anywhere inside the pipeline */
+static void deep_element_added_cb(GstBin *bin, GstBin *sub_bin, GstElement *element, PlayerStats *stats)
+{
+  GstElementFactory *factory = gst_element_get_factory(element);
+  const gchar *klass;
+
+  if (factory == NULL)
+    return;
+
+  klass = gst_element_factory_get_metadata(factory, GST_ELEMENT_METADATA_KLASS);
+  if (klass == NULL)
+    return;
+
+  if (strstr(klass, "Decoder") != NULL && strstr(klass, "Video") != NULL) {
+    attach_decoder(stats, element);
+  } else if (strstr(klass, "Sink") != NULL && strstr(klass, "Video") != NULL) {
+    attach_video_sink(stats, element);
+  } else if (g_str_has_suffix(GST_OBJECT_NAME(factory), "queue") ||
+      g_str_has_suffix(GST_OBJECT_NAME(factory), "queue2")) {
+    g_mutex_lock(&stats->lock);
+    g_ptr_array_add(stats->queues, gst_object_ref(element));
+    g_mutex_unlock(&stats->lock);
+  }
+}
+
+/* This function is called when an element is removed from anywhere inside the pipeline */
+static void deep_element_removed_cb(GstBin *bin, GstBin *sub_bin, GstElement *element, PlayerStats *stats)
+{
+  g_mutex_lock(&stats->lock);
+  g_ptr_array_remove(stats->queues, element);
+  g_mutex_unlock(&stats->lock);
+}
+
+/* This function starts collecting statistics from the elements the pipeline will create */
+void player_stats_attach(PlayerStats *stats, GstElement *pipeline)
+{
+  g_return_if_fail(stats != NULL);
+  g_return_if_fail(GST_IS_BIN(pipeline));
+
+  stats->pipeline = pipeline;
+  g_signal_connect(pipeline, "deep-element-added", G_CALLBACK(deep_element_added_cb), stats);
+  g_signal_connect(pipeline, "deep-element-removed", G_CALLBACK(deep_element_removed_cb), stats);
+}
+
+/* This function must be called for the bus messages of the attached pipeline.
+ * It returns TRUE when the message completed a seek, whose latency is then in the snapshot */
+gboolean player_stats_handle_message(PlayerStats *stats, GstMessage *msg)
+{
+  g_return_val_if_fail(stats != NULL, FALSE);
+
+  switch (GST_MESSAGE_TYPE(msg)) {
+    case GST_MESSAGE_QOS: {
+      GstFormat format;
+      guint64 processed, dropped;
+
+      gint64 jitter;
+      gst_message_parse_qos_values(msg, &jitter, NULL, NULL);
+      gint jitter_us = (gint) MIN(ABS(jitter) / 1000, G_MAXINT);
+      gint average = g_atomic_int_get(&stats->jitter_us);
+      g_atomic_int_set(&stats->jitter_us, average > 0 ? (average * 7 + jitter_us) / 8 : jitter_us);
+
+      gst_message_parse_qos_stats(msg, &format, &processed, &dropped);
+      if (format != GST_FORMAT_BUFFERS || dropped == (guint64) -1)
+        break;
+
+      /* QoS counters are per element and restart from zero on flush */
+      guint previous = GPOINTER_TO_UINT(g_hash_table_lookup(stats->qos_dropped, GST_MESSAGE_SRC(msg)));
+      guint delta = dropped >= previous ? dropped - previous : dropped;
+      g_hash_table_insert(stats->qos_dropped, GST_MESSAGE_SRC(msg), GUINT_TO_POINTER((guint) dropped));
+      g_atomic_int_add(&stats->frames_dropped, delta);
+      break;
+    }
+    case GST_MESSAGE_ASYNC_DONE:
+      if (GST_MESSAGE_SRC(msg) == GST_OBJECT(stats->pipeline) && stats->seek_start > 0) {
+        g_mutex_lock(&stats->lock);
+        stats->current.seek_latency_ms = (g_get_monotonic_time() - stats->seek_start) / 1000.0;
+        g_mutex_unlock(&stats->lock);
+        stats->seek_start = 0;
+        return TRUE;
+      }
+      break;
+    default:
+      break;
+  }
+
+  return FALSE;
+}
+
+/* This function must be called right before a flushing seek is sent to the pipeline */
+void player_stats_seek_started(PlayerStats *stats)
+{
+  g_return_if_fail(stats != NULL);
+
+  stats->seek_start = g_get_monotonic_time();
+}
+
+void player_stats_set_thumbnail_queue(PlayerStats *stats, gint depth)
+{
+  g_return_if_fail(stats != NULL);
+
+  g_atomic_int_set(&stats->thumbnail_queue, depth);
+}
+
+void player_stats_snapshot(PlayerStats *stats, PlayerStatsSnapshot *snapshot)
+{
+  g_return_if_fail(stats != NULL);
+  g_return_if_fail(snapshot != NULL);
+
+  g_mutex_lock(&stats->lock);
+  *snapshot = stats->current;
+  g_mutex_unlock(&stats->lock);
+
+  snapshot->decode_ms = g_atomic_int_get(&stats->decode_us) / 1000.0;
+  snapshot->jitter_ms = g_atomic_int_get(&stats->jitter_us) / 1000.0;
+  snapshot->thumbnail_queue = g_atomic_int_get(&stats->thumbnail_queue);
+  snapshot->frames_rendered = (guint) g_atomic_int_get(&stats->frames_rendered);
+  snapshot->frames_dropped = (guint) g_atomic_int_get(&stats->frames_dropped);
+}
+
+/* This function formats a snapshot as the multi-line text shown by the HUD
+ * The returned string should be freed with g_free() when no longer needed.
+*/
+gchar *player_stats_snapshot_to_string(const PlayerStatsSnapshot *snapshot)
+{
+  gchar seek[G_ASCII_DTOSTR_BUF_SIZE];
+
+  g_return_val_if_fail(snapshot != NULL, NULL);
+
+  if (snapshot->seek_latency_ms < 0)
+    g_strlcpy(seek, "n/a", sizeof(seek));
+  else
+    g_snprintf(seek, sizeof(seek), "%.0f ms", snapshot->seek_latency_ms);
+
+  return g_strdup_printf("Rendered: %.1f fps\n"
+                         "Dropped: %.1f fps\n"
+                         "Decode: %.2f ms/frame\n"
+                         "Jitter: %.2f ms\n"
+                         "Queues: %d%%\n"
+                         "Last seek: %s\n"
+                         "Thumbnails queued: %d\n"
+                         "RSS: %.1f MiB",
+                         snapshot->rendered_fps, snapshot->dropped_fps, snapshot->decode_ms, snapshot->jitter_ms,
+                         snapshot->queue_percent, seek, snapshot->thumbnail_queue,
+                         snapshot->rss_bytes / (1024.0 * 1024.0));
+}
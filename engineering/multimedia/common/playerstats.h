@@ -0,0 +1,39 @@
+#ifndef PLAYER_STATS_H
+#define PLAYER_STATS_H
+
+#include <gst/gst.h>
+
+G_BEGIN_DECLS
+
+/* Point-in-time view of the playback statistics, filled by player_stats_snapshot() */
+typedef struct _PlayerStatsSnapshot
+{
+  gdouble rendered_fps;     /* Frames that reached the video sink per second */
+  gdouble dropped_fps;      /* Frames dropped per second, as reported by QoS */
+  gdouble decode_ms;        /* Average decode time per frame, in milliseconds */
+  gdouble jitter_ms;        /* Average lateness of the frames at the sink, as reported by QoS */
+  gint queue_percent;       /* Fill level of the fullest playback queue */
+  gdouble seek_latency_ms;  /* Latency of the last completed seek, in milliseconds, -1 if none */
+  gint thumbnail_queue;     /* Thumbnails still waiting to be generated */
+  guint64 rss_bytes;        /* Resident set size of the process */
+  guint64 frames_rendered;  /* Total frames that reached the video sink */
+  guint64 frames_dropped;   /* Total frames dropped, as reported by QoS */
+} PlayerStatsSnapshot;
+
+/* Opaque statistics collector for one playback pipeline */
+typedef struct _PlayerStats PlayerStats;
+
+PlayerStats *player_stats_new(void);
+void player_stats_free(PlayerStats *stats);
+
+void player_stats_attach(PlayerStats *stats, GstElement *pipeline);
+gboolean player_stats_handle_message(PlayerStats *stats, GstMessage *msg);
+void player_stats_seek_started(PlayerStats *stats);
+void player_stats_set_thumbnail_queue(PlayerStats *stats, gint depth);
+
+void player_stats_snapshot(PlayerStats *stats, PlayerStatsSnapshot *snapshot);
+gchar *player_stats_snapshot_to_string(const PlayerStatsSnapshot *snapshot);
+
+G_END_DECLS
+
+#endif /* PLAYER_STATS_H */
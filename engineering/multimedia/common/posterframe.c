@@ -0,0 +1,82 @@
+#include "posterframe.h"
+
+#define POSTER_CAPS      "video/x-raw,format=RGB,width=%d,pixel-aspect-ratio=1/1"
+
+/* This function links the first video stream of the clip to the converter */
+static void source_pad_added_cb(GstElement *source, GstPad *pad, GstElement *convert)
+{
+  GstPad *sink = gst_element_get_static_pad(convert, "sink");
+
+  if (!gst_pad_is_linked(sink))
+    gst_pad_link(pad, sink);
+  gst_object_unref(sink);
+}
+
+/* This function keeps the decoders to one thread, prerolling decodes a single frame */
+static void deep_element_added_cb(GstBin *bin, GstBin *sub_bin, GstElement *element, gpointer user_data)
+{
+  if (g_object_class_find_property(G_OBJECT_GET_CLASS(element), "max-threads") != NULL)
+    g_object_set(element, "max-threads", 1, NULL);
+}
+
+/* This function decodes the first keyframe of the clip at uri, scaled to width in RGB.
+ * It runs its own small pipeline, so it can be used while the player prerolls, and
+ * blocks for at most timeout
+ * The returned sample should be freed with gst_sample_unref() when no longer needed.
+*/
+GstSample *poster_frame_grab(const gchar *uri, gint width, GstClockTime timeout, GError **error)
+{
+  g_return_val_if_fail(uri != NULL, NULL);
+  g_return_val_if_fail(width > 0, NULL);
+
+  GstElement *pipeline = gst_pipeline_new("poster");
+  GstElement *source = gst_element_factory_make("uridecodebin", NULL);
+  GstElement *convert = gst_element_factory_make("videoconvert", NULL);
+  GstElement *scale = gst_element_factory_make("videoscale", NULL);
+  GstElement *sink = gst_element_factory_make("appsink", NULL);
+  GstSample *sample = NULL;
+
+  if (source == NULL || convert == NULL || scale == NULL || sink == NULL) {
+    g_set_error(error, GST_CORE_ERROR, GST_CORE_ERROR_MISSING_PLUGIN, "Not all poster elements could be created");
+    gst_object_unref(pipeline);
+    return NULL;
+  }
+
+  /* Only the video is decoded, and nothing waits for the clock */
+  GstCaps *caps = gst_caps_from_string("video/x-raw");
+  g_object_set(source, "uri", uri, "caps", caps, "expose-all-streams", FALSE, NULL);
+  gst_caps_unref(caps);
+
+  gchar *caps_str = g_strdup_printf(POSTER_CAPS, width);
+  caps = gst_caps_from_string(caps_str);
+  g_object_set(sink, "caps", caps, "sync", FALSE, "max-buffers", 1, NULL);
+  gst_caps_unref(caps);
+  g_free(caps_str);
+
+  gst_bin_add_many(GST_BIN(pipeline), source, convert, scale, sink, NULL);
+  gst_element_link_many(convert, scale, sink, NULL);
+  g_signal_connect(source, "pad-added", G_CALLBACK(source_pad_added_cb), convert);
+  g_signal_connect(pipeline, "deep-element-added", G_CALLBACK(deep_element_added_cb), NULL);
+
+  gst_element_set_state(pipeline, GST_STATE_PAUSED);
+
+  GstBus *bus = gst_element_get_bus(pipeline);
+  GstMessage *msg = gst_bus_timed_pop_filtered(bus, timeout, GST_MESSAGE_ASYNC_DONE | GST_MESSAGE_ERROR);
+  gst_object_unref(bus);
+
+  if (msg == NULL) {
+    g_set_error(error, GST_CORE_ERROR, GST_CORE_ERROR_STATE_CHANGE, "Timed out decoding the poster frame");
+  } else if (GST_MESSAGE_TYPE(msg) == GST_MESSAGE_ERROR) {
+    gst_message_parse_error(msg, error, NULL);
+  } else {
+    g_signal_emit_by_name(sink, "pull-preroll", &sample, NULL);
+    if (sample == NULL)
+      g_set_error(error, GST_STREAM_ERROR, GST_STREAM_ERROR_DECODE, "No poster frame decoded");
+  }
+
+  if (msg != NULL)
+    gst_message_unref(msg);
+  gst_element_set_state(pipeline, GST_STATE_NULL);
+  gst_object_unref(pipeline);
+  return sample;
+}
@@ -0,0 +1,12 @@
+#ifndef POSTER_FRAME_H
+#define POSTER_FRAME_H
+
+#include <gst/gst.h>
+
+G_BEGIN_DECLS
+
+GstSample *poster_frame_grab(const gchar *uri, gint width, GstClockTime timeout, GError **error);
+
+G_END_DECLS
+
+#endif /* POSTER_FRAME_H */
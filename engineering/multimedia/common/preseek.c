@@ -0,0 +1,345 @@
+#include "preseek.h"
+#include "decodertuning.h"
+
+#include <gst/video/video.h>
+
+#define FRAME_CAPS      "video/x-raw,format=RGB,width=%d,pixel-aspect-ratio=1/1"
+#define PREROLL_TIMEOUT (2 * GST_SECOND)
+#define SAME_TARGET     (40 * GST_MSECOND)  /* Hints closer than this to the ready frame need no decode */
+#define DECODER_FRAMES  6   /* Frames held by an open pipeline: decoder references and its output pool */
+
+/* Only the last hint is kept: the thread decodes it once done with the previous one, so a
+ * pointer moving over the slider costs at most one decode in flight. Each decode is a keyframe
+ * seek, which decodes the keyframe before the position alone, so the frame is the one the main
+ * pipeline shows after a keyframe seek to the same position, and to the keyframe itself. */
+struct _PreSeek
+{
+  gint width;
+  gboolean tune_decoders;
+  GThread *thread;
+
+  GMutex lock;                 /* Protects the fields below */
+  GCond cond;
+  gboolean running;
+  gchar *uri;                  /* Clip the frames are decoded from, NULL if none */
+  guint serial;                /* Incremented when the clip changes */
+  GstClockTime hint;           /* Position to decode next, GST_CLOCK_TIME_NONE if none */
+  GstSample *ready;            /* Last frame decoded, NULL once taken */
+  GstClockTime ready_position; /* Hint it was decoded for */
+  GstClockTime ready_frame_position; /* Position of its keyframe */
+  guint64 budget;              /* Bytes the pipeline and the ready frame may hold */
+  guint64 pipeline_bytes;      /* Estimate of what the open pipeline holds, 0 if closed */
+  guint64 decode_bytes;        /* What the last decode of the clip needed, pipeline and frame */
+  gboolean close_requested;    /* Set when the pipeline is over budget */
+  PreSeekStats stats;
+
+  /* Only touched by the thread */
+  GstElement *pipeline;
+  GstElement *sink;
+  guint pipeline_serial;       /* Clip the pipeline was made for */
+  gboolean failed;             /* Whether that clip could not be opened */
+  guint64 decoder_bytes;       /* Estimate of what the pipeline holds, from the size of the decoded frames */
+};
+
+static void close_pipeline(PreSeek *pre_seek)
+{
+  if (pre_seek->pipeline == NULL)
+    return;
+
+  gst_element_set_state(pre_seek->pipeline, GST_STATE_NULL);
+  gst_object_unref(pre_seek->sink);
+  gst_object_unref(pre_seek->pipeline);
+  pre_seek->pipeline = NULL;
+  pre_seek->sink = NULL;
+  pre_seek->decoder_bytes = 0;
+}
+
+static gboolean open_pipeline(PreSeek *pre_seek, const gchar *uri, GError **error)
+{
+  gchar *caps = g_strdup_printf(FRAME_CAPS, pre_seek->width);
+  gchar *description = g_strdup_printf("uridecodebin uri=\"%s\" ! videoconvert name=convert ! videoscale ! "
+      "appsink name=sink sync=false caps=\"%s\"", uri, caps);
+
+  pre_seek->pipeline = gst_parse_launch(description, error);
+  g_free(description);
+  g_free(caps);
+  if (pre_seek->pipeline == NULL)
+    return FALSE;
+
+  /* Decoding ahead is background work, it must not take CPUs from playback */
+  if (pre_seek->tune_decoders)
+    decoder_tuning_install(pre_seek->pipeline, DECODER_ROLE_BACKGROUND);
+
+  pre_seek->sink = gst_bin_get_by_name(GST_BIN(pre_seek->pipeline), "sink");
+  if (gst_element_set_state(pre_seek->pipeline, GST_STATE_PAUSED) == GST_STATE_CHANGE_FAILURE ||
+      gst_element_get_state(pre_seek->pipeline, NULL, NULL, PREROLL_TIMEOUT) != GST_STATE_CHANGE_SUCCESS) {
+    g_set_error(error, GST_CORE_ERROR, GST_CORE_ERROR_STATE_CHANGE, "Could not decode %s", uri);
+    close_pipeline(pre_seek);
+    return FALSE;
+  }
+
+  /* The frames of the decoder are those entering the conversion, at the size of the clip */
+  GstElement *convert = gst_bin_get_by_name(GST_BIN(pre_seek->pipeline), "convert");
+  GstPad *pad = gst_element_get_static_pad(convert, "sink");
+  GstCaps *decoded = gst_pad_get_current_caps(pad);
+  GstVideoInfo info;
+  if (decoded != NULL && gst_video_info_from_caps(&info, decoded))
+    pre_seek->decoder_bytes = DECODER_FRAMES * (guint64) GST_VIDEO_INFO_SIZE(&info);
+  if (decoded != NULL)
+    gst_caps_unref(decoded);
+  gst_object_unref(pad);
+  gst_object_unref(convert);
+
+  return TRUE;
+}
+
+/* This function decodes the frame at position of the clip serial, NULL on failure */
+static GstSample *decode(PreSeek *pre_seek, const gchar *uri, guint serial, GstClockTime position)
+{
+  GstSample *sample = NULL;
+  GError *error = NULL;
+
+  if (pre_seek->pipeline_serial != serial) {
+    close_pipeline(pre_seek);
+    pre_seek->pipeline_serial = serial;
+    pre_seek->failed = FALSE;
+  }
+  if (pre_seek->failed)
+    return NULL;
+
+  if (pre_seek->pipeline == NULL && !open_pipeline(pre_seek, uri, &error)) {
+    g_printerr("Could not pre-seek: %s\n", error->message);
+    g_clear_error(&error);
+    pre_seek->failed = TRUE;
+    return NULL;
+  }
+
+  if (!gst_element_seek_simple(pre_seek->pipeline, GST_FORMAT_TIME,
+        GST_SEEK_FLAG_KEY_UNIT | GST_SEEK_FLAG_SNAP_BEFORE | GST_SEEK_FLAG_FLUSH, position))
+    return NULL;
+
+  g_signal_emit_by_name(pre_seek->sink, "try-pull-preroll", PREROLL_TIMEOUT, &sample);
+  return sample;
+}
+
+static gpointer pre_seek_thread_func(PreSeek *pre_seek)
+{
+  g_mutex_lock(&pre_seek->lock);
+  while (pre_seek->running) {
+    if (pre_seek->close_requested) {
+      pre_seek->close_requested = FALSE;
+      pre_seek->pipeline_bytes = 0;
+      g_mutex_unlock(&pre_seek->lock);
+      close_pipeline(pre_seek);
+      g_mutex_lock(&pre_seek->lock);
+      continue;
+    }
+    if (pre_seek->hint == GST_CLOCK_TIME_NONE || pre_seek->uri == NULL) {
+      g_cond_wait(&pre_seek->cond, &pre_seek->lock);
+      continue;
+    }
+    /* Hints are dropped while there is no memory to decode them */
+    if (pre_seek->budget == 0 || pre_seek->budget < pre_seek->decode_bytes) {
+      pre_seek->hint = GST_CLOCK_TIME_NONE;
+      continue;
+    }
+
+    GstClockTime position = pre_seek->hint;
+    guint serial = pre_seek->serial;
+    gchar *uri = g_strdup(pre_seek->uri);
+    pre_seek->hint = GST_CLOCK_TIME_NONE;
+    g_mutex_unlock(&pre_seek->lock);
+
+    GstSample *sample = decode(pre_seek, uri, serial, position);
+    g_free(uri);
+
+    g_mutex_lock(&pre_seek->lock);
+    pre_seek->pipeline_bytes = pre_seek->pipeline != NULL ? pre_seek->decoder_bytes : 0;
+    if (sample == NULL)
+      continue;
+
+    pre_seek->stats.decodes++;
+    if (serial != pre_seek->serial) {
+      /* The clip changed while decoding */
+      pre_seek->stats.wasted++;
+      gst_sample_unref(sample);
+      continue;
+    }
+    pre_seek->decode_bytes = pre_seek->pipeline_bytes + gst_buffer_get_size(gst_sample_get_buffer(sample));
+    if (pre_seek->decode_bytes > pre_seek->budget) {
+      pre_seek->stats.wasted++;
+      gst_sample_unref(sample);
+      pre_seek->close_requested = TRUE;
+      continue;
+    }
+    if (pre_seek->ready != NULL) {
+      pre_seek->stats.wasted++;
+      gst_sample_unref(pre_seek->ready);
+    }
+    pre_seek->ready = sample;
+    pre_seek->ready_position = position;
+    pre_seek->ready_frame_position = gst_segment_to_stream_time(gst_sample_get_segment(sample), GST_FORMAT_TIME,
+        GST_BUFFER_PTS(gst_sample_get_buffer(sample)));
+    if (!GST_CLOCK_TIME_IS_VALID(pre_seek->ready_frame_position))
+      pre_seek->ready_frame_position = position;
+  }
+  g_mutex_unlock(&pre_seek->lock);
+
+  close_pipeline(pre_seek);
+  return NULL;
+}
+
+/* This function starts a pre-seeker decoding RGB frames scaled to width. With tune_decoders, its
+ * decoders get the background role of decoder_tuning_install(), the topology must be probed */
+PreSeek *pre_seek_new(gint width, gboolean tune_decoders)
+{
+  g_return_val_if_fail(width > 0, NULL);
+
+  PreSeek *pre_seek = g_new0(PreSeek, 1);
+  pre_seek->width = width;
+  pre_seek->tune_decoders = tune_decoders;
+  pre_seek->hint = GST_CLOCK_TIME_NONE;
+  pre_seek->budget = G_MAXUINT64;
+  pre_seek->running = TRUE;
+  g_mutex_init(&pre_seek->lock);
+  g_cond_init(&pre_seek->cond);
+  pre_seek->thread = g_thread_new("pre-seek", (GThreadFunc) pre_seek_thread_func, pre_seek);
+
+  return pre_seek;
+}
+
+/* This function stops the thread, it waits for the decode in flight if any */
+void pre_seek_free(PreSeek *pre_seek)
+{
+  g_return_if_fail(pre_seek != NULL);
+
+  g_mutex_lock(&pre_seek->lock);
+  pre_seek->running = FALSE;
+  g_cond_signal(&pre_seek->cond);
+  g_mutex_unlock(&pre_seek->lock);
+  g_thread_join(pre_seek->thread);
+
+  if (pre_seek->ready != NULL)
+    gst_sample_unref(pre_seek->ready);
+  g_free(pre_seek->uri);
+  g_mutex_clear(&pre_seek->lock);
+  g_cond_clear(&pre_seek->cond);
+  g_free(pre_seek);
+}
+
+/* This function sets the clip the next hints are for, uri may be NULL */
+void pre_seek_set_uri(PreSeek *pre_seek, const gchar *uri)
+{
+  g_return_if_fail(pre_seek != NULL);
+
+  g_mutex_lock(&pre_seek->lock);
+  g_free(pre_seek->uri);
+  pre_seek->uri = g_strdup(uri);
+  pre_seek->serial++;
+  pre_seek->hint = GST_CLOCK_TIME_NONE;
+  pre_seek->decode_bytes = 0;
+  if (pre_seek->ready != NULL) {
+    pre_seek->stats.wasted++;
+    gst_sample_unref(pre_seek->ready);
+    pre_seek->ready = NULL;
+  }
+  g_mutex_unlock(&pre_seek->lock);
+}
+
+/* This function tells that the user is likely to seek to position soon, it returns at once */
+void pre_seek_hint(PreSeek *pre_seek, GstClockTime position)
+{
+  g_return_if_fail(pre_seek != NULL);
+  g_return_if_fail(GST_CLOCK_TIME_IS_VALID(position));
+
+  g_mutex_lock(&pre_seek->lock);
+  pre_seek->stats.hints++;
+  if (pre_seek->ready == NULL || ABS(GST_CLOCK_DIFF(pre_seek->ready_position, position)) >= SAME_TARGET) {
+    pre_seek->hint = position;
+    g_cond_signal(&pre_seek->cond);
+  }
+  g_mutex_unlock(&pre_seek->lock);
+}
+
+/* This function is called on a seek to position. It returns the frame decoded ahead if it was
+ * hinted within tolerance of position, and sets frame_position to the position of its keyframe;
+ * the seek should go there. Returns NULL otherwise.
+ * The returned sample should be freed with gst_sample_unref() when no longer needed.
+*/
+GstSample *pre_seek_take(PreSeek *pre_seek, GstClockTime position, GstClockTime tolerance,
+    GstClockTime *frame_position)
+{
+  GstSample *sample = NULL;
+
+  g_return_val_if_fail(pre_seek != NULL && frame_position != NULL, NULL);
+
+  g_mutex_lock(&pre_seek->lock);
+  if (pre_seek->ready != NULL &&
+      (GstClockTime) ABS(GST_CLOCK_DIFF(pre_seek->ready_position, position)) <= tolerance) {
+    sample = pre_seek->ready;
+    *frame_position = pre_seek->ready_frame_position;
+    pre_seek->ready = NULL;
+    pre_seek->stats.hits++;
+  } else {
+    pre_seek->stats.misses++;
+  }
+  g_mutex_unlock(&pre_seek->lock);
+
+  return sample;
+}
+
+/* This function gives an estimate of the bytes held by the pipeline and the ready frame */
+guint64 pre_seek_get_memory(PreSeek *pre_seek)
+{
+  g_return_val_if_fail(pre_seek != NULL, 0);
+
+  g_mutex_lock(&pre_seek->lock);
+  guint64 bytes = pre_seek->pipeline_bytes;
+  if (pre_seek->ready != NULL)
+    bytes += gst_buffer_get_size(gst_sample_get_buffer(pre_seek->ready));
+  g_mutex_unlock(&pre_seek->lock);
+
+  return bytes;
+}
+
+/* This function bounds the bytes held by the pipeline and the ready frame. Over budget, the
+ * ready frame is dropped and the pipeline closed; with no budget, hints are ignored */
+void pre_seek_set_budget(PreSeek *pre_seek, guint64 budget)
+{
+  g_return_if_fail(pre_seek != NULL);
+
+  g_mutex_lock(&pre_seek->lock);
+  pre_seek->budget = budget;
+  if (pre_seek->ready != NULL &&
+      pre_seek->pipeline_bytes + gst_buffer_get_size(gst_sample_get_buffer(pre_seek->ready)) > budget) {
+    pre_seek->stats.wasted++;
+    gst_sample_unref(pre_seek->ready);
+    pre_seek->ready = NULL;
+  }
+  if (pre_seek->pipeline_bytes > budget || budget == 0) {
+    pre_seek->close_requested = TRUE;
+    g_cond_signal(&pre_seek->cond);
+  }
+  g_mutex_unlock(&pre_seek->lock);
+}
+
+void pre_seek_get_stats(PreSeek *pre_seek, PreSeekStats *stats)
+{
+  g_return_if_fail(pre_seek != NULL && stats != NULL);
+
+  g_mutex_lock(&pre_seek->lock);
+  *stats = pre_seek->stats;
+  g_mutex_unlock(&pre_seek->lock);
+}
+
+/* This function formats the counters for the HUD
+ * The returned string should be freed with g_free() when no longer needed.
+*/
+gchar *pre_seek_stats_to_string(const PreSeekStats *stats)
+{
+  g_return_val_if_fail(stats != NULL, NULL);
+
+  return g_strdup_printf("Pre-seek: %" G_GUINT64_FORMAT " hits, %" G_GUINT64_FORMAT " misses\n"
+                         "Pre-seek: %" G_GUINT64_FORMAT " of %" G_GUINT64_FORMAT " decodes wasted",
+                         stats->hits, stats->misses, stats->wasted, stats->decodes);
+}
@@ -0,0 +1,37 @@
+#ifndef PRE_SEEK_H
+#define PRE_SEEK_H
+
+#include <gst/gst.h>
+
+G_BEGIN_DECLS
+
+/* Counters of a pre-seeker, filled by pre_seek_get_stats() */
+typedef struct _PreSeekStats
+{
+  guint64 hints;     /* Likely seek targets given by the UI */
+  guint64 decodes;   /* Frames decoded ahead of a seek */
+  guint64 hits;      /* Seeks served by a frame decoded ahead */
+  guint64 misses;    /* Seeks with no frame decoded ahead near their target */
+  guint64 wasted;    /* Frames decoded ahead and dropped without serving a seek */
+} PreSeekStats;
+
+/* Thread decoding, on a pipeline of its own, the frame at the position the user is likely to seek to */
+typedef struct _PreSeek PreSeek;
+
+PreSeek *pre_seek_new(gint width, gboolean tune_decoders);
+void pre_seek_free(PreSeek *pre_seek);
+
+void pre_seek_set_uri(PreSeek *pre_seek, const gchar *uri);
+void pre_seek_hint(PreSeek *pre_seek, GstClockTime position);
+GstSample *pre_seek_take(PreSeek *pre_seek, GstClockTime position, GstClockTime tolerance,
+    GstClockTime *frame_position);
+
+guint64 pre_seek_get_memory(PreSeek *pre_seek);
+void pre_seek_set_budget(PreSeek *pre_seek, guint64 budget);
+
+void pre_seek_get_stats(PreSeek *pre_seek, PreSeekStats *stats);
+gchar *pre_seek_stats_to_string(const PreSeekStats *stats);
+
+G_END_DECLS
+
+#endif /* PRE_SEEK_H */
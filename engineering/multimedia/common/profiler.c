@@ -0,0 +1,335 @@
+#include "profiler.h"
+
+#include <string.h>
+
+#define PROFILER_TRACERS    "latency(flags=element);interlatency;proctime;rusage"
+#define HISTOGRAM_BUCKETS   48
+
+/* Log2 histogram of the values recorded for one element and one tracer metric */
+typedef struct _ProfilerEntry
+{
+  gchar *element;                    /* Path of the element, such as playbin/videosink, or thread-<id> for rusage */
+  const gchar *metric;               /* Tracer metric, a static string */
+  gboolean is_time;                  /* Values are nanoseconds, otherwise per-mille CPU load */
+  guint64 count;
+  guint64 total;
+  guint64 max;
+  guint64 buckets[HISTOGRAM_BUCKETS]; /* Bucket i counts values in [2^(i-1), 2^i) */
+} ProfilerEntry;
+
+/* Tracers log from every streaming thread, so the profiler is a locked singleton */
+static struct
+{
+  GMutex lock;
+  GHashTable *entries; /* "element\metric" -> ProfilerEntry */
+  GHashTable *paths;   /* Address of a watched element, as logged in element-id -> its path */
+  GHashTable *stacks;  /* Element path -> folded path of its bins */
+} profiler;
+
+gboolean profiler_format_from_string(const gchar *str, ProfilerFormat *format)
+{
+  g_return_val_if_fail(format != NULL, FALSE);
+
+  if (g_strcmp0(str, "table") == 0)
+    *format = PROFILER_FORMAT_TABLE;
+  else if (g_strcmp0(str, "folded") == 0)
+    *format = PROFILER_FORMAT_FOLDED;
+  else
+    return FALSE;
+
+  return TRUE;
+}
+
+static void profiler_entry_free(gpointer user_data)
+{
+  ProfilerEntry *entry = user_data;
+
+  g_free(entry->element);
+  g_free(entry);
+}
+
+/* This function adds a value to the histogram of an element metric, with the lock held */
+static void record_locked(const gchar *element, const gchar *metric, gboolean is_time, guint64 value)
+{
+  gchar *key = g_strconcat(element, "\\", metric, NULL);
+  ProfilerEntry *entry = g_hash_table_lookup(profiler.entries, key);
+
+  if (entry == NULL) {
+    entry = g_new0(ProfilerEntry, 1);
+    entry->element = g_strdup(element);
+    entry->metric = metric;
+    entry->is_time = is_time;
+    g_hash_table_insert(profiler.entries, key, entry);
+  } else {
+    g_free(key);
+  }
+
+  guint bucket = value > 0 ? g_bit_storage(value) : 0;
+  entry->buckets[MIN(bucket, HISTOGRAM_BUCKETS - 1)]++;
+  entry->count++;
+  entry->total += value;
+  entry->max = MAX(entry->max, value);
+}
+
+/* This function reads a tracer time field, logged either as guint64 or as a GST_TIME_FORMAT string */
+static gboolean structure_get_time(const GstStructure *s, const gchar *field, guint64 *time)
+{
+  const GValue *value = gst_structure_get_value(s, field);
+  guint hours, minutes, seconds;
+  gulong nanoseconds;
+
+  if (value == NULL)
+    return FALSE;
+
+  if (G_VALUE_HOLDS_UINT64(value)) {
+    *time = g_value_get_uint64(value);
+    return TRUE;
+  }
+
+  if (G_VALUE_HOLDS_STRING(value) &&
+      sscanf(g_value_get_string(value), "%u:%u:%u.%lu", &hours, &minutes, &seconds, &nanoseconds) == 4) {
+    *time = ((hours * 60 + minutes) * 60 + (guint64) seconds) * GST_SECOND + nanoseconds;
+    return TRUE;
+  }
+
+  return FALSE;
+}
+
+/* This function extracts the element path out of a pad path, such as bin/name out of
+ * /GstBin:bin/GstElement:name.GstPad:sink */
+static gchar *element_from_pad_path(const gchar *path)
+{
+  gchar **components = g_strsplit(path[0] == '/' ? path + 1 : path, "/", -1);
+  GString *element = g_string_new(NULL);
+
+  for (guint i = 0; components[i] != NULL; i++) {
+    const gchar *start = strchr(components[i], ':');
+    start = start != NULL ? start + 1 : components[i];
+
+    const gchar *end = components[i + 1] == NULL ? strchr(start, '.') : NULL;
+    if (element->len > 0)
+      g_string_append_c(element, '/');
+    g_string_append_len(element, start, end != NULL ? end - start : (gssize) strlen(start));
+  }
+
+  g_strfreev(components);
+  return g_string_free(element, FALSE);
+}
+
+/* This function gives the path of the element of a tracer record, with the lock held. Elements
+ * of other pipelines than the watched ones only have their name */
+static const gchar *element_path_locked(const GstStructure *s)
+{
+  const gchar *id = gst_structure_get_string(s, "element-id");
+  const gchar *path = id != NULL ? g_hash_table_lookup(profiler.paths, id) : NULL;
+
+  return path != NULL ? path : gst_structure_get_string(s, "element");
+}
+
+/* This function aggregates one tracer record */
+static void handle_record(const GstStructure *s)
+{
+  const gchar *name = gst_structure_get_name(s);
+  guint64 time;
+  guint load;
+
+  g_mutex_lock(&profiler.lock);
+  if (g_strcmp0(name, "element-latency") == 0 || g_strcmp0(name, "proctime") == 0) {
+    const gchar *element = element_path_locked(s);
+    if (element != NULL && structure_get_time(s, "time", &time))
+      record_locked(element, name[0] == 'p' ? "proctime" : "latency", TRUE, time);
+  } else if (g_strcmp0(name, "interlatency") == 0) {
+    const gchar *to_pad = gst_structure_get_string(s, "to_pad");
+    if (to_pad != NULL && structure_get_time(s, "time", &time)) {
+      gchar *element = element_from_pad_path(to_pad);
+      record_locked(element, "interlatency", TRUE, time);
+      g_free(element);
+    }
+  } else if (g_strcmp0(name, "thread-rusage") == 0) {
+    guint64 thread_id;
+    if (gst_structure_get_uint64(s, "thread-id", &thread_id) &&
+        gst_structure_get_uint(s, "current-cpuload", &load)) {
+      gchar *thread = g_strdup_printf("thread-%" G_GUINT64_FORMAT, thread_id);
+      record_locked(thread, "cpuload", FALSE, load);
+      g_free(thread);
+    }
+  } else if (g_strcmp0(name, "proc-rusage") == 0) {
+    if (gst_structure_get_uint(s, "current-cpuload", &load))
+      record_locked("process", "cpuload", FALSE, load);
+  }
+  g_mutex_unlock(&profiler.lock);
+}
+
+/* This function replaces the default log function: it aggregates tracer records
+ * in-process and forwards every other debug message to the default handler */
+static void profiler_log_func(GstDebugCategory *category, GstDebugLevel level,
+    const gchar *file, const gchar *function, gint line, GObject *object,
+    GstDebugMessage *message, gpointer user_data)
+{
+  if (level != GST_LEVEL_TRACE || g_strcmp0(gst_debug_category_get_name(category), "GST_TRACER") != 0) {
+    gst_debug_log_default(category, level, file, function, line, object, message, NULL);
+    return;
+  }
+
+  GstStructure *s = gst_structure_from_string(gst_debug_message_get(message), NULL);
+  if (s != NULL) {
+    handle_record(s);
+    gst_structure_free(s);
+  }
+}
+
+/* This function must be called before gst_init(), tracers are instantiated during initialization */
+void profiler_enable_tracers(void)
+{
+  g_setenv("GST_TRACERS", PROFILER_TRACERS, TRUE);
+}
+
+/* This function must be called right after gst_init() */
+void profiler_start(void)
+{
+  g_mutex_init(&profiler.lock);
+  profiler.entries = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, profiler_entry_free);
+  profiler.paths = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+  profiler.stacks = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+
+  gst_debug_set_active(TRUE);
+  gst_debug_set_threshold_for_name("GST_TRACER", GST_LEVEL_TRACE);
+  gst_debug_remove_log_function(gst_debug_log_default);
+  gst_debug_add_log_function(profiler_log_func, NULL, NULL);
+}
+
+/* This function is called when an element is added anywhere inside a watched pipeline. Elements
+ * are known by their path, as pipelines have elements of the same name, such as their videosink */
+static void deep_element_added_cb(GstBin *bin, GstBin *sub_bin, GstElement *element, gpointer user_data)
+{
+  GString *path = g_string_new(GST_OBJECT_NAME(element));
+  GString *stack = g_string_new(GST_OBJECT_NAME(element));
+
+  for (GstObject *parent = gst_object_get_parent(GST_OBJECT(element)); parent != NULL;) {
+    g_string_prepend_c(path, '/');
+    g_string_prepend(path, GST_OBJECT_NAME(parent));
+    g_string_prepend_c(stack, ';');
+    g_string_prepend(stack, GST_OBJECT_NAME(parent));
+
+    GstObject *grand_parent = gst_object_get_parent(parent);
+    gst_object_unref(parent);
+    parent = grand_parent;
+  }
+
+  g_mutex_lock(&profiler.lock);
+  g_hash_table_replace(profiler.paths, g_strdup_printf("%p", element), g_strdup(path->str));
+  g_hash_table_replace(profiler.stacks, g_string_free(path, FALSE), g_string_free(stack, FALSE));
+  g_mutex_unlock(&profiler.lock);
+}
+
+/* This function records the bin hierarchy of a pipeline, used to build the folded stacks */
+void profiler_watch_pipeline(GstElement *pipeline)
+{
+  g_return_if_fail(GST_IS_BIN(pipeline));
+  g_return_if_fail(profiler.stacks != NULL);
+
+  g_signal_connect(pipeline, "deep-element-added", G_CALLBACK(deep_element_added_cb), NULL);
+}
+
+/* This function estimates a percentile from the log2 buckets, returning the bucket upper bound */
+static guint64 entry_percentile(const ProfilerEntry *entry, gdouble percentile)
+{
+  guint64 rank = (guint64)(entry->count * percentile);
+  guint64 seen = 0;
+
+  for (guint i = 0; i < HISTOGRAM_BUCKETS; i++) {
+    seen += entry->buckets[i];
+    if (seen > rank)
+      return MIN(entry->max, i > 0 ? G_GUINT64_CONSTANT(1) << i : 0);
+  }
+
+  return entry->max;
+}
+
+/* This function formats a value in the unit of its entry
+ * The returned string should be freed with g_free() when no longer needed.
+*/
+static gchar *entry_format_value(const ProfilerEntry *entry, guint64 value)
+{
+  if (entry->is_time)
+    return g_strdup_printf("%.1fus", value / 1000.0);
+
+  return g_strdup_printf("%.1f%%", value / 10.0);
+}
+
+static gint entry_compare_total(gconstpointer a, gconstpointer b)
+{
+  const ProfilerEntry *entry_a = *(const ProfilerEntry **) a;
+  const ProfilerEntry *entry_b = *(const ProfilerEntry **) b;
+
+  /* Time metrics first, then by decreasing total */
+  if (entry_a->is_time != entry_b->is_time)
+    return entry_a->is_time ? -1 : 1;
+  if (entry_a->total != entry_b->total)
+    return entry_a->total > entry_b->total ? -1 : 1;
+  return 0;
+}
+
+static void dump_table(GPtrArray *entries, FILE *out)
+{
+  fprintf(out, "%-60s %-12s %10s %12s %12s %12s %12s %14s\n",
+      "ELEMENT", "METRIC", "COUNT", "MEAN", "P50", "P99", "MAX", "TOTAL");
+
+  for (guint i = 0; i < entries->len; i++) {
+    ProfilerEntry *entry = g_ptr_array_index(entries, i);
+    gchar *mean = entry_format_value(entry, entry->total / MAX(entry->count, 1));
+    gchar *p50 = entry_format_value(entry, entry_percentile(entry, 0.50));
+    gchar *p99 = entry_format_value(entry, entry_percentile(entry, 0.99));
+    gchar *max = entry_format_value(entry, entry->max);
+    gchar *total = entry->is_time ? entry_format_value(entry, entry->total) : g_strdup("-");
+
+    fprintf(out, "%-60s %-12s %10" G_GUINT64_FORMAT " %12s %12s %12s %12s %14s\n",
+        entry->element, entry->metric, entry->count, mean, p50, p99, max, total);
+
+    g_free(mean);
+    g_free(p50);
+    g_free(p99);
+    g_free(max);
+    g_free(total);
+  }
+}
+
+/* Folded stacks weight every element of the watched pipelines by its processing time, in microseconds */
+static void dump_folded(GPtrArray *entries, FILE *out)
+{
+  for (guint i = 0; i < entries->len; i++) {
+    ProfilerEntry *entry = g_ptr_array_index(entries, i);
+    if (g_strcmp0(entry->metric, "proctime") != 0)
+      continue;
+
+    const gchar *stack = g_hash_table_lookup(profiler.stacks, entry->element);
+    fprintf(out, "%s %" G_GUINT64_FORMAT "\n",
+        stack != NULL ? stack : entry->element, entry->total / 1000);
+  }
+}
+
+/* This function writes the aggregated tracer data, it is meant to be called on exit */
+void profiler_dump(ProfilerFormat format, FILE *out)
+{
+  g_return_if_fail(profiler.entries != NULL);
+  g_return_if_fail(out != NULL);
+
+  g_mutex_lock(&profiler.lock);
+  GPtrArray *entries = g_ptr_array_new();
+  GHashTableIter iter;
+  gpointer value;
+
+  g_hash_table_iter_init(&iter, profiler.entries);
+  while (g_hash_table_iter_next(&iter, NULL, &value))
+    g_ptr_array_add(entries, value);
+  g_ptr_array_sort(entries, entry_compare_total);
+
+  if (format == PROFILER_FORMAT_FOLDED)
+    dump_folded(entries, out);
+  else
+    dump_table(entries, out);
+
+  g_ptr_array_unref(entries);
+  g_mutex_unlock(&profiler.lock);
+  fflush(out);
+}
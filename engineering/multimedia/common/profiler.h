@@ -0,0 +1,25 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <stdio.h>
+#include <gst/gst.h>
+
+G_BEGIN_DECLS
+
+/* Output formats of profiler_dump() */
+typedef enum
+{
+  PROFILER_FORMAT_TABLE,  /* Per-element table sorted by total time */
+  PROFILER_FORMAT_FOLDED  /* Folded stacks for flamegraph.pl / speedscope */
+} ProfilerFormat;
+
+gboolean profiler_format_from_string(const gchar *str, ProfilerFormat *format);
+
+void profiler_enable_tracers(void);
+void profiler_start(void);
+void profiler_watch_pipeline(GstElement *pipeline);
+void profiler_dump(ProfilerFormat format, FILE *out);
+
+G_END_DECLS
+
+#endif /* PROFILER_H */
@@ -0,0 +1,187 @@
+#define _GNU_SOURCE
+#include "proxygen.h"
+#include "sharedtaskpool.h"
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <glib/gstdio.h>
+
+#define PROXY_CAPS    "video/x-raw,height=%d,pixel-aspect-ratio=1/1"
+#define PROXY_QUALITY 75  /* JPEG quality of the proxy frames */
+#define PROXY_NICE    19  /* Nice value of the threads of the job, so playback always comes first */
+
+struct _ProxyJob
+{
+  GstElement *pipeline;
+  gchar *path;          /* Where the proxy ends up */
+  gchar *partial_path;  /* Where it is written, renamed to path once complete */
+  guint watch_id;       /* Bus watch, 0 once the job is done */
+  ProxyDoneFunc done;
+  gpointer user_data;
+};
+
+/* This function links the first video stream of the clip to the converter */
+static void source_pad_added_cb(GstElement *source, GstPad *pad, GstElement *convert)
+{
+  GstPad *sink = gst_element_get_static_pad(convert, "sink");
+
+  if (!gst_pad_is_linked(sink))
+    gst_pad_link(pad, sink);
+  gst_object_unref(sink);
+}
+
+/* This function lowers the priority of the thread running the demuxer or decoder, on its first
+ * event. The threads a decoder creates afterwards inherit it */
+static GstPadProbeReturn lower_priority_probe_cb(GstPad *pad, GstPadProbeInfo *info, gpointer user_data)
+{
+  if (GST_EVENT_TYPE(GST_PAD_PROBE_INFO_EVENT(info)) != GST_EVENT_STREAM_START)
+    return GST_PAD_PROBE_OK;
+
+  setpriority(PRIO_PROCESS, (id_t) syscall(SYS_gettid), PROXY_NICE);
+  return GST_PAD_PROBE_REMOVE;
+}
+
+static void deep_element_added_cb(GstBin *bin, GstBin *sub_bin, GstElement *element, gpointer user_data)
+{
+  GstElementFactory *factory = gst_element_get_factory(element);
+  const gchar *klass = factory != NULL ? gst_element_factory_get_metadata(factory, GST_ELEMENT_METADATA_KLASS) : NULL;
+
+  if (klass == NULL || (strstr(klass, "Decoder") == NULL && strstr(klass, "Demuxer") == NULL))
+    return;
+
+  GstPad *pad = gst_element_get_static_pad(element, "sink");
+  if (pad != NULL) {
+    gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM, lower_priority_probe_cb, NULL, NULL);
+    gst_object_unref(pad);
+  }
+}
+
+static gboolean bus_watch_cb(GstBus *bus, GstMessage *msg, ProxyJob *job)
+{
+  GError *error = NULL;
+
+  switch (GST_MESSAGE_TYPE(msg)) {
+  case GST_MESSAGE_EOS:
+    gst_element_set_state(job->pipeline, GST_STATE_NULL);
+    if (g_rename(job->partial_path, job->path) != 0)
+      g_set_error(&error, G_FILE_ERROR, g_file_error_from_errno(errno), "Could not move the proxy to %s", job->path);
+    break;
+  case GST_MESSAGE_ERROR:
+    gst_message_parse_error(msg, &error, NULL);
+    gst_element_set_state(job->pipeline, GST_STATE_NULL);
+    g_unlink(job->partial_path);
+    break;
+  default:
+    return G_SOURCE_CONTINUE;
+  }
+
+  /* The callback may free the job */
+  job->watch_id = 0;
+  job->done(job->path, error, job->user_data);
+  g_clear_error(&error);
+  return G_SOURCE_REMOVE;
+}
+
+/* This function starts transcoding the video of the clip at uri to a MJPEG proxy of the given
+ * height at path. Every frame of the proxy is a keyframe, so seeking it decodes one small
+ * frame. The threads of the job run at the lowest priority, and done is called
+ * from the main context when it is over */
+ProxyJob *proxy_job_start(const gchar *uri, const gchar *path, gint height,
+    ProxyDoneFunc done, gpointer user_data, GError **error)
+{
+  g_return_val_if_fail(uri != NULL && path != NULL, NULL);
+  g_return_val_if_fail(height > 0, NULL);
+  g_return_val_if_fail(done != NULL, NULL);
+
+  GstElement *pipeline = gst_pipeline_new("proxy");
+  GstElement *source = gst_element_factory_make("uridecodebin", NULL);
+  GstElement *convert = gst_element_factory_make("videoconvert", NULL);
+  GstElement *scale = gst_element_factory_make("videoscale", NULL);
+  GstElement *filter = gst_element_factory_make("capsfilter", NULL);
+  GstElement *encoder = gst_element_factory_make("jpegenc", NULL);
+  GstElement *muxer = gst_element_factory_make("matroskamux", NULL);
+  GstElement *sink = gst_element_factory_make("filesink", NULL);
+
+  if (source == NULL || convert == NULL || scale == NULL || filter == NULL || encoder == NULL ||
+      muxer == NULL || sink == NULL) {
+    g_set_error(error, GST_CORE_ERROR, GST_CORE_ERROR_MISSING_PLUGIN, "Not all proxy elements could be created");
+    gst_object_unref(pipeline);
+    return NULL;
+  }
+
+  ProxyJob *job = g_new0(ProxyJob, 1);
+  job->pipeline = pipeline;
+  job->path = g_strdup(path);
+  job->partial_path = g_strconcat(path, ".partial", NULL);
+  job->done = done;
+  job->user_data = user_data;
+
+  GstCaps *caps = gst_caps_from_string("video/x-raw");
+  g_object_set(source, "uri", uri, "caps", caps, "expose-all-streams", FALSE, NULL);
+  gst_caps_unref(caps);
+
+  gchar *caps_str = g_strdup_printf(PROXY_CAPS, height);
+  caps = gst_caps_from_string(caps_str);
+  g_object_set(filter, "caps", caps, NULL);
+  gst_caps_unref(caps);
+  g_free(caps_str);
+
+  g_object_set(encoder, "quality", PROXY_QUALITY, NULL);
+  g_object_set(sink, "location", job->partial_path, "sync", FALSE, NULL);
+
+  gst_bin_add_many(GST_BIN(pipeline), source, convert, scale, filter, encoder, muxer, sink, NULL);
+  gst_element_link_many(convert, scale, filter, encoder, muxer, sink, NULL);
+  g_signal_connect(source, "pad-added", G_CALLBACK(source_pad_added_cb), convert);
+  g_signal_connect(pipeline, "deep-element-added", G_CALLBACK(deep_element_added_cb), NULL);
+
+  shared_task_pool_install(pipeline, shared_task_pool_get_default());
+
+  GstBus *bus = gst_element_get_bus(pipeline);
+  job->watch_id = gst_bus_add_watch(bus, (GstBusFunc) bus_watch_cb, job);
+  gst_object_unref(bus);
+
+  if (gst_element_set_state(pipeline, GST_STATE_PLAYING) == GST_STATE_CHANGE_FAILURE) {
+    g_set_error(error, GST_CORE_ERROR, GST_CORE_ERROR_STATE_CHANGE, "Could not start the proxy of %s", uri);
+    proxy_job_free(job);
+    return NULL;
+  }
+
+  return job;
+}
+
+/* This function stops the job if it is still running, and removes what it wrote */
+void proxy_job_free(ProxyJob *job)
+{
+  g_return_if_fail(job != NULL);
+
+  if (job->watch_id != 0) {
+    g_source_remove(job->watch_id);
+    gst_element_set_state(job->pipeline, GST_STATE_NULL);
+    g_unlink(job->partial_path);
+  }
+
+  gst_object_unref(job->pipeline);
+  g_free(job->partial_path);
+  g_free(job->path);
+  g_free(job);
+}
+
+/* This function gives the part of the clip transcoded so far, from 0 to 1 */
+gdouble proxy_job_get_progress(ProxyJob *job)
+{
+  g_return_val_if_fail(job != NULL, 0);
+
+  gint64 position, duration;
+
+  if (job->watch_id == 0)
+    return 1;
+
+  if (!gst_element_query_position(job->pipeline, GST_FORMAT_TIME, &position) ||
+      !gst_element_query_duration(job->pipeline, GST_FORMAT_TIME, &duration) || duration <= 0)
+    return 0;
+
+  return CLAMP((gdouble) position / duration, 0, 1);
+}
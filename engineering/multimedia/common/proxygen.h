@@ -0,0 +1,22 @@
+#ifndef PROXY_GEN_H
+#define PROXY_GEN_H
+
+#include <gst/gst.h>
+
+G_BEGIN_DECLS
+
+/* Called from the main context when the proxy is written, error is NULL on success */
+typedef void (*ProxyDoneFunc)(const gchar *path, const GError *error, gpointer user_data);
+
+/* Transcoding of a clip to a low resolution, all-intra proxy used for scrubbing */
+typedef struct _ProxyJob ProxyJob;
+
+ProxyJob *proxy_job_start(const gchar *uri, const gchar *path, gint height,
+    ProxyDoneFunc done, gpointer user_data, GError **error);
+void proxy_job_free(ProxyJob *job);
+
+gdouble proxy_job_get_progress(ProxyJob *job);
+
+G_END_DECLS
+
+#endif /* PROXY_GEN_H */
@@ -0,0 +1,105 @@
+#include "sharedtaskpool.h"
+
+/* GstTaskPool running the streaming threads of every pipeline on one WorkPool,
+ * so their threads are reused across pipelines. They are dedicated jobs of the pool:
+ * a task kept waiting for a thread would hang its pipeline without an error */
+struct _SharedTaskPool
+{
+  GstTaskPool parent;
+
+  WorkPool *pool;  /* Not owned */
+};
+
+G_DEFINE_TYPE(SharedTaskPool, shared_task_pool, GST_TYPE_TASK_POOL)
+
+/* Threads belong to the WorkPool, there is nothing to set up or tear down per GstTaskPool */
+static void shared_task_pool_prepare(GstTaskPool *pool, GError **error)
+{
+}
+
+static void shared_task_pool_cleanup(GstTaskPool *pool)
+{
+}
+
+/* Streaming tasks loop until they are stopped, they are never kept waiting for a thread */
+static gpointer shared_task_pool_push(GstTaskPool *pool, GstTaskPoolFunction func,
+    gpointer user_data, GError **error)
+{
+  SharedTaskPool *self = SHARED_TASK_POOL(pool);
+
+  return work_pool_push(self->pool, (WorkFunc) func, user_data, WORK_JOB_DEDICATED, error);
+}
+
+static void shared_task_pool_join(GstTaskPool *pool, gpointer id)
+{
+  if (id != NULL)
+    work_job_join(id);
+}
+
+static void shared_task_pool_class_init(SharedTaskPoolClass *klass)
+{
+  GstTaskPoolClass *pool_class = GST_TASK_POOL_CLASS(klass);
+
+  pool_class->prepare = shared_task_pool_prepare;
+  pool_class->cleanup = shared_task_pool_cleanup;
+  pool_class->push = shared_task_pool_push;
+  pool_class->join = shared_task_pool_join;
+}
+
+static void shared_task_pool_init(SharedTaskPool *self)
+{
+}
+
+GstTaskPool *shared_task_pool_new(WorkPool *pool)
+{
+  g_return_val_if_fail(pool != NULL, NULL);
+
+  SharedTaskPool *self = g_object_new(SHARED_TYPE_TASK_POOL, NULL);
+  self->pool = pool;
+
+  return GST_TASK_POOL(self);
+}
+
+static gpointer create_default_task_pool(gpointer user_data)
+{
+  return shared_task_pool_new(work_pool_get_default());
+}
+
+/* This function returns the task pool backed by the default WorkPool, it is never freed */
+GstTaskPool *shared_task_pool_get_default(void)
+{
+  static GOnce once = G_ONCE_INIT;
+
+  g_once(&once, create_default_task_pool, NULL);
+  return once.retval;
+}
+
+/* This function is called from the streaming thread creating a task, before it starts */
+static void stream_status_cb(GstBus *bus, GstMessage *msg, GstTaskPool *pool)
+{
+  GstStreamStatusType type;
+  GstElement *owner;
+  const GValue *value;
+
+  gst_message_parse_stream_status(msg, &type, &owner);
+  if (type != GST_STREAM_STATUS_TYPE_CREATE)
+    return;
+
+  value = gst_message_get_stream_status_object(msg);
+  if (value == NULL || !G_VALUE_HOLDS(value, GST_TYPE_TASK))
+    return;
+
+  gst_task_set_pool(GST_TASK(g_value_get_object(value)), pool);
+}
+
+/* This function makes every task created by the pipeline run on the given pool */
+void shared_task_pool_install(GstElement *pipeline, GstTaskPool *pool)
+{
+  g_return_if_fail(GST_IS_PIPELINE(pipeline));
+  g_return_if_fail(GST_IS_TASK_POOL(pool));
+
+  GstBus *bus = gst_element_get_bus(pipeline);
+  gst_bus_enable_sync_message_emission(bus);
+  g_signal_connect_object(bus, "sync-message::stream-status", G_CALLBACK(stream_status_cb), pool, 0);
+  gst_object_unref(bus);
+}
@@ -0,0 +1,19 @@
+#ifndef SHARED_TASK_POOL_H
+#define SHARED_TASK_POOL_H
+
+#include <gst/gst.h>
+
+#include "workpool.h"
+
+G_BEGIN_DECLS
+
+#define SHARED_TYPE_TASK_POOL (shared_task_pool_get_type())
+G_DECLARE_FINAL_TYPE(SharedTaskPool, shared_task_pool, SHARED, TASK_POOL, GstTaskPool)
+
+GstTaskPool *shared_task_pool_new(WorkPool *pool);
+GstTaskPool *shared_task_pool_get_default(void);
+void shared_task_pool_install(GstElement *pipeline, GstTaskPool *pool);
+
+G_END_DECLS
+
+#endif /* SHARED_TASK_POOL_H */
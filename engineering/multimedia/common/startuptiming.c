@@ -0,0 +1,78 @@
+#include "startuptiming.h"
+
+#define MAX_PHASES 32
+
+/* End of one startup phase */
+typedef struct _StartupPhase
+{
+  const gchar *name;   /* Static string given to startup_timing_mark() */
+  GThread *thread;     /* Thread that ran the phase */
+  gint64 end;          /* Monotonic time the phase ended at, in microseconds */
+} StartupPhase;
+
+/* Phases are marked from the UI thread and from the GStreamer init thread */
+static struct
+{
+  GMutex lock;
+  gint64 start;
+  GThread *main_thread;
+  StartupPhase phases[MAX_PHASES];
+  guint n_phases;
+} timing;
+
+/* This function starts the clock, it should be the first thing main() does */
+void startup_timing_begin(void)
+{
+  g_mutex_lock(&timing.lock);
+  timing.start = g_get_monotonic_time();
+  timing.main_thread = g_thread_self();
+  timing.n_phases = 0;
+  g_mutex_unlock(&timing.lock);
+}
+
+/* This function records that phase just ended on the calling thread, phase must be a static string */
+void startup_timing_mark(const gchar *phase)
+{
+  g_return_if_fail(phase != NULL);
+
+  gint64 now = g_get_monotonic_time();
+
+  g_mutex_lock(&timing.lock);
+  if (timing.n_phases < MAX_PHASES) {
+    StartupPhase *p = &timing.phases[timing.n_phases++];
+    p->name = phase;
+    p->thread = g_thread_self();
+    p->end = now;
+  }
+  g_mutex_unlock(&timing.lock);
+}
+
+/* This function prints the phases in the order they ended. The duration of a phase is the
+ * time since the previous phase of the same thread, so phases run in parallel overlap */
+void startup_timing_report(FILE *out, gdouble target_ms)
+{
+  g_return_if_fail(out != NULL);
+
+  g_mutex_lock(&timing.lock);
+  fprintf(out, "%-24s %-10s %10s %10s\n", "phase", "thread", "at-ms", "took-ms");
+  for (guint i = 0; i < timing.n_phases; i++) {
+    const StartupPhase *p = &timing.phases[i];
+    gint64 previous = timing.start;
+
+    for (guint j = 0; j < i; j++) {
+      if (timing.phases[j].thread == p->thread)
+        previous = timing.phases[j].end;
+    }
+
+    fprintf(out, "%-24s %-10s %10.1f %10.1f\n", p->name,
+        p->thread == timing.main_thread ? "main" : "background",
+        (p->end - timing.start) / 1000.0, (p->end - previous) / 1000.0);
+  }
+
+  if (timing.n_phases > 0) {
+    gdouble total_ms = (timing.phases[timing.n_phases - 1].end - timing.start) / 1000.0;
+    fprintf(out, "startup took %.1f ms, %s the %.0f ms target\n", total_ms,
+        total_ms <= target_ms ? "within" : "over", target_ms);
+  }
+  g_mutex_unlock(&timing.lock);
+}
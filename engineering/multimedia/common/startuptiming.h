@@ -0,0 +1,15 @@
+#ifndef STARTUP_TIMING_H
+#define STARTUP_TIMING_H
+
+#include <stdio.h>
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+void startup_timing_begin(void);
+void startup_timing_mark(const gchar *phase);
+void startup_timing_report(FILE *out, gdouble target_ms);
+
+G_END_DECLS
+
+#endif /* STARTUP_TIMING_H */
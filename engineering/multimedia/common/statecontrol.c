@@ -0,0 +1,132 @@
+#include "statecontrol.h"
+
+/* State changes are made by gst_element_call_async(), off the calling thread, since going to
+ * READY or NULL waits for the streaming threads, which may be blocked on the network or in a
+ * decoder. The requests of an element are run in the order they were made, by a single call
+ * at a time draining the queue attached to the element. */
+
+typedef struct _StateRequest
+{
+  GstElement *element;
+  GstState state;
+  GstStateChangeReturn ret;
+  StateControlDoneFunc done;
+  GDestroyNotify notify;   /* For a teardown, called from the control thread instead of done */
+  gpointer user_data;
+} StateRequest;
+
+typedef struct _StateQueue
+{
+  GMutex lock;             /* Protects the fields below */
+  GQueue requests;
+  gboolean draining;       /* Whether a call is running the requests */
+} StateQueue;
+
+G_DEFINE_QUARK(state-control-queue, state_queue)
+
+static void state_queue_free(StateQueue *queue)
+{
+  g_mutex_clear(&queue->lock);
+  g_free(queue);
+}
+
+/* This function gives the queue of element, made on its first request */
+static StateQueue *get_state_queue(GstElement *element)
+{
+  StateQueue *queue;
+
+  GST_OBJECT_LOCK(element);
+  queue = g_object_get_qdata(G_OBJECT(element), state_queue_quark());
+  if (queue == NULL) {
+    queue = g_new0(StateQueue, 1);
+    g_mutex_init(&queue->lock);
+    g_queue_init(&queue->requests);
+    g_object_set_qdata_full(G_OBJECT(element), state_queue_quark(), queue, (GDestroyNotify) state_queue_free);
+  }
+  GST_OBJECT_UNLOCK(element);
+
+  return queue;
+}
+
+static void state_request_free(StateRequest *request)
+{
+  gst_object_unref(request->element);
+  g_free(request);
+}
+
+static gboolean state_done_idle(StateRequest *request)
+{
+  request->done(request->element, request->state, request->ret, request->user_data);
+  state_request_free(request);
+  return G_SOURCE_REMOVE;
+}
+
+/* This function runs on a GStreamer thread, until the queue of element is empty */
+static void drain_func(GstElement *element, StateQueue *queue)
+{
+  for (;;) {
+    g_mutex_lock(&queue->lock);
+    StateRequest *request = g_queue_pop_head(&queue->requests);
+    if (request == NULL)
+      queue->draining = FALSE;
+    g_mutex_unlock(&queue->lock);
+
+    if (request == NULL)
+      return;
+
+    request->ret = gst_element_set_state(element, request->state);
+    if (request->notify != NULL) {
+      request->notify(request->user_data);
+      state_request_free(request);
+    } else if (request->done != NULL) {
+      g_idle_add((GSourceFunc) state_done_idle, request);
+    } else {
+      state_request_free(request);
+    }
+  }
+}
+
+static void push_request(StateRequest *request)
+{
+  StateQueue *queue = get_state_queue(request->element);
+  gboolean start;
+
+  g_mutex_lock(&queue->lock);
+  g_queue_push_tail(&queue->requests, request);
+  start = !queue->draining;
+  queue->draining = TRUE;
+  g_mutex_unlock(&queue->lock);
+
+  if (start)
+    gst_element_call_async(request->element, (GstElementCallAsyncFunc) drain_func, queue, NULL);
+}
+
+/* This function queues a change of element to state and returns at once. done, if not NULL, is
+ * called from the default main context with the result of gst_element_set_state(). Changes to
+ * PAUSED or PLAYING usually complete later, as reported by the state-changed messages */
+void state_control_set(GstElement *element, GstState state, StateControlDoneFunc done, gpointer user_data)
+{
+  g_return_if_fail(GST_IS_ELEMENT(element));
+
+  StateRequest *request = g_new0(StateRequest, 1);
+  request->element = gst_object_ref(element);
+  request->state = state;
+  request->done = done;
+  request->user_data = user_data;
+  push_request(request);
+}
+
+/* This function sets element to NULL in the background, after the changes already queued, and
+ * then calls notify, if not NULL, from that thread. It can be used while the main loop is quitting:
+ * the caller may drop its reference to element at once */
+void state_control_teardown(GstElement *element, GDestroyNotify notify, gpointer user_data)
+{
+  g_return_if_fail(GST_IS_ELEMENT(element));
+
+  StateRequest *request = g_new0(StateRequest, 1);
+  request->element = gst_object_ref(element);
+  request->state = GST_STATE_NULL;
+  request->notify = notify;
+  request->user_data = user_data;
+  push_request(request);
+}
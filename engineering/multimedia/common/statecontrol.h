@@ -0,0 +1,17 @@
+#ifndef STATE_CONTROL_H
+#define STATE_CONTROL_H
+
+#include <gst/gst.h>
+
+G_BEGIN_DECLS
+
+/* Called from the main context once a state change queued by state_control_set() returned */
+typedef void (*StateControlDoneFunc)(GstElement *element, GstState state, GstStateChangeReturn ret,
+    gpointer user_data);
+
+void state_control_set(GstElement *element, GstState state, StateControlDoneFunc done, gpointer user_data);
+void state_control_teardown(GstElement *element, GDestroyNotify notify, gpointer user_data);
+
+G_END_DECLS
+
+#endif /* STATE_CONTROL_H */
@@ -0,0 +1,230 @@
+#include "storyboard.h"
+
+#include <string.h>
+#include <gdk-pixbuf/gdk-pixbuf.h>
+
+#define TILE_CAPS       "video/x-raw,format=RGB,width=%d,pixel-aspect-ratio=1/1"
+#define TILE_WIDTH      160
+#define SPRITE_COLUMNS  10
+#define SPRITE_ROWS     10
+#define SPRITE_QUALITY  "80"  /* JPEG quality of the sprites */
+#define PREROLL_TIMEOUT (5 * GST_SECOND)
+
+/* Pipeline decoding the tiles missing from the cache, made on the first miss */
+typedef struct _TileDecoder
+{
+  GstElement *pipeline;
+  GstElement *sink;
+} TileDecoder;
+
+static gboolean tile_decoder_open(TileDecoder *decoder, const gchar *uri, GError **error)
+{
+  gchar *caps = g_strdup_printf(TILE_CAPS, TILE_WIDTH);
+  gchar *description = g_strdup_printf("uridecodebin uri=\"%s\" ! videoconvert ! videoscale ! "
+      "appsink name=sink sync=false caps=\"%s\"", uri, caps);
+
+  decoder->pipeline = gst_parse_launch(description, error);
+  g_free(description);
+  g_free(caps);
+  if (decoder->pipeline == NULL)
+    return FALSE;
+
+  decoder->sink = gst_bin_get_by_name(GST_BIN(decoder->pipeline), "sink");
+  if (gst_element_set_state(decoder->pipeline, GST_STATE_PAUSED) == GST_STATE_CHANGE_FAILURE ||
+      gst_element_get_state(decoder->pipeline, NULL, NULL, PREROLL_TIMEOUT) != GST_STATE_CHANGE_SUCCESS) {
+    g_set_error(error, GST_CORE_ERROR, GST_CORE_ERROR_STATE_CHANGE, "Could not decode %s", uri);
+    return FALSE;
+  }
+
+  return TRUE;
+}
+
+static void tile_decoder_close(TileDecoder *decoder)
+{
+  if (decoder->pipeline == NULL)
+    return;
+
+  gst_element_set_state(decoder->pipeline, GST_STATE_NULL);
+  if (decoder->sink != NULL)
+    gst_object_unref(decoder->sink);
+  gst_object_unref(decoder->pipeline);
+}
+
+/* This function decodes the keyframe nearest to position
+ * The returned pixbuf should be freed with g_object_unref() when no longer needed.
+*/
+static GdkPixbuf *tile_decoder_get(TileDecoder *decoder, GstClockTime position)
+{
+  GstSample *sample = NULL;
+  GstMapInfo map;
+  gint width, height;
+
+  if (!gst_element_seek_simple(decoder->pipeline, GST_FORMAT_TIME, GST_SEEK_FLAG_KEY_UNIT | GST_SEEK_FLAG_FLUSH,
+        position))
+    return NULL;
+  g_signal_emit_by_name(decoder->sink, "try-pull-preroll", PREROLL_TIMEOUT, &sample, NULL);
+  if (sample == NULL)
+    return NULL;
+
+  GstStructure *s = gst_caps_get_structure(gst_sample_get_caps(sample), 0);
+  GstBuffer *buffer = gst_sample_get_buffer(sample);
+  GdkPixbuf *pixbuf = NULL;
+
+  if (gst_structure_get_int(s, "width", &width) && gst_structure_get_int(s, "height", &height) &&
+      gst_buffer_map(buffer, &map, GST_MAP_READ)) {
+    GdkPixbuf *wrapper = gdk_pixbuf_new_from_data(map.data, GDK_COLORSPACE_RGB, FALSE, 8, width, height,
+        GST_ROUND_UP_4(width * 3), NULL, NULL);
+    pixbuf = gdk_pixbuf_copy(wrapper);
+    g_object_unref(wrapper);
+    gst_buffer_unmap(buffer, &map);
+  }
+
+  gst_sample_unref(sample);
+  return pixbuf;
+}
+
+/* This function stores a decoded tile in the cache. The tile is written aside and moved in place,
+ * so an export running at the same time never loads a truncated one. Failing to cache it only
+ * means decoding it again next time */
+static void cache_tile(GdkPixbuf *tile, const gchar *path)
+{
+  gchar *partial = thumb_cache_get_partial_path(path);
+  GError *error = NULL;
+
+  if (!thumb_cache_commit(partial, path, gdk_pixbuf_save(tile, partial, "png", &error, NULL), &error)) {
+    g_printerr("Could not cache the tile %s: %s\n", path, error != NULL ? error->message : "unknown error");
+    g_clear_error(&error);
+  }
+  g_free(partial);
+}
+
+static void append_timestamp(GString *str, GstClockTime time)
+{
+  guint64 ms = time / GST_MSECOND;
+
+  g_string_append_printf(str, "%02u:%02u:%02u.%03u", (guint) (ms / 3600000), (guint) (ms / 60000 % 60),
+      (guint) (ms / 1000 % 60), (guint) (ms % 1000));
+}
+
+/* This function writes a sprite, the part of it holding tiles */
+static gboolean save_sprite(GdkPixbuf *sprite, guint n_tiles, gint tile_width, gint tile_height,
+    const gchar *path, GError **error)
+{
+  gint rows = (n_tiles + SPRITE_COLUMNS - 1) / SPRITE_COLUMNS;
+  gint columns = MIN(n_tiles, SPRITE_COLUMNS);
+  GdkPixbuf *used = gdk_pixbuf_new_subpixbuf(sprite, 0, 0, columns * tile_width, rows * tile_height);
+
+  gboolean res = gdk_pixbuf_save(used, path, "jpeg", error, "quality", SPRITE_QUALITY, NULL);
+  g_object_unref(used);
+  return res;
+}
+
+/* This function writes the storyboard of the clip at uri to dir: name-N.jpg sprites of up to
+ * 10x10 tiles, one tile per interval, and name.vtt mapping each interval to its tile. Tiles
+ * are taken from the cache, only the missing ones are decoded, in one pass, and stored in the
+ * cache. Running it again for the same clip decodes nothing, it only encodes the sprites */
+gboolean storyboard_export(ThumbCache *cache, const gchar *uri, GstClockTime duration, GstClockTime interval,
+    const gchar *dir, const gchar *name, StoryboardStats *stats, GError **error)
+{
+  g_return_val_if_fail(cache != NULL && uri != NULL && dir != NULL && name != NULL, FALSE);
+  g_return_val_if_fail(GST_CLOCK_TIME_IS_VALID(duration) && interval > 0, FALSE);
+
+  guint n_tiles = MAX(1, (duration + interval - 1) / interval);
+  guint per_sprite = SPRITE_COLUMNS * SPRITE_ROWS;
+  TileDecoder decoder = { NULL, NULL };
+  GdkPixbuf *sprite = NULL;
+  gint tile_width = 0, tile_height = 0;
+  gboolean res = TRUE;
+  GString *vtt = g_string_new("WEBVTT\n");
+
+  memset(stats, 0, sizeof(*stats));
+  stats->tiles = n_tiles;
+
+  for (guint i = 0; i < n_tiles && res; i++) {
+    GstClockTime start = i * interval;
+    GstClockTime end = MIN(start + interval, duration);
+    gchar *tile_name = g_strdup_printf("storyboard-%" G_GUINT64_FORMAT "-%u", interval / GST_MSECOND, i);
+    gchar *path = thumb_cache_lookup(cache, uri, tile_name);
+    GdkPixbuf *tile = NULL;
+
+    /* A cached tile that does not load is decoded again, and replaced */
+    if (path != NULL) {
+      tile = gdk_pixbuf_new_from_file(path, NULL);
+      if (tile == NULL)
+        g_clear_pointer(&path, g_free);
+    }
+    if (tile == NULL) {
+      if (decoder.pipeline == NULL && !tile_decoder_open(&decoder, uri, error)) {
+        res = FALSE;
+      } else {
+        tile = tile_decoder_get(&decoder, start + (end - start) / 2);
+        stats->decoded++;
+        if (tile != NULL) {
+          path = thumb_cache_get_path(cache, uri, tile_name);
+          cache_tile(tile, path);
+        }
+      }
+    }
+    g_free(tile_name);
+
+    if (res && tile == NULL) {
+      g_set_error(error, GST_STREAM_ERROR, GST_STREAM_ERROR_DECODE, "No tile for %" GST_TIME_FORMAT,
+          GST_TIME_ARGS(start));
+      res = FALSE;
+    }
+
+    if (res) {
+      /* The size of the first tile is the size of all of them */
+      if (tile_width == 0) {
+        tile_width = gdk_pixbuf_get_width(tile);
+        tile_height = gdk_pixbuf_get_height(tile);
+      }
+
+      guint index = i % per_sprite;
+      if (sprite == NULL)
+        sprite = gdk_pixbuf_new(GDK_COLORSPACE_RGB, FALSE, 8, SPRITE_COLUMNS * tile_width, SPRITE_ROWS * tile_height);
+
+      gint x = (index % SPRITE_COLUMNS) * tile_width;
+      gint y = (index / SPRITE_COLUMNS) * tile_height;
+      gdk_pixbuf_copy_area(tile, 0, 0, MIN(tile_width, gdk_pixbuf_get_width(tile)),
+          MIN(tile_height, gdk_pixbuf_get_height(tile)), sprite, x, y);
+
+      g_string_append_c(vtt, '\n');
+      append_timestamp(vtt, start);
+      g_string_append(vtt, " --> ");
+      append_timestamp(vtt, end);
+      g_string_append_printf(vtt, "\n%s-%u.jpg#xywh=%d,%d,%d,%d\n", name, i / per_sprite, x, y, tile_width, tile_height);
+
+      /* A sprite is written as soon as it is full, only one is in memory */
+      if (index == per_sprite - 1 || i == n_tiles - 1) {
+        gchar *file = g_strdup_printf("%s-%u.jpg", name, i / per_sprite);
+        gchar *sprite_path = g_build_filename(dir, file, NULL);
+
+        res = save_sprite(sprite, index + 1, tile_width, tile_height, sprite_path, error);
+        stats->sprites++;
+        g_clear_object(&sprite);
+        g_free(sprite_path);
+        g_free(file);
+      }
+    }
+
+    if (tile != NULL)
+      g_object_unref(tile);
+    g_free(path);
+  }
+
+  tile_decoder_close(&decoder);
+  g_clear_object(&sprite);
+
+  if (res) {
+    gchar *file = g_strconcat(name, ".vtt", NULL);
+    gchar *vtt_path = g_build_filename(dir, file, NULL);
+
+    res = g_file_set_contents(vtt_path, vtt->str, vtt->len, error);
+    g_free(vtt_path);
+    g_free(file);
+  }
+
+  g_string_free(vtt, TRUE);
+  return res;
+}
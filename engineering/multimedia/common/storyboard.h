@@ -0,0 +1,23 @@
+#ifndef STORYBOARD_H
+#define STORYBOARD_H
+
+#include <gst/gst.h>
+
+#include "thumbcache.h"
+
+G_BEGIN_DECLS
+
+/* Tiles of a storyboard, filled by storyboard_export() */
+typedef struct _StoryboardStats
+{
+  guint tiles;    /* Tiles in the storyboard */
+  guint decoded;  /* Tiles that were not in the cache and had to be decoded */
+  guint sprites;  /* Sprite images written */
+} StoryboardStats;
+
+gboolean storyboard_export(ThumbCache *cache, const gchar *uri, GstClockTime duration, GstClockTime interval,
+    const gchar *dir, const gchar *name, StoryboardStats *stats, GError **error);
+
+G_END_DECLS
+
+#endif /* STORYBOARD_H */
@@ -0,0 +1,250 @@
+#include "streamswitch.h"
+
+#define TRACKS_CHANGED_NAME "stream-switch-tracks-changed"
+
+/* Properties and signals of playbin for each kind of track */
+static const struct
+{
+  const gchar *n_property;
+  const gchar *current_property;
+  const gchar *tags_signal;
+  const gchar *changed_signal;
+  GstStreamType stream_type;
+} track_types[STREAM_SWITCH_TYPE_COUNT] = {
+  [STREAM_SWITCH_AUDIO] = { "n-audio", "current-audio", "get-audio-tags", "audio-changed", GST_STREAM_TYPE_AUDIO },
+  [STREAM_SWITCH_VIDEO] = { "n-video", "current-video", "get-video-tags", "video-changed", GST_STREAM_TYPE_VIDEO },
+  [STREAM_SWITCH_TEXT]  = { "n-text", "current-text", "get-text-tags", "text-changed", GST_STREAM_TYPE_TEXT },
+};
+
+struct _StreamSwitch
+{
+  GstElement *playbin;
+  gboolean select_streams;          /* Whether playbin is playbin3, whatever its factory is called */
+  gulong changed_ids[STREAM_SWITCH_TYPE_COUNT];
+  GstStreamCollection *collection;  /* Streams of playbin3, NULL until it posted them */
+  GPtrArray *selected;              /* Stream ids selected by playbin3 */
+};
+
+/* This function is called from a streaming thread when playbin finds tracks. The
+ * UI learns about it from the bus, where stream_switch_handle_message() picks it up */
+static void tracks_changed_cb(GstElement *playbin, StreamSwitch *sw)
+{
+  gst_element_post_message(playbin,
+      gst_message_new_application(GST_OBJECT(playbin), gst_structure_new_empty(TRACKS_CHANGED_NAME)));
+}
+
+/* This function tracks the streams of playbin. The switch uses SELECT_STREAMS with playbin3,
+ * where decodebin3 reuses the running decoder for the new stream. With playbin it switches
+ * the active pad of the input-selectors, the decoders of the other tracks stay linked and
+ * in sync, so in both cases there is no flush and no preroll */
+StreamSwitch *stream_switch_new(GstElement *playbin)
+{
+  g_return_val_if_fail(GST_IS_ELEMENT(playbin), NULL);
+
+  StreamSwitch *sw = g_new0(StreamSwitch, 1);
+  sw->playbin = gst_object_ref(playbin);
+  sw->select_streams = g_str_equal(G_OBJECT_TYPE_NAME(playbin), "GstPlayBin3");
+  sw->selected = g_ptr_array_new_with_free_func(g_free);
+
+  for (guint type = 0; type < STREAM_SWITCH_TYPE_COUNT; type++) {
+    if (g_signal_lookup(track_types[type].changed_signal, G_OBJECT_TYPE(playbin)) != 0)
+      sw->changed_ids[type] = g_signal_connect(playbin, track_types[type].changed_signal,
+          G_CALLBACK(tracks_changed_cb), sw);
+  }
+
+  return sw;
+}
+
+void stream_switch_free(StreamSwitch *sw)
+{
+  g_return_if_fail(sw != NULL);
+
+  for (guint type = 0; type < STREAM_SWITCH_TYPE_COUNT; type++) {
+    if (sw->changed_ids[type] != 0)
+      g_signal_handler_disconnect(sw->playbin, sw->changed_ids[type]);
+  }
+
+  if (sw->collection != NULL)
+    gst_object_unref(sw->collection);
+  g_ptr_array_unref(sw->selected);
+  gst_object_unref(sw->playbin);
+  g_free(sw);
+}
+
+/* This function follows the streams of the pipeline. It returns TRUE when the tracks
+ * or the selection changed, so the UI should be updated */
+gboolean stream_switch_handle_message(StreamSwitch *sw, GstMessage *msg)
+{
+  g_return_val_if_fail(sw != NULL, FALSE);
+
+  switch (GST_MESSAGE_TYPE(msg)) {
+  case GST_MESSAGE_APPLICATION:
+    return GST_MESSAGE_SRC(msg) == GST_OBJECT(sw->playbin) && gst_message_has_name(msg, TRACKS_CHANGED_NAME);
+  case GST_MESSAGE_STREAM_COLLECTION: {
+    GstStreamCollection *collection = NULL;
+
+    /* Demuxers post collections under playbin too, which ignores SELECT_STREAMS */
+    if (!sw->select_streams)
+      return FALSE;
+
+    gst_message_parse_stream_collection(msg, &collection);
+    if (sw->collection != NULL)
+      gst_object_unref(sw->collection);
+    sw->collection = collection;
+    return TRUE;
+  }
+  case GST_MESSAGE_STREAMS_SELECTED:
+    if (!sw->select_streams)
+      return FALSE;
+
+    g_ptr_array_set_size(sw->selected, 0);
+    for (guint i = 0; i < gst_message_streams_selected_get_size(msg); i++) {
+      GstStream *stream = gst_message_streams_selected_get_stream(msg, i);
+
+      g_ptr_array_add(sw->selected, g_strdup(gst_stream_get_stream_id(stream)));
+      gst_object_unref(stream);
+    }
+    return TRUE;
+  default:
+    return FALSE;
+  }
+}
+
+/* This function gives the index-th stream of the given kind in the playbin3 collection */
+static GstStream *collection_get_stream(StreamSwitch *sw, StreamSwitchType type, gint index)
+{
+  guint size = gst_stream_collection_get_size(sw->collection);
+
+  for (guint i = 0; i < size; i++) {
+    GstStream *stream = gst_stream_collection_get_stream(sw->collection, i);
+
+    if ((gst_stream_get_stream_type(stream) & track_types[type].stream_type) && index-- == 0)
+      return stream;
+  }
+
+  return NULL;
+}
+
+static gboolean is_selected(StreamSwitch *sw, GstStream *stream)
+{
+  const gchar *id = gst_stream_get_stream_id(stream);
+
+  for (guint i = 0; i < sw->selected->len; i++) {
+    if (g_strcmp0(g_ptr_array_index(sw->selected, i), id) == 0)
+      return TRUE;
+  }
+
+  return FALSE;
+}
+
+gint stream_switch_get_n_tracks(StreamSwitch *sw, StreamSwitchType type)
+{
+  g_return_val_if_fail(sw != NULL, 0);
+  g_return_val_if_fail(type < STREAM_SWITCH_TYPE_COUNT, 0);
+
+  gint n = 0;
+
+  if (sw->collection != NULL) {
+    while (collection_get_stream(sw, type, n) != NULL)
+      n++;
+  } else if (!sw->select_streams) {
+    g_object_get(sw->playbin, track_types[type].n_property, &n, NULL);
+  }
+
+  return n;
+}
+
+/* This function gives the index of the track being played, -1 if none */
+gint stream_switch_get_current(StreamSwitch *sw, StreamSwitchType type)
+{
+  g_return_val_if_fail(sw != NULL, -1);
+  g_return_val_if_fail(type < STREAM_SWITCH_TYPE_COUNT, -1);
+
+  gint current = -1;
+
+  if (sw->collection != NULL) {
+    GstStream *stream;
+
+    for (gint i = 0; (stream = collection_get_stream(sw, type, i)) != NULL; i++) {
+      if (is_selected(sw, stream))
+        return i;
+    }
+  } else if (!sw->select_streams) {
+    g_object_get(sw->playbin, track_types[type].current_property, &current, NULL);
+  }
+
+  return current;
+}
+
+/* This function describes a track by its language or title, for menus
+ * The returned string should be freed with g_free() when no longer needed.
+*/
+gchar *stream_switch_get_label(StreamSwitch *sw, StreamSwitchType type, gint index)
+{
+  g_return_val_if_fail(sw != NULL, NULL);
+  g_return_val_if_fail(type < STREAM_SWITCH_TYPE_COUNT, NULL);
+
+  GstTagList *tags = NULL;
+  gchar *name = NULL;
+
+  if (sw->collection != NULL) {
+    GstStream *stream = collection_get_stream(sw, type, index);
+    if (stream != NULL)
+      tags = gst_stream_get_tags(stream);
+  } else if (!sw->select_streams) {
+    g_signal_emit_by_name(sw->playbin, track_types[type].tags_signal, index, &tags);
+  }
+
+  if (tags != NULL) {
+    if (!gst_tag_list_get_string(tags, GST_TAG_LANGUAGE_CODE, &name))
+      gst_tag_list_get_string(tags, GST_TAG_TITLE, &name);
+    gst_tag_list_unref(tags);
+  }
+
+  gchar *label = name != NULL ? g_strdup_printf("%d: %s", index + 1, name) : g_strdup_printf("%d", index + 1);
+  g_free(name);
+  return label;
+}
+
+/* This function plays the index-th track of the given kind instead of the current one */
+gboolean stream_switch_select(StreamSwitch *sw, StreamSwitchType type, gint index)
+{
+  g_return_val_if_fail(sw != NULL, FALSE);
+  g_return_val_if_fail(type < STREAM_SWITCH_TYPE_COUNT, FALSE);
+
+  if (index < 0 || index >= stream_switch_get_n_tracks(sw, type))
+    return FALSE;
+
+  if (sw->collection == NULL) {
+    g_object_set(sw->playbin, track_types[type].current_property, index, NULL);
+    return TRUE;
+  }
+
+  /* Keep the streams of the other kinds, and replace the one of this kind */
+  GList *ids = NULL;
+  guint size = gst_stream_collection_get_size(sw->collection);
+
+  for (guint i = 0; i < size; i++) {
+    GstStream *stream = gst_stream_collection_get_stream(sw->collection, i);
+
+    if (!(gst_stream_get_stream_type(stream) & track_types[type].stream_type) && is_selected(sw, stream))
+      ids = g_list_append(ids, (gpointer) gst_stream_get_stream_id(stream));
+  }
+  ids = g_list_append(ids, (gpointer) gst_stream_get_stream_id(collection_get_stream(sw, type, index)));
+
+  gboolean res = gst_element_send_event(sw->playbin, gst_event_new_select_streams(ids));
+  g_list_free(ids);
+  return res;
+}
+
+/* This function switches to the track after the current one, wrapping around */
+gboolean stream_switch_next(StreamSwitch *sw, StreamSwitchType type)
+{
+  g_return_val_if_fail(sw != NULL, FALSE);
+
+  gint n = stream_switch_get_n_tracks(sw, type);
+  if (n < 2)
+    return FALSE;
+
+  return stream_switch_select(sw, type, (stream_switch_get_current(sw, type) + 1) % n);
+}
@@ -0,0 +1,35 @@
+#ifndef STREAM_SWITCH_H
+#define STREAM_SWITCH_H
+
+#include <gst/gst.h>
+
+G_BEGIN_DECLS
+
+/* Kinds of track that can be switched */
+typedef enum
+{
+  STREAM_SWITCH_AUDIO,
+  STREAM_SWITCH_VIDEO,
+  STREAM_SWITCH_TEXT,
+
+  STREAM_SWITCH_TYPE_COUNT
+} StreamSwitchType;
+
+/* Track selection of a playbin or playbin3, without rebuilding the pipeline */
+typedef struct _StreamSwitch StreamSwitch;
+
+StreamSwitch *stream_switch_new(GstElement *playbin);
+void stream_switch_free(StreamSwitch *sw);
+
+gboolean stream_switch_handle_message(StreamSwitch *sw, GstMessage *msg);
+
+gint stream_switch_get_n_tracks(StreamSwitch *sw, StreamSwitchType type);
+gint stream_switch_get_current(StreamSwitch *sw, StreamSwitchType type);
+gchar *stream_switch_get_label(StreamSwitch *sw, StreamSwitchType type, gint index);
+
+gboolean stream_switch_select(StreamSwitch *sw, StreamSwitchType type, gint index);
+gboolean stream_switch_next(StreamSwitch *sw, StreamSwitchType type);
+
+G_END_DECLS
+
+#endif /* STREAM_SWITCH_H */
@@ -0,0 +1,225 @@
+#include "thumbcache.h"
+
+#include <errno.h>
+
+#include <glib/gstdio.h>
+
+#define THUMB_CACHE_SUBDIR      "videoplayer/thumbnails"
+#define THUMB_CACHE_PARTIAL     ".partial"
+#define PARTIAL_MAX_AGE         (60 * 60) /* Seconds after which a partial file is left over from a crash */
+
+struct _ThumbCache
+{
+  gchar *dir;
+  gint hits;    /* Updated atomically, lookups come from the UI and the background jobs */
+  gint misses;
+};
+
+/* This function opens the cache in dir, or in the user cache directory if dir is NULL */
+ThumbCache *thumb_cache_new(const gchar *dir)
+{
+  ThumbCache *cache = g_new0(ThumbCache, 1);
+
+  cache->dir = dir != NULL ? g_strdup(dir) : g_build_filename(g_get_user_cache_dir(), THUMB_CACHE_SUBDIR, NULL);
+  if (g_mkdir_with_parents(cache->dir, 0700) != 0)
+    g_printerr("Could not create the thumbnail cache %s\n", cache->dir);
+
+  return cache;
+}
+
+void thumb_cache_free(ThumbCache *cache)
+{
+  g_return_if_fail(cache != NULL);
+
+  g_free(cache->dir);
+  g_free(cache);
+}
+
+/* This function gives the path where the file called name of the clip at uri is stored,
+ * whether it exists or not. Files are written there by the caller, name includes the extension
+ * The returned string should be freed with g_free() when no longer needed.
+*/
+gchar *thumb_cache_get_file_path(ThumbCache *cache, const gchar *uri, const gchar *name)
+{
+  g_return_val_if_fail(cache != NULL, NULL);
+  g_return_val_if_fail(uri != NULL && name != NULL, NULL);
+
+  gchar *key = g_compute_checksum_for_string(G_CHECKSUM_MD5, uri, -1);
+  gchar *file = g_strdup_printf("%s-%s", key, name);
+  gchar *path = g_build_filename(cache->dir, file, NULL);
+
+  g_free(file);
+  g_free(key);
+  return path;
+}
+
+/* This function gives the path where the image called name of the clip at uri is stored,
+ * whether it exists or not. Images are written there by the caller, as PNG
+ * The returned string should be freed with g_free() when no longer needed.
+*/
+gchar *thumb_cache_get_path(ThumbCache *cache, const gchar *uri, const gchar *name)
+{
+  g_return_val_if_fail(name != NULL, NULL);
+
+  gchar *file = g_strconcat(name, ".png", NULL);
+  gchar *path = thumb_cache_get_file_path(cache, uri, file);
+
+  g_free(file);
+  return path;
+}
+
+/* This function checks that an image made from a local clip is not older than the clip */
+static gboolean is_fresh(const gchar *uri, const gchar *path)
+{
+  GStatBuf clip_stat, image_stat;
+  gchar *filename = g_filename_from_uri(uri, NULL, NULL);
+  gboolean fresh = TRUE;
+
+  if (filename != NULL && g_stat(filename, &clip_stat) == 0 && g_stat(path, &image_stat) == 0)
+    fresh = image_stat.st_mtime >= clip_stat.st_mtime;
+
+  g_free(filename);
+  return fresh;
+}
+
+/* This function gives the path of the file called name of the clip at uri, NULL if it is not cached
+ * The returned string should be freed with g_free() when no longer needed.
+*/
+gchar *thumb_cache_lookup_file(ThumbCache *cache, const gchar *uri, const gchar *name)
+{
+  g_return_val_if_fail(cache != NULL, NULL);
+
+  gchar *path = thumb_cache_get_file_path(cache, uri, name);
+
+  if (path == NULL || !g_file_test(path, G_FILE_TEST_IS_REGULAR) || !is_fresh(uri, path)) {
+    g_atomic_int_inc(&cache->misses);
+    g_free(path);
+    return NULL;
+  }
+
+  g_atomic_int_inc(&cache->hits);
+  return path;
+}
+
+/* This function gives the path of the image called name of the clip at uri, NULL if it is not cached
+ * The returned string should be freed with g_free() when no longer needed.
+*/
+gchar *thumb_cache_lookup(ThumbCache *cache, const gchar *uri, const gchar *name)
+{
+  g_return_val_if_fail(name != NULL, NULL);
+
+  gchar *file = g_strconcat(name, ".png", NULL);
+  gchar *path = thumb_cache_lookup_file(cache, uri, file);
+
+  g_free(file);
+  return path;
+}
+
+/* This function gives a path, unique to the caller, where the file to store at path is written
+ * before thumb_cache_commit() moves it in place, so readers never see a truncated file
+ * The returned string should be freed with g_free() when no longer needed.
+*/
+gchar *thumb_cache_get_partial_path(const gchar *path)
+{
+  g_return_val_if_fail(path != NULL, NULL);
+
+  return g_strdup_printf("%s.%08x" THUMB_CACHE_PARTIAL, path, g_random_int());
+}
+
+/* This function moves the file written at partial_path to path, or removes it if written is FALSE */
+gboolean thumb_cache_commit(const gchar *partial_path, const gchar *path, gboolean written, GError **error)
+{
+  g_return_val_if_fail(partial_path != NULL && path != NULL, FALSE);
+
+  if (written && g_rename(partial_path, path) == 0)
+    return TRUE;
+
+  if (written) {
+    int saved_errno = errno;
+    g_set_error(error, G_FILE_ERROR, g_file_error_from_errno(saved_errno), "Could not move %s to %s: %s",
+        partial_path, path, g_strerror(saved_errno));
+  }
+  g_unlink(partial_path);
+  return FALSE;
+}
+
+typedef struct _CacheEntry
+{
+  gchar *path;
+  gint64 mtime;
+  guint64 size;
+} CacheEntry;
+
+static gint compare_entries(gconstpointer a, gconstpointer b)
+{
+  const CacheEntry *x = a, *y = b;
+
+  return x->mtime < y->mtime ? -1 : x->mtime > y->mtime;
+}
+
+/* This function removes the oldest files of the cache until it holds at most max_bytes, and the
+ * partial files left over by a crash. It does blocking I/O on the whole cache, run it in the background */
+void thumb_cache_prune(ThumbCache *cache, guint64 max_bytes)
+{
+  g_return_if_fail(cache != NULL);
+
+  GDir *dir = g_dir_open(cache->dir, 0, NULL);
+  GArray *entries = g_array_new(FALSE, FALSE, sizeof(CacheEntry));
+  gint64 now = g_get_real_time() / G_USEC_PER_SEC;
+  guint64 total = 0, removed = 0;
+  const gchar *name;
+
+  if (dir == NULL) {
+    g_array_free(entries, TRUE);
+    return;
+  }
+
+  while ((name = g_dir_read_name(dir)) != NULL) {
+    CacheEntry entry = { g_build_filename(cache->dir, name, NULL), 0, 0 };
+    GStatBuf entry_stat;
+
+    if (g_stat(entry.path, &entry_stat) != 0 || !S_ISREG(entry_stat.st_mode)) {
+      g_free(entry.path);
+      continue;
+    }
+
+    /* Partial files being written are recent, the others belong to no writer anymore */
+    if (g_str_has_suffix(name, THUMB_CACHE_PARTIAL)) {
+      if (now - entry_stat.st_mtime > PARTIAL_MAX_AGE)
+        g_unlink(entry.path);
+      g_free(entry.path);
+      continue;
+    }
+
+    entry.mtime = entry_stat.st_mtime;
+    entry.size = entry_stat.st_size;
+    total += entry.size;
+    g_array_append_val(entries, entry);
+  }
+  g_dir_close(dir);
+
+  g_array_sort(entries, compare_entries);
+  for (guint i = 0; i < entries->len; i++) {
+    CacheEntry *entry = &g_array_index(entries, CacheEntry, i);
+
+    if (total > max_bytes && g_unlink(entry->path) == 0) {
+      total -= entry->size;
+      removed++;
+    }
+    g_free(entry->path);
+  }
+  g_array_free(entries, TRUE);
+
+  if (removed > 0)
+    g_print("Thumbnail cache: removed %" G_GUINT64_FORMAT " old files, %" G_GUINT64_FORMAT " bytes left\n",
+        removed, total);
+}
+
+void thumb_cache_get_stats(ThumbCache *cache, ThumbCacheStats *stats)
+{
+  g_return_if_fail(cache != NULL);
+  g_return_if_fail(stats != NULL);
+
+  stats->hits = (guint) g_atomic_int_get(&cache->hits);
+  stats->misses = (guint) g_atomic_int_get(&cache->misses);
+}
@@ -0,0 +1,34 @@
+#ifndef THUMB_CACHE_H
+#define THUMB_CACHE_H
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/* Lookup counters of a cache, filled by thumb_cache_get_stats() */
+typedef struct _ThumbCacheStats
+{
+  guint64 hits;
+  guint64 misses;
+} ThumbCacheStats;
+
+/* On-disk cache of the images and other files made from a clip, keyed by the URI of the clip and a name */
+typedef struct _ThumbCache ThumbCache;
+
+ThumbCache *thumb_cache_new(const gchar *dir);
+void thumb_cache_free(ThumbCache *cache);
+
+gchar *thumb_cache_lookup(ThumbCache *cache, const gchar *uri, const gchar *name);
+gchar *thumb_cache_get_path(ThumbCache *cache, const gchar *uri, const gchar *name);
+gchar *thumb_cache_lookup_file(ThumbCache *cache, const gchar *uri, const gchar *name);
+gchar *thumb_cache_get_file_path(ThumbCache *cache, const gchar *uri, const gchar *name);
+
+gchar *thumb_cache_get_partial_path(const gchar *path);
+gboolean thumb_cache_commit(const gchar *partial_path, const gchar *path, gboolean written, GError **error);
+void thumb_cache_prune(ThumbCache *cache, guint64 max_bytes);
+
+void thumb_cache_get_stats(ThumbCache *cache, ThumbCacheStats *stats);
+
+G_END_DECLS
+
+#endif /* THUMB_CACHE_H */
@@ -0,0 +1,224 @@
+#include "watchdog.h"
+
+#define CHECK_INTERVAL_US (100 * G_TIME_SPAN_MILLISECOND)
+
+/* The sink pad of each watched pipeline has a probe beating on every buffer, and on every gap
+ * event: a sparse stream, or one made only of gaps, tells that it is alive that way. A pipeline
+ * is only expected to beat while it prerolls or plays: once it is paused, at EOS or
+ * stopped, the watchdog restarts its deadline on each check instead. */
+
+typedef struct _Watch
+{
+  guint id;
+  GstElement *pipeline;
+  GstPad *pad;
+  gulong probe_id;
+  GstClockTime deadline;
+  WatchdogStallFunc func;
+  gpointer user_data;
+
+  GMutex lock;                /* Protects the fields below, taken by the probe */
+  guint beats;                /* Buffers and gaps seen by the probe */
+  gboolean eos;               /* Whether EOS went through since the last flush */
+  GstSegment segment;         /* To convert the buffer timestamps to stream time */
+  GstClockTime position;      /* Stream time of the last buffer */
+
+  guint last_beats;           /* Beats seen by the last check */
+  gint64 last_progress;       /* Monotonic time of the last check with progress, or not expecting any */
+} Watch;
+
+struct _Watchdog
+{
+  GThread *thread;
+  GMutex lock;                /* Protects the fields below */
+  GCond cond;
+  gboolean running;
+  GList *watches;
+  guint next_id;
+};
+
+static GstPadProbeReturn heartbeat_probe_cb(GstPad *pad, GstPadProbeInfo *info, Watch *watch)
+{
+  g_mutex_lock(&watch->lock);
+  if (info->type & GST_PAD_PROBE_TYPE_BUFFER) {
+    GstBuffer *buffer = GST_PAD_PROBE_INFO_BUFFER(info);
+
+    watch->beats++;
+    if (GST_BUFFER_PTS_IS_VALID(buffer) && watch->segment.format == GST_FORMAT_TIME)
+      watch->position = gst_segment_to_stream_time(&watch->segment, GST_FORMAT_TIME, GST_BUFFER_PTS(buffer));
+  } else {
+    GstEvent *event = GST_PAD_PROBE_INFO_EVENT(info);
+
+    switch (GST_EVENT_TYPE(event)) {
+      case GST_EVENT_SEGMENT:
+        gst_event_copy_segment(event, &watch->segment);
+        break;
+      case GST_EVENT_GAP: {
+        GstClockTime timestamp;
+
+        gst_event_parse_gap(event, &timestamp, NULL);
+        watch->beats++;
+        if (GST_CLOCK_TIME_IS_VALID(timestamp) && watch->segment.format == GST_FORMAT_TIME)
+          watch->position = gst_segment_to_stream_time(&watch->segment, GST_FORMAT_TIME, timestamp);
+        break;
+      }
+      case GST_EVENT_EOS:
+        watch->eos = TRUE;
+        break;
+      case GST_EVENT_FLUSH_STOP:
+      case GST_EVENT_STREAM_START:
+        watch->eos = FALSE;
+        break;
+      default:
+        break;
+    }
+  }
+  g_mutex_unlock(&watch->lock);
+
+  return GST_PAD_PROBE_OK;
+}
+
+/* This function tells whether the pipeline should be producing buffers: it is prerolling, or
+ * it is playing and did not reach EOS */
+static gboolean expects_progress(Watch *watch, gboolean eos)
+{
+  GstState current, pending;
+  GstStateChangeReturn ret = gst_element_get_state(watch->pipeline, &current, &pending, 0);
+
+  if (ret == GST_STATE_CHANGE_ASYNC)
+    return pending >= GST_STATE_PAUSED;
+  return ret == GST_STATE_CHANGE_SUCCESS && current == GST_STATE_PLAYING && !eos;
+}
+
+static void check(Watch *watch, gint64 now)
+{
+  g_mutex_lock(&watch->lock);
+  guint beats = watch->beats;
+  gboolean eos = watch->eos;
+  GstClockTime position = watch->position;
+  g_mutex_unlock(&watch->lock);
+
+  if (beats != watch->last_beats || !expects_progress(watch, eos)) {
+    watch->last_beats = beats;
+    watch->last_progress = now;
+    return;
+  }
+
+  if (now - watch->last_progress >= (gint64) (watch->deadline / GST_USECOND)) {
+    /* Reported once per deadline, the owner may be recovering already */
+    watch->last_progress = now;
+    watch->func(watch->pipeline, position, watch->user_data);
+  }
+}
+
+static gpointer watchdog_thread_func(Watchdog *watchdog)
+{
+  gint64 next_check = g_get_monotonic_time() + CHECK_INTERVAL_US;
+
+  g_mutex_lock(&watchdog->lock);
+  while (watchdog->running) {
+    if (g_cond_wait_until(&watchdog->cond, &watchdog->lock, next_check))
+      continue;
+
+    /* The callbacks run with the lock held, so a watch is never freed under them */
+    gint64 now = g_get_monotonic_time();
+    for (GList *l = watchdog->watches; l != NULL; l = l->next)
+      check(l->data, now);
+    next_check = now + CHECK_INTERVAL_US;
+  }
+  g_mutex_unlock(&watchdog->lock);
+
+  return NULL;
+}
+
+Watchdog *watchdog_new(void)
+{
+  Watchdog *watchdog = g_new0(Watchdog, 1);
+
+  g_mutex_init(&watchdog->lock);
+  g_cond_init(&watchdog->cond);
+  watchdog->running = TRUE;
+  watchdog->next_id = 1;
+  watchdog->thread = g_thread_new("watchdog", (GThreadFunc) watchdog_thread_func, watchdog);
+
+  return watchdog;
+}
+
+static void watch_free(Watch *watch)
+{
+  gst_pad_remove_probe(watch->pad, watch->probe_id);
+  gst_object_unref(watch->pad);
+  gst_object_unref(watch->pipeline);
+  g_mutex_clear(&watch->lock);
+  g_free(watch);
+}
+
+void watchdog_free(Watchdog *watchdog)
+{
+  g_return_if_fail(watchdog != NULL);
+
+  g_mutex_lock(&watchdog->lock);
+  watchdog->running = FALSE;
+  g_cond_signal(&watchdog->cond);
+  g_mutex_unlock(&watchdog->lock);
+  g_thread_join(watchdog->thread);
+
+  g_list_free_full(watchdog->watches, (GDestroyNotify) watch_free);
+  g_mutex_clear(&watchdog->lock);
+  g_cond_clear(&watchdog->cond);
+  g_free(watchdog);
+}
+
+/* This function watches the buffers reaching sink, an element of pipeline. func is called when
+ * the pipeline prerolls or plays, and no buffer or gap reached sink for deadline. A pipeline with
+ * no stream for sink never beats, the owner has to tell that apart in func. Returns the id to give
+ * to watchdog_unwatch() */
+guint watchdog_watch(Watchdog *watchdog, GstElement *pipeline, GstElement *sink, GstClockTime deadline,
+    WatchdogStallFunc func, gpointer user_data)
+{
+  g_return_val_if_fail(watchdog != NULL && GST_IS_ELEMENT(pipeline) && GST_IS_ELEMENT(sink), 0);
+  g_return_val_if_fail(GST_CLOCK_TIME_IS_VALID(deadline) && func != NULL, 0);
+
+  GstPad *pad = gst_element_get_static_pad(sink, "sink");
+  if (pad == NULL)
+    return 0;
+
+  Watch *watch = g_new0(Watch, 1);
+  watch->pipeline = gst_object_ref(pipeline);
+  watch->pad = pad;
+  watch->deadline = deadline;
+  watch->func = func;
+  watch->user_data = user_data;
+  watch->position = GST_CLOCK_TIME_NONE;
+  watch->last_progress = g_get_monotonic_time();
+  gst_segment_init(&watch->segment, GST_FORMAT_UNDEFINED);
+  g_mutex_init(&watch->lock);
+  watch->probe_id = gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_BUFFER | GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM |
+      GST_PAD_PROBE_TYPE_EVENT_FLUSH, (GstPadProbeCallback) heartbeat_probe_cb, watch, NULL);
+
+  g_mutex_lock(&watchdog->lock);
+  watch->id = watchdog->next_id++;
+  watchdog->watches = g_list_append(watchdog->watches, watch);
+  g_mutex_unlock(&watchdog->lock);
+
+  return watch->id;
+}
+
+/* This function stops watching a pipeline. It must not be called from a WatchdogStallFunc */
+void watchdog_unwatch(Watchdog *watchdog, guint id)
+{
+  g_return_if_fail(watchdog != NULL);
+
+  g_mutex_lock(&watchdog->lock);
+  for (GList *l = watchdog->watches; l != NULL; l = l->next) {
+    Watch *watch = l->data;
+
+    if (watch->id == id) {
+      watchdog->watches = g_list_delete_link(watchdog->watches, l);
+      g_mutex_unlock(&watchdog->lock);
+      watch_free(watch);
+      return;
+    }
+  }
+  g_mutex_unlock(&watchdog->lock);
+}
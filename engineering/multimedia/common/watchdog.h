@@ -0,0 +1,25 @@
+#ifndef WATCHDOG_H
+#define WATCHDOG_H
+
+#include <gst/gst.h>
+
+G_BEGIN_DECLS
+
+/* Thread checking that the watched pipelines make progress */
+typedef struct _Watchdog Watchdog;
+
+/* Called from the watchdog thread when a pipeline expected to produce data has not for longer
+ * than its deadline. position is the stream time of the last buffer, GST_CLOCK_TIME_NONE if none.
+ * It is called again every deadline for as long as the pipeline stays stalled */
+typedef void (*WatchdogStallFunc)(GstElement *pipeline, GstClockTime position, gpointer user_data);
+
+Watchdog *watchdog_new(void);
+void watchdog_free(Watchdog *watchdog);
+
+guint watchdog_watch(Watchdog *watchdog, GstElement *pipeline, GstElement *sink, GstClockTime deadline,
+    WatchdogStallFunc func, gpointer user_data);
+void watchdog_unwatch(Watchdog *watchdog, guint id);
+
+G_END_DECLS
+
+#endif /* WATCHDOG_H */
@@ -0,0 +1,419 @@
+#define _GNU_SOURCE
+#include "workpool.h"
+
+#include <sched.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+
+#define DEFAULT_MAX_THREADS  64
+#define SPARE_IDLE_TIMEOUT   (10 * G_TIME_SPAN_SECOND)
+
+/* The pool runs three kinds of jobs:
+ *  - short jobs, run by a fixed set of workers, each with its own deque: a worker
+ *    pops its own jobs LIFO and steals the oldest job of another worker when idle;
+ *  - long jobs, such as exports, run by spare threads that are cached and reused
+ *    between jobs. The workers and the long jobs never take more than max_threads
+ *    threads: past it, long jobs wait in long_jobs until one of them is done;
+ *  - dedicated jobs, run by spare threads too but never kept waiting. GStreamer
+ *    streaming loops only return when their pipeline stops, a queued one would hang
+ *    its pipeline for good, and the jobs recovering stalled pipelines must not wait
+ *    behind the threads they recover. They are bounded by the pipelines, not the pool. */
+
+struct _WorkJob
+{
+  WorkFunc func;
+  gpointer user_data;
+  gint ref_count;      /* One for the pool, one for the joiner */
+  GMutex lock;
+  GCond cond;
+  gboolean done;
+  WorkJobKind kind;
+};
+
+typedef struct _Worker
+{
+  WorkPool *pool;
+  guint index;
+  GThread *thread;
+  GMutex lock;         /* Protects jobs */
+  GQueue jobs;         /* The owner pops from the head, thieves from the tail */
+} Worker;
+
+struct _WorkPool
+{
+  guint n_workers;
+  guint max_threads;
+  Worker *workers;
+
+  GMutex lock;         /* Protects the fields below */
+  GCond cond;          /* Signalled when short jobs are queued, spares exit or on shutdown */
+  GCond spare_cond;    /* Signalled when a job is handed to the spare threads */
+  gboolean running;
+  gint queued;         /* Short jobs waiting in any deque */
+  guint next_worker;   /* Round robin for pushes from outside the pool */
+  GQueue spare_jobs;   /* Long and dedicated jobs to start, picked up by the spare threads */
+  GQueue long_jobs;    /* Long jobs waiting for the running ones to drop below the limit */
+  guint max_long;      /* Long jobs running at once, the threads left by the workers */
+  guint n_long;        /* Long jobs handed to the spare threads */
+  guint n_dedicated;
+  guint peak_dedicated;
+  guint n_spares;
+  guint n_idle_spares;
+  guint n_threads;
+  guint peak_threads;
+  guint peak_waiting;
+  guint steals;
+};
+
+/* Worker of the calling thread, to push nested jobs on its own deque */
+static GPrivate current_worker;
+
+static gpointer spare_thread_func(gpointer user_data);
+
+static void work_job_unref(WorkJob *job)
+{
+  if (!g_atomic_int_dec_and_test(&job->ref_count))
+    return;
+
+  g_mutex_clear(&job->lock);
+  g_cond_clear(&job->cond);
+  g_free(job);
+}
+
+static void run_job(WorkJob *job)
+{
+  job->func(job->user_data);
+
+  g_mutex_lock(&job->lock);
+  job->done = TRUE;
+  g_cond_broadcast(&job->cond);
+  g_mutex_unlock(&job->lock);
+
+  work_job_unref(job);
+}
+
+/* This function waits for a job to complete and releases it */
+void work_job_join(WorkJob *job)
+{
+  g_return_if_fail(job != NULL);
+
+  g_mutex_lock(&job->lock);
+  while (!job->done)
+    g_cond_wait(&job->cond, &job->lock);
+  g_mutex_unlock(&job->lock);
+
+  work_job_unref(job);
+}
+
+/* This function releases the handle of a job without waiting for it, the job still runs */
+void work_job_detach(WorkJob *job)
+{
+  g_return_if_fail(job != NULL);
+
+  work_job_unref(job);
+}
+
+/* This function pops a job of the worker, or steals one from the others */
+static WorkJob *worker_take_job(Worker *worker)
+{
+  WorkPool *pool = worker->pool;
+  WorkJob *job;
+
+  g_mutex_lock(&worker->lock);
+  job = g_queue_pop_head(&worker->jobs);
+  g_mutex_unlock(&worker->lock);
+
+  for (guint i = 1; job == NULL && i < pool->n_workers; i++) {
+    Worker *victim = &pool->workers[(worker->index + i) % pool->n_workers];
+
+    g_mutex_lock(&victim->lock);
+    job = g_queue_pop_tail(&victim->jobs);
+    g_mutex_unlock(&victim->lock);
+
+    if (job != NULL)
+      g_atomic_int_inc((gint *) &pool->steals);
+  }
+
+  return job;
+}
+
+static gpointer worker_thread_func(gpointer user_data)
+{
+  Worker *worker = user_data;
+  WorkPool *pool = worker->pool;
+
+  g_private_set(&current_worker, worker);
+
+  while (TRUE) {
+    WorkJob *job = worker_take_job(worker);
+
+    if (job != NULL) {
+      g_mutex_lock(&pool->lock);
+      pool->queued--;
+      g_mutex_unlock(&pool->lock);
+
+      run_job(job);
+      continue;
+    }
+
+    g_mutex_lock(&pool->lock);
+    while (pool->running && pool->queued <= 0)
+      g_cond_wait(&pool->cond, &pool->lock);
+    gboolean finished = !pool->running && pool->queued <= 0;
+    g_mutex_unlock(&pool->lock);
+
+    if (finished)
+      break;
+  }
+
+  return NULL;
+}
+
+/* This function starts a spare thread, with the pool lock held */
+static void spawn_spare_locked(WorkPool *pool)
+{
+  pool->n_spares++;
+  pool->n_threads++;
+  pool->peak_threads = MAX(pool->peak_threads, pool->n_threads);
+  g_thread_unref(g_thread_new("work-pool-spare", spare_thread_func, pool));
+}
+
+/* This function hands a job to an idle spare thread or a new one, with the pool lock held */
+static void start_spare_job_locked(WorkPool *pool, WorkJob *job)
+{
+  g_queue_push_tail(&pool->spare_jobs, job);
+  if (pool->n_idle_spares >= g_queue_get_length(&pool->spare_jobs))
+    g_cond_signal(&pool->spare_cond);
+  else
+    spawn_spare_locked(pool);
+}
+
+/* This function accounts for a job done by a spare thread, with the pool lock held. The slot of
+ * a long job goes to the first one waiting, which the calling thread picks up next */
+static void finish_spare_job_locked(WorkPool *pool, WorkJobKind kind)
+{
+  if (kind == WORK_JOB_DEDICATED) {
+    pool->n_dedicated--;
+    return;
+  }
+
+  WorkJob *waiting = g_queue_pop_head(&pool->long_jobs);
+  if (waiting != NULL)
+    g_queue_push_tail(&pool->spare_jobs, waiting);
+  else
+    pool->n_long--;
+}
+
+static gpointer spare_thread_func(gpointer user_data)
+{
+  WorkPool *pool = user_data;
+  id_t tid = (id_t) syscall(SYS_gettid);
+  cpu_set_t affinity;
+  int nice_value;
+
+  /* Jobs may pin or renice their thread, do not let that leak into the next job */
+  pthread_getaffinity_np(pthread_self(), sizeof(affinity), &affinity);
+  nice_value = getpriority(PRIO_PROCESS, tid);
+
+  g_mutex_lock(&pool->lock);
+  while (TRUE) {
+    WorkJob *job = g_queue_pop_head(&pool->spare_jobs);
+
+    if (job != NULL) {
+      WorkJobKind kind = job->kind;
+
+      g_mutex_unlock(&pool->lock);
+      run_job(job);
+      pthread_setaffinity_np(pthread_self(), sizeof(affinity), &affinity);
+      /* Raising the priority back needs CAP_SYS_NICE, retire the thread if it cannot */
+      gboolean reniced = getpriority(PRIO_PROCESS, tid) != nice_value
+          && setpriority(PRIO_PROCESS, tid, nice_value) != 0;
+      g_mutex_lock(&pool->lock);
+      finish_spare_job_locked(pool, kind);
+      if (reniced)
+        break;
+      continue;
+    }
+
+    if (!pool->running)
+      break;
+
+    /* Stay around for a while, streaming threads come and go with pipelines */
+    pool->n_idle_spares++;
+    gboolean woken = g_cond_wait_until(&pool->spare_cond, &pool->lock,
+        g_get_monotonic_time() + SPARE_IDLE_TIMEOUT);
+    pool->n_idle_spares--;
+
+    if (!woken && g_queue_is_empty(&pool->spare_jobs))
+      break;
+  }
+
+  pool->n_spares--;
+  pool->n_threads--;
+  /* Jobs handed to this thread after it decided to leave go to a new one */
+  if (g_queue_get_length(&pool->spare_jobs) > pool->n_idle_spares)
+    spawn_spare_locked(pool);
+  g_cond_broadcast(&pool->cond);
+  g_mutex_unlock(&pool->lock);
+
+  return NULL;
+}
+
+/* This function creates a pool with n_workers threads for short jobs, which can grow up to
+ * max_threads threads with the spare threads running long jobs, and past it for dedicated jobs */
+WorkPool *work_pool_new(guint n_workers, guint max_threads)
+{
+  g_return_val_if_fail(n_workers > 0, NULL);
+  g_return_val_if_fail(max_threads > n_workers, NULL);
+
+  WorkPool *pool = g_new0(WorkPool, 1);
+
+  pool->n_workers = n_workers;
+  pool->max_threads = max_threads;
+  pool->max_long = max_threads - n_workers;
+  pool->running = TRUE;
+  g_mutex_init(&pool->lock);
+  g_cond_init(&pool->cond);
+  g_cond_init(&pool->spare_cond);
+  g_queue_init(&pool->spare_jobs);
+  g_queue_init(&pool->long_jobs);
+
+  pool->workers = g_new0(Worker, n_workers);
+  for (guint i = 0; i < n_workers; i++) {
+    Worker *worker = &pool->workers[i];
+
+    worker->pool = pool;
+    worker->index = i;
+    g_mutex_init(&worker->lock);
+    g_queue_init(&worker->jobs);
+    worker->thread = g_thread_new("work-pool", worker_thread_func, worker);
+  }
+  pool->n_threads = pool->peak_threads = n_workers;
+
+  return pool;
+}
+
+static gpointer create_default_pool(gpointer user_data)
+{
+  guint n_workers = MAX(g_get_num_processors(), 1);
+
+  return work_pool_new(n_workers, MAX(DEFAULT_MAX_THREADS, 2 * n_workers));
+}
+
+/* This function returns the pool shared by the whole process, it is never freed */
+WorkPool *work_pool_get_default(void)
+{
+  static GOnce once = G_ONCE_INIT;
+
+  g_once(&once, create_default_pool, NULL);
+  return once.retval;
+}
+
+/* This function waits for the queued jobs to complete and frees the pool */
+void work_pool_free(WorkPool *pool)
+{
+  g_return_if_fail(pool != NULL);
+  g_return_if_fail(pool != work_pool_get_default());
+
+  g_mutex_lock(&pool->lock);
+  pool->running = FALSE;
+  g_cond_broadcast(&pool->cond);
+  g_cond_broadcast(&pool->spare_cond);
+  g_mutex_unlock(&pool->lock);
+
+  for (guint i = 0; i < pool->n_workers; i++) {
+    g_thread_join(pool->workers[i].thread);
+    g_mutex_clear(&pool->workers[i].lock);
+  }
+
+  /* Spare threads are detached, wait for them to leave */
+  g_mutex_lock(&pool->lock);
+  while (pool->n_spares > 0)
+    g_cond_wait(&pool->cond, &pool->lock);
+  g_mutex_unlock(&pool->lock);
+
+  g_free(pool->workers);
+  g_mutex_clear(&pool->lock);
+  g_cond_clear(&pool->cond);
+  g_cond_clear(&pool->spare_cond);
+  g_free(pool);
+}
+
+/* This function starts a long job, with the pool lock held. At the limit, the job waits for
+ * the first long job to be done */
+static void push_long_locked(WorkPool *pool, WorkJob *job)
+{
+  if (pool->n_long < pool->max_long) {
+    pool->n_long++;
+    start_spare_job_locked(pool, job);
+    return;
+  }
+
+  g_queue_push_tail(&pool->long_jobs, job);
+  pool->peak_waiting = MAX(pool->peak_waiting, g_queue_get_length(&pool->long_jobs));
+}
+
+/* This function queues a job. The returned handle must be passed to work_job_join() or work_job_detach() */
+WorkJob *work_pool_push(WorkPool *pool, WorkFunc func, gpointer user_data, WorkJobKind kind, GError **error)
+{
+  g_return_val_if_fail(pool != NULL, NULL);
+  g_return_val_if_fail(func != NULL, NULL);
+
+  WorkJob *job = g_new0(WorkJob, 1);
+  job->func = func;
+  job->user_data = user_data;
+  job->kind = kind;
+  job->ref_count = 2;
+  g_mutex_init(&job->lock);
+  g_cond_init(&job->cond);
+
+  g_mutex_lock(&pool->lock);
+  if (!pool->running) {
+    g_mutex_unlock(&pool->lock);
+    g_set_error(error, G_THREAD_ERROR, G_THREAD_ERROR_AGAIN, "Work pool is shutting down");
+    job->ref_count = 1;
+    work_job_unref(job);
+    return NULL;
+  }
+
+  if (kind == WORK_JOB_LONG) {
+    push_long_locked(pool, job);
+  } else if (kind == WORK_JOB_DEDICATED) {
+    pool->n_dedicated++;
+    pool->peak_dedicated = MAX(pool->peak_dedicated, pool->n_dedicated);
+    start_spare_job_locked(pool, job);
+  } else {
+    /* Nested jobs stay on the deque of their worker, for locality */
+    Worker *worker = g_private_get(&current_worker);
+    if (worker == NULL || worker->pool != pool)
+      worker = &pool->workers[pool->next_worker++ % pool->n_workers];
+
+    g_mutex_lock(&worker->lock);
+    g_queue_push_head(&worker->jobs, job);
+    g_mutex_unlock(&worker->lock);
+
+    pool->queued++;
+    g_cond_signal(&pool->cond);
+  }
+  g_mutex_unlock(&pool->lock);
+
+  return job;
+}
+
+void work_pool_get_stats(WorkPool *pool, WorkPoolStats *stats)
+{
+  g_return_if_fail(pool != NULL);
+  g_return_if_fail(stats != NULL);
+
+  g_mutex_lock(&pool->lock);
+  stats->threads = pool->n_threads;
+  stats->peak_threads = pool->peak_threads;
+  stats->dedicated = pool->n_dedicated;
+  stats->peak_dedicated = pool->peak_dedicated;
+  stats->waiting = g_queue_get_length(&pool->long_jobs);
+  stats->peak_waiting = pool->peak_waiting;
+  g_mutex_unlock(&pool->lock);
+  stats->steals = g_atomic_int_get((gint *) &pool->steals);
+}
@@ -0,0 +1,49 @@
+#ifndef WORK_POOL_H
+#define WORK_POOL_H
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+typedef void (*WorkFunc)(gpointer user_data);
+
+/* How a pushed job is run */
+typedef enum
+{
+  WORK_JOB_SHORT,      /* By a worker, from its deque */
+  WORK_JOB_LONG,       /* By a spare thread, waiting for one past the thread limit */
+  WORK_JOB_DEDICATED,  /* By a spare thread at once, past the thread limit if needed: streaming tasks,
+                        * which only return when their pipeline stops, and the jobs recovering them */
+} WorkJobKind;
+
+/* Bounded thread pool shared by all the pipelines and background jobs of the process */
+typedef struct _WorkPool WorkPool;
+
+/* Handle of a pushed job, released by work_job_join() or work_job_detach() */
+typedef struct _WorkJob WorkJob;
+
+/* Thread accounting of a pool, filled by work_pool_get_stats() */
+typedef struct _WorkPoolStats
+{
+  guint threads;       /* Threads currently alive, dedicated jobs included */
+  guint peak_threads;  /* Highest number of threads alive at once */
+  guint dedicated;     /* Dedicated jobs running */
+  guint peak_dedicated; /* Highest number of dedicated jobs running at once */
+  guint waiting;       /* Long jobs waiting for a spare thread, past the thread limit */
+  guint peak_waiting;  /* Highest number of long jobs waiting at once */
+  guint steals;        /* Jobs taken from the deque of another worker */
+} WorkPoolStats;
+
+WorkPool *work_pool_new(guint n_workers, guint max_threads);
+WorkPool *work_pool_get_default(void);
+void work_pool_free(WorkPool *pool);
+
+WorkJob *work_pool_push(WorkPool *pool, WorkFunc func, gpointer user_data, WorkJobKind kind, GError **error);
+void work_job_join(WorkJob *job);
+void work_job_detach(WorkJob *job);
+
+void work_pool_get_stats(WorkPool *pool, WorkPoolStats *stats);
+
+G_END_DECLS
+
+#endif /* WORK_POOL_H */
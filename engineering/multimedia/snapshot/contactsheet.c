@@ -0,0 +1,299 @@
+/* GStreamer contact sheet example
+ *
+ * Writes a COLUMNS x ROWS grid of frames taken at regular intervals of each clip,
+ * optionally with their timestamps burned in. Each clip is read by several
+ * pipelines at once, which copy their tiles straight into the sheet, and the
+ * sheet is encoded once at the end. Directories are processed by a bounded
+ * number of clips at a time.
+ */
+
+#include <gst/gst.h>
+#include <gdk-pixbuf/gdk-pixbuf.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define CAPS "video/x-raw,format=RGB,width=%d,height=%d,pixel-aspect-ratio=1/1"
+#define FRAME_TIMEOUT (5 * GST_SECOND)  /* a clip that cannot decode a frame in time is given up */
+#define SNIFF_SIZE 4096                 /* bytes read to guess the content type of a file */
+
+static gint columns = 4;
+static gint rows = 4;
+static gint tile_width = 320;
+static gint tile_height = 180;
+static gboolean timestamps = FALSE;
+static gint threads = 4;
+static gint jobs = 2;
+static gchar *output_dir = NULL;
+
+static GOptionEntry entries[] = {
+  {"columns", 'c', 0, G_OPTION_ARG_INT, &columns, "Columns of the grid (default: 4)", "N"},
+  {"rows", 'r', 0, G_OPTION_ARG_INT, &rows, "Rows of the grid (default: 4)", "M"},
+  {"width", 0, 0, G_OPTION_ARG_INT, &tile_width, "Width of a tile (default: 320)", "PIXELS"},
+  {"height", 0, 0, G_OPTION_ARG_INT, &tile_height, "Height of a tile (default: 180)", "PIXELS"},
+  {"timestamps", 't', 0, G_OPTION_ARG_NONE, &timestamps, "Burn the timestamp of each frame in its tile", NULL},
+  {"threads", 0, 0, G_OPTION_ARG_INT, &threads, "Pipelines reading each clip (default: 4)", "N"},
+  {"jobs", 'j', 0, G_OPTION_ARG_INT, &jobs, "Clips processed at the same time (default: 2)", "N"},
+  {"output-dir", 'o', 0, G_OPTION_ARG_FILENAME, &output_dir, "Where the sheets are written (default: .)", "DIR"},
+  {NULL}
+};
+
+/* A pipeline reading every n-th tile of a sheet */
+typedef struct
+{
+  const gchar *uri;
+  GdkPixbuf *sheet;
+  gint first;
+  gint step;
+  gboolean ok;
+} TileReader;
+
+/* copy a tile into its place in the sheet, one memcpy per row. The tiles of the
+ * readers do not overlap, so they write to the sheet without locking */
+static void
+blit_tile (GdkPixbuf * sheet, gint index, const guint8 * data, gint stride)
+{
+  gint x = (index % columns) * tile_width;
+  gint y = (index / columns) * tile_height;
+  gint sheet_stride = gdk_pixbuf_get_rowstride (sheet);
+  guint8 *dest = gdk_pixbuf_get_pixels (sheet) + y * sheet_stride + x * 3;
+
+  for (gint line = 0; line < tile_height; line++)
+    memcpy (dest + line * sheet_stride, data + line * stride, tile_width * 3);
+}
+
+static gpointer
+read_tiles (TileReader * reader)
+{
+  GstElement *pipeline, *sink;
+  GstStateChangeReturn ret;
+  GError *error = NULL;
+  gint64 duration;
+  gint n_tiles = columns * rows;
+
+  /* videoscale adds borders to keep the aspect ratio in the fixed tile size, and
+   * the timestamp is drawn at the size of the tile so it stays readable */
+  gchar *caps = g_strdup_printf (CAPS, tile_width, tile_height);
+  gchar *descr =
+      g_strdup_printf ("uridecodebin uri=\"%s\" ! videoconvert ! videoscale ! "
+      "%s videoconvert ! appsink name=sink sync=false caps=\"%s\"", reader->uri,
+      timestamps ? "timeoverlay time-mode=stream-time font-desc=\"Sans 10\" ! " : "", caps);
+  pipeline = gst_parse_launch (descr, &error);
+  g_free (descr);
+  g_free (caps);
+
+  if (error != NULL) {
+    g_print ("could not construct pipeline: %s\n", error->message);
+    g_error_free (error);
+    if (pipeline)
+      gst_object_unref (pipeline);
+    return NULL;
+  }
+
+  sink = gst_bin_get_by_name (GST_BIN (pipeline), "sink");
+
+  ret = gst_element_set_state (pipeline, GST_STATE_PAUSED);
+  if (ret != GST_STATE_CHANGE_FAILURE)
+    ret = gst_element_get_state (pipeline, NULL, NULL, 5 * GST_SECOND);
+  if (ret == GST_STATE_CHANGE_FAILURE || ret == GST_STATE_CHANGE_NO_PREROLL
+      || !gst_element_query_duration (pipeline, GST_FORMAT_TIME, &duration)) {
+    g_print ("failed to play %s\n", reader->uri);
+    goto done;
+  }
+
+  reader->ok = TRUE;
+  for (gint index = reader->first; index < n_tiles; index += reader->step) {
+    GstSample *sample = NULL;
+    GstMapInfo map;
+
+    /* the middle of the index-th interval of the clip */
+    gint64 position = gst_util_uint64_scale (duration, 2 * index + 1, 2 * n_tiles);
+    if (!gst_element_seek_simple (pipeline, GST_FORMAT_TIME,
+            GST_SEEK_FLAG_KEY_UNIT | GST_SEEK_FLAG_FLUSH, position)) {
+      g_print ("could not seek to frame %d of %s\n", index, reader->uri);
+      reader->ok = FALSE;
+      break;
+    }
+
+    /* a clip that stops decoding would otherwise hold this job forever */
+    g_signal_emit_by_name (sink, "try-pull-preroll", FRAME_TIMEOUT, &sample, NULL);
+    if (sample == NULL) {
+      g_print ("could not get frame %d of %s\n", index, reader->uri);
+      reader->ok = FALSE;
+      break;
+    }
+
+    GstBuffer *buffer = gst_sample_get_buffer (sample);
+    if (gst_buffer_map (buffer, &map, GST_MAP_READ)) {
+      blit_tile (reader->sheet, index, map.data, GST_ROUND_UP_4 (tile_width * 3));
+      gst_buffer_unmap (buffer, &map);
+    } else {
+      g_print ("could not read frame %d of %s\n", index, reader->uri);
+      reader->ok = FALSE;
+    }
+    gst_sample_unref (sample);
+  }
+
+done:
+  gst_object_unref (sink);
+  gst_element_set_state (pipeline, GST_STATE_NULL);
+  gst_object_unref (pipeline);
+  return NULL;
+}
+
+/* A clip to process and the file its sheet is written to */
+typedef struct
+{
+  gchar *path;
+  gchar *output;
+} SheetJob;
+
+/* write the sheet of a clip, reading it with several pipelines at once */
+static void
+make_sheet (SheetJob * job, gpointer user_data)
+{
+  const gchar *path = job->path;
+  gchar *uri = gst_uri_is_valid (path) ? g_strdup (path) :
+      gst_filename_to_uri (path, NULL);
+  TileReader *readers = g_new0 (TileReader, threads);
+  GThread **workers = g_new0 (GThread *, threads);
+  GError *error = NULL;
+  gboolean ok = TRUE;
+
+  /* the whole sheet is allocated once, the readers copy their tiles into it */
+  GdkPixbuf *sheet = gdk_pixbuf_new (GDK_COLORSPACE_RGB, FALSE, 8,
+      columns * tile_width, rows * tile_height);
+  gdk_pixbuf_fill (sheet, 0x000000ff);
+
+  for (gint i = 0; i < threads; i++) {
+    readers[i].uri = uri;
+    readers[i].sheet = sheet;
+    readers[i].first = i;
+    readers[i].step = threads;
+    workers[i] = g_thread_new ("tiles", (GThreadFunc) read_tiles, &readers[i]);
+  }
+  for (gint i = 0; i < threads; i++) {
+    g_thread_join (workers[i]);
+    ok &= readers[i].ok;
+  }
+
+  if (ok) {
+    if (gdk_pixbuf_save (sheet, job->output, "png", &error, NULL)) {
+      g_print ("%s\n", job->output);
+    } else {
+      g_print ("could not write %s: %s\n", job->output, error->message);
+      g_clear_error (&error);
+    }
+  }
+
+  g_object_unref (sheet);
+  g_free (workers);
+  g_free (readers);
+  g_free (uri);
+  g_free (job->output);
+  g_free (job->path);
+  g_free (job);
+}
+
+/* tell whether a file of a directory is a video clip, from its name and first bytes */
+static gboolean
+is_video_file (const gchar * file)
+{
+  guchar data[SNIFF_SIZE];
+  gsize size = 0;
+  FILE *in = fopen (file, "rb");
+
+  if (in != NULL) {
+    size = fread (data, 1, sizeof (data), in);
+    fclose (in);
+  }
+
+  gchar *type = g_content_type_guess (file, size > 0 ? data : NULL, size, NULL);
+  gchar *mime = g_content_type_get_mime_type (type);
+  gboolean video = mime != NULL && g_str_has_prefix (mime, "video/");
+
+  g_free (mime);
+  g_free (type);
+  return video;
+}
+
+/* queue a clip, naming its sheet after it. Clips with the same name in different
+ * directories get a numbered sheet instead of overwriting each other's */
+static void
+queue_clip (GThreadPool * pool, GHashTable * outputs, const gchar * path)
+{
+  gchar *base = g_path_get_basename (path);
+  gchar *name = g_strconcat (base, ".png", NULL);
+
+  for (gint n = 2; g_hash_table_contains (outputs, name); n++) {
+    g_free (name);
+    name = g_strdup_printf ("%s-%d.png", base, n);
+  }
+  g_hash_table_add (outputs, name);
+
+  SheetJob *job = g_new0 (SheetJob, 1);
+  job->path = g_strdup (path);
+  job->output = g_build_filename (output_dir ? output_dir : ".", name, NULL);
+  g_thread_pool_push (pool, job, NULL);
+  g_free (base);
+}
+
+/* queue a clip, or every video file of a directory */
+static void
+queue_path (GThreadPool * pool, GHashTable * outputs, const gchar * path)
+{
+  GDir *dir = g_dir_open (path, 0, NULL);
+  const gchar *name;
+
+  if (dir == NULL) {
+    queue_clip (pool, outputs, path);
+    return;
+  }
+
+  while ((name = g_dir_read_name (dir)) != NULL) {
+    gchar *file = g_build_filename (path, name, NULL);
+
+    if (g_file_test (file, G_FILE_TEST_IS_REGULAR) && is_video_file (file))
+      queue_clip (pool, outputs, file);
+    g_free (file);
+  }
+  g_dir_close (dir);
+}
+
+int
+main (int argc, char *argv[])
+{
+  GOptionContext *context;
+  GError *error = NULL;
+  GThreadPool *pool;
+  GHashTable *outputs;
+
+  context = g_option_context_new ("<file|uri|directory>... - write contact sheets");
+  g_option_context_add_main_entries (context, entries, NULL);
+  g_option_context_add_group (context, gst_init_get_option_group ());
+  if (!g_option_context_parse (context, &argc, &argv, &error)) {
+    g_print ("could not parse options: %s\n", error->message);
+    g_error_free (error);
+    exit (-1);
+  }
+  g_option_context_free (context);
+
+  if (argc < 2 || columns <= 0 || rows <= 0 || tile_width <= 0
+      || tile_height <= 0 || threads <= 0 || jobs <= 0) {
+    g_print ("usage: %s [OPTION...] <file|uri|directory>...\n"
+        " Writes a <name>.png contact sheet per clip, <name>-2.png for the second\n"
+        " clip of that name and so on\n", argv[0]);
+    exit (-1);
+  }
+
+  /* at most jobs clips at once, each read by threads pipelines */
+  pool = g_thread_pool_new ((GFunc) make_sheet, NULL, jobs, TRUE, NULL);
+  outputs = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+  for (gint i = 1; i < argc; i++)
+    queue_path (pool, outputs, argv[i]);
+  g_thread_pool_free (pool, FALSE, TRUE);
+  g_hash_table_destroy (outputs);
+
+  exit (0);
+}
@@ -0,0 +1,336 @@
+#include "mosaic.h"
+#include "statecontrol.h"
+
+#define MOSAIC_WIDTH        1280
+#define MOSAIC_HEIGHT       720
+#define TILE_QUEUE_BUFFERS  3
+#define MAX_LOWRES          2    /* 1/4 size, the smallest gst-libav decoders offer */
+
+/* One clip of the grid */
+typedef struct _MosaicTile
+{
+  Mosaic *mosaic;
+  guint index;           /* Position in the grid, row major */
+  GstElement *source;    /* uridecodebin of the clip */
+  GPtrArray *elements;   /* Elements between the source and the compositor */
+  GstPad *mixer_pad;     /* Request pad of the compositor, NULL until the video pad appears */
+} MosaicTile;
+
+struct _Mosaic
+{
+  guint columns;
+  guint rows;
+  gint tile_width;
+  gint tile_height;
+  gboolean decoder_downscale;  /* Whether libav decoders skip the resolution the tiles do not need */
+  GstElement *pipeline;  /* Single pipeline, hence a single clock for all the tiles */
+  GstElement *mixer;     /* compositor */
+  GPtrArray *tiles;
+};
+
+/* This function parses a layout such as 3x2, columns first */
+gboolean mosaic_parse_layout(const gchar *layout, guint *columns, guint *rows)
+{
+  gchar *end = NULL;
+
+  g_return_val_if_fail(layout != NULL, FALSE);
+
+  guint64 parsed_columns = g_ascii_strtoull(layout, &end, 10);
+  if (end == layout || (*end != 'x' && *end != 'X'))
+    return FALSE;
+
+  const gchar *rows_str = end + 1;
+  guint64 parsed_rows = g_ascii_strtoull(rows_str, &end, 10);
+  if (end == rows_str || *end != '\0')
+    return FALSE;
+
+  if (parsed_columns == 0 || parsed_rows == 0 || parsed_columns > 8 || parsed_rows > 8)
+    return FALSE;
+
+  *columns = parsed_columns;
+  *rows = parsed_rows;
+  return TRUE;
+}
+
+static GstElement *make_capsfilter(gint width, gint height)
+{
+  GstElement *filter = gst_element_factory_make("capsfilter", NULL);
+  GstCaps *caps = gst_caps_new_simple("video/x-raw",
+      "width", G_TYPE_INT, width,
+      "height", G_TYPE_INT, height,
+      "pixel-aspect-ratio", GST_TYPE_FRACTION, 1, 1,
+      NULL);
+
+  g_object_set(filter, "caps", caps, NULL);
+  gst_caps_unref(caps);
+  return filter;
+}
+
+/* This function is called from a streaming thread when uridecodebin exposes a decoded stream */
+static void source_pad_added_cb(GstElement *source, GstPad *pad, MosaicTile *tile)
+{
+  Mosaic *mosaic = tile->mosaic;
+  GstCaps *caps = gst_pad_get_current_caps(pad);
+  gboolean is_video = FALSE;
+
+  if (caps != NULL) {
+    is_video = g_str_has_prefix(gst_structure_get_name(gst_caps_get_structure(caps, 0)), "video/");
+    gst_caps_unref(caps);
+  }
+
+  /* Only the first video stream of each clip is shown */
+  if (!is_video || tile->mixer_pad != NULL)
+    return;
+
+  /* Scale before converting, so the conversion and the compositor work at tile size. Libav
+   * decoders of large clips already output a fraction of their size, see decoder_caps_probe_cb,
+   * the other decoders the full size, and videoscale takes them the rest of the way */
+  GstElement *queue = gst_element_factory_make("queue", NULL);
+  GstElement *scale = gst_element_factory_make("videoscale", NULL);
+  GstElement *convert = gst_element_factory_make("videoconvert", NULL);
+  GstElement *filter = make_capsfilter(mosaic->tile_width, mosaic->tile_height);
+
+  g_object_set(queue, "max-size-buffers", TILE_QUEUE_BUFFERS, "max-size-bytes", 0, "max-size-time", (guint64) 0, NULL);
+
+  gst_bin_add_many(GST_BIN(mosaic->pipeline), queue, scale, convert, filter, NULL);
+  g_ptr_array_add(tile->elements, queue);
+  g_ptr_array_add(tile->elements, scale);
+  g_ptr_array_add(tile->elements, convert);
+  g_ptr_array_add(tile->elements, filter);
+  gst_element_link_many(queue, scale, convert, filter, NULL);
+
+#if GST_CHECK_VERSION(1, 20, 0)
+  tile->mixer_pad = gst_element_request_pad_simple(mosaic->mixer, "sink_%u");
+#else
+  tile->mixer_pad = gst_element_get_request_pad(mosaic->mixer, "sink_%u");
+#endif
+  g_object_set(tile->mixer_pad,
+      "xpos", (gint)(tile->index % mosaic->columns) * mosaic->tile_width,
+      "ypos", (gint)(tile->index / mosaic->columns) * mosaic->tile_height,
+      NULL);
+
+  GstPad *filter_src = gst_element_get_static_pad(filter, "src");
+  gst_pad_link(filter_src, tile->mixer_pad);
+  gst_object_unref(filter_src);
+
+  for (guint i = 0; i < tile->elements->len; i++)
+    gst_element_sync_state_with_parent(g_ptr_array_index(tile->elements, i));
+
+  GstPad *queue_sink = gst_element_get_static_pad(queue, "sink");
+  if (gst_pad_link(pad, queue_sink) != GST_PAD_LINK_OK)
+    g_printerr("Could not link tile %u\n", tile->index);
+  gst_object_unref(queue_sink);
+}
+
+/* This function returns the lowres level of gst-libav decoding a width x height stream for a
+ * tile: each level halves both dimensions, never below the tile, so videoscale only shrinks */
+static gint lowres_for_tile(Mosaic *mosaic, gint width, gint height)
+{
+  gint lowres = 0;
+
+  while (lowres < MAX_LOWRES && (width >> (lowres + 1)) >= mosaic->tile_width &&
+      (height >> (lowres + 1)) >= mosaic->tile_height)
+    lowres++;
+
+  return lowres;
+}
+
+/* This function is called from a streaming thread for the events reaching a libav video
+ * decoder. On caps, before the decoder opens for them, it picks its lowres level from the
+ * size of the stream. libavcodec falls back to full size for the codecs it cannot decode at
+ * a lower resolution, such as H.264 and HEVC, it only helps with MPEG-2, MPEG-4 part 2 and JPEG */
+static GstPadProbeReturn decoder_caps_probe_cb(GstPad *pad, GstPadProbeInfo *info, MosaicTile *tile)
+{
+  GstEvent *event = GST_PAD_PROBE_INFO_EVENT(info);
+  GstCaps *caps = NULL;
+  gint width, height;
+
+  if (GST_EVENT_TYPE(event) != GST_EVENT_CAPS)
+    return GST_PAD_PROBE_OK;
+
+  gst_event_parse_caps(event, &caps);
+  GstStructure *structure = gst_caps_get_structure(caps, 0);
+  if (!gst_structure_get_int(structure, "width", &width) || !gst_structure_get_int(structure, "height", &height))
+    return GST_PAD_PROBE_OK;
+
+  GstElement *decoder = gst_pad_get_parent_element(pad);
+  if (decoder != NULL) {
+    g_object_set(decoder, "lowres", lowres_for_tile(tile->mosaic, width, height), NULL);
+    gst_object_unref(decoder);
+  }
+
+  return GST_PAD_PROBE_OK;
+}
+
+/* This function is called when an element is added to the uridecodebin of a tile, or to one of its bins */
+static void source_element_added_cb(GstBin *bin, GstBin *sub_bin, GstElement *element, MosaicTile *tile)
+{
+  GParamSpec *pspec = g_object_class_find_property(G_OBJECT_GET_CLASS(element), "lowres");
+
+  /* Only the video decoders of gst-libav have it, as an enum of 0 to 2 */
+  if (!tile->mosaic->decoder_downscale || pspec == NULL || !G_IS_PARAM_SPEC_ENUM(pspec))
+    return;
+
+  GstPad *sink = gst_element_get_static_pad(element, "sink");
+  if (sink != NULL) {
+    gst_pad_add_probe(sink, GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM,
+        (GstPadProbeCallback) decoder_caps_probe_cb, tile, NULL);
+    gst_object_unref(sink);
+  }
+}
+
+/* This function removes a tile from the pipeline, which must be in the NULL state */
+static void mosaic_tile_free(gpointer user_data)
+{
+  MosaicTile *tile = user_data;
+  Mosaic *mosaic = tile->mosaic;
+
+  if (tile->mixer_pad != NULL) {
+    gst_element_release_request_pad(mosaic->mixer, tile->mixer_pad);
+    gst_object_unref(tile->mixer_pad);
+  }
+
+  for (guint i = 0; i < tile->elements->len; i++)
+    gst_bin_remove(GST_BIN(mosaic->pipeline), g_ptr_array_index(tile->elements, i));
+  g_ptr_array_unref(tile->elements);
+
+  gst_bin_remove(GST_BIN(mosaic->pipeline), tile->source);
+  g_free(tile);
+}
+
+static MosaicTile *mosaic_tile_new(Mosaic *mosaic, guint index, const gchar *uri)
+{
+  MosaicTile *tile = g_new0(MosaicTile, 1);
+  GstCaps *caps = gst_caps_from_string("video/x-raw(ANY)");
+
+  tile->mosaic = mosaic;
+  tile->index = index;
+  tile->elements = g_ptr_array_new();
+
+  /* Streams other than video are neither decoded nor exposed */
+  tile->source = gst_element_factory_make("uridecodebin", NULL);
+  g_object_set(tile->source, "uri", uri, "caps", caps, "expose-all-streams", FALSE, NULL);
+  gst_caps_unref(caps);
+  g_signal_connect(tile->source, "pad-added", G_CALLBACK(source_pad_added_cb), tile);
+  g_signal_connect(tile->source, "deep-element-added", G_CALLBACK(source_element_added_cb), tile);
+  gst_bin_add(GST_BIN(mosaic->pipeline), tile->source);
+
+  return tile;
+}
+
+/* This function creates the mosaic pipeline, composing columns x rows tiles into video_sink */
+Mosaic *mosaic_new(guint columns, guint rows, GstElement *video_sink)
+{
+  g_return_val_if_fail(columns > 0 && rows > 0, NULL);
+  g_return_val_if_fail(GST_IS_ELEMENT(video_sink), NULL);
+
+  Mosaic *mosaic = g_new0(Mosaic, 1);
+  mosaic->columns = columns;
+  mosaic->rows = rows;
+  mosaic->tile_width = GST_ROUND_DOWN_2(MOSAIC_WIDTH / columns);
+  mosaic->tile_height = GST_ROUND_DOWN_2(MOSAIC_HEIGHT / rows);
+  mosaic->decoder_downscale = TRUE;
+  mosaic->tiles = g_ptr_array_new_with_free_func(mosaic_tile_free);
+
+  mosaic->pipeline = gst_pipeline_new("mosaic");
+  mosaic->mixer = gst_element_factory_make("compositor", "mixer");
+  GstElement *filter = make_capsfilter(mosaic->tile_width * columns, mosaic->tile_height * rows);
+  GstElement *convert = gst_element_factory_make("videoconvert", NULL);
+
+  if (mosaic->mixer == NULL || convert == NULL) {
+    g_printerr("Not all mosaic elements could be created.\n");
+    gst_object_unref(mosaic->pipeline);
+    g_ptr_array_unref(mosaic->tiles);
+    g_free(mosaic);
+    return NULL;
+  }
+
+  gst_util_set_object_arg(G_OBJECT(mosaic->mixer), "background", "black");
+  gst_bin_add_many(GST_BIN(mosaic->pipeline), mosaic->mixer, filter, convert, video_sink, NULL);
+  gst_element_link_many(mosaic->mixer, filter, convert, video_sink, NULL);
+
+  return mosaic;
+}
+
+/* This function frees the mosaic once its pipeline reached NULL, from the state control thread */
+static void mosaic_destroy(Mosaic *mosaic)
+{
+  g_ptr_array_unref(mosaic->tiles);
+  gst_object_unref(mosaic->pipeline);
+  g_free(mosaic);
+}
+
+/* This function frees the mosaic, its pipeline is torn down in the background */
+void mosaic_free(Mosaic *mosaic)
+{
+  g_return_if_fail(mosaic != NULL);
+
+  state_control_teardown(mosaic->pipeline, (GDestroyNotify) mosaic_destroy, mosaic);
+}
+
+GstElement *mosaic_get_pipeline(Mosaic *mosaic)
+{
+  g_return_val_if_fail(mosaic != NULL, NULL);
+
+  return mosaic->pipeline;
+}
+
+guint mosaic_get_tile_count(Mosaic *mosaic)
+{
+  g_return_val_if_fail(mosaic != NULL, 0);
+
+  return mosaic->columns * mosaic->rows;
+}
+
+/* This function sets whether libav decoders of the clips set afterwards decode at a lower
+ * resolution when their stream is at least twice the tile size, which is the default */
+void mosaic_set_decoder_downscale(Mosaic *mosaic, gboolean enabled)
+{
+  g_return_if_fail(mosaic != NULL);
+
+  mosaic->decoder_downscale = enabled;
+}
+
+/* Clips waiting for the pipeline to reach NULL */
+typedef struct _SetUrisRequest
+{
+  Mosaic *mosaic;
+  gchar **uris;
+  MosaicReadyFunc ready;
+  gpointer user_data;
+} SetUrisRequest;
+
+/* This function is called from the main context once the pipeline went to NULL, the tiles can be replaced */
+static void set_uris_done_cb(GstElement *pipeline, GstState state, GstStateChangeReturn ret, SetUrisRequest *request)
+{
+  Mosaic *mosaic = request->mosaic;
+  gboolean ready = FALSE;
+
+  if (ret != GST_STATE_CHANGE_FAILURE) {
+    g_ptr_array_set_size(mosaic->tiles, 0);
+    for (guint i = 0; request->uris[i] != NULL && i < mosaic_get_tile_count(mosaic); i++)
+      g_ptr_array_add(mosaic->tiles, mosaic_tile_new(mosaic, i, request->uris[i]));
+    ready = mosaic->tiles->len > 0;
+  }
+
+  if (request->ready != NULL)
+    request->ready(mosaic, ready, request->user_data);
+  g_strfreev(request->uris);
+  g_free(request);
+}
+
+/* This function replaces the clips of the grid, extra URIs are ignored. The pipeline is set to
+ * NULL in the background, then the tiles are replaced and ready, if not NULL, is called from the
+ * default main context, with whether there is any tile. The pipeline is left in the NULL state */
+void mosaic_set_uris(Mosaic *mosaic, gchar **uris, MosaicReadyFunc ready, gpointer user_data)
+{
+  g_return_if_fail(mosaic != NULL);
+  g_return_if_fail(uris != NULL);
+
+  SetUrisRequest *request = g_new0(SetUrisRequest, 1);
+  request->mosaic = mosaic;
+  request->uris = g_strdupv(uris);
+  request->ready = ready;
+  request->user_data = user_data;
+  state_control_set(mosaic->pipeline, GST_STATE_NULL, (StateControlDoneFunc) set_uris_done_cb, request);
+}
@@ -0,0 +1,26 @@
+#ifndef MOSAIC_H
+#define MOSAIC_H
+
+#include <gst/gst.h>
+
+G_BEGIN_DECLS
+
+/* Grid of clips composed by a single compositor into one video sink */
+typedef struct _Mosaic Mosaic;
+
+/* Called from the main context once the clips given to mosaic_set_uris() replaced the previous ones */
+typedef void (*MosaicReadyFunc)(Mosaic *mosaic, gboolean ready, gpointer user_data);
+
+gboolean mosaic_parse_layout(const gchar *layout, guint *columns, guint *rows);
+
+Mosaic *mosaic_new(guint columns, guint rows, GstElement *video_sink);
+void mosaic_free(Mosaic *mosaic);
+
+GstElement *mosaic_get_pipeline(Mosaic *mosaic);
+guint mosaic_get_tile_count(Mosaic *mosaic);
+void mosaic_set_decoder_downscale(Mosaic *mosaic, gboolean enabled);
+void mosaic_set_uris(Mosaic *mosaic, gchar **uris, MosaicReadyFunc ready, gpointer user_data);
+
+G_END_DECLS
+
+#endif /* MOSAIC_H */
@@ -7,8 +7,74 @@
 #include <gdk/gdk.h>
 #include <gdk/gdkx.h>
 
+#include "clipexport.h"
+#include "decodertuning.h"
+#include "hugepagealloc.h"
+#include "framegrab.h"
+#include "memgovernor.h"
+#include "metrics.h"
+#include "mosaic.h"
+#include "netsync.h"
+#include "playerstats.h"
+#include "posterframe.h"
+#include "preseek.h"
+#include "profiler.h"
+#include "proxygen.h"
+#include "sharedtaskpool.h"
+#include "startuptiming.h"
+#include "statecontrol.h"
+#include "storyboard.h"
+#include "streamswitch.h"
+#include "thumbcache.h"
+#include "watchdog.h"
+#include "workpool.h"
+
 #define TIME_STRING_LENGTH 13
 #define THUMBNAILS_NUMBER  10
+#define HUD_REFRESH_MS     500
+#define HUD_WIDTH          220
+#define METRICS_INTERVAL_S 15
+#define POSTER_WIDTH       640
+#define POSTER_TIMEOUT     (2 * GST_SECOND)
+#define STARTUP_TARGET_MS  150
+#define PROXY_HEIGHT       480
+#define STORYBOARD_INTERVAL_S 10
+#define WATCHDOG_DEADLINE_S 5
+#define SHUTDOWN_TIMEOUT_MS 2000
+#define PRESEEK_WIDTH      1280
+#define PRESEEK_DELAY_MS   120  /* Time the pointer rests on the slider before its position is pre-decoded */
+#define PRESEEK_TOLERANCE  (250 * GST_MSECOND) /* Between the position pre-decoded and that of the click */
+#define MEMORY_INTERVAL_MS 1000
+#define FRAME_GRAB_BUDGET  (64 << 20) /* A 4K RGBx frame and its encoder */
+#define PRESEEK_BUDGET     (48 << 20) /* The pre-seek pipeline of a 1080p clip and its ready frame */
+#define THUMB_CACHE_BUDGET (512 << 20) /* Posters, thumbnails, storyboard tiles and proxies of the recent clips */
+#define THUMBNAIL_POSITION_KEY "tEXt::position" /* PNG text chunk holding the position of the frame of a thumbnail */
+
+/* Metrics exported for long running deployments */
+typedef struct _PlayerMetrics
+{
+  Metric *frames_rendered;   /* Frames that reached the video sink */
+  Metric *frames_dropped;    /* Frames dropped, as reported by QoS */
+  Metric *seeks;             /* Seeks requested by the user */
+  Metric *seek_latency;      /* Histogram of the seek latency, in seconds */
+  Metric *decode_errors;     /* Stream errors posted by the pipeline */
+  Metric *pipeline_restarts; /* Times playbin was torn down and started again to recover from a failure */
+  Metric *rss;               /* Resident set size of the process */
+  Metric *jitter;            /* Average lateness of the frames at the sink */
+  Metric *first_pixel;       /* Histogram of the time from open to the first poster or video frame shown */
+  Metric *cache_hits;        /* Thumbnail cache lookups that found an image */
+  Metric *cache_misses;      /* Thumbnail cache lookups that did not */
+  Metric *stalls;            /* Stalls of playbin or timelinebin detected by the watchdog */
+  Metric *stall_recovery;    /* Histogram of the time from a stall being detected to the pipeline running again */
+  Metric *pre_seek_hits;     /* Seeks served by a frame decoded ahead */
+  Metric *pre_seek_misses;   /* Seeks with no frame decoded ahead near their target */
+  Metric *pre_seek_wasted;   /* Frames decoded ahead and never shown */
+  Metric *thumbnail_seek;    /* Histogram of the time from a click on a thumbnail to its frame reaching the video sink */
+  Metric *memory_usage;      /* Memory charged to the cgroup of the player, but its clean page cache */
+  Metric *memory_limit;      /* Limit of that cgroup */
+  Metric *memory_stall;      /* Share of the last 10 s some task of the cgroup stalled on memory */
+  Metric *memory_shrinks;    /* Times the caches were shrunk under memory pressure */
+} PlayerMetrics;
 
 /* Structure to contain all our information, so we can pass it around */
 typedef struct _CustomData
@@ -19,9 +85,125 @@ typedef struct _CustomData
   gint64 duration;         /* Duration of the clip, in nanoseconds */
   gint64 position;         /* Position of the clip, in nanoseconds */
   gint timer_id;           /* The ID of the timer source */
-  GstElement *timelinebin; /* Timeline pipline to make thumbnails */
+  GstElement *timelinebin; /* Timeline pipline to make thumbnails, created on each open */
+  guint timeline_timer_id; /* The ID of the source making the thumbnails, 0 when done */
+  gint thumbnail_count;    /* Thumbnails made for the clip being played */
+  PlayerStats *stats;      /* Playback statistics shown by the HUD */
+  GtkWidget *hud;          /* Drawing area of the performance HUD */
+  gint hud_timer_id;       /* The ID of the HUD refresh source */
+  gboolean profile;        /* Whether the pipelines are profiled with tracers */
+  ProfilerFormat profile_format; /* Format of the profile dumped on exit */
+  PlayerMetrics metrics;   /* Exported metrics */
+  GstElement *video_sink;  /* Sink drawing into the video window */
+  Mosaic *mosaic;          /* Grid of clips replacing playbin in mosaic mode, NULL otherwise */
+  guint mosaic_columns;    /* Layout of the mosaic */
+  guint mosaic_rows;
+  NetSync *sync;           /* Shared clock in sync mode, NULL otherwise */
+  StreamSwitch *stream_switch; /* Track selection of playbin, NULL in mosaic mode */
+  GtkWidget *audio_button; /* Switches to the next audio track */
+  GtkWidget *video_button; /* Switches to the next video track */
+  GtkWidget *video_window; /* The drawing area where the video is shown */
+  gchar *uri;              /* URI of the clip being played */
+  ThumbCache *thumb_cache; /* Poster frames and timeline thumbnails of the clips already opened */
+  gchar *thumbnail_path;   /* Last thumbnail made for the timeline */
+  GdkPixbuf *poster;       /* Shown in the video window until playbin renders its first frame */
+  guint open_serial;       /* Incremented on each open, to drop posters of a previous clip */
+  gint64 open_time;        /* Monotonic time of the last open, in microseconds */
+  gboolean first_pixel_shown; /* Whether the first pixel after the last open was reported */
+  gint waiting_first_frame; /* Set until the video sink gets a buffer after an open, accessed atomically */
+  FrameGrabber *frame_grabber; /* Saves the frame being shown */
+  ProxyJob *proxy_job;     /* Makes the scrubbing proxy of the clip, NULL when not running */
+  GstElement *proxybin;    /* Plays the proxy, paused, while the slider is dragged. NULL until it is ready */
+  GstElement *proxy_sink;  /* Sink of proxybin, drawing into the video window too */
+  gboolean scrubbing;      /* Whether the slider is being dragged over the proxy */
+  gboolean scrub_resume;   /* Whether playbin was playing when the drag started */
+  gint64 scrub_position;   /* Last position shown from the proxy, -1 if none */
+  GstClockTime export_in;  /* Range set with the IN and OUT buttons, GST_CLOCK_TIME_NONE if not set */
+  GstClockTime export_out;
+  GtkWidget *in_button;    /* Show the ends of the export range */
+  GtkWidget *out_button;
+  Watchdog *watchdog;      /* Detects stalls of playbin and timelinebin, NULL if disabled */
+  guint playbin_watch;     /* Watches of the pipelines */
+  guint timeline_watch;
+  gint recovering;         /* Set while playbin is recovered from a stall, accessed atomically */
+  gint recovering_timeline; /* Set while timelinebin is torn down after a stall, accessed atomically */
+  gpointer recovered_timeline; /* timelinebin torn down after a stall, until its thumbnail is retried, accessed atomically */
+  gboolean thumbnail_retried; /* Whether the thumbnail being made was already retried after a stall */
+  GstClockTime recover_position; /* Where playbin resumes after the recovery, GST_CLOCK_TIME_NONE if unknown */
+  GstState recover_state;  /* State playbin goes back to after the recovery */
+  gint64 stall_time;       /* Monotonic time at which the stall being recovered was detected */
+  gint shutdown_pending;   /* Pipelines still going to NULL after the window was closed */
+  guint shutdown_timeout_id; /* Bounds the time waited for them */
+  gboolean shutdown_timed_out; /* Whether the player quit with pipelines still going to NULL */
+  PreSeek *pre_seek;       /* Decodes the frame under the pointer on the slider, NULL if disabled */
+  guint pre_seek_timer_id; /* Hints the position under the pointer once it rests */
+  GstClockTime pre_seek_position;
+  gboolean slider_clicked; /* Set from a press on the slider to the seek it makes */
+  gint64 first_frame_time; /* Monotonic time the video sink got its first buffer after waiting_first_frame was set */
+  gint64 thumbnail_click_time; /* Monotonic time of the click on a thumbnail whose frame is not shown yet, 0 if none */
+  MemoryGovernor *memory_governor; /* Shrinks the caches under memory pressure, NULL if disabled */
 } CustomData;
 
+/* Command line options */
+static gchar *profile_option = NULL;
+static gchar *profile_output_option = NULL;
+static gchar *metrics_file_option = NULL;
+static gint metrics_interval_option = METRICS_INTERVAL_S;
+static gint metrics_port_option = 0;
+static gboolean no_decoder_tuning_option = FALSE;
+static gboolean no_huge_pages_option = FALSE;
+static gboolean no_pre_seek_option = FALSE;
+static gboolean no_memory_governor_option = FALSE;
+static gchar *mosaic_option = NULL;
+static gchar *sync_master_option = NULL;
+static gchar *sync_slave_option = NULL;
+static gchar *sync_log_option = NULL;
+static gboolean startup_report_option = FALSE;
+static gboolean proxy_option = FALSE;
+static gchar *storyboard_dir_option = NULL;
+static gint storyboard_interval_option = STORYBOARD_INTERVAL_S;
+static gint watchdog_deadline_option = WATCHDOG_DEADLINE_S;
+
+static GOptionEntry option_entries[] = {
+  { "profile", 0, 0, G_OPTION_ARG_STRING, &profile_option,
+    "Profile playbin and timelinebin with GStreamer tracers and dump the result on exit", "table|folded" },
+  { "profile-output", 0, 0, G_OPTION_ARG_FILENAME, &profile_output_option,
+    "Write the profile to FILE instead of the standard output", "FILE" },
+  { "metrics-file", 0, 0, G_OPTION_ARG_FILENAME, &metrics_file_option,
+    "Write Prometheus metrics to FILE for the textfile collector", "FILE" },
+  { "metrics-interval", 0, 0, G_OPTION_ARG_INT, &metrics_interval_option,
+    "Seconds between two writes of the metrics file (default: 15)", "SECONDS" },
+  { "metrics-port", 0, 0, G_OPTION_ARG_INT, &metrics_port_option,
+    "Serve Prometheus metrics over HTTP on localhost:PORT", "PORT" },
+  { "no-decoder-tuning", 0, 0, G_OPTION_ARG_NONE, &no_decoder_tuning_option,
+    "Leave decoder threading and CPU affinity at the element defaults", NULL },
+  { "no-huge-pages", 0, 0, G_OPTION_ARG_NONE, &no_huge_pages_option,
+    "Allocate decoded frames from the system allocator instead of huge pages", NULL },
+  { "no-pre-seek", 0, 0, G_OPTION_ARG_NONE, &no_pre_seek_option,
+    "Do not decode ahead the frame under the pointer on the slider", NULL },
+  { "no-memory-governor", 0, 0, G_OPTION_ARG_NONE, &no_memory_governor_option,
+    "Do not shrink the caches when memory usage or pressure rises", NULL },
+  { "mosaic", 0, 0, G_OPTION_ARG_STRING, &mosaic_option,
+    "Play up to COLUMNS x ROWS clips, given as extra arguments, in a grid", "COLUMNSxROWS" },
+  { "sync-master", 0, 0, G_OPTION_ARG_STRING, &sync_master_option,
+    "Publish the pipeline clock and base time on ADDRESS:PORT for other players", "ADDRESS:PORT" },
+  { "sync-slave", 0, 0, G_OPTION_ARG_STRING, &sync_slave_option,
+    "Play in lockstep with the master publishing its clock on ADDRESS:PORT", "ADDRESS:PORT" },
+  { "sync-log", 0, 0, G_OPTION_ARG_FILENAME, &sync_log_option,
+    "Log the presentation time of every frame to FILE in sync mode", "FILE" },
+  { "proxy", 0, 0, G_OPTION_ARG_NONE, &proxy_option,
+    "Make a low resolution proxy of each clip in the background, and scrub on it", NULL },
+  { "storyboard-dir", 0, 0, G_OPTION_ARG_FILENAME, &storyboard_dir_option,
+    "Export a WebVTT storyboard and its sprites of each clip to DIR", "DIR" },
+  { "storyboard-interval", 0, 0, G_OPTION_ARG_INT, &storyboard_interval_option,
+    "Seconds of the clip per storyboard tile (default: 10)", "SECONDS" },
+  { "watchdog-deadline", 0, 0, G_OPTION_ARG_INT, &watchdog_deadline_option,
+    "Restart a pipeline making no progress for SECONDS, 0 to disable (default: 5)", "SECONDS" },
+  { "startup-report", 0, 0, G_OPTION_ARG_NONE, &startup_report_option,
+    "Print the time taken by each startup phase once the window is visible", NULL },
+  { NULL }
+};
+
 /* Enumerates widget types */
 enum widget_type
 {
@@ -109,13 +291,48 @@ static void set_label_txt(GtkWidget *label, enum widget_type type, CustomData *d
   g_free(label_txt);
 }
 
-/* This functions adds an image created from file to a widget */
-static void widget_add_image(GtkWidget *widget) {
-  g_return_if_fail(widget != NULL);
+/* Frame a timeline thumbnail was made from, attached to its event box */
+typedef struct _Thumbnail
+{
+  guint serial;          /* Open the thumbnail was made for */
+  GstClockTime position; /* Position of its keyframe */
+} Thumbnail;
+
+static gboolean thumbnail_enter_cb(GtkWidget *widget, GdkEventCrossing *event, CustomData *data);
+static gboolean thumbnail_press_cb(GtkWidget *widget, GdkEventButton *event, CustomData *data);
+static gboolean pre_seek_leave_cb(GtkWidget *widget, GdkEventCrossing *event, CustomData *data);
+
+/* This function gives the position the step-th timeline thumbnail is made at */
+static gint64 thumbnail_target(CustomData *data, gint step)
+{
+  return (step+1) * data->duration * 10 / 100;
+}
 
-  GtkWidget *image = gtk_image_new_from_file ("snapshot.png");
-  gtk_box_pack_start(GTK_BOX(widget), image, FALSE, FALSE, 2);
-  gtk_widget_show_all(widget);
+/* This functions adds the last thumbnail made to the timeline. A click on it seeks to the
+ * keyframe it was made from, whose position is stored in the image by extract_thumbnails() */
+static void timeline_add_thumbnail(GtkWidget *timeline, CustomData *data) {
+  g_return_if_fail(timeline != NULL);
+
+  GdkPixbuf *pixbuf = gdk_pixbuf_new_from_file(data->thumbnail_path, NULL);
+  GtkWidget *image = pixbuf != NULL ? gtk_image_new_from_pixbuf(pixbuf) : gtk_image_new_from_file(data->thumbnail_path);
+  Thumbnail *thumbnail = g_new0(Thumbnail, 1);
+  thumbnail->serial = data->open_serial;
+
+  /* Images cached before positions were recorded were made by a keyframe seek to the target */
+  const gchar *position = pixbuf != NULL ? gdk_pixbuf_get_option(pixbuf, THUMBNAIL_POSITION_KEY) : NULL;
+  thumbnail->position = position != NULL ? g_ascii_strtoull(position, NULL, 10) :
+      (GstClockTime) thumbnail_target(data, data->thumbnail_count);
+  if (pixbuf != NULL)
+    g_object_unref(pixbuf);
+
+  GtkWidget *event_box = gtk_event_box_new();
+  g_object_set_data_full(G_OBJECT(event_box), "thumbnail", thumbnail, g_free);
+  g_signal_connect(G_OBJECT(event_box), "enter-notify-event", G_CALLBACK(thumbnail_enter_cb), data);
+  g_signal_connect(G_OBJECT(event_box), "leave-notify-event", G_CALLBACK(pre_seek_leave_cb), data);
+  g_signal_connect(G_OBJECT(event_box), "button-press-event", G_CALLBACK(thumbnail_press_cb), data);
+  gtk_container_add(GTK_CONTAINER(event_box), image);
+  gtk_box_pack_start(GTK_BOX(timeline), event_box, FALSE, FALSE, 2);
+  gtk_widget_show_all(timeline);
 }
 
 /* Function to update a specific widget */
@@ -143,7 +360,7 @@ static void update_widget(CustomData *data, enum widget_type type)
     if (g_strcmp0(box_name, "timeline") == 0) {
       if (type != WIDGET_TYPE_TIMELINE)
         continue;
-      widget_add_image(box);
+      timeline_add_thumbnail(box, data);
       break;
     }
 
@@ -167,6 +384,55 @@ static void update_widget(CustomData *data, enum widget_type type)
   g_list_free(children);
 }
 
+/* This function gives the size of the frames of a sample of the timeline sink */
+static gboolean get_sample_size(GstSample *sample, gint *width, gint *height)
+{
+  GstCaps *caps;
+  GstStructure *s;
+
+  /* get the snapshot buffer format now. We set the caps on the appsink so
+   * that it can only be an rgb buffer. The only thing we have not specified
+   * on the caps is the height, which is dependant on the pixel-aspect-ratio
+   * of the source material */
+  caps = gst_sample_get_caps (sample);
+  if (!caps) {
+    g_print ("could not get snapshot format\n");
+    return FALSE;
+  }
+  s = gst_caps_get_structure (caps, 0);
+
+  /* we need to get the final caps on the buffer to get the size */
+  if (!gst_structure_get_int (s, "width", width) || !gst_structure_get_int (s, "height", height)) {
+    g_print ("could not get snapshot dimension\n");
+    return FALSE;
+  }
+
+  return TRUE;
+}
+
+/* This function wraps the RGB frame of a sample of the timeline sink in a pixbuf, without
+ * copying it. The buffer of the sample stays mapped in map, it should be unmapped with
+ * gst_buffer_unmap() once the pixbuf is freed with g_object_unref(). Returns NULL if the
+ * format of the sample is unknown */
+static GdkPixbuf *wrap_sample(GstSample *sample, GstMapInfo *map)
+{
+  GstBuffer *buffer;
+  gint width, height;
+
+  if (!get_sample_size (sample, &width, &height))
+    return NULL;
+
+  /* create pixmap from buffer, gstreamer video buffers have a stride
+   * that is rounded up to the nearest multiple of 4 */
+  buffer = gst_sample_get_buffer (sample);
+  if (!gst_buffer_map (buffer, map, GST_MAP_READ))
+    return NULL;
+
+  return gdk_pixbuf_new_from_data (map->data,
+      GDK_COLORSPACE_RGB, FALSE, 8, width, height,
+      GST_ROUND_UP_4 (width * 3), NULL, NULL);
+}
+
 /*This function extracts thumbnails using timeline pipeline */
 static void extract_thumbnails(CustomData *data, gint step) {
   g_return_if_fail(data != NULL);
@@ -174,13 +440,20 @@ static void extract_thumbnails(CustomData *data, gint step) {
   gint64 position;
   GstElement *sink = NULL;
   GstSample *sample;
-  gint width, height;
   GdkPixbuf *pixbuf;
   GError *error = NULL;
-  gboolean res;
   GstMapInfo map;
   GstStateChangeReturn ret;
 
+  /* Thumbnails of a clip opened before are taken from the cache, without running the timeline */
+  gchar *name = g_strdup_printf("timeline-%d", step);
+  gchar *cached = thumb_cache_lookup(data->thumb_cache, data->uri, name);
+  g_free(data->thumbnail_path);
+  data->thumbnail_path = cached != NULL ? cached : thumb_cache_get_path(data->thumb_cache, data->uri, name);
+  g_free(name);
+  if (cached != NULL)
+    return;
+
   /* set to PAUSED to make the first frame arrive in the sink */
   ret = gst_element_set_state (data->timelinebin, GST_STATE_PAUSED);
   switch (ret) {
@@ -198,7 +471,7 @@ static void extract_thumbnails(CustomData *data, gint step) {
 
   gst_element_query_duration(data->timelinebin, GST_FORMAT_TIME, &data->duration);
 
-  position = (step+1) * data->duration * 10 / 100;
+  position = thumbnail_target(data, step);
 
   gst_element_seek_simple (data->timelinebin, GST_FORMAT_TIME,
       GST_SEEK_FLAG_KEY_UNIT | GST_SEEK_FLAG_FLUSH, position);
@@ -208,63 +481,338 @@ static void extract_thumbnails(CustomData *data, gint step) {
   g_signal_emit_by_name (sink, "pull-preroll", &sample, NULL);
   gst_object_unref (sink);
 
-if (sample) {
-    GstBuffer *buffer;
-    GstCaps *caps;
-    GstStructure *s;
-
-    /* get the snapshot buffer format now. We set the caps on the appsink so
-     * that it can only be an rgb buffer. The only thing we have not specified
-     * on the caps is the height, which is dependant on the pixel-aspect-ratio
-     * of the source material */
-    caps = gst_sample_get_caps (sample);
-    if (!caps) {
-      g_print ("could not get snapshot format\n");
-      return;
+  if (sample) {
+    pixbuf = wrap_sample (sample, &map);
+    if (pixbuf != NULL) {
+      /* The keyframe seek landed on the keyframe at or before position, its own position is what
+       * a click on the thumbnail seeks to */
+      GstClockTime pts = gst_segment_to_stream_time(gst_sample_get_segment(sample), GST_FORMAT_TIME,
+          GST_BUFFER_PTS(gst_sample_get_buffer(sample)));
+      gchar *recorded = g_strdup_printf("%" G_GUINT64_FORMAT, pts);
+
+      /* save the pixbuf, with the position unless it is unknown */
+      gchar *partial = thumb_cache_get_partial_path(data->thumbnail_path);
+      gboolean saved = gdk_pixbuf_save (pixbuf, partial, "png", &error,
+          GST_CLOCK_TIME_IS_VALID(pts) ? THUMBNAIL_POSITION_KEY : NULL, recorded, NULL);
+      saved = thumb_cache_commit(partial, data->thumbnail_path, saved, saved ? &error : NULL);
+      g_free(partial);
+      g_free(recorded);
+      if (!saved) {
+        g_print ("could not save thumbnail: %s\n", error->message);
+        g_clear_error (&error);
+      }
+      g_object_unref (pixbuf);
+      gst_buffer_unmap (gst_sample_get_buffer (sample), &map);
     }
-    s = gst_caps_get_structure (caps, 0);
+    gst_sample_unref (sample);
+  } else {
+    g_print ("could not make snapshot\n");
+  }
+}
 
-    /* we need to get the final caps on the buffer to get the size */
-    res = gst_structure_get_int (s, "width", &width);
-    res |= gst_structure_get_int (s, "height", &height);
-    if (!res) {
-      g_print ("could not get snapshot dimension\n");
-      return;
-    }
+/* This function trims the thumbnail cache to its budget, it runs in the work pool */
+static void prune_cache_job_func(gpointer user_data)
+{
+  /* The job has its own instance of the cache, it may outlive the player's */
+  ThumbCache *cache = thumb_cache_new(NULL);
+
+  thumb_cache_prune(cache, THUMB_CACHE_BUDGET);
+  thumb_cache_free(cache);
+}
+
+/* Storyboard of a clip, exported by the work pool */
+typedef struct _StoryboardJob
+{
+  gchar *uri;
+  GstClockTime duration;
+} StoryboardJob;
+
+static void storyboard_job_func(StoryboardJob *job)
+{
+  /* The job has its own instance of the cache, it may outlive the player's */
+  ThumbCache *cache = thumb_cache_new(NULL);
+  gchar *path = gst_uri_get_location(job->uri);
+  gchar *base = path != NULL ? g_path_get_basename(path) : g_strdup("clip");
+  gchar *name = g_strconcat(base, "-storyboard", NULL);
+  StoryboardStats stats;
+  GError *error = NULL;
 
-    /* create pixmap from buffer and save, gstreamer video buffers have a stride
-     * that is rounded up to the nearest multiple of 4 */
-    buffer = gst_sample_get_buffer (sample);
-    gst_buffer_map (buffer, &map, GST_MAP_READ);
-    pixbuf = gdk_pixbuf_new_from_data (map.data,
-        GDK_COLORSPACE_RGB, FALSE, 8, width, height,
-        GST_ROUND_UP_4 (width * 3), NULL, NULL);
-
-    /* save the pixbuf */
-    gdk_pixbuf_save (pixbuf, "snapshot.png", "png", &error, NULL);
-    gst_buffer_unmap (buffer, &map);
+  if (storyboard_export(cache, job->uri, job->duration, storyboard_interval_option * GST_SECOND,
+        storyboard_dir_option, name, &stats, &error)) {
+    g_print("Storyboard: %u tiles, %u decoded, %u sprites\n", stats.tiles, stats.decoded, stats.sprites);
   } else {
-    g_print ("could not make snapshot\n");
+    g_printerr("Could not export the storyboard: %s\n", error->message);
+    g_clear_error(&error);
+  }
+
+  thumb_cache_free(cache);
+  g_free(name);
+  g_free(base);
+  g_free(path);
+  g_free(job->uri);
+  g_free(job);
+}
+
+/* This function exports the storyboard of the clip once its timeline is done, the
+ * tiles decoded for it are in the cache */
+static void export_storyboard(CustomData *data)
+{
+  GError *error = NULL;
+
+  if (storyboard_dir_option == NULL || data->duration <= 0)
+    return;
+
+  StoryboardJob *job = g_new0(StoryboardJob, 1);
+  job->uri = g_strdup(data->uri);
+  job->duration = data->duration;
+
+  WorkJob *handle = work_pool_push(work_pool_get_default(), (WorkFunc) storyboard_job_func, job, WORK_JOB_LONG, &error);
+  if (handle == NULL) {
+    g_printerr("Could not export the storyboard: %s\n", error->message);
+    g_clear_error(&error);
+    g_free(job->uri);
+    g_free(job);
+    return;
+  }
+  work_job_detach(handle);
+}
+
+/* This function is called from the main loop when a state change queued on playbin returned.
+ * Asynchronous changes are followed by state_changed_cb() */
+static void state_done_cb(GstElement *element, GstState state, GstStateChangeReturn ret, CustomData *data)
+{
+  if (ret == GST_STATE_CHANGE_FAILURE)
+    g_printerr("Could not set the pipeline to %s\n", gst_element_state_get_name(state));
+}
+
+/* Pipeline torn down after a stall, by the work pool */
+typedef struct _RecoveryJob
+{
+  CustomData *data;
+  GstElement *pipeline;
+  gboolean restart;        /* Whether the pipeline is started again, only for playbin */
+  GstClockTime position;   /* Where playbin resumes */
+  GstState state;          /* State playbin goes back to */
+  gint64 stall_time;       /* Monotonic time at which the stall was detected */
+} RecoveryJob;
+
+static void recovery_job_free(RecoveryJob *job)
+{
+  gst_object_unref(job->pipeline);
+  g_free(job);
+}
+
+/* This function is called from the main loop when the preroll of playbin after a stall was started */
+static void playbin_recover_done_cb(GstElement *element, GstState state, GstStateChangeReturn ret, CustomData *data)
+{
+  if (ret == GST_STATE_CHANGE_FAILURE) {
+    g_printerr("Could not restart the pipeline after a stall\n");
+    g_atomic_int_set(&data->recovering, FALSE);
+  }
+}
+
+/* This function runs on the UI thread once the stalled playbin is torn down. It prerolls it
+ * again, state_changed_cb() then resumes from the position of the stall */
+static gboolean playbin_recover_idle(RecoveryJob *job)
+{
+  CustomData *data = job->data;
+
+  data->recover_position = job->position;
+  data->recover_state = job->state;
+  data->stall_time = job->stall_time;
+  state_control_set(data->playbin, GST_STATE_PAUSED, (StateControlDoneFunc) playbin_recover_done_cb, data);
+
+  recovery_job_free(job);
+  return G_SOURCE_REMOVE;
+}
+
+/* This function is called by state_changed_cb() when playbin prerolled again after a stall */
+static void finish_recovery(CustomData *data)
+{
+  if (GST_CLOCK_TIME_IS_VALID(data->recover_position))
+    gst_element_seek_simple(data->playbin, GST_FORMAT_TIME, GST_SEEK_FLAG_KEY_UNIT | GST_SEEK_FLAG_FLUSH,
+        data->recover_position);
+  state_control_set(data->playbin, data->recover_state, (StateControlDoneFunc) state_done_cb, data);
+  metric_inc(data->metrics.pipeline_restarts);
+
+  gdouble seconds = (g_get_monotonic_time() - data->stall_time) / (gdouble) G_USEC_PER_SEC;
+  metric_observe(data->metrics.stall_recovery, seconds);
+  g_print("Pipeline recovered from a stall in %.0f ms\n", seconds * 1000);
+  g_atomic_int_set(&data->recovering, FALSE);
+}
+
+/* This function tears a stalled pipeline down. Going to NULL unblocks the streaming threads
+ * and a pull-preroll waiting on the pipeline, and drops the stuck decoders, which are created
+ * again on the next preroll */
+static void recovery_job_func(RecoveryJob *job)
+{
+  CustomData *data = job->data;
+
+  /* Set before the teardown, which wakes up the UI thread blocked in extract_thumbnails(). The
+   * pipeline is only compared, never used, through it */
+  if (!job->restart)
+    g_atomic_pointer_set(&data->recovered_timeline, job->pipeline);
+
+  gst_element_set_state(job->pipeline, GST_STATE_NULL);
+  if (job->restart) {
+    g_idle_add((GSourceFunc) playbin_recover_idle, job);
+    return;
+  }
+
+  /* The timeline prerolls again to retry the thumbnail of the stall, by timeline_make_thumbnails() */
+  gdouble seconds = (g_get_monotonic_time() - job->stall_time) / (gdouble) G_USEC_PER_SEC;
+  metric_observe(data->metrics.stall_recovery, seconds);
+  g_print("Timeline recovered from a stall in %.0f ms\n", seconds * 1000);
+  g_atomic_int_set(&data->recovering_timeline, FALSE);
+  recovery_job_free(job);
+}
+
+/* This function pushes the teardown of a stalled pipeline. It does not block the watchdog,
+ * which keeps reporting the stall if the teardown itself hangs */
+static void push_recovery(CustomData *data, RecoveryJob *job)
+{
+  GError *error = NULL;
+
+  metric_inc(data->metrics.stalls);
+  WorkJob *handle = work_pool_push(work_pool_get_default(), (WorkFunc) recovery_job_func, job, WORK_JOB_DEDICATED,
+      &error);
+  if (handle == NULL) {
+    g_printerr("Could not recover from the stall: %s\n", error->message);
+    g_clear_error(&error);
+    g_atomic_int_set(job->restart ? &data->recovering : &data->recovering_timeline, FALSE);
+    recovery_job_free(job);
+    return;
+  }
+  work_job_detach(handle);
+}
+
+/* This function tells whether playbin plays a video stream, the one the watchdog follows */
+static gboolean has_video_stream(GstElement *pipeline)
+{
+  gint n_video = 1;
+
+  /* The mosaic pipeline is not a playbin, its tiles are all video */
+  if (g_object_class_find_property(G_OBJECT_GET_CLASS(pipeline), "n-video") != NULL)
+    g_object_get(pipeline, "n-video", &n_video, NULL);
+  return n_video > 0;
+}
+
+/* This function is called from the watchdog thread when playbin stalls */
+static void playbin_stalled_cb(GstElement *pipeline, GstClockTime position, CustomData *data)
+{
+  /* An audio-only clip never feeds the video sink, that is no stall */
+  if (!has_video_stream(pipeline))
+    return;
+
+  if (!g_atomic_int_compare_and_exchange(&data->recovering, FALSE, TRUE)) {
+    g_printerr("Pipeline still stalled, waiting for its teardown\n");
+    return;
+  }
+
+  g_printerr("Pipeline stalled at %" GST_TIME_FORMAT ", restarting it\n", GST_TIME_ARGS(position));
+  RecoveryJob *job = g_new0(RecoveryJob, 1);
+  job->data = data;
+  job->pipeline = gst_object_ref(pipeline);
+  job->restart = TRUE;
+  job->position = position;
+  job->stall_time = g_get_monotonic_time();
+  GST_OBJECT_LOCK(pipeline);
+  job->state = GST_STATE_TARGET(pipeline) == GST_STATE_PLAYING ? GST_STATE_PLAYING : GST_STATE_PAUSED;
+  GST_OBJECT_UNLOCK(pipeline);
+  push_recovery(data, job);
+}
+
+/* This function is called from the watchdog thread when timelinebin stalls, usually with the UI
+ * thread blocked in extract_thumbnails() */
+static void timeline_stalled_cb(GstElement *pipeline, GstClockTime position, CustomData *data)
+{
+  if (!g_atomic_int_compare_and_exchange(&data->recovering_timeline, FALSE, TRUE))
+    return;
+
+  g_printerr("Timeline stalled, restarting it\n");
+  RecoveryJob *job = g_new0(RecoveryJob, 1);
+  job->data = data;
+  job->pipeline = gst_object_ref(pipeline);
+  job->stall_time = g_get_monotonic_time();
+  push_recovery(data, job);
+}
+
+/* This function drops the timeline pipeline, it is torn down in the background */
+static void free_timelinebin(CustomData *data)
+{
+  if (data->timeline_watch != 0) {
+    watchdog_unwatch(data->watchdog, data->timeline_watch);
+    data->timeline_watch = 0;
   }
+  state_control_teardown(data->timelinebin, NULL, NULL);
+  gst_object_unref(data->timelinebin);
+  data->timelinebin = NULL;
 }
 
 static gboolean timeline_make_thumbnails(CustomData *data) {
   g_return_val_if_fail(data != NULL, FALSE);
 
-  static int count;
-  if (count< THUMBNAILS_NUMBER) {
-    extract_thumbnails(data, count);
+  if (data->thumbnail_count < THUMBNAILS_NUMBER) {
+    extract_thumbnails(data, data->thumbnail_count);
+
+    /* A stall on this thumbnail tore the timeline down, it is made again once on the next tick */
+    gboolean recovered = g_atomic_pointer_compare_and_exchange(&data->recovered_timeline, data->timelinebin, NULL);
+    if (recovered && !data->thumbnail_retried) {
+      data->thumbnail_retried = TRUE;
+      return TRUE;
+    }
+    data->thumbnail_retried = FALSE;
+
     update_widget(data, WIDGET_TYPE_TIMELINE);
-    count++;
+    data->thumbnail_count++;
+    player_stats_set_thumbnail_queue(data->stats, THUMBNAILS_NUMBER - data->thumbnail_count);
     return TRUE;
   }
 
-  /* Free resources */
-  gst_element_set_state(data->timelinebin, GST_STATE_NULL);
-  gst_object_unref(data->timelinebin);
+  /* Free resources, the next open creates the timeline again */
+  free_timelinebin(data);
+  data->timeline_timer_id = 0;
+  export_storyboard(data);
   return G_SOURCE_REMOVE;
 }
 
+/* This function creates the timeline pipeline. It is only needed once a clip is opened,
+ * so it is not built at startup */
+static gboolean ensure_timelinebin(CustomData *data)
+{
+  /* A new URI is only taken into account from the NULL state, which the timeline of the previous
+   * clip may take a while to reach, so it is replaced */
+  if (data->timelinebin != NULL)
+    free_timelinebin(data);
+
+  data->timelinebin = gst_element_factory_make("playbin", "timelinebin");
+  GstElement *app_sink = gst_element_factory_make("appsink", "videosink");
+  if (!data->timelinebin || !app_sink)
+  {
+    g_printerr("Not all timelinebin elements could be created.\n");
+    if (app_sink)
+      gst_object_unref(app_sink);
+    g_clear_object(&data->timelinebin);
+    return FALSE;
+  }
+
+  GstCaps *caps  = gst_caps_from_string ("video/x-raw,format=RGB,width=160,pixel-aspect-ratio=1/1");
+  g_object_set(app_sink, "caps", caps, NULL);
+  gst_caps_unref(caps);
+  g_object_set(data->timelinebin, "video-sink", app_sink, NULL);
+
+  if (data->profile)
+    profiler_watch_pipeline(data->timelinebin);
+  shared_task_pool_install(data->timelinebin, shared_task_pool_get_default());
+  if (!no_decoder_tuning_option)
+    decoder_tuning_install(data->timelinebin, DECODER_ROLE_BACKGROUND);
+  if (data->watchdog != NULL)
+    data->timeline_watch = watchdog_watch(data->watchdog, data->timelinebin, app_sink,
+        watchdog_deadline_option * GST_SECOND, (WatchdogStallFunc) timeline_stalled_cb, data);
+
+  return TRUE;
+}
+
 /* This function is called when the GUI toolkit creates the physical window that will hold the video.
  * At this point we can retrieve its handler (which has a different meaning depending on the windowing system)
  * and pass it to GStreamer through the VideoOverlay interface. */
@@ -277,26 +825,344 @@ static void realize_cb(GtkWidget *widget, CustomData *data)
     g_error("Couldn't create native window needed for GstVideoOverlay!");
 
   window_handle = GDK_WINDOW_XID(window);
-  /* Pass it to playbin, which implements VideoOverlay and will forward it to the video sink */
-  gst_video_overlay_set_window_handle(GST_VIDEO_OVERLAY(data->playbin), window_handle);
+  /* Pass it to the video sink directly, in mosaic mode there is no playbin to forward it */
+  gst_video_overlay_set_window_handle(GST_VIDEO_OVERLAY(data->video_sink), window_handle);
+}
+
+/* This function reports the time from the last open to the first thing shown in the video window */
+static void report_first_pixel(CustomData *data, const gchar *what)
+{
+  if (data->first_pixel_shown)
+    return;
+
+  gdouble seconds = (g_get_monotonic_time() - data->open_time) / (gdouble) G_USEC_PER_SEC;
+  data->first_pixel_shown = TRUE;
+  metric_observe(data->metrics.first_pixel, seconds);
+  g_print("First pixel after %.0f ms (%s)\n", seconds * 1000, what);
+}
+
+/* This function paints the poster frame while playbin prerolls, the video sink paints the window afterwards */
+static gboolean video_draw_cb(GtkWidget *widget, cairo_t *cr, CustomData *data)
+{
+  if (data->poster == NULL)
+    return FALSE;
+
+  gint width = gtk_widget_get_allocated_width(widget);
+  gint height = gtk_widget_get_allocated_height(widget);
+  gint poster_width = gdk_pixbuf_get_width(data->poster);
+  gint poster_height = gdk_pixbuf_get_height(data->poster);
+  gdouble scale = MIN(width / (gdouble) poster_width, height / (gdouble) poster_height);
+
+  cairo_set_source_rgb(cr, 0, 0, 0);
+  cairo_paint(cr);
+  cairo_translate(cr, (width - poster_width * scale) / 2, (height - poster_height * scale) / 2);
+  cairo_scale(cr, scale, scale);
+  gdk_cairo_set_source_pixbuf(cr, data->poster, 0, 0);
+  cairo_paint(cr);
+
+  report_first_pixel(data, "poster");
+  return TRUE;
+}
+
+static void set_poster(CustomData *data, GdkPixbuf *poster)
+{
+  g_clear_object(&data->poster);
+  data->poster = poster;
+  gtk_widget_queue_draw(data->video_window);
+}
+
+/* This function runs on the UI thread once playbin rendered its first frame after an open or a seek */
+static gboolean first_frame_idle(CustomData *data)
+{
+  set_poster(data, NULL);
+  report_first_pixel(data, "video");
+
+  if (data->thumbnail_click_time != 0) {
+    gdouble seconds = (data->first_frame_time - data->thumbnail_click_time) / (gdouble) G_USEC_PER_SEC;
+    data->thumbnail_click_time = 0;
+    metric_observe(data->metrics.thumbnail_seek, seconds);
+    g_print("Thumbnail frame after %.0f ms\n", seconds * 1000);
+  }
+  return G_SOURCE_REMOVE;
+}
+
+/* This function is called from the streaming thread for every buffer of the video sink */
+static GstPadProbeReturn video_sink_probe_cb(GstPad *pad, GstPadProbeInfo *info, CustomData *data)
+{
+  if (g_atomic_int_compare_and_exchange(&data->waiting_first_frame, TRUE, FALSE)) {
+    data->first_frame_time = g_get_monotonic_time();
+    g_idle_add((GSourceFunc) first_frame_idle, data);
+  }
+
+  return GST_PAD_PROBE_OK;
+}
+
+/* Poster frame decoded in the background, for the open it was started for */
+typedef struct _PosterJob
+{
+  CustomData *data;
+  guint serial;
+  gchar *uri;
+  gchar *path;       /* Where the poster is cached */
+  GdkPixbuf *poster; /* Result, NULL on failure */
+} PosterJob;
+
+/* This function runs on the UI thread when the poster job is done */
+static gboolean poster_ready_idle(PosterJob *job)
+{
+  CustomData *data = job->data;
+
+  /* Drop it if another clip was opened, or if playbin was faster */
+  if (job->poster != NULL && job->serial == data->open_serial && g_atomic_int_get(&data->waiting_first_frame))
+    set_poster(data, g_object_ref(job->poster));
+
+  if (job->poster != NULL)
+    g_object_unref(job->poster);
+  g_free(job->path);
+  g_free(job->uri);
+  g_free(job);
+  return G_SOURCE_REMOVE;
+}
+
+/* This function decodes the first keyframe of the clip, it runs in the work pool */
+static void poster_job_func(PosterJob *job)
+{
+  GError *error = NULL;
+  GstSample *sample = poster_frame_grab(job->uri, POSTER_WIDTH, POSTER_TIMEOUT, &error);
+
+  if (sample != NULL) {
+    GstStructure *s = gst_caps_get_structure(gst_sample_get_caps(sample), 0);
+    GstBuffer *buffer = gst_sample_get_buffer(sample);
+    gint width, height;
+    GstMapInfo map;
+
+    if (gst_structure_get_int(s, "width", &width) && gst_structure_get_int(s, "height", &height) &&
+        gst_buffer_map(buffer, &map, GST_MAP_READ)) {
+      GdkPixbuf *pixbuf = gdk_pixbuf_new_from_data(map.data, GDK_COLORSPACE_RGB, FALSE, 8, width, height,
+          GST_ROUND_UP_4(width * 3), NULL, NULL);
+
+      /* Copy it, the sample goes away with the job */
+      job->poster = gdk_pixbuf_copy(pixbuf);
+      /* Written aside and moved in place, another player may be reading the cache */
+      gchar *partial = thumb_cache_get_partial_path(job->path);
+      thumb_cache_commit(partial, job->path, gdk_pixbuf_save(job->poster, partial, "png", NULL, NULL), NULL);
+      g_free(partial);
+      g_object_unref(pixbuf);
+      gst_buffer_unmap(buffer, &map);
+    }
+    gst_sample_unref(sample);
+  } else {
+    g_printerr("No poster frame: %s\n", error->message);
+    g_clear_error(&error);
+  }
+
+  g_idle_add((GSourceFunc) poster_ready_idle, job);
+}
+
+/* This function shows a poster frame of uri as soon as possible, from the cache or from a
+ * single-frame decode next to playbin */
+static void show_poster(CustomData *data, const gchar *uri)
+{
+  gchar *path = thumb_cache_lookup(data->thumb_cache, uri, "poster");
+  GError *error = NULL;
+
+  if (path != NULL) {
+    GdkPixbuf *poster = gdk_pixbuf_new_from_file(path, NULL);
+    g_free(path);
+    if (poster != NULL) {
+      set_poster(data, poster);
+      return;
+    }
+  }
+
+  PosterJob *job = g_new0(PosterJob, 1);
+  job->data = data;
+  job->serial = data->open_serial;
+  job->uri = g_strdup(uri);
+  job->path = thumb_cache_get_path(data->thumb_cache, uri, "poster");
+
+  WorkJob *handle = work_pool_push(work_pool_get_default(), (WorkFunc) poster_job_func, job, WORK_JOB_LONG, &error);
+  if (handle == NULL) {
+    g_printerr("Could not decode the poster frame: %s\n", error->message);
+    g_clear_error(&error);
+    g_free(job->path);
+    g_free(job->uri);
+    g_free(job);
+    return;
+  }
+  work_job_detach(handle);
+}
+
+/* This function starts the mosaic once its clips replaced the previous ones */
+static void mosaic_ready_cb(Mosaic *mosaic, gboolean ready, CustomData *data)
+{
+  if (ready)
+    state_control_set(data->playbin, GST_STATE_PLAYING, (StateControlDoneFunc) state_done_cb, data);
 }
 
 /* This function is called when the PLAY button is clicked */
 static void play_cb(GtkButton *button, CustomData *data)
 {
-  gst_element_set_state(data->playbin, GST_STATE_PLAYING);
+  state_control_set(data->playbin, GST_STATE_PLAYING, (StateControlDoneFunc) state_done_cb, data);
 }
 
 /* This function is called when the PAUSE button is clicked */
 static void pause_cb(GtkButton *button, CustomData *data)
 {
-  gst_element_set_state(data->playbin, GST_STATE_PAUSED);
+  state_control_set(data->playbin, GST_STATE_PAUSED, (StateControlDoneFunc) state_done_cb, data);
 }
 
 /* This function is called when the STOP button is clicked */
 static void stop_cb(GtkButton *button, CustomData *data)
 {
-  gst_element_set_state(data->playbin, GST_STATE_READY);
+  state_control_set(data->playbin, GST_STATE_READY, (StateControlDoneFunc) state_done_cb, data);
+}
+
+/* This function drops the proxy of the previous clip, or stops making it */
+static void clear_proxy(CustomData *data)
+{
+  if (data->proxy_job != NULL) {
+    proxy_job_free(data->proxy_job);
+    data->proxy_job = NULL;
+  }
+  if (data->proxybin != NULL) {
+    state_control_teardown(data->proxybin, NULL, NULL);
+    gst_object_unref(data->proxybin);
+    data->proxybin = NULL;
+    data->proxy_sink = NULL;
+  }
+  data->scrubbing = FALSE;
+}
+
+/* This function opens the proxy in proxybin and prerolls it. Its sink draws into the video window
+ * like the one of playbin, but it only shows frames while the slider is dragged */
+static void setup_proxybin(CustomData *data, const gchar *path)
+{
+  gchar *uri = gst_filename_to_uri(path, NULL);
+
+  data->proxybin = gst_element_factory_make("playbin", "proxybin");
+  data->proxy_sink = gst_element_factory_make("ximagesink", "proxysink");
+  if (!data->proxybin || !data->proxy_sink || uri == NULL) {
+    g_printerr("Not all proxybin elements could be created.\n");
+    if (data->proxy_sink)
+      gst_object_unref(data->proxy_sink);
+    g_clear_object(&data->proxybin);
+    data->proxy_sink = NULL;
+    g_free(uri);
+    return;
+  }
+
+  g_object_set(data->proxy_sink, "show-preroll-frame", FALSE, NULL);
+  g_object_set(data->proxybin, "uri", uri, "video-sink", data->proxy_sink, NULL);
+  gst_util_set_object_arg(G_OBJECT(data->proxybin), "flags", "video");
+  gst_video_overlay_set_window_handle(GST_VIDEO_OVERLAY(data->proxy_sink),
+      GDK_WINDOW_XID(gtk_widget_get_window(data->video_window)));
+  state_control_set(data->proxybin, GST_STATE_PAUSED, NULL, NULL);
+  g_free(uri);
+}
+
+/* This function is called when the proxy of the clip being played is written */
+static void proxy_done_cb(const gchar *path, const GError *error, CustomData *data)
+{
+  if (error != NULL) {
+    g_printerr("Could not make the proxy: %s\n", error->message);
+  } else {
+    g_print("Proxy ready: %s\n", path);
+    setup_proxybin(data, path);
+  }
+
+  proxy_job_free(data->proxy_job);
+  data->proxy_job = NULL;
+}
+
+/* This function gets the scrubbing proxy of uri, from the cache or by starting to make it */
+static void open_proxy(CustomData *data, const gchar *uri)
+{
+  gchar *path = thumb_cache_lookup_file(data->thumb_cache, uri, "proxy.mkv");
+  GError *error = NULL;
+
+  if (path != NULL) {
+    setup_proxybin(data, path);
+    g_free(path);
+    return;
+  }
+
+  path = thumb_cache_get_file_path(data->thumb_cache, uri, "proxy.mkv");
+  data->proxy_job = proxy_job_start(uri, path, PROXY_HEIGHT, (ProxyDoneFunc) proxy_done_cb, data, &error);
+  if (data->proxy_job == NULL) {
+    g_printerr("Could not make the proxy: %s\n", error->message);
+    g_clear_error(&error);
+  }
+  g_free(path);
+}
+
+/* This function starts playing uri, and making its thumbnails */
+static void open_uri(CustomData *data, const gchar *uri)
+{
+  g_free(data->uri);
+  data->uri = g_strdup(uri);
+  data->export_in = data->export_out = GST_CLOCK_TIME_NONE;
+  gtk_button_set_label(GTK_BUTTON(data->in_button), "In");
+  gtk_button_set_label(GTK_BUTTON(data->out_button), "Out");
+  data->open_serial++;
+  data->open_time = g_get_monotonic_time();
+  data->first_pixel_shown = FALSE;
+  data->thumbnail_click_time = 0;
+  g_atomic_int_set(&data->waiting_first_frame, TRUE);
+  set_poster(data, NULL);
+  show_poster(data, uri);
+  if (data->pre_seek != NULL)
+    pre_seek_set_uri(data->pre_seek, uri);
+  clear_proxy(data);
+  if (proxy_option)
+    open_proxy(data, uri);
+
+  /* Set the URI to timelinebin, making the thumbnails of the previous clip is given up */
+  if (data->timeline_timer_id != 0) {
+    g_source_remove(data->timeline_timer_id);
+    data->timeline_timer_id = 0;
+  }
+  if (ensure_timelinebin(data)) {
+    g_object_set(data->timelinebin, "uri", uri, NULL);
+    data->thumbnail_count = 0;
+    data->thumbnail_retried = FALSE;
+    player_stats_set_thumbnail_queue(data->stats, THUMBNAILS_NUMBER);
+    data->timeline_timer_id = g_timeout_add(1000, (GSourceFunc) timeline_make_thumbnails, data);
+  }
+  /* Set the URI to playbin, it only takes it going from READY to PAUSED */
+  g_object_set(data->playbin, "uri", uri, NULL);
+  state_control_set(data->playbin, GST_STATE_READY, (StateControlDoneFunc) state_done_cb, data);
+  state_control_set(data->playbin, GST_STATE_PLAYING, (StateControlDoneFunc) state_done_cb, data);
+}
+
+/* This function is called when the OPEN button is clicked in mosaic mode */
+static void open_mosaic_cb(GtkButton *button, CustomData *data)
+{
+  GtkWidget *dialog;
+
+  dialog = gtk_file_chooser_dialog_new("Open Files",
+                                       GTK_WINDOW(data->main_window),
+                                       GTK_FILE_CHOOSER_ACTION_OPEN,
+                                       "_Cancel",
+                                       GTK_RESPONSE_CANCEL,
+                                       "_Open",
+                                       GTK_RESPONSE_ACCEPT,
+                                       NULL);
+  gtk_file_chooser_set_select_multiple(GTK_FILE_CHOOSER(dialog), TRUE);
+  if (gtk_dialog_run(GTK_DIALOG(dialog)) == GTK_RESPONSE_ACCEPT)
+  {
+    GSList *files = gtk_file_chooser_get_uris(GTK_FILE_CHOOSER(dialog));
+    GPtrArray *uris = g_ptr_array_new_with_free_func(g_free);
+
+    for (GSList *it = files; it != NULL; it = it->next)
+      g_ptr_array_add(uris, it->data);
+    g_ptr_array_add(uris, NULL);
+    g_slist_free(files);
+
+    mosaic_set_uris(data->mosaic, (gchar **) uris->pdata, (MosaicReadyFunc) mosaic_ready_cb, data);
+    g_ptr_array_unref(uris);
+  }
+  gtk_widget_destroy(dialog);
 }
 
 /* This function is called when the OPEN button is clicked */
@@ -305,6 +1171,11 @@ static void open_cb(GtkButton *button, CustomData *data)
   gint res;
   GtkWidget *dialog;
 
+  if (data->mosaic != NULL) {
+    open_mosaic_cb(button, data);
+    return;
+  }
+
   dialog = gtk_file_chooser_dialog_new("Open File",
                                        GTK_WINDOW(data->main_window),
                                        GTK_FILE_CHOOSER_ACTION_OPEN,
@@ -319,22 +1190,94 @@ static void open_cb(GtkButton *button, CustomData *data)
     char *filename;
     GtkFileChooser *chooser = GTK_FILE_CHOOSER(dialog);
     filename = gtk_file_chooser_get_uri(chooser);
-    /* Set the URI to timelinebin */
-    g_object_set(data->timelinebin, "uri", filename, NULL);
-    g_timeout_add(1000, (GSourceFunc) timeline_make_thumbnails, data);
-    /* Set the URI to playbin */
-    g_object_set(data->playbin, "uri", filename, NULL);
-    gst_element_set_state(data->playbin, GST_STATE_PLAYING);
+    open_uri(data, filename);
     g_free(filename);
   }
   gtk_widget_destroy(dialog);
 }
 
-/* This function is called when the main window is closed */
-static void delete_event_cb(GtkWidget *widget, GdkEvent *event, CustomData *data)
+/* This function is called from the main loop when a pipeline reached NULL after the window was closed */
+static void shutdown_done_cb(GstElement *element, GstState state, GstStateChangeReturn ret, CustomData *data)
+{
+  if (--data->shutdown_pending > 0)
+    return;
+
+  g_source_remove(data->shutdown_timeout_id);
+  data->shutdown_timeout_id = 0;
+  gtk_main_quit();
+}
+
+/* This function is called when the pipelines take too long to go to NULL, the player quits
+ * without them */
+static gboolean shutdown_timeout_cb(CustomData *data)
 {
-  stop_cb(NULL, data);
+  g_printerr("Pipelines still shutting down after %d ms, quitting anyway\n", SHUTDOWN_TIMEOUT_MS);
+  data->shutdown_timed_out = TRUE;
+  data->shutdown_timeout_id = 0;
   gtk_main_quit();
+  return G_SOURCE_REMOVE;
+}
+
+/* This function is called when the main window is closed. It goes away at once, and the
+ * pipelines are torn down in the background */
+static gboolean delete_event_cb(GtkWidget *widget, GdkEvent *event, CustomData *data)
+{
+  gtk_widget_hide(widget);
+  if (data->shutdown_pending > 0)
+    return TRUE;
+
+  if (data->timeline_timer_id != 0) {
+    g_source_remove(data->timeline_timer_id);
+    data->timeline_timer_id = 0;
+  }
+
+  data->shutdown_pending = 1;
+  state_control_set(data->playbin, GST_STATE_NULL, (StateControlDoneFunc) shutdown_done_cb, data);
+  if (data->timelinebin != NULL) {
+    data->shutdown_pending++;
+    state_control_set(data->timelinebin, GST_STATE_NULL, (StateControlDoneFunc) shutdown_done_cb, data);
+  }
+  data->shutdown_timeout_id = g_timeout_add(SHUTDOWN_TIMEOUT_MS, (GSourceFunc) shutdown_timeout_cb, data);
+  return TRUE;
+}
+
+/* This function serves a seek to position with the frame decoded ahead, if it was decoded for a
+ * position within tolerance: its keyframe is shown at once, like a poster, while playbin seeks to
+ * that keyframe, and playback resumes from there */
+static gboolean seek_pre_decoded(CustomData *data, gint64 position, GstClockTime tolerance)
+{
+  GstClockTime frame_position;
+  GstMapInfo map;
+
+  if (data->pre_seek == NULL)
+    return FALSE;
+
+  GstSample *sample = pre_seek_take(data->pre_seek, position, tolerance, &frame_position);
+  if (sample == NULL)
+    return FALSE;
+
+  GdkPixbuf *frame = NULL;
+  GdkPixbuf *wrapper = wrap_sample(sample, &map);
+  if (wrapper != NULL) {
+    frame = gdk_pixbuf_copy(wrapper);
+    g_object_unref(wrapper);
+    gst_buffer_unmap(gst_sample_get_buffer(sample), &map);
+  }
+  gst_sample_unref(sample);
+  if (frame == NULL)
+    return FALSE;
+
+  if (!gst_element_seek_simple(data->playbin, GST_FORMAT_TIME, GST_SEEK_FLAG_KEY_UNIT | GST_SEEK_FLAG_FLUSH,
+        frame_position)) {
+    g_printerr("Seek failed ! \n");
+    g_object_unref(frame);
+    return TRUE;
+  }
+
+  /* The flush is over once the seek returns, so the next frame of the sink is the new one */
+  set_poster(data, frame);
+  g_atomic_int_set(&data->waiting_first_frame, TRUE);
+  return TRUE;
 }
 
 /* This function is called when scale value changed */
@@ -346,11 +1289,432 @@ static void scale_cb(GtkRange *scale, GtkScrollType scroll, gdouble value, Custo
   }
 
   gint64 position = value * data->duration;
-  if (!gst_element_seek_simple (data->playbin, GST_FORMAT_TIME,
+  metric_inc(data->metrics.seeks);
+
+  /* While the slider is dragged, seeks go to the proxy, where each one decodes a single small frame */
+  if (data->scrubbing) {
+    data->scrub_position = position;
+    if (!gst_element_seek_simple(data->proxybin, GST_FORMAT_TIME,
+        GST_SEEK_FLAG_KEY_UNIT | GST_SEEK_FLAG_FLUSH, position))
+      g_printerr("Seek failed ! \n");
+    return;
+  }
+
+  player_stats_seek_started(data->stats);
+  data->thumbnail_click_time = 0;
+
+  /* Only the seek of a click was predicted, not those following the pointer while dragging */
+  gboolean clicked = data->slider_clicked;
+  data->slider_clicked = FALSE;
+  if (clicked && seek_pre_decoded(data, position, PRESEEK_TOLERANCE))
+    return;
+
+  if (!gst_element_seek_simple (data->playbin, GST_FORMAT_TIME,
       GST_SEEK_FLAG_KEY_UNIT | GST_SEEK_FLAG_FLUSH, position))
     g_printerr("Seek failed ! \n");
 }
 
+/* This function draws the performance HUD, it runs on the UI thread and never touches the video */
+static gboolean hud_draw_cb(GtkWidget *widget, cairo_t *cr, CustomData *data)
+{
+  PlayerStatsSnapshot snapshot;
+
+  player_stats_snapshot(data->stats, &snapshot);
+  gchar *text = player_stats_snapshot_to_string(&snapshot);
+  if (data->sync != NULL) {
+    NetSyncStats sync_stats;
+
+    net_sync_get_stats(data->sync, &sync_stats);
+    gchar *sync_text = net_sync_stats_to_string(&sync_stats);
+    gchar *joined = g_strjoin("\n", text, sync_text, NULL);
+    g_free(sync_text);
+    g_free(text);
+    text = joined;
+  }
+  if (data->proxy_job != NULL || data->proxybin != NULL) {
+    gchar *joined = data->proxy_job != NULL ?
+        g_strdup_printf("%s\nProxy: %.0f%%", text, 100 * proxy_job_get_progress(data->proxy_job)) :
+        g_strdup_printf("%s\nProxy: ready", text);
+    g_free(text);
+    text = joined;
+  }
+  if (data->pre_seek != NULL) {
+    PreSeekStats pre_seek_stats;
+
+    pre_seek_get_stats(data->pre_seek, &pre_seek_stats);
+    gchar *pre_seek_text = pre_seek_stats_to_string(&pre_seek_stats);
+    gchar *joined = g_strjoin("\n", text, pre_seek_text, NULL);
+    g_free(pre_seek_text);
+    g_free(text);
+    text = joined;
+  }
+  if (data->memory_governor != NULL) {
+    MemoryGovernorStats memory_stats;
+
+    memory_governor_get_stats(data->memory_governor, &memory_stats);
+    gchar *memory_text = memory_governor_stats_to_string(&memory_stats);
+    gchar *joined = g_strjoin("\n", text, memory_text, NULL);
+    g_free(memory_text);
+    g_free(text);
+    text = joined;
+  }
+  gchar **lines = g_strsplit(text, "\n", -1);
+
+  cairo_set_source_rgb(cr, 0, 0, 0);
+  cairo_paint(cr);
+  cairo_set_source_rgb(cr, 0.2, 1.0, 0.2);
+  cairo_select_font_face(cr, "monospace", CAIRO_FONT_SLANT_NORMAL, CAIRO_FONT_WEIGHT_NORMAL);
+  cairo_set_font_size(cr, 12);
+  for (gint i = 0; lines[i] != NULL; i++) {
+    cairo_move_to(cr, 8, 20 + i * 16);
+    cairo_show_text(cr, lines[i]);
+  }
+
+  g_strfreev(lines);
+  g_free(text);
+  return TRUE;
+}
+
+static gboolean hud_refresh_func(CustomData *data)
+{
+  g_return_val_if_fail(data != NULL, G_SOURCE_REMOVE);
+
+  gtk_widget_queue_draw(data->hud);
+  return TRUE;
+}
+
+/* This function is called when a drag of the slider starts. Once the proxy is ready, playbin
+ * is paused and the proxy is shown instead until the drag ends */
+static gboolean scale_press_cb(GtkWidget *scale, GdkEventButton *event, CustomData *data)
+{
+  data->slider_clicked = TRUE;
+  if (data->proxybin == NULL || data->scrubbing)
+    return FALSE;
+
+  data->scrubbing = TRUE;
+  data->scrub_resume = data->state == GST_STATE_PLAYING;
+  data->scrub_position = -1;
+  state_control_set(data->playbin, GST_STATE_PAUSED, (StateControlDoneFunc) state_done_cb, data);
+  g_object_set(data->proxy_sink, "show-preroll-frame", TRUE, NULL);
+  return FALSE;
+}
+
+/* This function is called when a drag of the slider ends, playback goes back to the original */
+static gboolean scale_release_cb(GtkWidget *scale, GdkEventButton *event, CustomData *data)
+{
+  data->slider_clicked = FALSE;
+  if (!data->scrubbing)
+    return FALSE;
+
+  data->scrubbing = FALSE;
+  g_object_set(data->proxy_sink, "show-preroll-frame", FALSE, NULL);
+
+  /* A single accurate seek lands the original on the frame the proxy showed */
+  if (data->scrub_position >= 0) {
+    player_stats_seek_started(data->stats);
+    if (!gst_element_seek_simple(data->playbin, GST_FORMAT_TIME,
+        GST_SEEK_FLAG_ACCURATE | GST_SEEK_FLAG_FLUSH, data->scrub_position))
+      g_printerr("Seek failed ! \n");
+  }
+  if (data->scrub_resume)
+    state_control_set(data->playbin, GST_STATE_PLAYING, (StateControlDoneFunc) state_done_cb, data);
+  return FALSE;
+}
+
+/* This function runs once the pointer rested on the slider: where it is is the likely next seek */
+static gboolean pre_seek_timeout_cb(CustomData *data)
+{
+  data->pre_seek_timer_id = 0;
+  pre_seek_hint(data->pre_seek, data->pre_seek_position);
+  return G_SOURCE_REMOVE;
+}
+
+/* This function is called when the pointer moves over the slider */
+static gboolean scale_motion_cb(GtkWidget *scale, GdkEventMotion *event, CustomData *data)
+{
+  GdkRectangle trough;
+
+  if (data->pre_seek == NULL || data->scrubbing || !GST_CLOCK_TIME_IS_VALID(data->duration) || data->duration <= 0)
+    return FALSE;
+
+  gtk_range_get_range_rect(GTK_RANGE(scale), &trough);
+  if (trough.width <= 0)
+    return FALSE;
+
+  /* The value of a click is rounded like that of the slider, so the hint is rounded the same way */
+  gdouble fraction = CLAMP((event->x - trough.x) / trough.width, 0, 1);
+  gint digits = gtk_range_get_round_digits(GTK_RANGE(scale));
+  if (digits >= 0) {
+    gdouble steps = 1;
+    for (gint i = 0; i < digits; i++)
+      steps *= 10;
+    fraction = (gint64)(fraction * steps + 0.5) / steps;
+  }
+  data->pre_seek_position = fraction * data->duration;
+  if (data->pre_seek_timer_id != 0)
+    g_source_remove(data->pre_seek_timer_id);
+  data->pre_seek_timer_id = g_timeout_add(PRESEEK_DELAY_MS, (GSourceFunc) pre_seek_timeout_cb, data);
+  return FALSE;
+}
+
+/* This function is called when the pointer leaves the slider or a thumbnail, it was only passing over */
+static gboolean pre_seek_leave_cb(GtkWidget *widget, GdkEventCrossing *event, CustomData *data)
+{
+  if (data->pre_seek_timer_id != 0) {
+    g_source_remove(data->pre_seek_timer_id);
+    data->pre_seek_timer_id = 0;
+  }
+  return FALSE;
+}
+
+/* This function is called when the pointer enters a timeline thumbnail */
+static gboolean thumbnail_enter_cb(GtkWidget *widget, GdkEventCrossing *event, CustomData *data)
+{
+  Thumbnail *thumbnail = g_object_get_data(G_OBJECT(widget), "thumbnail");
+
+  if (data->pre_seek == NULL || thumbnail->serial != data->open_serial)
+    return FALSE;
+
+  data->pre_seek_position = thumbnail->position;
+  if (data->pre_seek_timer_id != 0)
+    g_source_remove(data->pre_seek_timer_id);
+  data->pre_seek_timer_id = g_timeout_add(PRESEEK_DELAY_MS, (GSourceFunc) pre_seek_timeout_cb, data);
+  return FALSE;
+}
+
+/* This function is called when a timeline thumbnail is clicked. The seek goes to the keyframe
+ * the thumbnail was made from, so the frame shown is the thumbnail's and only that keyframe is
+ * decoded. The time until it reaches the video sink is reported by first_frame_idle() */
+static gboolean thumbnail_press_cb(GtkWidget *widget, GdkEventButton *event, CustomData *data)
+{
+  Thumbnail *thumbnail = g_object_get_data(G_OBJECT(widget), "thumbnail");
+
+  /* Thumbnails of a previous clip stay in the timeline, their positions are not in this one */
+  if (event->button != GDK_BUTTON_PRIMARY || event->type != GDK_BUTTON_PRESS ||
+      thumbnail->serial != data->open_serial)
+    return FALSE;
+
+  metric_inc(data->metrics.seeks);
+  data->thumbnail_click_time = g_get_monotonic_time();
+  player_stats_seek_started(data->stats);
+  if (seek_pre_decoded(data, thumbnail->position, 0))
+    return TRUE;
+
+  if (!gst_element_seek_simple(data->playbin, GST_FORMAT_TIME, GST_SEEK_FLAG_KEY_UNIT | GST_SEEK_FLAG_FLUSH,
+        thumbnail->position)) {
+    g_printerr("Seek failed ! \n");
+    data->thumbnail_click_time = 0;
+    return TRUE;
+  }
+
+  g_atomic_int_set(&data->waiting_first_frame, TRUE);
+  return TRUE;
+}
+
+/* This function is called when the HUD button is toggled */
+static void hud_toggled_cb(GtkToggleButton *button, CustomData *data)
+{
+  if (gtk_toggle_button_get_active(button)) {
+    gtk_widget_show(data->hud);
+    data->hud_timer_id = g_timeout_add(HUD_REFRESH_MS, (GSourceFunc) hud_refresh_func, data);
+  } else {
+    gtk_widget_hide(data->hud);
+    if (data->hud_timer_id > 0) {
+      g_source_remove(data->hud_timer_id);
+      data->hud_timer_id = -1;
+    }
+  }
+}
+
+/* This function shows the current tracks on the track buttons, which are only usable with several tracks */
+static void update_track_buttons(CustomData *data)
+{
+  GtkWidget *buttons[] = { [STREAM_SWITCH_AUDIO] = data->audio_button, [STREAM_SWITCH_VIDEO] = data->video_button };
+  const gchar *names[] = { [STREAM_SWITCH_AUDIO] = "Audio", [STREAM_SWITCH_VIDEO] = "Video" };
+
+  for (guint type = 0; type < G_N_ELEMENTS(buttons); type++) {
+    gint n = stream_switch_get_n_tracks(data->stream_switch, type);
+    gint current = stream_switch_get_current(data->stream_switch, type);
+    gchar *label;
+
+    if (current >= 0) {
+      gchar *track = stream_switch_get_label(data->stream_switch, type, current);
+      label = g_strdup_printf("%s %s/%d", names[type], track, n);
+      g_free(track);
+    } else {
+      label = g_strdup(names[type]);
+    }
+
+    gtk_button_set_label(GTK_BUTTON(buttons[type]), label);
+    gtk_widget_set_sensitive(buttons[type], n > 1);
+    g_free(label);
+  }
+}
+
+/* This function is called when the AUDIO button is clicked */
+static void audio_cb(GtkButton *button, CustomData *data)
+{
+  stream_switch_next(data->stream_switch, STREAM_SWITCH_AUDIO);
+  update_track_buttons(data);
+}
+
+/* This function is called when the VIDEO button is clicked */
+static void video_cb(GtkButton *button, CustomData *data)
+{
+  stream_switch_next(data->stream_switch, STREAM_SWITCH_VIDEO);
+  update_track_buttons(data);
+}
+
+/* This function is called from the work pool once a frame is saved */
+static void frame_saved_cb(const gchar *path, const GError *error, CustomData *data)
+{
+  if (error != NULL)
+    g_printerr("Could not save the frame to %s: %s\n", path, error->message);
+  else
+    g_print("Saved the frame to %s\n", path);
+}
+
+/* This function is called when the SNAPSHOT button is clicked. Playback goes on, the frame
+ * shown is saved at full resolution in the background */
+static void snapshot_cb(GtkButton *button, CustomData *data)
+{
+  GstSample *sample = frame_grab_get_last_sample(data->video_sink);
+  GError *error = NULL;
+
+  if (sample == NULL) {
+    g_printerr("No frame shown yet\n");
+    return;
+  }
+
+  const gchar *dir = g_get_user_special_dir(G_USER_DIRECTORY_PICTURES);
+  gchar *name = g_strdup_printf("videoplayer-%" G_GINT64_FORMAT ".png", g_get_real_time() / 1000);
+  gchar *path = g_build_filename(dir != NULL ? dir : g_get_home_dir(), name, NULL);
+
+  if (!frame_grabber_save(data->frame_grabber, sample, path, (FrameGrabDoneFunc) frame_saved_cb, data, &error)) {
+    g_printerr("Could not save the frame: %s\n", error->message);
+    g_clear_error(&error);
+  }
+
+  g_free(path);
+  g_free(name);
+  gst_sample_unref(sample);
+}
+
+/* Export of a range of the clip, run in the work pool */
+typedef struct _ExportJob
+{
+  gchar *uri;
+  GstClockTime start;
+  GstClockTime stop;
+  gchar *path;
+  ClipExportMode mode;
+  gint64 start_time;   /* Monotonic time the export started at */
+  gboolean ok;
+  GError *error;
+} ExportJob;
+
+/* This function reports the end of an export, in the main thread */
+static gboolean export_done_idle(ExportJob *job)
+{
+  if (job->ok)
+    g_print("Exported %s in %.1f s\n", job->path, (g_get_monotonic_time() - job->start_time) / 1e6);
+  else
+    g_printerr("Could not export to %s: %s\n", job->path, job->error->message);
+
+  g_clear_error(&job->error);
+  g_free(job->path);
+  g_free(job->uri);
+  g_free(job);
+  return G_SOURCE_REMOVE;
+}
+
+static void export_job_func(ExportJob *job)
+{
+  job->ok = clip_export(job->uri, job->start, job->stop, job->path, job->mode, 0, &job->error);
+  g_idle_add((GSourceFunc) export_done_idle, job);
+}
+
+/* This function sets one end of the export range to the current position */
+static void set_export_point(CustomData *data, GtkButton *button, const gchar *name, GstClockTime *point)
+{
+  gint64 position;
+
+  if (!gst_element_query_position(data->playbin, GST_FORMAT_TIME, &position))
+    return;
+
+  *point = position;
+  gchar *time = time_to_string(position);
+  gchar *label = g_strdup_printf("%s %s", name, time);
+  gtk_button_set_label(button, label);
+  g_free(label);
+  g_free(time);
+}
+
+/* This function is called when the IN button is clicked */
+static void export_in_cb(GtkButton *button, CustomData *data)
+{
+  set_export_point(data, button, "In", &data->export_in);
+}
+
+/* This function is called when the OUT button is clicked */
+static void export_out_cb(GtkButton *button, CustomData *data)
+{
+  set_export_point(data, button, "Out", &data->export_out);
+}
+
+/* This function is called when the EXPORT button is clicked. The range between IN and OUT, the
+ * whole clip if they are not set, is exported in the background while playback goes on */
+static void export_cb(GtkButton *button, CustomData *data)
+{
+  GtkWidget *dialog, *reencode;
+  GError *error = NULL;
+
+  if (data->uri == NULL)
+    return;
+
+  GstClockTime start = data->export_in != GST_CLOCK_TIME_NONE ? data->export_in : 0;
+  GstClockTime stop = data->export_out != GST_CLOCK_TIME_NONE ? data->export_out : (GstClockTime) data->duration;
+  if (!GST_CLOCK_TIME_IS_VALID(stop) || stop <= start) {
+    g_printerr("Set an export range with the In and Out buttons first\n");
+    return;
+  }
+
+  dialog = gtk_file_chooser_dialog_new("Export Range",
+                                       GTK_WINDOW(data->main_window),
+                                       GTK_FILE_CHOOSER_ACTION_SAVE,
+                                       "_Cancel",
+                                       GTK_RESPONSE_CANCEL,
+                                       "_Export",
+                                       GTK_RESPONSE_ACCEPT,
+                                       NULL);
+  gtk_file_chooser_set_do_overwrite_confirmation(GTK_FILE_CHOOSER(dialog), TRUE);
+  gtk_file_chooser_set_current_name(GTK_FILE_CHOOSER(dialog), "export.mkv");
+
+  /* Stream copy is pure I/O but starts on the keyframe before IN, re-encoding is frame accurate */
+  reencode = gtk_check_button_new_with_label("Re-encode the video, frame accurate");
+  gtk_file_chooser_set_extra_widget(GTK_FILE_CHOOSER(dialog), reencode);
+
+  if (gtk_dialog_run(GTK_DIALOG(dialog)) == GTK_RESPONSE_ACCEPT)
+  {
+    ExportJob *job = g_new0(ExportJob, 1);
+    job->uri = g_strdup(data->uri);
+    job->start = start;
+    job->stop = stop;
+    job->path = gtk_file_chooser_get_filename(GTK_FILE_CHOOSER(dialog));
+    job->mode = gtk_toggle_button_get_active(GTK_TOGGLE_BUTTON(reencode)) ? CLIP_EXPORT_REENCODE : CLIP_EXPORT_COPY;
+    job->start_time = g_get_monotonic_time();
+
+    WorkJob *handle = work_pool_push(work_pool_get_default(), (WorkFunc) export_job_func, job, WORK_JOB_LONG, &error);
+    if (handle != NULL) {
+      work_job_detach(handle);
+    } else {
+      job->error = error;
+      export_done_idle(job);
+    }
+  }
+  gtk_widget_destroy(dialog);
+}
+
 /* This creates all the GTK+ widgets that compose our application, and registers the callbacks */
 static void create_ui(CustomData *data)
 {
@@ -359,6 +1723,9 @@ static void create_ui(CustomData *data)
   GtkWidget *main_hbox;                                              /* HBox to hold the video_window and the stream info text widget */
   GtkWidget *controls;                                               /* HBox to hold the buttons and the slider */
   GtkWidget *play_button, *pause_button, *stop_button, *open_button; /* Buttons */
+  GtkWidget *hud_button;                                             /* Toggles the performance HUD */
+  GtkWidget *snapshot_button;                                        /* Saves the frame being shown */
+  GtkWidget *export_button;                                          /* Exports the range between IN and OUT */
   GtkWidget *duration;                                               /* Duration label */
   GtkWidget *position;                                               /* Position label */
   GtkWidget *scale;                                                  /* Scale widget */
@@ -368,7 +1735,9 @@ static void create_ui(CustomData *data)
   g_signal_connect(G_OBJECT(data->main_window), "delete-event", G_CALLBACK(delete_event_cb), data);
 
   video_window = gtk_drawing_area_new();
+  data->video_window = video_window;
   g_signal_connect(video_window, "realize", G_CALLBACK(realize_cb), data);
+  g_signal_connect(video_window, "draw", G_CALLBACK(video_draw_cb), data);
 
   play_button = gtk_button_new_from_icon_name("media-playback-start", GTK_ICON_SIZE_SMALL_TOOLBAR);
   g_signal_connect(G_OBJECT(play_button), "clicked", G_CALLBACK(play_cb), data);
@@ -382,6 +1751,36 @@ static void create_ui(CustomData *data)
   open_button = gtk_button_new_from_icon_name("gtk-open", GTK_ICON_SIZE_SMALL_TOOLBAR);
   g_signal_connect(G_OBJECT(open_button), "clicked", G_CALLBACK(open_cb), data);
 
+  data->audio_button = gtk_button_new_with_label("Audio");
+  gtk_widget_set_name(data->audio_button, "audio");
+  gtk_widget_set_sensitive(data->audio_button, FALSE);
+  g_signal_connect(G_OBJECT(data->audio_button), "clicked", G_CALLBACK(audio_cb), data);
+
+  data->video_button = gtk_button_new_with_label("Video");
+  gtk_widget_set_name(data->video_button, "video");
+  gtk_widget_set_sensitive(data->video_button, FALSE);
+  g_signal_connect(G_OBJECT(data->video_button), "clicked", G_CALLBACK(video_cb), data);
+
+  snapshot_button = gtk_button_new_from_icon_name("camera-photo", GTK_ICON_SIZE_SMALL_TOOLBAR);
+  gtk_widget_set_name(snapshot_button, "snapshot");
+  g_signal_connect(G_OBJECT(snapshot_button), "clicked", G_CALLBACK(snapshot_cb), data);
+
+  data->in_button = gtk_button_new_with_label("In");
+  gtk_widget_set_name(data->in_button, "in");
+  g_signal_connect(G_OBJECT(data->in_button), "clicked", G_CALLBACK(export_in_cb), data);
+
+  data->out_button = gtk_button_new_with_label("Out");
+  gtk_widget_set_name(data->out_button, "out");
+  g_signal_connect(G_OBJECT(data->out_button), "clicked", G_CALLBACK(export_out_cb), data);
+
+  export_button = gtk_button_new_with_label("Export");
+  gtk_widget_set_name(export_button, "export");
+  g_signal_connect(G_OBJECT(export_button), "clicked", G_CALLBACK(export_cb), data);
+
+  hud_button = gtk_toggle_button_new_with_label("HUD");
+  gtk_widget_set_name(hud_button, "hud");
+  g_signal_connect(G_OBJECT(hud_button), "toggled", G_CALLBACK(hud_toggled_cb), data);
+
   position = gtk_label_new(NULL);
   gtk_widget_set_name(position, "position");
   set_label_txt(position, WIDGET_TYPE_POSITION, data);
@@ -390,6 +1789,11 @@ static void create_ui(CustomData *data)
   g_object_set(scale, "width-request", 1350, NULL);
   gtk_widget_set_name(scale, "scale");
   g_signal_connect(G_OBJECT(scale), "change-value", G_CALLBACK(scale_cb), data);
+  g_signal_connect(G_OBJECT(scale), "button-press-event", G_CALLBACK(scale_press_cb), data);
+  g_signal_connect(G_OBJECT(scale), "button-release-event", G_CALLBACK(scale_release_cb), data);
+  gtk_widget_add_events(scale, GDK_POINTER_MOTION_MASK | GDK_LEAVE_NOTIFY_MASK);
+  g_signal_connect(G_OBJECT(scale), "motion-notify-event", G_CALLBACK(scale_motion_cb), data);
+  g_signal_connect(G_OBJECT(scale), "leave-notify-event", G_CALLBACK(pre_seek_leave_cb), data);
 
   duration = gtk_label_new(NULL);
   gtk_widget_set_name(duration, "duration");
@@ -401,6 +1805,13 @@ static void create_ui(CustomData *data)
   gtk_box_pack_start(GTK_BOX(controls), pause_button, FALSE, FALSE, 2);
   gtk_box_pack_start(GTK_BOX(controls), stop_button, FALSE, FALSE, 2);
   gtk_box_pack_start(GTK_BOX(controls), open_button, FALSE, FALSE, 2);
+  gtk_box_pack_start(GTK_BOX(controls), data->audio_button, FALSE, FALSE, 2);
+  gtk_box_pack_start(GTK_BOX(controls), data->video_button, FALSE, FALSE, 2);
+  gtk_box_pack_start(GTK_BOX(controls), snapshot_button, FALSE, FALSE, 2);
+  gtk_box_pack_start(GTK_BOX(controls), data->in_button, FALSE, FALSE, 2);
+  gtk_box_pack_start(GTK_BOX(controls), data->out_button, FALSE, FALSE, 2);
+  gtk_box_pack_start(GTK_BOX(controls), export_button, FALSE, FALSE, 2);
+  gtk_box_pack_start(GTK_BOX(controls), hud_button, FALSE, FALSE, 2);
   gtk_box_pack_start(GTK_BOX(controls), position, FALSE, FALSE, 2);
   gtk_box_pack_start(GTK_BOX(controls), scale, FALSE, FALSE, 10);
   gtk_box_pack_start(GTK_BOX(controls), duration, FALSE, FALSE, 2);
@@ -409,6 +1820,14 @@ static void create_ui(CustomData *data)
   gtk_widget_set_name(main_hbox, "main_hbox");
   gtk_box_pack_start(GTK_BOX(main_hbox), video_window, TRUE, TRUE, 0);
 
+  /* The HUD is drawn next to the video by the app, so it costs no video processing */
+  data->hud = gtk_drawing_area_new();
+  gtk_widget_set_name(data->hud, "hud");
+  gtk_widget_set_size_request(data->hud, HUD_WIDTH, -1);
+  gtk_widget_set_no_show_all(data->hud, TRUE);
+  g_signal_connect(G_OBJECT(data->hud), "draw", G_CALLBACK(hud_draw_cb), data);
+  gtk_box_pack_start(GTK_BOX(main_hbox), data->hud, FALSE, FALSE, 0);
+
   timeline =  gtk_box_new(GTK_ORIENTATION_HORIZONTAL, 0);
   gtk_widget_set_name(timeline, "timeline");
 
@@ -419,7 +1838,16 @@ static void create_ui(CustomData *data)
   gtk_container_add(GTK_CONTAINER(data->main_window), main_box);
   gtk_window_set_default_size(GTK_WINDOW(data->main_window), 1600, 680);
 
-  gtk_widget_show_all(data->main_window);
+  /* Pausing, stopping, seeking or opening another clip in one player would take it out of the
+   * shared schedule. The UI is built while the pipeline is being created, so this goes by the options */
+  if (sync_master_option != NULL || sync_slave_option != NULL) {
+    gtk_widget_set_sensitive(open_button, FALSE);
+    gtk_widget_set_sensitive(play_button, FALSE);
+    gtk_widget_set_sensitive(pause_button, FALSE);
+    gtk_widget_set_sensitive(stop_button, FALSE);
+    gtk_widget_set_sensitive(scale, FALSE);
+    gtk_widget_set_sensitive(timeline, FALSE);
+  }
 }
 
 /* This function is called when an error message is posted on the bus */
@@ -432,11 +1860,13 @@ static void error_cb(GstBus *bus, GstMessage *msg, CustomData *data)
   gst_message_parse_error(msg, &err, &debug_info);
   g_printerr("Error received from element %s: %s\n", GST_OBJECT_NAME(msg->src), err->message);
   g_printerr("Debugging information: %s\n", debug_info ? debug_info : "none");
+  if (err->domain == GST_STREAM_ERROR)
+    metric_inc(data->metrics.decode_errors);
   g_clear_error(&err);
   g_free(debug_info);
 
   /* Set the pipeline to READY (which stops playback) */
-  gst_element_set_state(data->playbin, GST_STATE_READY);
+  state_control_set(data->playbin, GST_STATE_READY, (StateControlDoneFunc) state_done_cb, data);
 }
 
 /* This function is called when an End-Of-Stream message is posted on the bus.
@@ -444,12 +1874,31 @@ static void error_cb(GstBus *bus, GstMessage *msg, CustomData *data)
 static void eos_cb(GstBus *bus, GstMessage *msg, CustomData *data)
 {
   g_print("End-Of-Stream reached.\n");
-  gst_element_set_state(data->playbin, GST_STATE_READY);
+  state_control_set(data->playbin, GST_STATE_READY, (StateControlDoneFunc) state_done_cb, data);
 
   data->position = data->duration;
   update_widget(data, WIDGET_TYPE_POSITION);
 }
 
+/* This function forwards every bus message to the statistics collector */
+static void stats_message_cb(GstBus *bus, GstMessage *msg, CustomData *data)
+{
+  if (data->sync != NULL && net_sync_handle_message(data->sync, msg))
+    return;
+
+  if (data->stream_switch != NULL && stream_switch_handle_message(data->stream_switch, msg)) {
+    update_track_buttons(data);
+    return;
+  }
+
+  if (player_stats_handle_message(data->stats, msg)) {
+    PlayerStatsSnapshot snapshot;
+
+    player_stats_snapshot(data->stats, &snapshot);
+    metric_observe(data->metrics.seek_latency, snapshot.seek_latency_ms / 1000.0);
+  }
+}
+
 static gboolean timer_src_func(CustomData *data) {
   g_return_val_if_fail(data != NULL, G_SOURCE_REMOVE);
 
@@ -476,6 +1925,13 @@ static void state_changed_cb(GstBus *bus, GstMessage *msg, CustomData *data)
   {
     data->state = new_state;
     g_print("State set to %s\n", gst_element_state_get_name(new_state));
+    if (old_state == GST_STATE_READY && new_state == GST_STATE_PAUSED) {
+      /* A late slave or a recovered pipeline starts at the position of the others */
+      if (data->sync != NULL)
+        net_sync_join(data->sync);
+      if (g_atomic_int_get(&data->recovering))
+        finish_recovery(data);
+    }
     if (new_state == GST_STATE_PLAYING)
     {
       /* Add timer to update current position and slider every 20 ms */
@@ -495,30 +1951,347 @@ static void state_changed_cb(GstBus *bus, GstMessage *msg, CustomData *data)
   }
 }
 
+/* This function mirrors the values maintained by the statistics collector, it runs on the exporter threads */
+static void metrics_collect_func(CustomData *data)
+{
+  PlayerStatsSnapshot snapshot;
+
+  player_stats_snapshot(data->stats, &snapshot);
+  metric_set(data->metrics.frames_rendered, snapshot.frames_rendered);
+  metric_set(data->metrics.frames_dropped, snapshot.frames_dropped);
+  metric_set(data->metrics.rss, snapshot.rss_bytes);
+  metric_set(data->metrics.jitter, snapshot.jitter_ms / 1000.0);
+
+  ThumbCacheStats cache_stats;
+  thumb_cache_get_stats(data->thumb_cache, &cache_stats);
+  metric_set(data->metrics.cache_hits, cache_stats.hits);
+  metric_set(data->metrics.cache_misses, cache_stats.misses);
+
+  if (data->pre_seek != NULL) {
+    PreSeekStats pre_seek_stats;
+    pre_seek_get_stats(data->pre_seek, &pre_seek_stats);
+    metric_set(data->metrics.pre_seek_hits, pre_seek_stats.hits);
+    metric_set(data->metrics.pre_seek_misses, pre_seek_stats.misses);
+    metric_set(data->metrics.pre_seek_wasted, pre_seek_stats.wasted);
+  }
+
+  if (data->memory_governor != NULL) {
+    MemoryGovernorStats memory_stats;
+    memory_governor_get_stats(data->memory_governor, &memory_stats);
+    metric_set(data->metrics.memory_usage, memory_stats.current);
+    metric_set(data->metrics.memory_limit, memory_stats.limit);
+    metric_set(data->metrics.memory_stall, memory_stats.some_avg10 / 100);
+    metric_set(data->metrics.memory_shrinks, memory_stats.shrinks);
+  }
+}
+
+/* This function registers the player metrics and starts the exporters requested on the command line */
+static gboolean setup_metrics(CustomData *data)
+{
+  static const gdouble seek_latency_bounds[] = { 0.01, 0.025, 0.05, 0.1, 0.25, 0.5, 1, 2.5 };
+  static const gdouble first_pixel_bounds[] = { 0.025, 0.05, 0.1, 0.15, 0.25, 0.5, 1, 2.5 };
+  static const gdouble stall_recovery_bounds[] = { 0.05, 0.1, 0.25, 0.5, 1, 2.5, 5, 10 };
+  PlayerMetrics *metrics = &data->metrics;
+  GError *error = NULL;
+
+  metrics->frames_rendered = metrics_counter_new("videoplayer_frames_rendered_total",
+      "Frames that reached the video sink");
+  metrics->frames_dropped = metrics_counter_new("videoplayer_frames_dropped_total",
+      "Frames dropped, as reported by QoS");
+  metrics->seeks = metrics_counter_new("videoplayer_seeks_total",
+      "Seeks requested by the user");
+  metrics->seek_latency = metrics_histogram_new("videoplayer_seek_latency_seconds",
+      "Time from a seek request to the pipeline prerolling again",
+      seek_latency_bounds, G_N_ELEMENTS(seek_latency_bounds));
+  metrics->decode_errors = metrics_counter_new("videoplayer_decode_errors_total",
+      "Stream errors posted by the pipeline");
+  metrics->pipeline_restarts = metrics_counter_new("videoplayer_pipeline_restarts_total",
+      "Times the playback pipeline was torn down and started again to recover from a stall");
+  metrics->rss = metrics_gauge_new("videoplayer_resident_memory_bytes",
+      "Resident set size of the process");
+  metrics->jitter = metrics_gauge_new("videoplayer_playback_jitter_seconds",
+      "Average lateness of the frames at the video sink, as reported by QoS");
+  metrics->first_pixel = metrics_histogram_new("videoplayer_time_to_first_pixel_seconds",
+      "Time from opening a clip to showing its poster or first video frame",
+      first_pixel_bounds, G_N_ELEMENTS(first_pixel_bounds));
+  metrics->cache_hits = metrics_counter_new("videoplayer_thumbnail_cache_hits_total",
+      "Poster and thumbnail lookups served from the cache");
+  metrics->cache_misses = metrics_counter_new("videoplayer_thumbnail_cache_misses_total",
+      "Poster and thumbnail lookups that had to decode the clip");
+  metrics->stalls = metrics_counter_new("videoplayer_pipeline_stalls_total",
+      "Stalls of the playback or thumbnail pipeline detected by the watchdog");
+  metrics->stall_recovery = metrics_histogram_new("videoplayer_stall_recovery_seconds",
+      "Time from a stall being detected to the pipeline running again",
+      stall_recovery_bounds, G_N_ELEMENTS(stall_recovery_bounds));
+  metrics->pre_seek_hits = metrics_counter_new("videoplayer_pre_seek_hits_total",
+      "Seeks served by a frame decoded ahead at the position under the pointer");
+  metrics->pre_seek_misses = metrics_counter_new("videoplayer_pre_seek_misses_total",
+      "Seeks with no frame decoded ahead near their target");
+  metrics->pre_seek_wasted = metrics_counter_new("videoplayer_pre_seek_wasted_total",
+      "Frames decoded ahead and never shown");
+  metrics->thumbnail_seek = metrics_histogram_new("videoplayer_thumbnail_seek_seconds",
+      "Time from a click on a timeline thumbnail to its frame reaching the video sink",
+      seek_latency_bounds, G_N_ELEMENTS(seek_latency_bounds));
+  metrics->memory_usage = metrics_gauge_new("videoplayer_memory_usage_bytes",
+      "Memory charged to the cgroup of the player but its clean page cache, or used on the host without cgroup v2");
+  metrics->memory_limit = metrics_gauge_new("videoplayer_memory_limit_bytes",
+      "memory.high or memory.max of the cgroup of the player, or the RAM of the host");
+  metrics->memory_stall = metrics_gauge_new("videoplayer_memory_stall_ratio",
+      "Share of the last 10 seconds some task of the cgroup stalled on memory");
+  metrics->memory_shrinks = metrics_counter_new("videoplayer_memory_shrinks_total",
+      "Times the caches were shrunk under memory pressure");
+  metrics_add_collector((MetricsCollectFunc) metrics_collect_func, data);
+
+  if (metrics_file_option != NULL) {
+    if (metrics_interval_option <= 0) {
+      g_printerr("The metrics interval must be positive\n");
+      return FALSE;
+    }
+    metrics_start_textfile_writer(metrics_file_option, metrics_interval_option);
+  }
+
+  if (metrics_port_option != 0) {
+    if (metrics_port_option < 0 || metrics_port_option > G_MAXUINT16) {
+      g_printerr("Invalid metrics port %d\n", metrics_port_option);
+      return FALSE;
+    }
+    if (!metrics_serve(metrics_port_option, &error)) {
+      g_printerr("Could not serve metrics: %s\n", error->message);
+      g_clear_error(&error);
+      return FALSE;
+    }
+  }
+
+  return TRUE;
+}
+
+/* This function parses our own options, leaving GTK+ and GStreamer ones in place */
+static gboolean parse_options(int *argc, char ***argv, CustomData *data)
+{
+  GOptionContext *context = g_option_context_new("- GStreamer video player");
+  GError *error = NULL;
+
+  g_option_context_add_main_entries(context, option_entries, NULL);
+  g_option_context_set_ignore_unknown_options(context, TRUE);
+  if (!g_option_context_parse(context, argc, argv, &error)) {
+    g_printerr("Could not parse options: %s\n", error->message);
+    g_clear_error(&error);
+    g_option_context_free(context);
+    return FALSE;
+  }
+  g_option_context_free(context);
+
+  if (mosaic_option != NULL && !mosaic_parse_layout(mosaic_option, &data->mosaic_columns, &data->mosaic_rows)) {
+    g_printerr("Invalid mosaic layout '%s', expected COLUMNSxROWS\n", mosaic_option);
+    return FALSE;
+  }
+
+  if (sync_master_option != NULL && sync_slave_option != NULL) {
+    g_printerr("A player cannot be both the sync master and a sync slave\n");
+    return FALSE;
+  }
+
+  if (watchdog_deadline_option < 0) {
+    g_printerr("Invalid watchdog deadline %d\n", watchdog_deadline_option);
+    return FALSE;
+  }
+
+  if (storyboard_interval_option <= 0) {
+    g_printerr("Invalid storyboard interval %d\n", storyboard_interval_option);
+    return FALSE;
+  }
+
+  if (profile_option != NULL) {
+    if (!profiler_format_from_string(profile_option, &data->profile_format)) {
+      g_printerr("Unknown profile format '%s', expected table or folded\n", profile_option);
+      return FALSE;
+    }
+    data->profile = TRUE;
+  }
+
+  return TRUE;
+}
+
+/* This function shares the clock of the pipeline with the other players, in sync mode */
+static gboolean setup_sync(CustomData *data)
+{
+  const gchar *option = sync_master_option != NULL ? sync_master_option : sync_slave_option;
+  gchar *address = NULL;
+  guint16 port;
+  GError *error = NULL;
+
+  if (option == NULL)
+    return TRUE;
+
+  if (!net_sync_parse_address(option, &address, &port)) {
+    g_printerr("Invalid sync address '%s', expected ADDRESS:PORT\n", option);
+    return FALSE;
+  }
+
+  if (sync_master_option != NULL)
+    data->sync = net_sync_new_master(data->playbin, address, port, &error);
+  else
+    data->sync = net_sync_new_slave(data->playbin, address, port, &error);
+  g_free(address);
+
+  if (data->sync == NULL) {
+    g_printerr("Could not set up sync mode: %s\n", error->message);
+    g_clear_error(&error);
+    return FALSE;
+  }
+
+  if (sync_log_option != NULL && !net_sync_set_log(data->sync, sync_log_option, &error)) {
+    g_printerr("%s\n", error->message);
+    g_clear_error(&error);
+    return FALSE;
+  }
+
+  g_print("Sync: base time %" GST_TIME_FORMAT "\n", GST_TIME_ARGS(net_sync_get_base_time(data->sync)));
+  net_sync_watch_sink(data->sync, data->video_sink);
+  return TRUE;
+}
+
+/* This function writes the profile gathered during the run */
+static void dump_profile(CustomData *data)
+{
+  FILE *out = stdout;
+
+  if (profile_output_option != NULL) {
+    out = fopen(profile_output_option, "w");
+    if (out == NULL) {
+      g_printerr("Could not open %s for writing the profile\n", profile_output_option);
+      return;
+    }
+  }
+
+  profiler_dump(data->profile_format, out);
+
+  if (out != stdout)
+    fclose(out);
+}
+
+/* Command line given to gst_init() by the GStreamer init thread */
+typedef struct _GstInitArgs
+{
+  CustomData *data;
+  gint argc;
+  gchar **argv;
+} GstInitArgs;
+
+/* This function runs on its own thread while GTK+ builds the UI. It loads the plugin
+ * registry and creates the playback pipeline, plugins themselves are only loaded by the
+ * registry when one of their elements is made */
+static gpointer gst_init_thread_func(GstInitArgs *args)
+{
+  CustomData *data = args->data;
+  GstElement *video_sink;
+
+  gst_init(&args->argc, &args->argv);
+  if (data->profile)
+    profiler_start();
+  startup_timing_mark("gst-init");
+
+  /* Create the elements */
+  video_sink = gst_element_factory_make("ximagesink", "videosink");
+  data->video_sink = video_sink;
+  if (mosaic_option != NULL) {
+    /* The mosaic pipeline takes the place of playbin, all the tiles share its clock */
+    data->mosaic = mosaic_new(data->mosaic_columns, data->mosaic_rows, video_sink);
+    if (data->mosaic != NULL)
+      data->playbin = gst_object_ref(mosaic_get_pipeline(data->mosaic));
+  } else {
+    data->playbin = gst_element_factory_make("playbin", "playbin");
+    if (data->playbin) {
+      g_object_set(data->playbin, "video-sink", video_sink, NULL);
+      data->stream_switch = stream_switch_new(data->playbin);
+    }
+  }
+
+  if (!no_decoder_tuning_option)
+    decoder_tuning_probe_topology();
+  startup_timing_mark("pipeline");
+  return NULL;
+}
+
+/* This function removes the GStreamer options left by gtk_init(), the GStreamer init thread
+ * parsed them from its own copy of the command line */
+static void strip_gst_options(int *argc, char **argv)
+{
+  /* The GStreamer options that take no value */
+  static const gchar *flags[] = {
+    "--gst-version", "--gst-fatal-warnings", "--gst-debug-help", "--gst-debug-no-color",
+    "--gst-disable-segtrap", "--gst-disable-registry-update", "--gst-disable-registry-fork", NULL
+  };
+  gint n = 1;
+
+  for (gint i = 1; i < *argc; i++) {
+    if (!g_str_has_prefix(argv[i], "--gst-")) {
+      argv[n++] = argv[i];
+      continue;
+    }
+
+    if (strchr(argv[i], '=') == NULL && !g_strv_contains(flags, argv[i]) && i + 1 < *argc)
+      i++;
+  }
+
+  argv[n] = NULL;
+  *argc = n;
+}
+
+/* This function is called when the main window is first shown on screen */
+static gboolean map_event_cb(GtkWidget *widget, GdkEvent *event, CustomData *data)
+{
+  startup_timing_mark("window-visible");
+  g_signal_handlers_disconnect_by_func(widget, map_event_cb, data);
+
+  if (startup_report_option)
+    startup_timing_report(stdout, STARTUP_TARGET_MS);
+  return FALSE;
+}
+
 int main(int argc, char *argv[])
 {
   CustomData data;
-  GstStateChangeReturn ret;
   GstBus *bus;
-  GstElement *video_sink;
-  GstElement *app_sink;
-
-  /* Initialize GTK */
-  gtk_init(&argc, &argv);
+  GstInitArgs gst_args;
+  GThread *gst_thread;
 
-  /* Initialize GStreamer */
-  gst_init(&argc, &argv);
+  startup_timing_begin();
 
   /* Initialize our data structure */
   memset(&data, 0, sizeof(data));
   data.duration = GST_CLOCK_TIME_NONE;
   data.position = GST_CLOCK_TIME_NONE;
   data.timer_id = -1;
+  data.hud_timer_id = -1;
+  data.export_in = GST_CLOCK_TIME_NONE;
+  data.export_out = GST_CLOCK_TIME_NONE;
 
-  /* Create the elements */
-  data.playbin = gst_element_factory_make("playbin", "playbin");
-  video_sink = gst_element_factory_make("ximagesink", "videosink");
-  g_object_set(data.playbin, "video-sink", video_sink, NULL);
+  if (!parse_options(&argc, &argv, &data))
+    return -1;
+
+  /* Tracers are set up by gst_init(), so they must be requested before */
+  if (data.profile)
+    profiler_enable_tracers();
+
+  /* Initialize GStreamer and create the pipeline while GTK+ connects to the display and builds the UI */
+  gst_args.data = &data;
+  gst_args.argc = argc;
+  gst_args.argv = g_strdupv(argv);
+  gst_thread = g_thread_new("gst-init", (GThreadFunc) gst_init_thread_func, &gst_args);
+
+  /* Initialize GTK */
+  gtk_init(&argc, &argv);
+  startup_timing_mark("gtk-init");
+
+  /* Create the GUI */
+  create_ui(&data);
+  startup_timing_mark("ui");
+
+  g_thread_join(gst_thread);
+  g_strfreev(gst_args.argv);
+  strip_gst_options(&argc, argv);
+  startup_timing_mark("gst-join");
 
   if (!data.playbin)
   {
@@ -526,22 +2299,89 @@ int main(int argc, char *argv[])
     return -1;
   }
 
-  data.timelinebin = gst_element_factory_make("playbin", "timelinebin");
-  app_sink = gst_element_factory_make("appsink", "videosink");
-  GstCaps *caps  = gst_caps_from_string ("video/x-raw,format=RGB,width=160,pixel-aspect-ratio=1/1");
-       
-  g_object_set(app_sink, "caps", caps, NULL);
-  gst_caps_unref(caps);
-  g_object_set(data.timelinebin, "video-sink", app_sink, NULL);
+  data.stats = player_stats_new();
+  player_stats_attach(data.stats, data.playbin);
+  data.thumb_cache = thumb_cache_new(NULL);
+  data.frame_grabber = frame_grabber_new();
+
+  /* The cache is trimmed once per run, away from the UI thread */
+  WorkJob *prune_job = work_pool_push(work_pool_get_default(), prune_cache_job_func, NULL, WORK_JOB_LONG, NULL);
+  if (prune_job != NULL)
+    work_job_detach(prune_job);
+
+  /* A click on the slider is usually where the pointer rested, its frame is decoded ahead */
+  if (!no_pre_seek_option && data.mosaic == NULL)
+    data.pre_seek = pre_seek_new(PRESEEK_WIDTH, !no_decoder_tuning_option);
+
+  /* Near the limit of the cgroup, or when it stalls on memory, the caches give memory back,
+   * the one rebuilt at the least cost first */
+  if (!no_memory_governor_option) {
+    data.memory_governor = memory_governor_new(NULL, MEMORY_INTERVAL_MS);
+    memory_governor_add_cache(data.memory_governor, "frame-grab", 0, FRAME_GRAB_BUDGET,
+        (MemoryCacheSizeFunc) frame_grabber_get_memory, (MemoryCacheBudgetFunc) frame_grabber_set_budget,
+        data.frame_grabber);
+    if (data.pre_seek != NULL)
+      memory_governor_add_cache(data.memory_governor, "pre-seek", 1, PRESEEK_BUDGET,
+          (MemoryCacheSizeFunc) pre_seek_get_memory, (MemoryCacheBudgetFunc) pre_seek_set_budget, data.pre_seek);
+  }
 
-  if (!data.timelinebin)
-  {
-    g_printerr("Not all timelinebin elements could be created.\n");
+  GstPad *video_sink_pad = gst_element_get_static_pad(data.video_sink, "sink");
+  gst_pad_add_probe(video_sink_pad, GST_PAD_PROBE_TYPE_BUFFER, (GstPadProbeCallback) video_sink_probe_cb, &data, NULL);
+  gst_object_unref(video_sink_pad);
+
+  if (!setup_metrics(&data))
     return -1;
+
+  if (!setup_sync(&data))
+    return -1;
+
+  /* A pipeline stuck in a decoder or a sink is torn down and started again */
+  if (watchdog_deadline_option > 0) {
+    data.watchdog = watchdog_new();
+    data.playbin_watch = watchdog_watch(data.watchdog, data.playbin, data.video_sink,
+        watchdog_deadline_option * GST_SECOND, (WatchdogStallFunc) playbin_stalled_cb, &data);
   }
 
-  /* Create the GUI */
-  create_ui(&data);
+  if (data.profile)
+    profiler_watch_pipeline(data.playbin);
+
+  /* Run the streaming threads of all our pipelines on one bounded, shared pool */
+  shared_task_pool_install(data.playbin, shared_task_pool_get_default());
+
+  /* Keep thumbnail decoding off the cores used for playback */
+  if (!no_decoder_tuning_option) {
+    gchar *description = decoder_tuning_describe();
+    g_print("Decoder tuning: %s\n", description);
+    g_free(description);
+
+    decoder_tuning_install(data.playbin, DECODER_ROLE_PLAYBACK);
+  }
+
+  /* Decoded frames are large enough for huge pages to save TLB misses when they are converted */
+  if (!no_huge_pages_option)
+    huge_page_allocator_install(data.playbin);
+  startup_timing_mark("pipeline-setup");
+
+  /* Show the GUI */
+  g_signal_connect(G_OBJECT(data.main_window), "map-event", G_CALLBACK(map_event_cb), &data);
+  gtk_widget_show_all(data.main_window);
+
+  /* In mosaic mode the clips are given on the command line */
+  if (data.mosaic != NULL && argc > 1) {
+    gchar **uris = g_new0(gchar *, argc);
+
+    for (gint i = 1; i < argc; i++)
+      uris[i - 1] = gst_uri_is_valid(argv[i]) ? g_strdup(argv[i]) : gst_filename_to_uri(argv[i], NULL);
+    mosaic_set_uris(data.mosaic, uris, (MosaicReadyFunc) mosaic_ready_cb, &data);
+    g_strfreev(uris);
+  } else if (argc > 1) {
+    /* Players in sync mode have no usable controls, so they get their clip here */
+    gchar *uri = gst_uri_is_valid(argv[1]) ? g_strdup(argv[1]) : gst_filename_to_uri(argv[1], NULL);
+
+    if (uri != NULL)
+      open_uri(&data, uri);
+    g_free(uri);
+  }
 
   /* Instruct the bus to emit signals for each received message, and connect to the interesting signals */
   bus = gst_element_get_bus(data.playbin);
@@ -549,13 +2389,54 @@ int main(int argc, char *argv[])
   g_signal_connect(G_OBJECT(bus), "message::error", (GCallback)error_cb, &data);
   g_signal_connect(G_OBJECT(bus), "message::eos", (GCallback)eos_cb, &data);
   g_signal_connect(G_OBJECT(bus), "message::state-changed", (GCallback)state_changed_cb, &data);
+  g_signal_connect(G_OBJECT(bus), "message", (GCallback)stats_message_cb, &data);
   gst_object_unref(bus);
 
   /* Start the GTK main loop. We will not regain control until gtk_main_quit is called. */
   gtk_main();
 
+  if (!no_huge_pages_option) {
+    HugePageStats huge_pages;
+
+    huge_page_allocator_get_stats(&huge_pages);
+    g_print("Frame buffers: %" G_GUINT64_FORMAT " from hugetlbfs, %" G_GUINT64_FORMAT " transparent huge pages, %"
+        G_GUINT64_FORMAT " small pages\n", huge_pages.hugetlb, huge_pages.thp, huge_pages.small);
+  }
+
   /* Free resources */
+  metrics_shutdown();
+  if (data.memory_governor != NULL)
+    memory_governor_free(data.memory_governor);
+  if (data.watchdog != NULL)
+    watchdog_free(data.watchdog);
+
+  /* The profile is most useful on the runs that did not shut down cleanly, it is written first */
+  if (data.profile)
+    dump_profile(&data);
+
+  /* The pipelines still stuck going to NULL would block the cleanup, the process exits instead */
+  if (data.shutdown_timed_out)
+    return 0;
   gst_element_set_state(data.playbin, GST_STATE_NULL);
   gst_object_unref(data.playbin);
+  if (data.timelinebin != NULL) {
+    gst_element_set_state(data.timelinebin, GST_STATE_NULL);
+    gst_object_unref(data.timelinebin);
+  }
+  if (data.mosaic != NULL)
+    mosaic_free(data.mosaic);
+  if (data.sync != NULL)
+    net_sync_free(data.sync);
+  if (data.stream_switch != NULL)
+    stream_switch_free(data.stream_switch);
+  clear_proxy(&data);
+  frame_grabber_free(data.frame_grabber);
+  if (data.pre_seek != NULL)
+    pre_seek_free(data.pre_seek);
+  thumb_cache_free(data.thumb_cache);
+  g_clear_object(&data.poster);
+  g_free(data.thumbnail_path);
+  g_free(data.uri);
+  player_stats_free(data.stats);
   return 0;
 }
\ No newline at end of file
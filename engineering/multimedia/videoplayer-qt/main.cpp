@@ -16,28 +16,117 @@
     along with this program.  If not, see <http://www.gnu.org/licenses/>.
 */
 #include "player.h"
+#include "framepacing.h"
+#include "startuptiming.h"
+#include <cstdio>
 #include <cstdlib>
+#include <cstring>
 #include <QApplication>
-#include <QDeclarativeView>
-#include <QDeclarativeContext>
-#include <QDeclarativeEngine>
-#include <QGst/Ui/GraphicsVideoSurface>
 #include <QGst/Init>
 
-#ifndef QMLPLAYER_NO_OPENGL
-# include <QGLWidget>
+#if defined(QMLPLAYER_QUICK2)
+# include <QQuickView>
+# include <QQmlContext>
+# include <QQmlEngine>
+# include <QThread>
+# include <QGst/Quick/VideoSurface>
+#else
+# include <QDeclarativeView>
+# include <QDeclarativeContext>
+# include <QDeclarativeEngine>
+# include <QEvent>
+# include <QGst/Ui/GraphicsVideoSurface>
+# ifndef QMLPLAYER_NO_OPENGL
+#  include <QGLWidget>
+# endif
+#endif
+
+static const double StartupTargetMs = 150;
+
+// frames on screen, shown by the HUD and --frame-pacing-report. It outlives the view, since
+// the scene graph may present a last frame from its own thread while the window closes
+static FramePacing *framePacing = 0;
+
+// command line given to QGst::init() by the GStreamer init thread
+struct GstInitArgs
+{
+    int argc;
+    char **argv;
+};
+
+// loads the plugin registry while QApplication connects to the display
+static gpointer gstInitThread(gpointer data)
+{
+    GstInitArgs *args = static_cast<GstInitArgs*>(data);
+    QGst::init(&args->argc, &args->argv);
+    startup_timing_mark("gst-init");
+    return NULL;
+}
+
+#if defined(QMLPLAYER_QUICK2)
+// whether the last frame was presented from the render thread rather than the GUI thread
+static QAtomicInt threadedRendering;
+
+// called by the scene graph once a frame is on screen, from the render thread when the
+// render loop is threaded, where the video texture was uploaded and drawn
+static void frameSwapped()
+{
+    frame_pacing_frame(framePacing);
+    threadedRendering.store(QThread::currentThread() != QCoreApplication::instance()->thread());
+}
+#else
+// counts the paints of the viewport, which while playing are mostly the video frames
+class PaintCounter : public QObject
+{
+public:
+    explicit PaintCounter(QObject *parent = 0) : QObject(parent) {}
+
+protected:
+    bool eventFilter(QObject *, QEvent *event)
+    {
+        if (event->type() == QEvent::Paint) {
+            frame_pacing_frame(framePacing);
+        }
+        return false;
+    }
+};
 #endif
 
 int main(int argc, char **argv)
 {
+    startup_timing_begin();
+
+    bool startupReport = false;
+    bool framePacingReport = false;
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--startup-report") == 0) {
+            startupReport = true;
+        } else if (strcmp(argv[i], "--frame-pacing-report") == 0) {
+            framePacingReport = true;
+        }
+    }
+
 #if defined(QTVIDEOSINK_PATH)
     //this allows the example to run from the QtGStreamer build tree without installing QtGStreamer
     qputenv("GST_PLUGIN_PATH", QTVIDEOSINK_PATH);
 #endif
 
+    // both QApplication and QGst::init() strip their own options, so each gets its own copy
+    GstInitArgs gstArgs;
+    gstArgs.argc = argc;
+    gstArgs.argv = g_strdupv(argv);
+    GThread *gstThread = g_thread_new("gst-init", gstInitThread, &gstArgs);
+
     QApplication app(argc, argv);
-    QGst::init(&argc, &argv);
+    startup_timing_mark("qapplication");
+    framePacing = frame_pacing_new();
 
+#if defined(QMLPLAYER_QUICK2)
+    // frames are uploaded to a texture and drawn by the scene graph, on its render thread
+    QQuickView view;
+    view.setResizeMode(QQuickView::SizeRootObjectToView);
+    QObject::connect(&view, &QQuickWindow::frameSwapped, frameSwapped);
+#else
     QDeclarativeView view;
 
 #if !defined(QMLPLAYER_NO_OPENGL)
@@ -47,12 +136,25 @@ int main(int argc, char **argv)
      */
     view.setViewport(new QGLWidget);
 #endif
+    view.viewport()->installEventFilter(new PaintCounter(&view));
+#endif
+    startup_timing_mark("view");
+
+    // the video surface makes the video sink, so GStreamer must be ready from here on
+    g_thread_join(gstThread);
+    g_strfreev(gstArgs.argv);
+    startup_timing_mark("gst-join");
 
+#if defined(QMLPLAYER_QUICK2)
+    QGst::Quick::VideoSurface *surface = new QGst::Quick::VideoSurface(&view);
+#else
     QGst::Ui::GraphicsVideoSurface *surface = new QGst::Ui::GraphicsVideoSurface(&view);
+#endif
     view.rootContext()->setContextProperty(QLatin1String("videoSurface1"), surface);
 
     Player *player = new Player(&view);
     player->setVideoSink(surface->videoSink());
+    player->setFramePacing(framePacing);
     view.rootContext()->setContextProperty(QLatin1String("player"), player);
 
 #if defined(UNINSTALLED_IMPORTS_DIR)
@@ -60,8 +162,35 @@ int main(int argc, char **argv)
     view.engine()->addImportPath(QLatin1String(UNINSTALLED_IMPORTS_DIR));
 #endif
 
+    // the QML is compiled into the binary, so loading it does not touch the disk
+#if defined(QMLPLAYER_QUICK2)
+    view.setSource(QUrl(QLatin1String("qrc:///qmlplayer2.qml")));
+#else
     view.setSource(QUrl(QLatin1String("qrc:///qmlplayer.qml")));
+#endif
+    startup_timing_mark("qml");
     view.show();
+    app.processEvents();
+    startup_timing_mark("window-visible");
+    if (startupReport) {
+        startup_timing_report(stdout, StartupTargetMs);
+    }
+
+    int ret = app.exec();
+
+    if (framePacingReport) {
+        FramePacingStats stats;
+        frame_pacing_get_stats(framePacing, &stats);
+
+        gchar *text = frame_pacing_stats_to_string(&stats);
+        printf("%s\n", text);
+        g_free(text);
+#if defined(QMLPLAYER_QUICK2)
+        printf("Rendering: %s thread\n", threadedRendering.load() ? "render" : "GUI");
+#else
+        printf("Rendering: GUI thread\n");
+#endif
+    }
 
-    return app.exec();
+    return ret;
 }
@@ -17,6 +17,7 @@
    along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 #include "player.h"
+#include <QDebug>
 #include <QUrl>
 #include <QFileDialog>
 #include <QGlib/Connect>
@@ -24,9 +25,56 @@
 #include <QGst/ElementFactory>
 #include <QGst/Bus>
 
+#include "statecontrol.h"
+
+static const int HudRefreshMs = 500;
+
 Player::Player(QObject *parent)
     : QObject(parent)
+    , m_stats(player_stats_new())
+    , m_streamSwitch(0)
+    , m_frameGrabber(frame_grabber_new())
+    , m_framePacing(0)
 {
+    m_hudTimer.setInterval(HudRefreshMs);
+    connect(&m_hudTimer, SIGNAL(timeout()), this, SLOT(refreshHud()));
+}
+
+// what is left of a player once its pipeline reached NULL
+struct PlayerTeardown
+{
+    PlayerStats *stats;
+    StreamSwitch *streamSwitch;
+    FrameGrabber *frameGrabber;
+};
+
+// called from the control thread, possibly after the window is gone
+static void teardownDone(gpointer userData)
+{
+    PlayerTeardown *teardown = static_cast<PlayerTeardown*>(userData);
+    // waits for the frames still being saved, off the GUI thread
+    frame_grabber_free(teardown->frameGrabber);
+    if (teardown->streamSwitch) {
+        stream_switch_free(teardown->streamSwitch);
+    }
+    player_stats_free(teardown->stats);
+    delete teardown;
+}
+
+Player::~Player()
+{
+    // the pad probes of the pipeline point to m_stats, so it is freed once the pipeline
+    // is torn down, in the background: going to NULL must not hold the window open
+    PlayerTeardown *teardown = new PlayerTeardown;
+    teardown->stats = m_stats;
+    teardown->streamSwitch = m_streamSwitch;
+    teardown->frameGrabber = m_frameGrabber;
+    if (m_pipeline) {
+        state_control_teardown(GST_ELEMENT(static_cast<GstPipeline*>(m_pipeline)), teardownDone, teardown);
+        m_pipeline.clear();
+    } else {
+        teardownDone(teardown);
+    }
 }
 
 void Player::setVideoSink(const QGst::ElementPtr & sink)
@@ -34,17 +82,163 @@ void Player::setVideoSink(const QGst::ElementPtr & sink)
     m_videoSink = sink;
 }
 
+// the HUD shows the pacing of the frames on screen, pacing is not owned
+void Player::setFramePacing(FramePacing *pacing)
+{
+    m_framePacing = pacing;
+}
+
+bool Player::hudVisible() const
+{
+    return m_hudTimer.isActive();
+}
+
+void Player::setHudVisible(bool visible)
+{
+    if (visible == hudVisible()) {
+        return;
+    }
+
+    if (visible) {
+        refreshHud();
+        m_hudTimer.start();
+    } else {
+        m_hudTimer.stop();
+    }
+    Q_EMIT hudVisibleChanged();
+}
+
+QString Player::hudText() const
+{
+    return m_hudText;
+}
+
+void Player::refreshHud()
+{
+    PlayerStatsSnapshot snapshot;
+    player_stats_snapshot(m_stats, &snapshot);
+
+    gchar *text = player_stats_snapshot_to_string(&snapshot);
+    m_hudText = QString::fromUtf8(text);
+    g_free(text);
+
+    if (m_framePacing) {
+        FramePacingStats pacing;
+        frame_pacing_get_stats(m_framePacing, &pacing);
+
+        text = frame_pacing_stats_to_string(&pacing);
+        m_hudText += QLatin1Char('\n') + QString::fromUtf8(text);
+        g_free(text);
+    }
+
+    Q_EMIT hudTextChanged();
+}
+
+QString Player::trackLabel(StreamSwitchType type) const
+{
+    int current = m_streamSwitch ? stream_switch_get_current(m_streamSwitch, type) : -1;
+    if (current < 0) {
+        return QString();
+    }
+
+    gchar *label = stream_switch_get_label(m_streamSwitch, type, current);
+    QString result = QString::fromUtf8(label);
+    g_free(label);
+    return result;
+}
+
+QString Player::audioTrack() const
+{
+    return trackLabel(STREAM_SWITCH_AUDIO);
+}
+
+int Player::audioTrackCount() const
+{
+    return m_streamSwitch ? stream_switch_get_n_tracks(m_streamSwitch, STREAM_SWITCH_AUDIO) : 0;
+}
+
+QString Player::videoTrack() const
+{
+    return trackLabel(STREAM_SWITCH_VIDEO);
+}
+
+int Player::videoTrackCount() const
+{
+    return m_streamSwitch ? stream_switch_get_n_tracks(m_streamSwitch, STREAM_SWITCH_VIDEO) : 0;
+}
+
+// switching keeps the pipeline and its decoders, unlike setUri()
+void Player::nextAudioTrack()
+{
+    if (m_streamSwitch && stream_switch_next(m_streamSwitch, STREAM_SWITCH_AUDIO)) {
+        Q_EMIT tracksChanged();
+    }
+}
+
+void Player::nextVideoTrack()
+{
+    if (m_streamSwitch && stream_switch_next(m_streamSwitch, STREAM_SWITCH_VIDEO)) {
+        Q_EMIT tracksChanged();
+    }
+}
+
+// called from the work pool once a frame is saved
+static void frameSaved(const gchar *path, const GError *error, gpointer)
+{
+    if (error) {
+        qWarning() << "Could not save the frame to" << path << ":" << error->message;
+    } else {
+        qDebug() << "Saved the frame to" << path;
+    }
+}
+
+// playback goes on, the frame shown is saved at full resolution in the background
+void Player::saveFrame()
+{
+    if (!m_pipeline) {
+        return;
+    }
+
+    GstSample *sample = frame_grab_get_last_sample(GST_ELEMENT(static_cast<GstPipeline*>(m_pipeline)));
+    if (!sample) {
+        qWarning() << "No frame shown yet";
+        return;
+    }
+
+    const gchar *dir = g_get_user_special_dir(G_USER_DIRECTORY_PICTURES);
+    QString name = QString::fromLatin1("videoplayer-%1.png").arg(g_get_real_time() / 1000);
+    gchar *path = g_build_filename(dir ? dir : g_get_home_dir(), name.toUtf8().constData(), NULL);
+    GError *error = NULL;
+
+    if (!frame_grabber_save(m_frameGrabber, sample, path, frameSaved, NULL, &error)) {
+        qWarning() << "Could not save the frame:" << error->message;
+        g_clear_error(&error);
+    }
+
+    g_free(path);
+    gst_sample_unref(sample);
+}
+
+// called from the main loop when a state change queued by play() or stop() returned
+static void stateDone(GstElement *, GstState state, GstStateChangeReturn ret, gpointer)
+{
+    if (ret == GST_STATE_CHANGE_FAILURE) {
+        qWarning() << "Could not set the pipeline to" << gst_element_state_get_name(state);
+    }
+}
+
+// state changes are queued to a control thread, stopping may wait for the network or a decoder
 void Player::play()
 {
     if (m_pipeline) {
-        m_pipeline->setState(QGst::StatePlaying);
+        state_control_set(GST_ELEMENT(static_cast<GstPipeline*>(m_pipeline)), GST_STATE_PLAYING, stateDone, this);
     }
 }
 
 void Player::stop()
 {
     if (m_pipeline) {
-        m_pipeline->setState(QGst::StateNull);
+        state_control_set(GST_ELEMENT(static_cast<GstPipeline*>(m_pipeline)), GST_STATE_NULL, stateDone, this);
     }
 }
 
@@ -74,6 +268,8 @@ void Player::setUri(const QString & uri)
         m_pipeline = QGst::ElementFactory::make("playbin").dynamicCast<QGst::Pipeline>();
         if (m_pipeline) {
             m_pipeline->setProperty("video-sink", m_videoSink);
+            player_stats_attach(m_stats, GST_ELEMENT(static_cast<GstPipeline*>(m_pipeline)));
+            m_streamSwitch = stream_switch_new(GST_ELEMENT(static_cast<GstPipeline*>(m_pipeline)));
 
             //watch the bus for messages
             QGst::BusPtr bus = m_pipeline->bus();
@@ -91,6 +287,11 @@ void Player::setUri(const QString & uri)
 
 void Player::onBusMessage(const QGst::MessagePtr & message)
 {
+    player_stats_handle_message(m_stats, static_cast<GstMessage*>(message));
+    if (stream_switch_handle_message(m_streamSwitch, static_cast<GstMessage*>(message))) {
+        Q_EMIT tracksChanged();
+    }
+
     switch (message->type()) {
     case QGst::MessageEos: //End of stream. We reached the end of the file.
         stop();
@@ -20,30 +20,71 @@
 #define PLAYER_H
 
 #include <QObject>
+#include <QTimer>
 #include <QGst/Pipeline>
 #include <QGst/Message>
 
+#include "framegrab.h"
+#include "framepacing.h"
+#include "playerstats.h"
+#include "streamswitch.h"
+
 class Player : public QObject
 {
     Q_OBJECT
+    Q_PROPERTY(bool hudVisible READ hudVisible WRITE setHudVisible NOTIFY hudVisibleChanged)
+    Q_PROPERTY(QString hudText READ hudText NOTIFY hudTextChanged)
+    Q_PROPERTY(QString audioTrack READ audioTrack NOTIFY tracksChanged)
+    Q_PROPERTY(int audioTrackCount READ audioTrackCount NOTIFY tracksChanged)
+    Q_PROPERTY(QString videoTrack READ videoTrack NOTIFY tracksChanged)
+    Q_PROPERTY(int videoTrackCount READ videoTrackCount NOTIFY tracksChanged)
 public:
     explicit Player(QObject *parent = 0);
+    ~Player();
 
     void setVideoSink(const QGst::ElementPtr & sink);
+    void setFramePacing(FramePacing *pacing);
+
+    bool hudVisible() const;
+    void setHudVisible(bool visible);
+    QString hudText() const;
+
+    QString audioTrack() const;
+    int audioTrackCount() const;
+    QString videoTrack() const;
+    int videoTrackCount() const;
 
 public Q_SLOTS:
     void play();
     void stop();
     void open();
+    void nextAudioTrack();
+    void nextVideoTrack();
+    void saveFrame();
+
+Q_SIGNALS:
+    void hudVisibleChanged();
+    void hudTextChanged();
+    void tracksChanged();
+
+private Q_SLOTS:
+    void refreshHud();
 
 private:
     void openFile(const QString & fileName);
     void setUri(const QString & uri);
     void onBusMessage(const QGst::MessagePtr & message);
+    QString trackLabel(StreamSwitchType type) const;
 
     QGst::PipelinePtr m_pipeline;
     QGst::ElementPtr m_videoSink;
     QString m_baseDir;
+    PlayerStats *m_stats;
+    StreamSwitch *m_streamSwitch;
+    FrameGrabber *m_frameGrabber;
+    FramePacing *m_framePacing;
+    QTimer m_hudTimer;
+    QString m_hudText;
 };
 
 #endif // PLAYER_H
@@ -10,6 +10,9 @@ CONFIG += silent
 CONFIG += link_pkgconfig
 
 # Now tell qmake to link to QtGStreamer and also use its include path and Cflags.
+PKGCONFIG += gstreamer-1.0 gstreamer-video-1.0
+INCLUDEPATH += ../common
+
 contains(QT_VERSION, ^4\\..*) {
   PKGCONFIG += QtGStreamer-1.0 QtGStreamerUi-1.0
 }
@@ -30,5 +33,5 @@ QT += declarative opengl
 
 # Input
 HEADERS += player.h
-SOURCES += main.cpp player.cpp
+SOURCES += main.cpp player.cpp ../common/playerstats.c ../common/streamswitch.c ../common/startuptiming.c ../common/workpool.c ../common/framegrab.c ../common/statecontrol.c ../common/framepacing.c
 RESOURCES += qmlplayer.qrc
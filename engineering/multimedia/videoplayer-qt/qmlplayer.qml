@@ -30,6 +30,27 @@ Rectangle {
             width: window.width
             height: 260
             surface: videoSurface1 //bound on the context from main()
+
+            // drawn by the scene, not by the pipeline, so it costs no video processing
+            Rectangle {
+                id: hud
+                color: "#b0000000"
+                visible: player.hudVisible
+
+                anchors.top: parent.top
+                anchors.left: parent.left
+                width: hudText.width + 16
+                height: hudText.height + 16
+
+                Text {
+                    id: hudText
+                    text: player.hudText
+                    color: "#33ff33"
+                    font.family: "monospace"
+                    font.pixelSize: 12
+                    anchors.centerIn: parent
+                }
+            }
         }
 
         Row {
@@ -71,6 +92,52 @@ Rectangle {
                 Text { text: "Open file"; color: "white"; anchors.centerIn: parent }
                 MouseArea { anchors.fill: parent; onClicked: player.open() }
             }
+
+            Rectangle {
+                id: audioButton
+                color: "black"
+                opacity: player.audioTrackCount > 1 ? 1.0 : 0.5
+
+                width: 90
+                height: 30
+
+                Text { text: "Audio " + player.audioTrack; color: "white"; anchors.centerIn: parent }
+                MouseArea { anchors.fill: parent; onClicked: player.nextAudioTrack() }
+            }
+
+            Rectangle {
+                id: videoButton
+                color: "black"
+                opacity: player.videoTrackCount > 1 ? 1.0 : 0.5
+
+                width: 90
+                height: 30
+
+                Text { text: "Video " + player.videoTrack; color: "white"; anchors.centerIn: parent }
+                MouseArea { anchors.fill: parent; onClicked: player.nextVideoTrack() }
+            }
+
+            Rectangle {
+                id: snapshotButton
+                color: "black"
+
+                width: 90
+                height: 30
+
+                Text { text: "Snapshot"; color: "white"; anchors.centerIn: parent }
+                MouseArea { anchors.fill: parent; onClicked: player.saveFrame() }
+            }
+
+            Rectangle {
+                id: hudButton
+                color: player.hudVisible ? "darkgreen" : "black"
+
+                width: 60
+                height: 30
+
+                Text { text: "HUD"; color: "white"; anchors.centerIn: parent }
+                MouseArea { anchors.fill: parent; onClicked: player.hudVisible = !player.hudVisible }
+            }
         }
     }
 }
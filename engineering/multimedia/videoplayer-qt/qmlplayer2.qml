@@ -0,0 +1,143 @@
+/*
+    Copyright (C) 2012 Collabora Ltd. <info@collabora.com>
+      @author George Kiagiadakis <george.kiagiadakis@collabora.com>
+
+    This library is free software; you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published
+    by the Free Software Foundation; either version 2.1 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+import QtQuick 2.0
+import QtGStreamer 1.0
+
+Rectangle {
+    id: window
+    width: 400
+    height: 300
+
+    Column {
+        VideoItem {
+            id: video
+
+            width: window.width
+            height: 260
+            surface: videoSurface1 //bound on the context from main()
+
+            // drawn by the scene, not by the pipeline, so it costs no video processing
+            Rectangle {
+                id: hud
+                color: "#b0000000"
+                visible: player.hudVisible
+
+                anchors.top: parent.top
+                anchors.left: parent.left
+                width: hudText.width + 16
+                height: hudText.height + 16
+
+                Text {
+                    id: hudText
+                    text: player.hudText
+                    color: "#33ff33"
+                    font.family: "monospace"
+                    font.pixelSize: 12
+                    anchors.centerIn: parent
+                }
+            }
+        }
+
+        Row {
+            id: buttons
+
+            width: window.width
+            height: 35
+            spacing: 5
+
+            Rectangle {
+                id: playButton
+                color: "black"
+
+                width: 60
+                height: 30
+
+                Text { text: "Play"; color: "white"; anchors.centerIn: parent }
+                MouseArea { anchors.fill: parent; onClicked: player.play() }
+            }
+
+            Rectangle {
+                id: stopButton
+                color: "black"
+
+                width: 60
+                height: 30
+
+                Text { text: "Stop"; color: "white"; anchors.centerIn: parent }
+                MouseArea { anchors.fill: parent; onClicked: player.stop() }
+            }
+
+            Rectangle {
+                id: openButton
+                color: "black"
+
+                width: 60
+                height: 30
+
+                Text { text: "Open file"; color: "white"; anchors.centerIn: parent }
+                MouseArea { anchors.fill: parent; onClicked: player.open() }
+            }
+
+            Rectangle {
+                id: audioButton
+                color: "black"
+                opacity: player.audioTrackCount > 1 ? 1.0 : 0.5
+
+                width: 90
+                height: 30
+
+                Text { text: "Audio " + player.audioTrack; color: "white"; anchors.centerIn: parent }
+                MouseArea { anchors.fill: parent; onClicked: player.nextAudioTrack() }
+            }
+
+            Rectangle {
+                id: videoButton
+                color: "black"
+                opacity: player.videoTrackCount > 1 ? 1.0 : 0.5
+
+                width: 90
+                height: 30
+
+                Text { text: "Video " + player.videoTrack; color: "white"; anchors.centerIn: parent }
+                MouseArea { anchors.fill: parent; onClicked: player.nextVideoTrack() }
+            }
+
+            Rectangle {
+                id: snapshotButton
+                color: "black"
+
+                width: 90
+                height: 30
+
+                Text { text: "Snapshot"; color: "white"; anchors.centerIn: parent }
+                MouseArea { anchors.fill: parent; onClicked: player.saveFrame() }
+            }
+
+            Rectangle {
+                id: hudButton
+                color: player.hudVisible ? "darkgreen" : "black"
+
+                width: 60
+                height: 30
+
+                Text { text: "HUD"; color: "white"; anchors.centerIn: parent }
+                MouseArea { anchors.fill: parent; onClicked: player.hudVisible = !player.hudVisible }
+            }
+        }
+    }
+}